@@ -0,0 +1,101 @@
+// Latency self-test report, shared by the service's --latency-test mode and
+// tools/latency_loopback.cpp. Every probe records, per stage, the time in
+// microseconds from submitting the synthetic event until that stage saw it;
+// a stage that never saw the probe simply has fewer samples. Histograms use
+// the same log2 buckets as the telemetry segment.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "nexus_telemetry.h"
+
+namespace nexus_latency {
+
+struct Stage {
+  const char *name;
+  std::vector<double> us;
+};
+
+struct Report {
+  std::string backend;
+  size_t probes = 0;
+  size_t timeouts = 0; // probes the last stage never saw
+  std::vector<Stage> stages;
+};
+
+// Nearest-rank percentile of ascending |sorted|; 0 when empty.
+inline double Percentile(const std::vector<double> &sorted, double pct) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t rank = static_cast<size_t>(pct / 100.0 * sorted.size() + 0.999999);
+  rank = std::min(std::max<size_t>(rank, 1), sorted.size());
+  return sorted[rank - 1];
+}
+
+inline void WriteStageJson(std::ostringstream &ss, const Stage &stage) {
+  std::vector<double> sorted = stage.us;
+  std::sort(sorted.begin(), sorted.end());
+  double sum = 0;
+  uint64_t histogram[nexus_telemetry::kHistogramBuckets] = {};
+  for (double v : sorted) {
+    sum += v;
+    ++histogram[nexus_telemetry::BucketFor(static_cast<uint64_t>(v))];
+  }
+  ss << "{\"name\":\"" << stage.name << "\",\"samples\":" << sorted.size()
+     << ",\"min_us\":" << (sorted.empty() ? 0 : sorted.front())
+     << ",\"mean_us\":" << (sorted.empty() ? 0 : sum / sorted.size())
+     << ",\"p50_us\":" << Percentile(sorted, 50)
+     << ",\"p90_us\":" << Percentile(sorted, 90)
+     << ",\"p99_us\":" << Percentile(sorted, 99)
+     << ",\"p999_us\":" << Percentile(sorted, 99.9)
+     << ",\"max_us\":" << (sorted.empty() ? 0 : sorted.back())
+     << ",\"histogram_us\":[";
+  for (size_t b = 0; b < nexus_telemetry::kHistogramBuckets; ++b) {
+    ss << (b ? "," : "") << histogram[b];
+  }
+  ss << "]}";
+}
+
+inline std::string ReportToJson(const Report &r) {
+  std::ostringstream ss;
+  ss.precision(1);
+  ss << std::fixed;
+  ss << "{\"backend\":\"" << r.backend << "\",\"probes\":" << r.probes
+     << ",\"timeouts\":" << r.timeouts << ",\"stages\":[";
+  for (size_t i = 0; i < r.stages.size(); ++i) {
+    ss << (i ? "," : "");
+    WriteStageJson(ss, r.stages[i]);
+  }
+  ss << "]}\n";
+  return ss.str();
+}
+
+// One console line.
+inline void WriteStageText(std::ostringstream &ss, const Stage &stage) {
+  std::vector<double> sorted = stage.us;
+  std::sort(sorted.begin(), sorted.end());
+  ss << "  " << stage.name << ": n=" << sorted.size()
+     << " p50=" << Percentile(sorted, 50)
+     << "us p99=" << Percentile(sorted, 99)
+     << "us max=" << (sorted.empty() ? 0 : sorted.back()) << "us\n";
+}
+
+inline std::string ReportToText(const Report &r) {
+  std::ostringstream ss;
+  ss.precision(1);
+  ss << std::fixed;
+  ss << r.backend << ": " << r.probes << " probes, " << r.timeouts
+     << " timeouts\n";
+  for (const Stage &stage : r.stages) {
+    WriteStageText(ss, stage);
+  }
+  return ss.str();
+}
+
+} // namespace nexus_latency
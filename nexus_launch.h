@@ -0,0 +1,311 @@
+// Launcher queue shared by the service and tools/launch_driver.cpp: run:
+// and open: requests are queued from the hook and started by one worker
+// thread, repeat clicks on the same target are coalesced, and finished
+// children are reaped. Starting a process is up to a backend; the service
+// uses CreateProcess and ShellExecute, PosixSpawnBackend below uses
+// posix_spawn so the queue can be driven on Linux.
+//
+// A backend provides
+//   Target                      immutable, resolved before it is queued
+//   Process                     a started child, Process{} for none
+//   static Key KeyOf(const Target &)       hashable, for repeat clicks
+//   static bool Same(const Target &, const Target &)
+//   bool Launch(const Target &, Process &child)
+//   bool Exited(Process child)  reaps the child when it returns true
+//   void Release(Process child) stops tracking a child that still runs
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace nexus_launch {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto kCoalesceWindow = std::chrono::milliseconds(500);
+constexpr auto kReapInterval = std::chrono::milliseconds(250);
+constexpr size_t kLatencySamples = 256;
+constexpr size_t kMaxTrackedChildren = 64;
+constexpr size_t kMaxRememberedTargets = 256;
+
+template <typename Backend> struct Launcher {
+  using Target = typename Backend::Target;
+
+  struct Request {
+    std::shared_ptr<const Target> target;
+    Clock::time_point queued;
+  };
+
+  Backend backend;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<Request> queue; // guarded by mutex
+  bool stop = false;          // guarded by mutex
+
+  std::atomic<unsigned long long> launches{0};
+  std::atomic<unsigned long long> failures{0};
+  std::atomic<unsigned long long> coalesced{0};
+  std::atomic<unsigned int> children{0};
+
+  mutable std::mutex statsMutex;
+  unsigned long long latencyUs[kLatencySamples] = {};
+  unsigned long long latencyCount = 0; // guarded by statsMutex
+};
+
+// Any thread, the hook included: never resolves or starts anything. A target
+// that is already waiting counts as coalesced.
+template <typename Backend>
+bool Queue(Launcher<Backend> &l,
+           std::shared_ptr<const typename Backend::Target> target) {
+  if (!target) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(l.mutex);
+    for (const auto &queued : l.queue) {
+      if (queued.target == target || Backend::Same(*queued.target, *target)) {
+        l.coalesced.fetch_add(1);
+        return true;
+      }
+    }
+    l.queue.push_back({std::move(target), Clock::now()});
+  }
+  l.cv.notify_one();
+  return true;
+}
+
+// Ends one Run; requests still queued are dropped.
+template <typename Backend> void Stop(Launcher<Backend> &l) {
+  {
+    std::lock_guard<std::mutex> lock(l.mutex);
+    l.stop = true;
+  }
+  l.cv.notify_one();
+}
+
+// Percentiles (0..100) over the most recent kLatencySamples launches, from
+// queueing to the backend returning.
+template <typename Backend>
+unsigned long long LatencyPercentile(const Launcher<Backend> &l,
+                                     int percentile) {
+  std::vector<unsigned long long> samples;
+  {
+    std::lock_guard<std::mutex> lock(l.statsMutex);
+    const size_t n = static_cast<size_t>(
+        std::min<unsigned long long>(l.latencyCount, kLatencySamples));
+    samples.assign(l.latencyUs, l.latencyUs + n);
+  }
+  if (samples.empty()) {
+    return 0;
+  }
+  const size_t idx = (samples.size() - 1) * percentile / 100;
+  std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+  return samples[idx];
+}
+
+template <typename Backend>
+void ReapChildren(Launcher<Backend> &l,
+                  std::vector<typename Backend::Process> &children) {
+  children.erase(std::remove_if(children.begin(), children.end(),
+                                [&](typename Backend::Process child) {
+                                  return l.backend.Exited(child);
+                                }),
+                 children.end());
+  l.children.store(static_cast<unsigned int>(children.size()));
+}
+
+// The worker loop, on the calling thread until Stop.
+template <typename Backend> void Run(Launcher<Backend> &l) {
+  using Process = typename Backend::Process;
+  using Key = std::decay_t<decltype(Backend::KeyOf(
+      std::declval<const typename Backend::Target &>()))>;
+  std::vector<Process> children;
+  std::unordered_map<Key, Clock::time_point> lastLaunch;
+  const auto ready = [&] { return !l.queue.empty() || l.stop; };
+
+  std::unique_lock<std::mutex> lock(l.mutex);
+  while (!l.stop) {
+    if (children.empty()) {
+      l.cv.wait(lock, ready);
+    } else {
+      l.cv.wait_for(lock, kReapInterval, ready);
+    }
+    std::vector<typename Launcher<Backend>::Request> batch;
+    batch.swap(l.queue);
+    lock.unlock();
+
+    for (const auto &req : batch) {
+      Key key = Backend::KeyOf(*req.target);
+      const Clock::time_point now = Clock::now();
+      auto it = lastLaunch.find(key);
+      if (it != lastLaunch.end() && now - it->second < kCoalesceWindow) {
+        l.coalesced.fetch_add(1);
+        continue;
+      }
+      lastLaunch[std::move(key)] = now;
+
+      Process child{};
+      if (l.backend.Launch(*req.target, child)) {
+        l.launches.fetch_add(1);
+      } else {
+        l.failures.fetch_add(1);
+      }
+      {
+        std::lock_guard<std::mutex> stats(l.statsMutex);
+        l.latencyUs[l.latencyCount++ % kLatencySamples] =
+            static_cast<unsigned long long>(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    Clock::now() - req.queued)
+                    .count());
+      }
+      if (child != Process{}) {
+        if (children.size() >= kMaxTrackedChildren) {
+          l.backend.Release(children.front());
+          children.erase(children.begin());
+        }
+        children.push_back(child);
+      }
+    }
+    ReapChildren(l, children);
+    if (lastLaunch.size() > kMaxRememberedTargets) {
+      lastLaunch.clear();
+    }
+    lock.lock();
+  }
+  l.stop = false;
+  l.queue.clear();
+  lock.unlock();
+
+  for (Process child : children) {
+    l.backend.Release(child);
+  }
+  l.children.store(0);
+}
+
+#ifndef _WIN32
+// run: only. The image is looked up on PATH once, by MakeTarget, like the
+// service resolves it when the mapping tables are compiled.
+struct PosixSpawnBackend {
+  struct Target {
+    std::string commandLine;
+    std::string path; // resolved image
+    std::vector<std::string> argv;
+  };
+  using Process = pid_t;
+
+  // Splits |commandLine| on blanks, honouring double quotes. Null when it is
+  // empty or the program is not found.
+  static std::shared_ptr<const Target> MakeTarget(
+      const std::string &commandLine) {
+    auto target = std::make_shared<Target>();
+    target->commandLine = commandLine;
+    std::string arg;
+    bool quoted = false;
+    bool pending = false;
+    for (char c : commandLine) {
+      if (c == '"') {
+        quoted = !quoted;
+        pending = true;
+      } else if (!quoted && (c == ' ' || c == '\t')) {
+        if (pending) {
+          target->argv.push_back(arg);
+        }
+        arg.clear();
+        pending = false;
+      } else {
+        arg += c;
+        pending = true;
+      }
+    }
+    if (pending) {
+      target->argv.push_back(arg);
+    }
+    if (target->argv.empty() || !Resolve(target->argv[0], target->path)) {
+      return nullptr;
+    }
+    return target;
+  }
+
+  static bool Resolve(const std::string &program, std::string &path) {
+    struct stat st = {};
+    const auto runnable = [&](const std::string &candidate) {
+      return stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+             access(candidate.c_str(), X_OK) == 0;
+    };
+    if (program.find('/') != std::string::npos) {
+      path = program;
+      return runnable(path);
+    }
+    const char *env = getenv("PATH");
+    const std::string dirs = env ? env : "/usr/bin:/bin";
+    size_t pos = 0;
+    for (;;) {
+      const size_t end = std::min(dirs.find(':', pos), dirs.size());
+      const std::string dir = dirs.substr(pos, end - pos);
+      path = (dir.empty() ? "." : dir) + "/" + program;
+      if (runnable(path)) {
+        return true;
+      }
+      if (end == dirs.size()) {
+        break;
+      }
+      pos = end + 1;
+    }
+    path.clear();
+    return false;
+  }
+
+  static const std::string &KeyOf(const Target &t) { return t.commandLine; }
+
+  static bool Same(const Target &a, const Target &b) {
+    return a.commandLine == b.commandLine;
+  }
+
+  bool Launch(const Target &t, pid_t &child) {
+    std::vector<char *> argv;
+    for (const std::string &arg : t.argv) {
+      argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    pid_t pid = 0;
+    if (posix_spawn(&pid, t.path.c_str(), nullptr, nullptr, argv.data(),
+                    environ) != 0) {
+      return false;
+    }
+    child = pid;
+    return true;
+  }
+
+  bool Exited(pid_t child) {
+    int status = 0;
+    return waitpid(child, &status, WNOHANG) != 0;
+  }
+
+  // Unlike a Windows handle a pid cannot be let go: a child dropped while it
+  // runs stays a zombie until the launching process exits.
+  void Release(pid_t) {}
+};
+#endif
+
+} // namespace nexus_launch
@@ -0,0 +1,283 @@
+// Thread scheduling policy shared by the service and the Linux tools: a
+// portable priority ladder plus a CPU affinity mask. On Windows it maps onto
+// thread priorities, priority classes and MMCSS; on Linux onto niceness,
+// SCHED_FIFO and sched_setaffinity. Everything is best effort: the Apply
+// functions report whether the OS accepted the whole policy, and callers keep
+// running either way.
+#pragma once
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace nexus_sched {
+
+enum class Priority : uint8_t {
+  kDefault, // leave whatever the OS assigned
+  kIdle,
+  kLowest,
+  kBelowNormal,
+  kNormal,
+  kAboveNormal,
+  kHighest,
+  kTimeCritical, // Windows TIME_CRITICAL / REALTIME class, Linux SCHED_FIFO
+};
+
+constexpr size_t kPriorityCount = 8;
+constexpr const char *kPriorityNames[kPriorityCount] = {
+    "default", "idle",         "lowest",  "below_normal",
+    "normal",  "above_normal", "highest", "time_critical"};
+
+struct ThreadPolicy {
+  Priority priority = Priority::kDefault;
+  uint64_t affinity = 0; // bit per CPU, 0 = any CPU
+};
+
+inline const char *PriorityName(Priority p) {
+  return kPriorityNames[static_cast<size_t>(p)];
+}
+
+inline bool ParsePriority(const std::string &text, Priority &out) {
+  std::string lower;
+  for (char c : text) {
+    lower += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+  for (size_t i = 0; i < kPriorityCount; ++i) {
+    if (lower == kPriorityNames[i]) {
+      out = static_cast<Priority>(i);
+      return true;
+    }
+  }
+  // Windows priority class names.
+  if (lower == "high" || lower == "realtime") {
+    out = lower == "high" ? Priority::kHighest : Priority::kTimeCritical;
+    return true;
+  }
+  return false;
+}
+
+// "0,2-3" sets bits 0, 2 and 3. CPUs above 63 are rejected.
+inline bool ParseCpuList(const std::string &text, uint64_t &mask) {
+  mask = 0;
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t end = text.find(',', pos);
+    end = end == std::string::npos ? text.size() : end;
+    const std::string part = text.substr(pos, end - pos);
+    char *rest = nullptr;
+    const long first = std::strtol(part.c_str(), &rest, 10);
+    long last = first;
+    if (*rest == '-') {
+      last = std::strtol(rest + 1, &rest, 10);
+    }
+    if (rest == part.c_str() || *rest || first < 0 || last < first ||
+        last > 63) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; ++cpu) {
+      mask |= 1ull << cpu;
+    }
+    pos = end + 1;
+  }
+  return mask != 0;
+}
+
+inline std::string CpuListToString(uint64_t mask) {
+  std::string out;
+  for (int cpu = 0; cpu < 64; ++cpu) {
+    if (!(mask >> cpu & 1)) {
+      continue;
+    }
+    int last = cpu;
+    while (last < 63 && (mask >> (last + 1) & 1)) {
+      ++last;
+    }
+    out += (out.empty() ? "" : ",") + std::to_string(cpu);
+    if (last > cpu) {
+      out += "-" + std::to_string(last);
+    }
+    cpu = last;
+  }
+  return out;
+}
+
+// "<priority>[@<cpu list>]", e.g. "time_critical@2,3".
+inline bool ParseThreadPolicy(const std::string &text, ThreadPolicy &out) {
+  const size_t at = text.find('@');
+  ThreadPolicy policy;
+  if (!ParsePriority(text.substr(0, at), policy.priority) ||
+      (at != std::string::npos &&
+       !ParseCpuList(text.substr(at + 1), policy.affinity))) {
+    return false;
+  }
+  out = policy;
+  return true;
+}
+
+inline std::string ThreadPolicyToString(const ThreadPolicy &p) {
+  std::string out = PriorityName(p.priority);
+  if (p.affinity) {
+    out += "@" + CpuListToString(p.affinity);
+  }
+  return out;
+}
+
+// A thread other threads can re-apply a policy to.
+struct ThreadRef {
+#ifdef _WIN32
+  HANDLE handle = nullptr;
+#else
+  pid_t tid = 0;
+#endif
+};
+
+inline ThreadRef CurrentThread() {
+  ThreadRef t;
+#ifdef _WIN32
+  DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(),
+                  &t.handle,
+                  THREAD_SET_INFORMATION | THREAD_QUERY_INFORMATION, FALSE, 0);
+#else
+  t.tid = static_cast<pid_t>(syscall(SYS_gettid));
+#endif
+  return t;
+}
+
+inline void ReleaseThread(ThreadRef &t) {
+#ifdef _WIN32
+  if (t.handle) {
+    CloseHandle(t.handle);
+  }
+  t.handle = nullptr;
+#else
+  t.tid = 0;
+#endif
+}
+
+// kDefault is a no-op. Any other policy sets both the priority and the
+// affinity, so affinity 0 restores every CPU the process may use.
+inline bool ApplyThreadPolicy(const ThreadRef &t, const ThreadPolicy &p) {
+  if (p.priority == Priority::kDefault) {
+    return true;
+  }
+#ifdef _WIN32
+  constexpr int kLevels[kPriorityCount] = {
+      THREAD_PRIORITY_NORMAL,  THREAD_PRIORITY_IDLE,
+      THREAD_PRIORITY_LOWEST,  THREAD_PRIORITY_BELOW_NORMAL,
+      THREAD_PRIORITY_NORMAL,  THREAD_PRIORITY_ABOVE_NORMAL,
+      THREAD_PRIORITY_HIGHEST, THREAD_PRIORITY_TIME_CRITICAL};
+  bool ok = SetThreadPriority(t.handle,
+                              kLevels[static_cast<size_t>(p.priority)]) != 0;
+  DWORD_PTR mask = static_cast<DWORD_PTR>(p.affinity);
+  DWORD_PTR systemMask = 0;
+  if (!mask && !GetProcessAffinityMask(GetCurrentProcess(), &mask,
+                                       &systemMask)) {
+    return false;
+  }
+  ok = SetThreadAffinityMask(t.handle, mask) != 0 && ok;
+  return ok;
+#else
+  // SCHED_FIFO at the lowest real-time priority already preempts every
+  // normal thread without outranking the kernel's threaded interrupts.
+  constexpr int kNice[kPriorityCount] = {0, 19, 10, 5, 0, -5, -10, 0};
+  bool ok;
+  if (p.priority == Priority::kTimeCritical) {
+    sched_param param = {};
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    ok = sched_setscheduler(t.tid, SCHED_FIFO, &param) == 0;
+  } else {
+    sched_param param = {};
+    ok = sched_setscheduler(t.tid, SCHED_OTHER, &param) == 0 &&
+         setpriority(PRIO_PROCESS, static_cast<id_t>(t.tid),
+                     kNice[static_cast<size_t>(p.priority)]) == 0;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu = 0; cpu < 64 && cpu < CPU_SETSIZE; ++cpu) {
+    if (!p.affinity || (p.affinity >> cpu & 1)) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  ok = sched_setaffinity(t.tid, sizeof(set), &set) == 0 && ok;
+  return ok;
+#endif
+}
+
+inline bool ApplyCurrentThreadPolicy(const ThreadPolicy &p) {
+  ThreadRef t = CurrentThread();
+  const bool ok = ApplyThreadPolicy(t, p);
+  ReleaseThread(t);
+  return ok;
+}
+
+// Windows priority class of the whole process; Linux has no process-wide
+// equivalent, so use per-thread policies there.
+inline bool ApplyProcessPriority(Priority p) {
+  if (p == Priority::kDefault) {
+    return true;
+  }
+#ifdef _WIN32
+  constexpr DWORD kClasses[kPriorityCount] = {
+      NORMAL_PRIORITY_CLASS, IDLE_PRIORITY_CLASS,
+      IDLE_PRIORITY_CLASS,   BELOW_NORMAL_PRIORITY_CLASS,
+      NORMAL_PRIORITY_CLASS, ABOVE_NORMAL_PRIORITY_CLASS,
+      HIGH_PRIORITY_CLASS,   REALTIME_PRIORITY_CLASS};
+  return SetPriorityClass(GetCurrentProcess(),
+                          kClasses[static_cast<size_t>(p)]) != 0;
+#else
+  return false;
+#endif
+}
+
+// Registers the calling thread with the Multimedia Class Scheduler Service
+// under |task| ("Games", "Pro Audio", ...). Returns the registration for
+// LeaveMmcss, or null; avrt.dll is loaded on first use.
+inline void *JoinMmcss(const char *task) {
+#ifdef _WIN32
+  using SetFn = HANDLE(WINAPI *)(LPCSTR, LPDWORD);
+  static HMODULE avrt = LoadLibraryA("avrt.dll");
+  if (!avrt) {
+    return nullptr;
+  }
+  const auto set = reinterpret_cast<SetFn>(reinterpret_cast<void *>(
+      GetProcAddress(avrt, "AvSetMmThreadCharacteristicsA")));
+  DWORD index = 0;
+  return set ? set(task, &index) : nullptr;
+#else
+  (void)task;
+  return nullptr;
+#endif
+}
+
+inline void LeaveMmcss(void *registration) {
+#ifdef _WIN32
+  using RevertFn = BOOL(WINAPI *)(HANDLE);
+  static HMODULE avrt = LoadLibraryA("avrt.dll");
+  if (!registration || !avrt) {
+    return;
+  }
+  const auto revert = reinterpret_cast<RevertFn>(reinterpret_cast<void *>(
+      GetProcAddress(avrt, "AvRevertMmThreadCharacteristics")));
+  if (revert) {
+    revert(registration);
+  }
+#else
+  (void)registration;
+#endif
+}
+
+} // namespace nexus_sched
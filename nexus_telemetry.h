@@ -0,0 +1,268 @@
+// Shared-memory telemetry segment: the service publishes its counters and
+// latency histograms here every few milliseconds, and external monitors map
+// it read-only. A reader costs a handful of cache lines and no syscalls once
+// mapped. One writer; readers retry while the sequence number is odd or
+// changes under them. Any layout change bumps kVersion.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace nexus_telemetry {
+
+constexpr uint32_t kMagic = 0x4D544E58; // "XNTM"
+constexpr uint32_t kVersion = 2;
+#ifdef _WIN32
+constexpr char kSegmentName[] = "Local\\NexusUltraTelemetry";
+#else
+constexpr char kSegmentName[] = "/nexus_ultra_telemetry";
+#endif
+
+enum Counter : uint32_t {
+  kRawInputEvents,
+  kPollRateHz,
+  kMouseButtons,
+  kMouseSampleRate,
+  kButtonPresses,
+  kMotionPackets,
+  kDpiChangeEvents,
+  kDpiPreset,
+  kEffectiveDpi,
+  kProfileSwitches,
+  kLayerActions,
+  kGestureStrokes,
+  kGestureMisses,
+  kWheelEvents,
+  kWheelActions,
+  kDeviceCorrelations,
+  kDeviceInferred,
+  kDeviceMismatches,
+  kInjectionsSuppressed,
+  kMacroRuns,
+  kTextJobs,
+  kLaunches,
+  kConfigReloads,
+  kCounterCount
+};
+
+constexpr const char *kCounterNames[kCounterCount] = {
+    "raw_input_events",
+    "poll_rate_hz",
+    "mouse_buttons",
+    "mouse_sample_rate",
+    "button_presses",
+    "motion_packets",
+    "dpi_change_events",
+    "dpi_preset",
+    "effective_dpi",
+    "profile_switches",
+    "layer_actions",
+    "gesture_strokes",
+    "gesture_misses",
+    "wheel_events",
+    "wheel_actions",
+    "device_correlations",
+    "device_inferred",
+    "device_mismatches",
+    "injections_suppressed",
+    "macro_runs",
+    "text_jobs",
+    "launches",
+    "config_reloads"};
+
+// Bucket i counts values in [2^(i-1), 2^i); bucket 0 counts zeros and the
+// last bucket everything above.
+enum Histogram : uint32_t {
+  kHookLatencyNs, // mouse hook, per button or wheel event
+  kRawIntervalUs, // gap between raw mouse packets
+  kMacroWakeUs,   // macro request until its thread picks it up
+  kHistogramCount
+};
+
+constexpr const char *kHistogramNames[kHistogramCount] = {
+    "hook_latency_ns", "raw_interval_us", "macro_wake_us"};
+constexpr size_t kHistogramBuckets = 24;
+
+inline size_t BucketFor(uint64_t value) {
+  size_t bucket = 0;
+  while (value && bucket < kHistogramBuckets - 1) {
+    value >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "segment atomics must be address-free");
+
+struct Segment {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size; // sizeof(Segment) in the writer
+  uint32_t counterCount;
+  uint32_t histogramCount;
+  uint32_t bucketCount;
+  uint32_t publishMs; // writer's publish period
+  uint32_t writerPid;
+  std::atomic<uint64_t> seq;       // odd while a snapshot is being written
+  std::atomic<uint64_t> updatedMs; // writer's monotonic clock
+  std::atomic<uint64_t> counters[kCounterCount];
+  std::atomic<uint64_t> histograms[kHistogramCount][kHistogramBuckets];
+};
+
+struct Snapshot {
+  uint64_t seq = 0;
+  uint64_t updatedMs = 0;
+  uint64_t counters[kCounterCount] = {};
+  uint64_t histograms[kHistogramCount][kHistogramBuckets] = {};
+};
+
+struct Mapping {
+  Segment *segment = nullptr;
+#ifdef _WIN32
+  HANDLE handle = nullptr;
+#else
+  int fd = -1;
+#endif
+};
+
+// Writer side: creates (or reuses) the named segment and stamps the header.
+inline bool CreateSegment(Mapping &m, uint32_t publishMs, uint32_t pid) {
+  void *view = nullptr;
+#ifdef _WIN32
+  m.handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                0, sizeof(Segment), kSegmentName);
+  if (!m.handle) {
+    return false;
+  }
+  view = MapViewOfFile(m.handle, FILE_MAP_WRITE, 0, 0, sizeof(Segment));
+#else
+  m.fd = shm_open(kSegmentName, O_CREAT | O_RDWR, 0644);
+  if (m.fd < 0) {
+    return false;
+  }
+  if (ftruncate(m.fd, sizeof(Segment)) == 0) {
+    view = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED,
+                m.fd, 0);
+    view = view == MAP_FAILED ? nullptr : view;
+  }
+#endif
+  if (!view) {
+    return false;
+  }
+  m.segment = static_cast<Segment *>(view);
+  Segment &s = *m.segment;
+  s.seq.store(s.seq.load(std::memory_order_relaxed) | 1,
+              std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  s.magic = kMagic;
+  s.version = kVersion;
+  s.size = sizeof(Segment);
+  s.counterCount = kCounterCount;
+  s.histogramCount = kHistogramCount;
+  s.bucketCount = kHistogramBuckets;
+  s.publishMs = publishMs;
+  s.writerPid = pid;
+  s.seq.fetch_add(1, std::memory_order_release);
+  return true;
+}
+
+// Reader side: maps an existing segment read-only.
+inline bool OpenSegment(Mapping &m) {
+  const void *view = nullptr;
+#ifdef _WIN32
+  m.handle = OpenFileMappingA(FILE_MAP_READ, FALSE, kSegmentName);
+  if (!m.handle) {
+    return false;
+  }
+  view = MapViewOfFile(m.handle, FILE_MAP_READ, 0, 0, sizeof(Segment));
+#else
+  m.fd = shm_open(kSegmentName, O_RDONLY, 0);
+  if (m.fd < 0) {
+    return false;
+  }
+  view = mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, m.fd, 0);
+  view = view == MAP_FAILED ? nullptr : view;
+#endif
+  m.segment = const_cast<Segment *>(static_cast<const Segment *>(view));
+  return m.segment != nullptr;
+}
+
+inline void CloseSegment(Mapping &m) {
+#ifdef _WIN32
+  if (m.segment) {
+    UnmapViewOfFile(m.segment);
+  }
+  if (m.handle) {
+    CloseHandle(m.handle);
+  }
+  m.handle = nullptr;
+#else
+  if (m.segment) {
+    munmap(m.segment, sizeof(Segment));
+  }
+  if (m.fd >= 0) {
+    close(m.fd);
+  }
+  m.fd = -1;
+#endif
+  m.segment = nullptr;
+}
+
+// Writer: bracket every update of counters/histograms.
+inline void BeginWrite(Segment &s) {
+  s.seq.store(s.seq.load(std::memory_order_relaxed) + 1,
+              std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+inline void EndWrite(Segment &s, uint64_t nowMs) {
+  s.updatedMs.store(nowMs, std::memory_order_relaxed);
+  s.seq.store(s.seq.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+}
+
+// Copies a consistent snapshot; false if the header does not match this
+// build or the writer kept it busy for |attempts| tries.
+inline bool ReadSnapshot(const Segment &s, Snapshot &out, int attempts = 100) {
+  if (s.magic != kMagic || s.version != kVersion ||
+      s.size != sizeof(Segment)) {
+    return false;
+  }
+  for (int i = 0; i < attempts; ++i) {
+    const uint64_t before = s.seq.load(std::memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+    out.seq = before;
+    out.updatedMs = s.updatedMs.load(std::memory_order_relaxed);
+    for (size_t c = 0; c < kCounterCount; ++c) {
+      out.counters[c] = s.counters[c].load(std::memory_order_relaxed);
+    }
+    for (size_t h = 0; h < kHistogramCount; ++h) {
+      for (size_t b = 0; b < kHistogramBuckets; ++b) {
+        out.histograms[h][b] =
+            s.histograms[h][b].load(std::memory_order_relaxed);
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.seq.load(std::memory_order_relaxed) == before) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace nexus_telemetry
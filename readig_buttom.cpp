@@ -3,38 +3,434 @@
 #include <ws2tcpip.h>
 #include <windows.h>
 #include <shellapi.h>
+#include <objbase.h>
 #include <commdlg.h>
+#include <psapi.h>
 
 #include <algorithm>
 #include <atomic>
 #include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "nexus_latency.h"
+#include "nexus_launch.h"
+#include "nexus_sched.h"
+#include "nexus_telemetry.h"
+
+namespace {
+std::atomic<unsigned long long> g_heapAllocs{0};
+std::atomic<unsigned long long> g_heapAllocBytes{0};
+
+// Per-subsystem heap accounting. Subsystem 0 is everything untagged; the
+// others are the service threads (ServiceThread + 1), set for a thread by
+// ScopedServiceThread and for a region by AllocScope. Allocation counts and
+// bytes are always kept. Frees and live bytes need the size and subsystem of
+// each block, which sit in a side table keyed by its address; that costs a
+// locked insert per allocation, so only the test harnesses turn it on (see
+// EnableAllocTracking). Blocks come straight from malloc either way.
+constexpr size_t kAllocSubsystems = 9;
+
+struct AllocCounters {
+  std::atomic<unsigned long long> allocs{0};
+  std::atomic<unsigned long long> frees{0};
+  std::atomic<unsigned long long> allocBytes{0};
+  std::atomic<long long> liveBytes{0};
+  std::atomic<long long> peakBytes{0};
+};
+
+AllocCounters g_allocCounters[kAllocSubsystems];
+thread_local uint8_t g_allocSubsystem = 0;
+std::atomic<bool> g_allocTracking{false};
+
+// The side table: open addressing with linear probing, split into shards
+// that each have a spin lock. Slot arrays come from malloc, so the table
+// never calls back into operator new. A zero address marks a free slot.
+constexpr size_t kAllocShards = 64;
+constexpr size_t kAllocShardMinSlots = 256;
+
+struct AllocEntry {
+  uintptr_t address;
+  std::size_t size;
+  uint8_t subsystem;
+};
+
+struct AllocShard {
+  std::atomic_flag busy = ATOMIC_FLAG_INIT;
+  AllocEntry *slots = nullptr;
+  size_t capacity = 0; // a power of two
+  size_t used = 0;
+};
+
+AllocShard g_allocShards[kAllocShards];
+
+uint64_t AllocHash(uintptr_t address) {
+  return (static_cast<uint64_t>(address) >> 4) * 0x9E3779B97F4A7C15ull;
+}
+
+class AllocShardLock {
+public:
+  explicit AllocShardLock(AllocShard &shard) : shard_(shard) {
+    while (shard_.busy.test_and_set(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+  ~AllocShardLock() { shard_.busy.clear(std::memory_order_release); }
+
+private:
+  AllocShard &shard_;
+};
+
+AllocShard &ShardOf(uintptr_t address) {
+  return g_allocShards[AllocHash(address) >> 58];
+}
+
+void PlaceEntry(AllocShard &s, const AllocEntry &e) {
+  size_t i = AllocHash(e.address) & (s.capacity - 1);
+  while (s.slots[i].address) {
+    i = (i + 1) & (s.capacity - 1);
+  }
+  s.slots[i] = e;
+}
+
+// Keeps the shard at most half full. False if malloc fails.
+bool ReserveEntry(AllocShard &s) {
+  if ((s.used + 1) * 2 <= s.capacity) {
+    return true;
+  }
+  const size_t capacity = std::max(kAllocShardMinSlots, s.capacity * 2);
+  auto *slots =
+      static_cast<AllocEntry *>(std::calloc(capacity, sizeof(AllocEntry)));
+  if (!slots) {
+    return false;
+  }
+  AllocEntry *old = s.slots;
+  const size_t oldCapacity = s.capacity;
+  s.slots = slots;
+  s.capacity = capacity;
+  for (size_t i = 0; i < oldCapacity; ++i) {
+    if (old[i].address) {
+      PlaceEntry(s, old[i]);
+    }
+  }
+  std::free(old);
+  return true;
+}
+
+// Removes |address| and returns its entry, or one with a zero address if the
+// block is not in the table, null included. Later entries of the probe run
+// are shifted back so that lookups never need tombstones.
+AllocEntry TakeEntry(AllocShard &s, uintptr_t address) {
+  if (!s.capacity) {
+    return {};
+  }
+  const size_t mask = s.capacity - 1;
+  size_t i = AllocHash(address) & mask;
+  for (;; i = (i + 1) & mask) {
+    if (!s.slots[i].address) {
+      return {};
+    }
+    if (s.slots[i].address == address) {
+      break;
+    }
+  }
+  const AllocEntry found = s.slots[i];
+  for (size_t j = (i + 1) & mask; s.slots[j].address; j = (j + 1) & mask) {
+    const size_t home = AllocHash(s.slots[j].address) & mask;
+    // Move j into the hole at i unless its home lies cyclically in (i, j].
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      s.slots[i] = s.slots[j];
+      i = j;
+    }
+  }
+  s.slots[i] = {};
+  --s.used;
+  return found;
+}
+
+// Blocks allocated before tracking was enabled are not in the table and are
+// freed uncounted.
+void FreeCounted(void *p) noexcept {
+  if (!p || !g_allocTracking.load(std::memory_order_relaxed)) {
+    std::free(p);
+    return;
+  }
+  const uintptr_t address = reinterpret_cast<uintptr_t>(p);
+  AllocShard &shard = ShardOf(address);
+  AllocEntry e;
+  {
+    AllocShardLock lock(shard);
+    e = TakeEntry(shard, address);
+  }
+  if (e.address) {
+    AllocCounters &c = g_allocCounters[e.subsystem];
+    c.frees.fetch_add(1, std::memory_order_relaxed);
+    c.liveBytes.fetch_sub(static_cast<long long>(e.size),
+                          std::memory_order_relaxed);
+  }
+  std::free(p);
+}
+
+// For --bench, --stress and --memcheck. Stays on once set.
+void EnableAllocTracking() {
+  g_allocTracking.store(true, std::memory_order_relaxed);
+}
+} // namespace
+
+// Counting replacements for the global allocator so the benchmark harness can
+// report allocations per operation and /status/memory per subsystem.
+void *operator new(std::size_t size) {
+  g_heapAllocs.fetch_add(1, std::memory_order_relaxed);
+  g_heapAllocBytes.fetch_add(size, std::memory_order_relaxed);
+  void *p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  const uint8_t subsystem = g_allocSubsystem;
+  AllocCounters &c = g_allocCounters[subsystem];
+  c.allocs.fetch_add(1, std::memory_order_relaxed);
+  c.allocBytes.fetch_add(size, std::memory_order_relaxed);
+  if (!g_allocTracking.load(std::memory_order_relaxed)) {
+    return p;
+  }
+  const uintptr_t address = reinterpret_cast<uintptr_t>(p);
+  AllocShard &shard = ShardOf(address);
+  {
+    AllocShardLock lock(shard);
+    if (!ReserveEntry(shard)) {
+      std::free(p);
+      throw std::bad_alloc();
+    }
+    PlaceEntry(shard, {address, size, subsystem});
+    ++shard.used;
+  }
+  const long long live =
+      c.liveBytes.fetch_add(static_cast<long long>(size),
+                            std::memory_order_relaxed) +
+      static_cast<long long>(size);
+  long long peak = c.peakBytes.load(std::memory_order_relaxed);
+  while (live > peak && !c.peakBytes.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed)) {
+  }
+  return p;
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return operator new(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return operator new(size, std::nothrow);
+}
+void operator delete(void *p) noexcept { FreeCounted(p); }
+void operator delete[](void *p) noexcept { FreeCounted(p); }
+void operator delete(void *p, std::size_t) noexcept { FreeCounted(p); }
+void operator delete[](void *p, std::size_t) noexcept { FreeCounted(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  FreeCounted(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  FreeCounted(p);
+}
+
 namespace {
 
-enum class ActionType { None, Keys, Run, Open, Text, Macro };
+enum class ActionType { None, Keys, Run, Open, Text, Macro, Dpi, DpiShift };
+
+// run:/open: target resolved once when the mapping tables are compiled.
+struct LaunchTarget {
+  ActionType type = ActionType::Run;
+  std::wstring application; // run: resolved image path, empty if not found
+  std::wstring commandLine; // run: full command line, open: target
+};
+
+enum class MacroOpCode : uint8_t {
+  Key,            // arg = vk, state = D/U/P
+  Delay,          // a..b ms, uniformly random when b > a
+  Jump,           // a = target
+  JumpIfReleased, // a = target; trigger button no longer held
+  JumpIfKeyUp,    // arg = vk, a = target
+  JumpIfKeyDown,  // arg = vk, a = target
+  SetVar,         // slot arg = a
+  AddVar,         // slot arg += a
+  LoopVar,        // if (--slot arg > 0) jump to a
+  JumpIfNonZero,  // slot arg != 0: jump to a
+  Halt,
+};
+
+struct MacroOp {
+  MacroOpCode code = MacroOpCode::Halt;
+  char state = 'P';
+  WORD arg = 0;
+  int32_t a = 0;
+  int32_t b = 0;
+  uint32_t loop = 0; // 1 + pc of the enclosing WHILEHELD check, 0 if none
+};
 
 struct Action {
   ActionType type = ActionType::None;
   std::vector<WORD> keys;
   std::string payload;
+  std::vector<INPUT> inputs; // keys: pre-built down/up sequence
+  std::shared_ptr<const std::vector<MacroOp>> macro; // macro: bytecode
+  std::shared_ptr<const LaunchTarget> launch; // not stored in the cache
+};
+
+enum class AccelCurve { None, Linear, Power };
+enum class TelemetryMode : uint8_t { Auto, Always, Minimal };
+
+struct DeviceScale {
+  WORD vid = 0;
+  WORD pid = 0;
+  double scale = 1.0;
+};
+
+struct DeviceId {
+  WORD vid = 0;
+  WORD pid = 0;
+};
+
+constexpr size_t kMaxMappedDevices = 8; // distinct match_device ids
+
+enum Binding {
+  kBindButton4,
+  kBindButton5,
+  kBindWheelUp, // wheel directions, in the order of Config::wheel
+  kBindWheelDown,
+  kBindWheelLeft,
+  kBindWheelRight,
+  kBindingCount
+};
+
+constexpr size_t kWheelBindings = kBindingCount - kBindWheelUp;
+
+constexpr size_t kMaxLayerTriggers = 8; // distinct triggers per section
+
+// layer.<trigger>.<binding>=<action>: applies while |trigger|, a key or
+// mouse button, is physically held.
+struct LayerBinding {
+  WORD trigger = 0;
+  Binding binding = kBindButton4;
+  Action action;
+};
+
+// gesture.<binding>.<stroke>=<action>: fires when the button is released
+// after the mouse moved along |stroke| while it was held.
+struct GestureBinding {
+  Binding binding = kBindButton4;
+  uint16_t stroke = 0;
+  Action action;
+};
+
+// [profile:<name>] section of the INI; selected while a matching
+// application is in the foreground.
+struct Profile {
+  std::string name;
+  std::vector<std::string> matchExe;   // lower-case file names, e.g. game.exe
+  std::vector<std::string> matchClass; // top-level window class names
+  std::vector<DeviceId> matchDevice;   // empty: any mouse
+  Action button4;
+  Action button5;
+  Action wheel[kWheelBindings];
+  int wheelInvert = -1; // -1 follows the global wheel_invert
+  int motionRescale = -1; // -1 follows the global motion_rescale
+  std::vector<LayerBinding> layers;
+  std::vector<GestureBinding> gestures;
+};
+
+// Service threads, each with its own thread.<name>= scheduling policy.
+enum ServiceThread {
+  kThreadInput, // hooks, raw input and the message loop (main thread)
+  kThreadMacro,
+  kThreadScroll,
+  kThreadText,
+  kThreadLauncher,
+  kThreadServer,
+  kThreadConfig, // INI watcher and background saver
+  kThreadTelemetry,
+  kServiceThreadCount
 };
+static_assert(kAllocSubsystems == kServiceThreadCount + 1,
+              "one allocation subsystem per service thread plus untagged");
 
 struct Config {
   Action button4;
   Action button5;
   bool suspendInFullscreen = true;
-  int dpi = 800;
+  // Software DPI, sensitivity and acceleration. Off by default: apps that
+  // read raw input would see the physical packet as well as the rescaled one.
+  bool motionRescale = false;
+  int dpi = 800; // native sensor DPI of the mouse
+  std::vector<int> dpiPresets; // target DPIs; empty runs at the native DPI
+  int dpiPreset = 0;
+  double sensitivity = 1.0;
+  AccelCurve accel = AccelCurve::None;
+  double accelRate = 0.0;   // gain per count/ms above the offset
+  double accelOffset = 0.0; // count/ms below which there is no acceleration
+  double accelCap = 4.0;
+  double accelExponent = 2.0; // power curve only
+  std::vector<DeviceScale> deviceScales;
+  std::vector<LayerBinding> layers;
+  int gestureDistance = 40; // counts of travel per stroke segment
+  int gestureFlickMs = 150; // one-segment strokes released sooner are flicks
+  std::vector<GestureBinding> gestures;
+  Action wheel[kWheelBindings];
+  int wheelNotch = 120;     // wheel delta per action of a bound direction
+  double wheelSpeed = 1.0;  // multiplier for scroll that is passed through
+  bool wheelSmooth = false; // spread passed-through scroll over a few frames
+  bool wheelInvert = false;
+  nexus_sched::Priority priorityClass = nexus_sched::Priority::kDefault;
+  nexus_sched::ThreadPolicy threads[kServiceThreadCount];
+  std::string mmcssTask; // MMCSS task of the input thread, empty for none
+  TelemetryMode telemetry = TelemetryMode::Auto;
+  std::vector<Profile> profiles;
 };
 
-Config g_config;
+// The base action of |binding| in the global section or a profile.
+template <typename Section>
+Action &BindingAction(Section &section, Binding binding) {
+  switch (binding) {
+  case kBindButton4:
+    return section.button4;
+  case kBindButton5:
+    return section.button5;
+  default:
+    return section.wheel[binding - kBindWheelUp];
+  }
+}
+
+// The running config, immutable once published. Readers take a snapshot
+// with CurrentConfig(); every change is a read-copy-publish made under
+// g_configWriteMutex (see CommitConfig), so two writers never interleave.
+std::mutex g_configMutex; // guards the g_config pointer
+std::shared_ptr<const Config> g_config = std::make_shared<const Config>();
+std::mutex g_configWriteMutex;
+
+std::shared_ptr<const Config> CurrentConfig() {
+  std::lock_guard<std::mutex> lock(g_configMutex);
+  return g_config;
+}
+
 HWND g_mainWindow = nullptr;
 HWND g_settingsWindow = nullptr;
 NOTIFYICONDATAA g_tray = {};
@@ -42,6 +438,7 @@ std::string g_configPath;
 std::thread g_statusServerThread;
 std::atomic<bool> g_statusServerStop{false};
 std::atomic<SOCKET> g_statusListenSocket{INVALID_SOCKET};
+constexpr u_short kStatusPort = 48621;
 
 std::atomic<unsigned long long> g_rawInputEvents{0};
 std::atomic<unsigned int> g_pollRateHz{0};
@@ -50,23 +447,75 @@ std::atomic<unsigned int> g_mouseSampleRate{0};
 std::atomic<unsigned long long> g_dpiChangeEvents{0};
 std::atomic<unsigned long long> g_lastRateWindowTick{0};
 std::atomic<unsigned long long> g_lastRateWindowCount{0};
+std::atomic<unsigned long long> g_configLoadUs{0};
+std::atomic<bool> g_configFromCache{false};
+std::atomic<uint64_t> g_loadedIniHash{0};
+std::atomic<unsigned long long> g_configReloads{0};
+std::atomic<unsigned long long> g_configReloadFailures{0};
+std::atomic<unsigned long long> g_configReloadsSuperseded{0};
+// Bumped by every CommitConfig, under g_configWriteMutex.
+std::atomic<unsigned long long> g_configGeneration{0};
+std::atomic<unsigned long long> g_configReloadUs{0};
+std::mutex g_configErrorMutex;
+std::string g_configLastError; // guarded by g_configErrorMutex
+std::atomic<unsigned long long> g_configSaveRequests{0};
+std::atomic<unsigned long long> g_configSaves{0};
+std::atomic<unsigned long long> g_configSaveFailures{0};
+std::atomic<unsigned long long> g_configSaveUs{0};
+std::atomic<unsigned long long> g_startupUs{0};
+std::atomic<unsigned long long> g_buttonPresses{0};
+// Log2 buckets (nexus_telemetry::BucketFor), published to shared memory.
+std::atomic<uint64_t> g_hookLatencyHist[nexus_telemetry::kHistogramBuckets] = {};
+std::atomic<uint64_t> g_rawIntervalHist[nexus_telemetry::kHistogramBuckets] = {};
+std::atomic<uint64_t> g_macroWakeHist[nexus_telemetry::kHistogramBuckets] = {};
+// Detailed telemetry tier: histograms, input history and the poll-rate
+// window. Switched by UpdateTelemetryTier.
+std::atomic<bool> g_telemetryDetailed{true};
+std::atomic<unsigned long long> g_telemetryTierChanges{0};
+std::atomic<bool> g_rawInputRegistered{false};
+// The keyboard hook only feeds layer triggers. PublishProfiles sets this
+// while a compiled table has a keyboard trigger, and the input thread
+// follows via WM_KEYBOARD_HOOK_CHANGED.
+std::atomic<bool> g_keyboardHookNeeded{false};
+std::atomic<bool> g_keyboardHookInstalled{false};
+std::atomic<unsigned long long> g_telemetryPublishes{0};
+std::atomic<bool> g_telemetryMapped{false};
 
 // Core Globals
 std::atomic<bool> g_macroRecording{false};
 std::atomic<bool> g_appIsReady{false};
 
 // Sticky Keys for Alt-Tab cycling
-bool g_isAltHeld = false;
 const UINT_PTR TIMER_ID_ALT_RELEASE = 1001;
 
 HHOOK g_mouseHook = nullptr;
 
 bool ParseAction(const std::string &rawValue, Action &action);
+bool ValidateConfig(const Config &cfg, std::string &error);
+bool IsFullscreenForegroundWindow();
+bool ForegroundRescalesMotion();
 bool SaveConfig(const std::string &path, const Config &cfg);
 std::string ActionToConfigValue(const Action &action);
-bool ExecuteMacro(const std::string &payload);
+bool StepDpiPreset(const std::string &payload);
+std::string ConfigLastError();
+uint64_t Fnv1a64(const void *data, size_t size);
+void RequestConfigSave(const Config &cfg);
+void RetireSnapshot(std::shared_ptr<const void> snapshot);
+void RecordHistogram(std::atomic<uint64_t> *hist, double value);
+void RenewTelemetryLease();
+void PublishTelemetryTier(const Config &cfg);
+std::string GetExeDir();
+bool ReadFileBytes(const std::string &path, std::string &out);
+std::string UiPageUrl(const char *page);
+void SetLayerBinding(std::vector<LayerBinding> &layers, LayerBinding layer);
+size_t CountLayerTriggers(const std::vector<LayerBinding> &layers);
+bool ParseBindingName(const std::string &upper, Binding &binding);
 
 constexpr UINT WM_TRAYICON = WM_APP + 1;
+constexpr UINT WM_CONFIG_RELOADED = WM_APP + 2;
+constexpr UINT WM_SCHEDULING_CHANGED = WM_APP + 3;
+constexpr UINT WM_RAW_INPUT_CHANGED = WM_APP + 4;
+constexpr UINT WM_KEYBOARD_HOOK_CHANGED = WM_APP + 5;
 constexpr UINT ID_TRAY_SETTINGS = 1001;
 constexpr UINT ID_TRAY_RELOAD = 1002;
 constexpr UINT ID_TRAY_EXIT = 1003;
@@ -122,6 +571,13 @@ std::string ToUpper(std::string s) {
   return s;
 }
 
+std::string ToLower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  return s;
+}
+
 std::vector<std::string> Split(const std::string &s, char delim) {
   std::vector<std::string> out;
   std::stringstream ss(s);
@@ -132,6 +588,42 @@ std::vector<std::string> Split(const std::string &s, char delim) {
   return out;
 }
 
+double QpcToNs(long long ticks) {
+  static const long long freq = [] {
+    LARGE_INTEGER f = {};
+    QueryPerformanceFrequency(&f);
+    return f.QuadPart;
+  }();
+  return static_cast<double>(ticks) * 1e9 / static_cast<double>(freq);
+}
+
+long long QpcNow() {
+  LARGE_INTEGER t = {};
+  QueryPerformanceCounter(&t);
+  return t.QuadPart;
+}
+
+long long QpcTicksPerMs() {
+  static const long long perMs = [] {
+    LARGE_INTEGER f = {};
+    QueryPerformanceFrequency(&f);
+    return std::max<long long>(1, f.QuadPart / 1000);
+  }();
+  return perMs;
+}
+
+std::string JoinStrings(const std::vector<std::string> &parts,
+                        const char *sep) {
+  std::string out;
+  for (const std::string &part : parts) {
+    if (!out.empty()) {
+      out += sep;
+    }
+    out += part;
+  }
+  return out;
+}
+
 std::wstring Utf8ToWide(const std::string &input) {
   if (input.empty()) {
     return L"";
@@ -155,122 +647,559 @@ std::wstring Utf8ToWide(const std::string &input) {
   return wide;
 }
 
-WORD KeyNameToVk(const std::string &name) {
-  static const std::unordered_map<std::string, WORD> keyMap = {
-      {"CTRL", VK_CONTROL},
-      {"CONTROL", VK_CONTROL},
-      {"SHIFT", VK_SHIFT},
-      {"ALT", VK_MENU},
-      {"WIN", VK_LWIN},
-      {"WINDOWS", VK_LWIN},
-      {"TAB", VK_TAB},
-      {"ENTER", VK_RETURN},
-      {"RETURN", VK_RETURN},
-      {"ESC", VK_ESCAPE},
-      {"ESCAPE", VK_ESCAPE},
-      {"SPACE", VK_SPACE},
-      {"BACKSPACE", VK_BACK},
-      {"DELETE", VK_DELETE},
-      {"DEL", VK_DELETE},
-      {"INSERT", VK_INSERT},
-      {"INS", VK_INSERT},
-      {"HOME", VK_HOME},
-      {"END", VK_END},
-      {"PGUP", VK_PRIOR},
-      {"PAGEUP", VK_PRIOR},
-      {"PGDN", VK_NEXT},
-      {"PAGEDOWN", VK_NEXT},
-      {"UP", VK_UP},
-      {"DOWN", VK_DOWN},
-      {"LEFT", VK_LEFT},
-      {"RIGHT", VK_RIGHT},
-      {"CAPSLOCK", VK_CAPITAL},
-      {"PRINTSCREEN", VK_SNAPSHOT},
-      {"PRTSC", VK_SNAPSHOT},
-      {"VOLUMEUP", VK_VOLUME_UP},
-      {"VOLUMEDOWN", VK_VOLUME_DOWN},
-      {"VOLUMEMUTE", VK_VOLUME_MUTE},
-      {"PLAYPAUSE", VK_MEDIA_PLAY_PAUSE},
-      {"NEXTTRACK", VK_MEDIA_NEXT_TRACK},
-      {"PREVTRACK", VK_MEDIA_PREV_TRACK},
-      {"BROWSERBACK", VK_BROWSER_BACK},
-      {"BROWSERFORWARD", VK_BROWSER_FORWARD}};
-
-  std::string upper = ToUpper(Trim(name));
-  if (upper.empty()) {
-    return 0;
+struct KeyName {
+  const char *name;
+  WORD vk;
+};
+
+// The first entry for a VK is its canonical spelling; KeysToString emits it.
+constexpr KeyName kKeyNames[] = {
+    {"CTRL", VK_CONTROL},
+    {"CONTROL", VK_CONTROL},
+    {"SHIFT", VK_SHIFT},
+    {"ALT", VK_MENU},
+    {"WIN", VK_LWIN},
+    {"WINDOWS", VK_LWIN},
+    {"LWIN", VK_LWIN},
+    {"RWIN", VK_RWIN},
+    {"APPS", VK_APPS},
+    {"CONTEXTMENU", VK_APPS},
+    {"LCTRL", VK_LCONTROL},
+    {"LCONTROL", VK_LCONTROL},
+    {"RCTRL", VK_RCONTROL},
+    {"RCONTROL", VK_RCONTROL},
+    {"LSHIFT", VK_LSHIFT},
+    {"RSHIFT", VK_RSHIFT},
+    {"LALT", VK_LMENU},
+    {"RALT", VK_RMENU},
+    {"ALTGR", VK_RMENU},
+    {"TAB", VK_TAB},
+    {"ENTER", VK_RETURN},
+    {"RETURN", VK_RETURN},
+    {"ESC", VK_ESCAPE},
+    {"ESCAPE", VK_ESCAPE},
+    {"SPACE", VK_SPACE},
+    {"BACKSPACE", VK_BACK},
+    {"DELETE", VK_DELETE},
+    {"DEL", VK_DELETE},
+    {"INSERT", VK_INSERT},
+    {"INS", VK_INSERT},
+    {"HOME", VK_HOME},
+    {"END", VK_END},
+    {"PGUP", VK_PRIOR},
+    {"PAGEUP", VK_PRIOR},
+    {"PGDN", VK_NEXT},
+    {"PAGEDOWN", VK_NEXT},
+    {"UP", VK_UP},
+    {"DOWN", VK_DOWN},
+    {"LEFT", VK_LEFT},
+    {"RIGHT", VK_RIGHT},
+    {"CAPSLOCK", VK_CAPITAL},
+    {"NUMLOCK", VK_NUMLOCK},
+    {"SCROLLLOCK", VK_SCROLL},
+    {"PAUSE", VK_PAUSE},
+    {"PRINTSCREEN", VK_SNAPSHOT},
+    {"PRTSC", VK_SNAPSHOT},
+    {"SLEEP", VK_SLEEP},
+    {"NUMPAD0", VK_NUMPAD0},
+    {"NUMPAD1", VK_NUMPAD1},
+    {"NUMPAD2", VK_NUMPAD2},
+    {"NUMPAD3", VK_NUMPAD3},
+    {"NUMPAD4", VK_NUMPAD4},
+    {"NUMPAD5", VK_NUMPAD5},
+    {"NUMPAD6", VK_NUMPAD6},
+    {"NUMPAD7", VK_NUMPAD7},
+    {"NUMPAD8", VK_NUMPAD8},
+    {"NUMPAD9", VK_NUMPAD9},
+    {"NUM0", VK_NUMPAD0},
+    {"NUM1", VK_NUMPAD1},
+    {"NUM2", VK_NUMPAD2},
+    {"NUM3", VK_NUMPAD3},
+    {"NUM4", VK_NUMPAD4},
+    {"NUM5", VK_NUMPAD5},
+    {"NUM6", VK_NUMPAD6},
+    {"NUM7", VK_NUMPAD7},
+    {"NUM8", VK_NUMPAD8},
+    {"NUM9", VK_NUMPAD9},
+    {"MULTIPLY", VK_MULTIPLY},
+    {"ADD", VK_ADD},
+    {"SEPARATOR", VK_SEPARATOR},
+    {"SUBTRACT", VK_SUBTRACT},
+    {"DECIMAL", VK_DECIMAL},
+    {"DIVIDE", VK_DIVIDE},
+    {"F1", VK_F1},
+    {"F2", VK_F2},
+    {"F3", VK_F3},
+    {"F4", VK_F4},
+    {"F5", VK_F5},
+    {"F6", VK_F6},
+    {"F7", VK_F7},
+    {"F8", VK_F8},
+    {"F9", VK_F9},
+    {"F10", VK_F10},
+    {"F11", VK_F11},
+    {"F12", VK_F12},
+    {"F13", VK_F13},
+    {"F14", VK_F14},
+    {"F15", VK_F15},
+    {"F16", VK_F16},
+    {"F17", VK_F17},
+    {"F18", VK_F18},
+    {"F19", VK_F19},
+    {"F20", VK_F20},
+    {"F21", VK_F21},
+    {"F22", VK_F22},
+    {"F23", VK_F23},
+    {"F24", VK_F24},
+    {"SEMICOLON", VK_OEM_1},
+    {"OEM_1", VK_OEM_1},
+    {"EQUALS", VK_OEM_PLUS},
+    {"OEM_PLUS", VK_OEM_PLUS},
+    {"COMMA", VK_OEM_COMMA},
+    {"OEM_COMMA", VK_OEM_COMMA},
+    {"MINUS", VK_OEM_MINUS},
+    {"OEM_MINUS", VK_OEM_MINUS},
+    {"PERIOD", VK_OEM_PERIOD},
+    {"OEM_PERIOD", VK_OEM_PERIOD},
+    {"SLASH", VK_OEM_2},
+    {"OEM_2", VK_OEM_2},
+    {"BACKTICK", VK_OEM_3},
+    {"GRAVE", VK_OEM_3},
+    {"OEM_3", VK_OEM_3},
+    {"LBRACKET", VK_OEM_4},
+    {"OEM_4", VK_OEM_4},
+    {"BACKSLASH", VK_OEM_5},
+    {"OEM_5", VK_OEM_5},
+    {"RBRACKET", VK_OEM_6},
+    {"OEM_6", VK_OEM_6},
+    {"QUOTE", VK_OEM_7},
+    {"OEM_7", VK_OEM_7},
+    {"OEM_8", VK_OEM_8},
+    {"OEM_102", VK_OEM_102},
+    {"VOLUMEUP", VK_VOLUME_UP},
+    {"VOLUMEDOWN", VK_VOLUME_DOWN},
+    {"VOLUMEMUTE", VK_VOLUME_MUTE},
+    {"PLAYPAUSE", VK_MEDIA_PLAY_PAUSE},
+    {"NEXTTRACK", VK_MEDIA_NEXT_TRACK},
+    {"PREVTRACK", VK_MEDIA_PREV_TRACK},
+    {"MEDIASTOP", VK_MEDIA_STOP},
+    {"BROWSERBACK", VK_BROWSER_BACK},
+    {"BROWSERFORWARD", VK_BROWSER_FORWARD},
+    {"BROWSERREFRESH", VK_BROWSER_REFRESH},
+    {"BROWSERSTOP", VK_BROWSER_STOP},
+    {"BROWSERSEARCH", VK_BROWSER_SEARCH},
+    {"BROWSERFAVORITES", VK_BROWSER_FAVORITES},
+    {"BROWSERHOME", VK_BROWSER_HOME},
+    {"LAUNCHMAIL", VK_LAUNCH_MAIL},
+    {"LAUNCHMEDIA", VK_LAUNCH_MEDIA_SELECT},
+    {"LAUNCHAPP1", VK_LAUNCH_APP1},
+    {"LAUNCHAPP2", VK_LAUNCH_APP2},
+    {"LBUTTON", VK_LBUTTON},
+    {"MOUSE1", VK_LBUTTON},
+    {"RBUTTON", VK_RBUTTON},
+    {"MOUSE2", VK_RBUTTON},
+    {"MBUTTON", VK_MBUTTON},
+    {"MOUSE3", VK_MBUTTON},
+    {"XBUTTON1", VK_XBUTTON1},
+    {"MOUSE4", VK_XBUTTON1},
+    {"XBUTTON2", VK_XBUTTON2},
+    {"MOUSE5", VK_XBUTTON2},
+    {"A", 'A'}, {"B", 'B'}, {"C", 'C'}, {"D", 'D'}, {"E", 'E'}, {"F", 'F'},
+    {"G", 'G'}, {"H", 'H'}, {"I", 'I'}, {"J", 'J'}, {"K", 'K'}, {"L", 'L'},
+    {"M", 'M'}, {"N", 'N'}, {"O", 'O'}, {"P", 'P'}, {"Q", 'Q'}, {"R", 'R'},
+    {"S", 'S'}, {"T", 'T'}, {"U", 'U'}, {"V", 'V'}, {"W", 'W'}, {"X", 'X'},
+    {"Y", 'Y'}, {"Z", 'Z'}, {"0", '0'}, {"1", '1'}, {"2", '2'}, {"3", '3'},
+    {"4", '4'}, {"5", '5'}, {"6", '6'}, {"7", '7'}, {"8", '8'}, {"9", '9'}};
+
+constexpr size_t kKeyNameCount = sizeof(kKeyNames) / sizeof(kKeyNames[0]);
+constexpr size_t kKeyHashBuckets = 64;
+constexpr size_t kKeyHashSlots = 512;
+constexpr size_t kMaxKeyNameLength = 16;
+
+constexpr char AsciiUpper(char c) {
+  return (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
+}
+
+constexpr size_t ConstStrLen(const char *s) {
+  size_t n = 0;
+  while (s[n] != '\0') {
+    ++n;
+  }
+  return n;
+}
+
+// Case-insensitive FNV-1a; the seed selects an independent hash function.
+constexpr uint32_t KeyNameHash(const char *s, size_t len, uint32_t seed) {
+  uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+  for (size_t i = 0; i < len; ++i) {
+    h ^= static_cast<unsigned char>(AsciiUpper(s[i]));
+    h *= 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+constexpr bool KeyNameEquals(const char *s, size_t len, const char *name) {
+  for (size_t i = 0; i < len; ++i) {
+    if (name[i] == '\0' || AsciiUpper(s[i]) != name[i]) {
+      return false;
+    }
+  }
+  return name[len] == '\0';
+}
+
+// Hash-and-displace perfect hash: names are grouped into buckets by the
+// seed-0 hash, then each bucket gets the first seed that places all of its
+// names in free slots. Built entirely at compile time.
+struct KeyNameHashTable {
+  uint16_t seeds[kKeyHashBuckets] = {};
+  int16_t slots[kKeyHashSlots] = {};
+};
+
+constexpr KeyNameHashTable BuildKeyNameHashTable() {
+  KeyNameHashTable t;
+  for (size_t i = 0; i < kKeyHashSlots; ++i) {
+    t.slots[i] = -1;
   }
 
-  auto it = keyMap.find(upper);
-  if (it != keyMap.end()) {
-    return it->second;
+  size_t bucketOf[kKeyNameCount] = {};
+  size_t bucketSize[kKeyHashBuckets] = {};
+  for (size_t i = 0; i < kKeyNameCount; ++i) {
+    const size_t len = ConstStrLen(kKeyNames[i].name);
+    if (len > kMaxKeyNameLength) {
+      throw "key name longer than kMaxKeyNameLength";
+    }
+    bucketOf[i] = KeyNameHash(kKeyNames[i].name, len, 0) % kKeyHashBuckets;
+    ++bucketSize[bucketOf[i]];
   }
 
-  if (upper.size() == 1) {
-    char c = upper[0];
-    if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
-      return static_cast<WORD>(c);
+  bool placed[kKeyHashBuckets] = {};
+  for (size_t round = 0; round < kKeyHashBuckets; ++round) {
+    // Place the largest remaining bucket first.
+    size_t b = kKeyHashBuckets;
+    for (size_t i = 0; i < kKeyHashBuckets; ++i) {
+      if (!placed[i] && (b == kKeyHashBuckets || bucketSize[i] > bucketSize[b])) {
+        b = i;
+      }
+    }
+    placed[b] = true;
+    if (bucketSize[b] == 0) {
+      continue;
+    }
+
+    for (uint32_t seed = 1;; ++seed) {
+      if (seed > 0xFFFF) {
+        throw "no perfect hash seed (duplicate key name?)";
+      }
+      size_t used[kKeyHashSlots] = {};
+      size_t usedCount = 0;
+      bool ok = true;
+      for (size_t i = 0; i < kKeyNameCount && ok; ++i) {
+        if (bucketOf[i] != b) {
+          continue;
+        }
+        const size_t slot =
+            KeyNameHash(kKeyNames[i].name, ConstStrLen(kKeyNames[i].name),
+                        seed) &
+            (kKeyHashSlots - 1);
+        if (t.slots[slot] != -1) {
+          ok = false;
+          break;
+        }
+        for (size_t u = 0; u < usedCount; ++u) {
+          if (used[u] == slot) {
+            ok = false;
+          }
+        }
+        used[usedCount++] = slot;
+      }
+      if (!ok) {
+        continue;
+      }
+
+      t.seeds[b] = static_cast<uint16_t>(seed);
+      for (size_t i = 0; i < kKeyNameCount; ++i) {
+        if (bucketOf[i] == b) {
+          t.slots[KeyNameHash(kKeyNames[i].name, ConstStrLen(kKeyNames[i].name),
+                              seed) &
+                  (kKeyHashSlots - 1)] = static_cast<int16_t>(i);
+        }
+      }
+      break;
     }
   }
+  return t;
+}
+
+struct VkNameTable {
+  const char *names[256] = {};
+};
 
-  if (upper.size() >= 2 && upper[0] == 'F') {
-    int fn = std::atoi(upper.c_str() + 1);
-    if (fn >= 1 && fn <= 24) {
-      return static_cast<WORD>(VK_F1 + (fn - 1));
+constexpr VkNameTable BuildVkNameTable() {
+  VkNameTable t;
+  for (size_t i = 0; i < kKeyNameCount; ++i) {
+    if (t.names[kKeyNames[i].vk & 0xFF] == nullptr) {
+      t.names[kKeyNames[i].vk & 0xFF] = kKeyNames[i].name;
     }
   }
+  return t;
+}
 
-  return 0;
+constexpr KeyNameHashTable kKeyNameTable = BuildKeyNameHashTable();
+constexpr VkNameTable kVkNames = BuildVkNameTable();
+
+std::string_view TrimView(std::string_view s) {
+  const auto start = s.find_first_not_of(" \t\r\n");
+  if (start == std::string_view::npos) {
+    return {};
+  }
+  const auto end = s.find_last_not_of(" \t\r\n");
+  return s.substr(start, end - start + 1);
+}
+
+WORD KeyNameToVk(std::string_view name) {
+  name = TrimView(name);
+  if (name.empty() || name.size() > kMaxKeyNameLength) {
+    return 0;
+  }
+
+  const uint32_t bucket =
+      KeyNameHash(name.data(), name.size(), 0) % kKeyHashBuckets;
+  const uint32_t slot = KeyNameHash(name.data(), name.size(),
+                                    kKeyNameTable.seeds[bucket]) &
+                        (kKeyHashSlots - 1);
+  const int16_t idx = kKeyNameTable.slots[slot];
+  if (idx < 0 || !KeyNameEquals(name.data(), name.size(), kKeyNames[idx].name)) {
+    return 0;
+  }
+  return kKeyNames[idx].vk;
 }
 
 bool ParseKeys(const std::string &value, std::vector<WORD> &outKeys) {
   outKeys.clear();
-  auto parts = Split(value, '+');
-  for (const std::string &raw : parts) {
-    WORD vk = KeyNameToVk(raw);
+  std::string_view rest(value);
+  while (!rest.empty()) {
+    const size_t plus = rest.find('+');
+    WORD vk = KeyNameToVk(rest.substr(0, plus));
     if (vk == 0) {
       return false;
     }
     outKeys.push_back(vk);
+    if (plus == std::string_view::npos) {
+      break;
+    }
+    rest.remove_prefix(plus + 1);
   }
   return !outKeys.empty();
 }
 
-bool SendKeyCombo(const std::vector<WORD> &keys) {
-  if (keys.empty()) {
-    return false;
+// Builds a down or up event for a VK. Mouse-button VKs become mouse events so
+// they can appear in key combos and macros.
+INPUT MakeKeyInput(WORD vk, bool up) {
+  INPUT in = {};
+  switch (vk) {
+  case VK_LBUTTON:
+    in.type = INPUT_MOUSE;
+    in.mi.dwFlags = up ? MOUSEEVENTF_LEFTUP : MOUSEEVENTF_LEFTDOWN;
+    return in;
+  case VK_RBUTTON:
+    in.type = INPUT_MOUSE;
+    in.mi.dwFlags = up ? MOUSEEVENTF_RIGHTUP : MOUSEEVENTF_RIGHTDOWN;
+    return in;
+  case VK_MBUTTON:
+    in.type = INPUT_MOUSE;
+    in.mi.dwFlags = up ? MOUSEEVENTF_MIDDLEUP : MOUSEEVENTF_MIDDLEDOWN;
+    return in;
+  case VK_XBUTTON1:
+  case VK_XBUTTON2:
+    in.type = INPUT_MOUSE;
+    in.mi.dwFlags = up ? MOUSEEVENTF_XUP : MOUSEEVENTF_XDOWN;
+    in.mi.mouseData = (vk == VK_XBUTTON1) ? XBUTTON1 : XBUTTON2;
+    return in;
+  default:
+    in.type = INPUT_KEYBOARD;
+    in.ki.wVk = vk;
+    in.ki.dwFlags = up ? KEYEVENTF_KEYUP : 0;
+    return in;
+  }
+}
+
+using SendInputFn = UINT (*)(UINT count, INPUT *inputs);
+
+UINT OsSendInput(UINT count, INPUT *inputs) {
+  return SendInput(count, inputs, sizeof(INPUT));
+}
+
+// Every injection ends here; --stress swaps in a counting sink so synthetic
+// load never reaches the desktop.
+SendInputFn g_sendInput = OsSendInput;
+
+// ---------------------------------------------------------------------------
+// Injected key state: one bit per VK the service currently holds down,
+// updated by every key injection. A down for a key already held and an up
+// for a key not held are dropped before SendInput; the up paired with a
+// dropped down in the same batch is dropped too, so a combo never releases
+// a key a macro is holding. Lock-free; a lookup is one relaxed load.
+// ---------------------------------------------------------------------------
+
+std::atomic<uint64_t> g_injectedKeys[4] = {};
+std::atomic<unsigned long long> g_injectSuppressed{0};
+
+bool InjectedKeyDown(WORD vk) {
+  return vk < 256 &&
+         ((g_injectedKeys[vk >> 6].load(std::memory_order_relaxed) >>
+           (vk & 63)) & 1) != 0;
+}
+
+// VK of a key or mouse-button event; 0 for motion, wheel and Unicode input.
+WORD InputVk(const INPUT &in, bool &up) {
+  if (in.type == INPUT_KEYBOARD) {
+    up = (in.ki.dwFlags & KEYEVENTF_KEYUP) != 0;
+    return ((in.ki.dwFlags & KEYEVENTF_UNICODE) || in.ki.wVk > 0xFF)
+               ? 0
+               : in.ki.wVk;
+  }
+  if (in.type != INPUT_MOUSE) {
+    return 0;
+  }
+  const DWORD f = in.mi.dwFlags;
+  up = (f & (MOUSEEVENTF_LEFTUP | MOUSEEVENTF_RIGHTUP | MOUSEEVENTF_MIDDLEUP |
+             MOUSEEVENTF_XUP)) != 0;
+  if (f & (MOUSEEVENTF_LEFTDOWN | MOUSEEVENTF_LEFTUP)) {
+    return VK_LBUTTON;
+  }
+  if (f & (MOUSEEVENTF_RIGHTDOWN | MOUSEEVENTF_RIGHTUP)) {
+    return VK_RBUTTON;
+  }
+  if (f & (MOUSEEVENTF_MIDDLEDOWN | MOUSEEVENTF_MIDDLEUP)) {
+    return VK_MBUTTON;
+  }
+  if (f & (MOUSEEVENTF_XDOWN | MOUSEEVENTF_XUP)) {
+    return in.mi.mouseData == XBUTTON1 ? VK_XBUTTON1 : VK_XBUTTON2;
+  }
+  return 0;
+}
+
+// Returns true if the bit changed.
+bool SetInjectedKey(WORD vk, bool down) {
+  const uint64_t bit = 1ull << (vk & 63);
+  std::atomic<uint64_t> &word = g_injectedKeys[vk >> 6];
+  const uint64_t old = down ? word.fetch_or(bit) : word.fetch_and(~bit);
+  return ((old & bit) != 0) != down;
+}
+
+// Compacts |inputs| in place to the events that change the key state and
+// records them as held/released. Returns the number kept; |origin|, when
+// given, receives each kept event's index in the original array.
+UINT FilterInjectedInputs(INPUT *inputs, UINT count, UINT *origin = nullptr) {
+  uint64_t dropped[4] = {};
+  UINT kept = 0;
+  for (UINT i = 0; i < count; ++i) {
+    bool up = false;
+    const WORD vk = InputVk(inputs[i], up);
+    if (vk != 0) {
+      const uint64_t bit = 1ull << (vk & 63);
+      uint64_t &mask = dropped[vk >> 6];
+      if (up ? ((mask & bit) != 0 || !SetInjectedKey(vk, false))
+             : !SetInjectedKey(vk, true)) {
+        mask = up ? (mask & ~bit) : (mask | bit);
+        g_injectSuppressed.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+    }
+    if (origin) {
+      origin[kept] = i;
+    }
+    inputs[kept++] = inputs[i];
+  }
+  return kept;
+}
+
+// Reverts the state recorded for events SendInput did not insert.
+void UnrecordInjectedInputs(const INPUT *inputs, UINT count) {
+  for (UINT i = 0; i < count; ++i) {
+    bool up = false;
+    const WORD vk = InputVk(inputs[i], up);
+    if (vk != 0) {
+      SetInjectedKey(vk, up);
+    }
+  }
+}
+
+// Every key injection goes through here. Returns |count| when everything
+// that survived filtering was inserted, otherwise the index in |inputs| of
+// the first event that was not, so callers can resume from there.
+UINT SubmitInputs(const INPUT *inputs, UINT count) {
+  thread_local std::vector<INPUT> scratch;
+  thread_local std::vector<UINT> origin;
+  scratch.assign(inputs, inputs + count);
+  origin.resize(count);
+  const UINT kept = FilterInjectedInputs(scratch.data(), count, origin.data());
+  const UINT sent = kept ? g_sendInput(kept, scratch.data()) : 0;
+  if (sent < kept) {
+    UnrecordInjectedInputs(scratch.data() + sent, kept - sent);
+    return origin[sent];
+  }
+  return count;
+}
+
+// Releases everything the service holds in one SendInput: profile switch,
+// stuck-Alt recovery and shutdown.
+UINT ReleaseInjectedKeys() {
+  std::vector<INPUT> ups;
+  for (WORD word = 0; word < 4; ++word) {
+    const uint64_t bits = g_injectedKeys[word].exchange(0);
+    for (uint64_t rest = bits; rest; rest &= rest - 1) {
+      WORD b = 0;
+      while (!((rest >> b) & 1)) {
+        ++b;
+      }
+      ups.push_back(MakeKeyInput(static_cast<WORD>(word * 64 + b), true));
+    }
+  }
+  return ups.empty() ? 0
+                     : g_sendInput(static_cast<UINT>(ups.size()), ups.data());
+}
+
+unsigned InjectedKeysHeld() {
+  unsigned n = 0;
+  for (const auto &word : g_injectedKeys) {
+    for (uint64_t bits = word.load(); bits; bits &= bits - 1) {
+      ++n;
+    }
   }
+  return n;
+}
 
+std::vector<INPUT> BuildComboInputs(const std::vector<WORD> &keys) {
   std::vector<INPUT> inputs;
   inputs.reserve(keys.size() * 2);
 
   for (WORD vk : keys) {
-    INPUT in = {};
-    in.type = INPUT_KEYBOARD;
-    in.ki.wVk = vk;
-    inputs.push_back(in);
+    inputs.push_back(MakeKeyInput(vk, false));
   }
 
   for (auto it = keys.rbegin(); it != keys.rend(); ++it) {
-    INPUT in = {};
-    in.type = INPUT_KEYBOARD;
-    in.ki.wVk = *it;
-    in.ki.dwFlags = KEYEVENTF_KEYUP;
-    inputs.push_back(in);
+    inputs.push_back(MakeKeyInput(*it, true));
+  }
+  return inputs;
+}
+
+bool SendInputs(const std::vector<INPUT> &inputs) {
+  if (inputs.empty()) {
+    return false;
   }
+  return SubmitInputs(inputs.data(), static_cast<UINT>(inputs.size())) ==
+         inputs.size();
+}
 
-  return SendInput(static_cast<UINT>(inputs.size()), inputs.data(),
-                   sizeof(INPUT)) == inputs.size();
+bool SendKeyCombo(const std::vector<WORD> &keys) {
+  return SendInputs(BuildComboInputs(keys));
 }
 
 void ReleaseStickyAlt() {
-  if (g_isAltHeld) {
-    INPUT in = {};
-    in.type = INPUT_KEYBOARD;
-    in.ki.wVk = VK_MENU;
-    in.ki.dwFlags = KEYEVENTF_KEYUP;
-    SendInput(1, &in, sizeof(INPUT));
-    g_isAltHeld = false;
+  if (InjectedKeyDown(VK_MENU)) {
+    const INPUT in = MakeKeyInput(VK_MENU, true);
+    SubmitInputs(&in, 1);
     if (g_mainWindow) {
       KillTimer(g_mainWindow, TIMER_ID_ALT_RELEASE);
     }
@@ -301,7 +1230,7 @@ bool HandleAltTab() {
   inputs[3].ki.wVk = VK_MENU;
   inputs[3].ki.dwFlags = KEYEVENTF_KEYUP;
 
-  SendInput(4, inputs, sizeof(INPUT));
+  SubmitInputs(inputs, 4);
   return true;
 }
 
@@ -318,949 +1247,6205 @@ bool IsAltTabCombo(const std::vector<WORD> &keys) {
   return hAlt && hTab;
 }
 
-bool SendUnicodeText(const std::string &text) {
-  std::wstring wide = Utf8ToWide(text);
-  if (wide.empty()) {
-    return false;
-  }
-
-  std::vector<INPUT> inputs;
-  inputs.reserve(wide.size() * 2);
-
-  for (wchar_t ch : wide) {
-    INPUT down = {};
-    down.type = INPUT_KEYBOARD;
-    down.ki.dwFlags = KEYEVENTF_UNICODE;
-    down.ki.wScan = ch;
-
-    INPUT up = down;
-    up.ki.dwFlags = KEYEVENTF_UNICODE | KEYEVENTF_KEYUP;
+// ---------------------------------------------------------------------------
+// Thread scheduling: each service thread registers itself when it starts,
+// and its thread.<name>= policy is applied then and again on every config
+// publish. The input thread (hooks, raw input, message loop) can also join
+// an MMCSS task. MMCSS only registers the calling thread, so a change made
+// on another thread is posted to the input thread as WM_SCHEDULING_CHANGED.
+// ---------------------------------------------------------------------------
+
+constexpr const char *kServiceThreadNames[kServiceThreadCount] = {
+    "input",    "macro",  "scroll", "text",
+    "launcher", "server", "config", "telemetry"};
+
+struct RegisteredThread {
+  DWORD id = 0;
+  ServiceThread kind = kThreadInput;
+  nexus_sched::ThreadRef ref;
+  nexus_sched::ThreadPolicy applied; // kDefault until a policy was set
+};
 
-    inputs.push_back(down);
-    inputs.push_back(up);
+std::mutex g_schedMutex;
+std::vector<RegisteredThread> g_schedThreads; // guarded by g_schedMutex
+nexus_sched::ThreadPolicy g_schedPolicy[kServiceThreadCount]; // g_schedMutex
+nexus_sched::Priority g_schedClass = nexus_sched::Priority::kDefault; // same
+std::string g_mmcssTask; // guarded by g_schedMutex
+std::atomic<DWORD> g_inputThreadId{0};
+void *g_mmcssRegistration = nullptr; // input thread only
+std::string g_mmcssJoined;           // input thread only
+std::atomic<bool> g_mmcssActive{false};
+std::atomic<unsigned long long> g_schedApplied{0};
+std::atomic<unsigned long long> g_schedFailures{0};
+
+bool ParseServiceThreadName(const std::string &upper, ServiceThread &thread) {
+  for (size_t i = 0; i < kServiceThreadCount; ++i) {
+    if (upper == ToUpper(kServiceThreadNames[i])) {
+      thread = static_cast<ServiceThread>(i);
+      return true;
+    }
   }
+  return false;
+}
 
-  return SendInput(static_cast<UINT>(inputs.size()), inputs.data(),
-                   sizeof(INPUT)) == inputs.size();
+bool SamePolicy(const nexus_sched::ThreadPolicy &a,
+                const nexus_sched::ThreadPolicy &b) {
+  return a.priority == b.priority && a.affinity == b.affinity;
 }
 
-bool RunCommand(const std::string &commandLine) {
-  std::wstring cmd = Utf8ToWide(commandLine);
-  if (cmd.empty()) {
-    return false;
+// Caller holds g_schedMutex. Going back to default restores normal priority
+// on every CPU rather than leaving the old policy in place.
+void ApplyRegisteredPolicy(RegisteredThread &t,
+                           const nexus_sched::ThreadPolicy &policy) {
+  if (SamePolicy(policy, t.applied)) {
+    return;
   }
-
-  std::vector<wchar_t> mutableCmd(cmd.begin(), cmd.end());
-  mutableCmd.push_back(L'\0');
-
-  STARTUPINFOW si = {};
-  si.cb = sizeof(si);
-  PROCESS_INFORMATION pi = {};
-
-  BOOL ok = CreateProcessW(nullptr, mutableCmd.data(), nullptr, nullptr, FALSE,
-                           0, nullptr, nullptr, &si, &pi);
-
-  if (!ok) {
-    return false;
+  nexus_sched::ThreadPolicy effective = policy;
+  if (policy.priority == nexus_sched::Priority::kDefault) {
+    effective.priority = nexus_sched::Priority::kNormal;
+    effective.affinity = 0;
   }
-
-  CloseHandle(pi.hThread);
-  CloseHandle(pi.hProcess);
-  return true;
+  if (nexus_sched::ApplyThreadPolicy(t.ref, effective)) {
+    g_schedApplied.fetch_add(1);
+  } else {
+    g_schedFailures.fetch_add(1);
+  }
+  t.applied = policy;
 }
 
-bool OpenTarget(const std::string &target) {
-  std::wstring wideTarget = Utf8ToWide(target);
-  if (wideTarget.empty()) {
-    return false;
+// Input thread: joins, switches or leaves the configured MMCSS task.
+void ApplyInputMmcss() {
+  std::string task;
+  {
+    std::lock_guard<std::mutex> lock(g_schedMutex);
+    task = g_mmcssTask;
   }
-
-  HINSTANCE res = ShellExecuteW(nullptr, L"open", wideTarget.c_str(), nullptr,
-                                nullptr, SW_SHOWNORMAL);
-  return reinterpret_cast<INT_PTR>(res) > 32;
+  if (task == g_mmcssJoined) {
+    return;
+  }
+  nexus_sched::LeaveMmcss(g_mmcssRegistration);
+  g_mmcssRegistration =
+      task.empty() ? nullptr : nexus_sched::JoinMmcss(task.c_str());
+  if (!task.empty() && !g_mmcssRegistration) {
+    g_schedFailures.fetch_add(1);
+  }
+  g_mmcssJoined = task;
+  g_mmcssActive = g_mmcssRegistration != nullptr;
 }
 
-void SetLaunchOnStartup(bool enable) {
-  HKEY hKey;
-  const char *runKey = "Software\\Microsoft\\Windows\\CurrentVersion\\Run";
-  const char *appName = "NexusMouseRemapper";
+void PublishScheduling(const Config &cfg) {
+  {
+    std::lock_guard<std::mutex> lock(g_schedMutex);
+    std::copy(std::begin(cfg.threads), std::end(cfg.threads), g_schedPolicy);
+    for (RegisteredThread &t : g_schedThreads) {
+      ApplyRegisteredPolicy(t, g_schedPolicy[t.kind]);
+    }
+    if (cfg.priorityClass != g_schedClass) {
+      const bool ok = nexus_sched::ApplyProcessPriority(
+          cfg.priorityClass == nexus_sched::Priority::kDefault
+              ? nexus_sched::Priority::kNormal
+              : cfg.priorityClass);
+      (ok ? g_schedApplied : g_schedFailures).fetch_add(1);
+      g_schedClass = cfg.priorityClass;
+    }
+    g_mmcssTask = cfg.mmcssTask;
+  }
+  if (GetCurrentThreadId() == g_inputThreadId.load()) {
+    ApplyInputMmcss();
+  } else if (g_mainWindow) {
+    PostMessageA(g_mainWindow, WM_SCHEDULING_CHANGED, 0, 0);
+  }
+}
 
-  if (RegOpenKeyExA(HKEY_CURRENT_USER, runKey, 0, KEY_SET_VALUE, &hKey) ==
-      ERROR_SUCCESS) {
-    if (enable) {
-      char path[MAX_PATH];
-      GetModuleFileNameA(nullptr, path, MAX_PATH);
-      
-      // Enclose path in quotes for Windows to handle spaces correctly
-      char quotedPath[MAX_PATH + 3];
-      sprintf(quotedPath, "\"%s\"", path);
+// Charges the calling thread's allocations to |kind| until destroyed.
+struct AllocScope {
+  explicit AllocScope(ServiceThread kind) : previous(g_allocSubsystem) {
+    g_allocSubsystem = static_cast<uint8_t>(kind + 1);
+  }
+  AllocScope(const AllocScope &) = delete;
+  AllocScope &operator=(const AllocScope &) = delete;
+  ~AllocScope() { g_allocSubsystem = previous; }
+  uint8_t previous;
+};
 
-      RegSetValueExA(hKey, appName, 0, REG_SZ,
-                     reinterpret_cast<const BYTE *>(quotedPath),
-                     static_cast<DWORD>(strlen(quotedPath) + 1));
-    } else {
-      RegDeleteValueA(hKey, appName);
+// Registers the calling thread for its kind's policy until destroyed, and
+// charges its allocations to that kind.
+struct ScopedServiceThread {
+  explicit ScopedServiceThread(ServiceThread kind) : alloc(kind) {
+    RegisteredThread t;
+    t.id = GetCurrentThreadId();
+    t.kind = kind;
+    t.ref = nexus_sched::CurrentThread();
+    {
+      std::lock_guard<std::mutex> lock(g_schedMutex);
+      ApplyRegisteredPolicy(t, g_schedPolicy[kind]);
+      g_schedThreads.push_back(t);
+    }
+    if (kind == kThreadInput) {
+      g_inputThreadId = t.id;
+      ApplyInputMmcss();
+    }
+  }
+  ScopedServiceThread(const ScopedServiceThread &) = delete;
+  ScopedServiceThread &operator=(const ScopedServiceThread &) = delete;
+  ~ScopedServiceThread() {
+    const DWORD id = GetCurrentThreadId();
+    if (id == g_inputThreadId.load()) {
+      nexus_sched::LeaveMmcss(g_mmcssRegistration);
+      g_mmcssRegistration = nullptr;
+      g_mmcssJoined.clear();
+      g_mmcssActive = false;
+      g_inputThreadId = 0;
+    }
+    std::lock_guard<std::mutex> lock(g_schedMutex);
+    for (auto it = g_schedThreads.begin(); it != g_schedThreads.end(); ++it) {
+      if (it->id == id) {
+        nexus_sched::ReleaseThread(it->ref);
+        g_schedThreads.erase(it);
+        break;
+      }
     }
-    RegCloseKey(hKey);
   }
+  AllocScope alloc;
+};
+
+// ---------------------------------------------------------------------------
+// Text injection: text: actions run on an injector thread. Short text is
+// typed as KEYEVENTF_UNICODE input in paced chunks; long text is pasted
+// through the clipboard.
+// ---------------------------------------------------------------------------
+
+constexpr size_t kTextChunkUnits = 64;   // UTF-16 units per SendInput call
+constexpr DWORD kTextChunkPauseMs = 1;   // lets the target drain its queue
+constexpr int kTextSendRetries = 20;     // consecutive zero-progress sends
+constexpr size_t kClipboardTextThreshold = 1024; // units; longer text pastes
+constexpr DWORD kClipboardSettleMs = 200; // before restoring, no window
+constexpr DWORD kClipboardPasteTimeoutMs = 1000; // the target never read it
+constexpr size_t kMaxQueuedTexts = 8;
+
+UINT SystemSendInput(UINT count, INPUT *inputs) {
+  return SubmitInputs(inputs, count);
 }
 
-bool IsLaunchOnStartupEnabled() {
-  HKEY hKey;
-  const char *runKey = "Software\\Microsoft\\Windows\\CurrentVersion\\Run";
-  const char *appName = "NexusMouseRemapper";
-  bool enabled = false;
+enum class TextStrategy { Unicode, Clipboard };
 
-  if (RegOpenKeyExA(HKEY_CURRENT_USER, runKey, 0, KEY_QUERY_VALUE, &hKey) ==
-      ERROR_SUCCESS) {
-    if (RegQueryValueExA(hKey, appName, nullptr, nullptr, nullptr, nullptr) ==
-        ERROR_SUCCESS) {
-      enabled = true;
+TextStrategy ChooseTextStrategy(const std::wstring &text) {
+  return text.size() > kClipboardTextThreshold ? TextStrategy::Clipboard
+                                               : TextStrategy::Unicode;
+}
+
+INPUT MakeUnicodeInput(wchar_t unit, bool up) {
+  INPUT in = {};
+  in.type = INPUT_KEYBOARD;
+  in.ki.wScan = unit;
+  in.ki.dwFlags = KEYEVENTF_UNICODE | (up ? KEYEVENTF_KEYUP : 0);
+  return in;
+}
+
+// One group per character: down/up for a BMP unit, both surrogate halves
+// down then both up for a pair, VK_RETURN for line breaks. |groupEnds|
+// records where each group ends so chunks never split one.
+std::vector<INPUT> BuildUnicodeInputs(const std::wstring &text,
+                                      std::vector<size_t> &groupEnds) {
+  std::vector<INPUT> inputs;
+  inputs.reserve(text.size() * 2);
+  groupEnds.clear();
+  groupEnds.reserve(text.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    const wchar_t ch = text[i];
+    if (ch == L'\r' || ch == L'\n') {
+      if (ch == L'\r' && i + 1 < text.size() && text[i + 1] == L'\n') {
+        ++i;
+      }
+      inputs.push_back(MakeKeyInput(VK_RETURN, false));
+      inputs.push_back(MakeKeyInput(VK_RETURN, true));
+    } else if (ch >= 0xD800 && ch <= 0xDBFF && i + 1 < text.size() &&
+               text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF) {
+      const wchar_t low = text[++i];
+      inputs.push_back(MakeUnicodeInput(ch, false));
+      inputs.push_back(MakeUnicodeInput(low, false));
+      inputs.push_back(MakeUnicodeInput(ch, true));
+      inputs.push_back(MakeUnicodeInput(low, true));
+    } else {
+      inputs.push_back(MakeUnicodeInput(ch, false));
+      inputs.push_back(MakeUnicodeInput(ch, true));
     }
-    RegCloseKey(hKey);
+    groupEnds.push_back(inputs.size());
   }
-  return enabled;
+  return inputs;
 }
 
-bool ExecuteMacro(const std::string &payload) {
-  // Format: VK_CODE:STATE,DELAY,VK_CODE:STATE...
-  // States: D (Down), U (Up), P (Press/Both)
-  auto parts = Split(payload, ',');
-  for (const auto &p : parts) {
-    if (p.empty()) continue;
-    if (std::isdigit(p[0])) {
-      Sleep(std::atoi(p.c_str()));
-    } else {
-      auto sub = Split(p, ':');
-      if (sub.size() < 1) continue;
-      WORD vk = KeyNameToVk(sub[0]);
-      if (vk == 0) continue;
-      char state = (sub.size() > 1) ? ToUpper(sub[1])[0] : 'P';
-      
-      INPUT in = {};
-      in.type = INPUT_KEYBOARD;
-      in.ki.wVk = vk;
-      if (state == 'U') {
-        in.ki.dwFlags = KEYEVENTF_KEYUP;
-        SendInput(1, &in, sizeof(INPUT));
-      } else if (state == 'D') {
-        SendInput(1, &in, sizeof(INPUT));
+// Submits |inputs| in chunks of about kTextChunkUnits characters, pausing
+// between chunks and resuming after partial sends (input desktop busy).
+bool SubmitInputsPaced(std::vector<INPUT> &inputs,
+                       const std::vector<size_t> &groupEnds,
+                       SendInputFn send) {
+  size_t pos = 0;
+  size_t group = 0;
+  while (pos < inputs.size()) {
+    size_t end = groupEnds[group++];
+    while (group < groupEnds.size() &&
+           groupEnds[group] - pos <= kTextChunkUnits * 2) {
+      end = groupEnds[group++];
+    }
+
+    int stalls = 0;
+    while (pos < end) {
+      const UINT sent = send(static_cast<UINT>(end - pos), &inputs[pos]);
+      pos += sent;
+      if (sent == 0) {
+        if (++stalls > kTextSendRetries) {
+          return false;
+        }
+        Sleep(5);
       } else {
-        // Press (Down + Up)
-        SendInput(1, &in, sizeof(INPUT));
-        Sleep(10);
-        in.ki.dwFlags = KEYEVENTF_KEYUP;
-        SendInput(1, &in, sizeof(INPUT));
+        stalls = 0;
       }
     }
+    if (pos < inputs.size()) {
+      Sleep(kTextChunkPauseMs);
+    }
   }
   return true;
 }
 
-bool ExecuteAction(const Action &action) {
-  // If doing non-alt-tab action, release Alt if it was stuck
-  if (g_isAltHeld &&
-      (action.type != ActionType::Keys || !IsAltTabCombo(action.keys))) {
-    ReleaseStickyAlt();
+bool OpenClipboardWithRetry() {
+  for (int attempt = 0; attempt < 10; ++attempt) {
+    if (OpenClipboard(g_mainWindow)) {
+      return true;
+    }
+    Sleep(10); // another process holds it
   }
+  return false;
+}
 
-  switch (action.type) {
-  case ActionType::Keys:
-    if (IsAltTabCombo(action.keys)) {
-      return HandleAltTab();
-    }
-    return SendKeyCombo(action.keys);
-  case ActionType::Run:
-    return RunCommand(action.payload);
-  case ActionType::Open:
-    return OpenTarget(action.payload);
-  case ActionType::Text:
-    return SendUnicodeText(action.payload);
-  case ActionType::Macro:
-    return ExecuteMacro(action.payload);
-  case ActionType::None:
-  default:
+HGLOBAL TextToGlobal(const std::wstring &text) {
+  const SIZE_T bytes = (text.size() + 1) * sizeof(wchar_t);
+  HGLOBAL mem = GlobalAlloc(GMEM_MOVEABLE, bytes);
+  if (!mem) {
+    return nullptr;
+  }
+  void *dst = GlobalLock(mem);
+  if (!dst) {
+    GlobalFree(mem);
+    return nullptr;
+  }
+  std::memcpy(dst, text.c_str(), bytes);
+  GlobalUnlock(mem);
+  return mem;
+}
+
+// Caller holds the clipboard open.
+bool SetClipboardText(const std::wstring &text) {
+  EmptyClipboard();
+  HGLOBAL mem = TextToGlobal(text);
+  if (!mem) {
     return false;
   }
+  if (!SetClipboardData(CF_UNICODETEXT, mem)) {
+    GlobalFree(mem);
+    return false;
+  }
+  return true;
 }
 
-std::string GetConfigPath() {
-  char buffer[MAX_PATH] = {};
-  GetModuleFileNameA(nullptr, buffer, MAX_PATH);
-  std::string exePath(buffer);
+struct SavedClipboardFormat {
+  UINT format = 0;
+  std::vector<BYTE> bytes;     // memory formats
+  HENHMETAFILE emf = nullptr;  // CF_ENHMETAFILE
+};
 
-  const auto slash = exePath.find_last_of("\\/");
-  const std::string dir =
-      (slash == std::string::npos) ? "." : exePath.substr(0, slash);
-  return dir + "\\mouse_remap.ini";
+bool HasFormat(const std::vector<SavedClipboardFormat> &saved, UINT format) {
+  return std::any_of(
+      saved.begin(), saved.end(),
+      [&](const SavedClipboardFormat &f) { return f.format == format; });
 }
 
-std::string GetExeDir() {
-  char buffer[MAX_PATH] = {};
-  GetModuleFileNameA(nullptr, buffer, MAX_PATH);
-  std::string exePath(buffer);
-  const auto slash = exePath.find_last_of("\\/");
-  return (slash == std::string::npos) ? "." : exePath.substr(0, slash);
+void FreeSavedClipboard(std::vector<SavedClipboardFormat> &saved) {
+  for (SavedClipboardFormat &f : saved) {
+    if (f.emf) {
+      DeleteEnhMetaFile(f.emf);
+    }
+  }
+  saved.clear();
 }
 
-std::string ToFileUrl(const std::string &path) {
-  std::string out = "file:///";
-  for (char c : path) {
-    if (c == '\\') {
-      out += '/';
-    } else if (c == ' ') {
-      out += "%20";
+// Caller holds the clipboard open. Copies every format so it can be put
+// back. CF_BITMAP, CF_PALETTE and CF_METAFILEPICT are skipped when Windows
+// can synthesize them again from a saved format. False when a format can
+// be neither copied nor synthesized (GDI handles, owner-display and
+// private formats, data the owner fails to render).
+bool SaveClipboard(std::vector<SavedClipboardFormat> &saved) {
+  std::vector<UINT> formats;
+  for (UINT f = EnumClipboardFormats(0); f; f = EnumClipboardFormats(f)) {
+    formats.push_back(f);
+  }
+  std::vector<UINT> synthesized;
+  for (UINT format : formats) {
+    if (format == CF_BITMAP || format == CF_PALETTE ||
+        format == CF_METAFILEPICT) {
+      synthesized.push_back(format);
+      continue;
+    }
+    if (format == CF_OWNERDISPLAY || format == CF_DSPBITMAP ||
+        format == CF_DSPMETAFILEPICT || format == CF_DSPENHMETAFILE ||
+        (format >= CF_PRIVATEFIRST && format <= CF_GDIOBJLAST)) {
+      FreeSavedClipboard(saved);
+      return false;
+    }
+    HANDLE data = GetClipboardData(format);
+    if (!data) {
+      FreeSavedClipboard(saved);
+      return false;
+    }
+    SavedClipboardFormat f;
+    f.format = format;
+    if (format == CF_ENHMETAFILE) {
+      f.emf = CopyEnhMetaFileA(static_cast<HENHMETAFILE>(data), nullptr);
+      if (!f.emf) {
+        FreeSavedClipboard(saved);
+        return false;
+      }
     } else {
-      out += c;
+      const SIZE_T size = GlobalSize(data);
+      const auto *src = static_cast<const BYTE *>(GlobalLock(data));
+      if (!src) {
+        FreeSavedClipboard(saved);
+        return false;
+      }
+      f.bytes.assign(src, src + size);
+      GlobalUnlock(data);
     }
+    saved.push_back(std::move(f));
   }
-  return out;
+  for (UINT format : synthesized) {
+    const bool fromDib = HasFormat(saved, CF_DIB) || HasFormat(saved, CF_DIBV5);
+    if (format == CF_METAFILEPICT ? !HasFormat(saved, CF_ENHMETAFILE)
+                                  : !fromDib) {
+      FreeSavedClipboard(saved);
+      return false;
+    }
+  }
+  return true;
 }
 
-std::string GetEdgePath() {
-  char path[MAX_PATH] = {};
-  DWORD size = sizeof(path);
-  if (RegGetValueA(
-          HKEY_LOCAL_MACHINE,
-          "SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\App Paths\\msedge.exe",
-          nullptr, RRF_RT_REG_SZ, nullptr, path, &size) == ERROR_SUCCESS) {
-    return std::string(path);
+// Caller holds the clipboard open. Hands |saved| back to the clipboard.
+void RestoreClipboard(std::vector<SavedClipboardFormat> &saved) {
+  EmptyClipboard();
+  for (SavedClipboardFormat &f : saved) {
+    if (f.emf) {
+      if (SetClipboardData(f.format, f.emf)) {
+        f.emf = nullptr; // owned by the clipboard now
+      }
+      continue;
+    }
+    HGLOBAL mem = GlobalAlloc(GMEM_MOVEABLE, f.bytes.size());
+    void *dst = mem ? GlobalLock(mem) : nullptr;
+    if (!dst) {
+      if (mem) {
+        GlobalFree(mem);
+      }
+      continue;
+    }
+    std::memcpy(dst, f.bytes.data(), f.bytes.size());
+    GlobalUnlock(mem);
+    if (!SetClipboardData(f.format, mem)) {
+      GlobalFree(mem);
+    }
   }
-  return "msedge.exe";
+  FreeSavedClipboard(saved);
 }
 
-void OpenStitchPage(const char *page) {
-  const std::string path = GetExeDir() + "\\ui\\" + page;
-  const std::string fileUrl = ToFileUrl(path);
-  const std::string edge = GetEdgePath();
-  const std::string args = "--app=\"" + fileUrl + "\" --window-size=440,900";
+// The text of a paste in progress. The main window owns the clipboard and
+// only renders the text when the target asks for it (WM_RENDERFORMAT), which
+// tells the paste that the previous contents can go back.
+struct ClipboardPaste {
+  std::mutex mutex;
+  std::condition_variable cv;
+  const std::wstring *text = nullptr;
+  bool rendered = false;
+  DWORD sequence = 0; // after the render
+};
 
-  HINSTANCE res = ShellExecuteA(nullptr, "open", edge.c_str(), args.c_str(),
-                                nullptr, SW_SHOWNORMAL);
-  if (reinterpret_cast<INT_PTR>(res) <= 32) {
-    // Fallback to default browser
-    ShellExecuteA(nullptr, "open", fileUrl.c_str(), nullptr, nullptr,
-                  SW_SHOWNORMAL);
+ClipboardPaste g_clipboardPaste;
+
+// Main thread, with the clipboard already open by whoever asked.
+void RenderPastedText() {
+  std::lock_guard<std::mutex> lock(g_clipboardPaste.mutex);
+  if (!g_clipboardPaste.text || g_clipboardPaste.rendered) {
+    return;
   }
+  HGLOBAL mem = TextToGlobal(*g_clipboardPaste.text);
+  if (mem && !SetClipboardData(CF_UNICODETEXT, mem)) {
+    GlobalFree(mem);
+  }
+  g_clipboardPaste.rendered = true;
+  g_clipboardPaste.sequence = GetClipboardSequenceNumber();
+  g_clipboardPaste.cv.notify_one();
 }
 
-std::string JsonEscape(const std::string &s) {
-  std::string out;
-  out.reserve(s.size() + 16);
-  for (char c : s) {
-    switch (c) {
-    case '\\':
-      out += "\\\\";
-      break;
-    case '"':
-      out += "\\\"";
-      break;
-    case '\n':
-      out += "\\n";
-      break;
-    case '\r':
-      out += "\\r";
-      break;
-    case '\t':
-      out += "\\t";
-      break;
-    default:
-      out += c;
-      break;
+enum class PasteResult { Sent, Failed, Unsupported };
+
+// Swaps |text| onto the clipboard, sends Ctrl+V and puts every previous
+// format back once the target has read it, unless something else wrote to
+// the clipboard in the meantime. The timeout only covers a target that never
+// reads; without a window to render from (the harnesses) the text goes on at
+// once and a fixed settle time stands in. Unsupported, with nothing touched,
+// when the clipboard holds data SaveClipboard cannot restore; the caller
+// then types the text.
+PasteResult PasteTextViaClipboard(const std::wstring &text,
+                                  SendInputFn send) {
+  if (!OpenClipboardWithRetry()) {
+    return PasteResult::Failed;
+  }
+  std::vector<SavedClipboardFormat> saved;
+  if (!SaveClipboard(saved)) {
+    CloseClipboard();
+    return PasteResult::Unsupported;
+  }
+  const bool delayed = g_mainWindow != nullptr;
+  bool placed = true;
+  if (delayed) {
+    {
+      std::lock_guard<std::mutex> lock(g_clipboardPaste.mutex);
+      g_clipboardPaste.text = &text;
+      g_clipboardPaste.rendered = false;
     }
+    EmptyClipboard();
+    SetClipboardData(CF_UNICODETEXT, nullptr); // rendered on request
+  } else {
+    placed = SetClipboardText(text);
   }
-  return out;
+  CloseClipboard();
+  if (!placed) {
+    if (OpenClipboardWithRetry()) {
+      RestoreClipboard(saved);
+      CloseClipboard();
+    }
+    FreeSavedClipboard(saved);
+    return PasteResult::Failed;
+  }
+  DWORD ours = GetClipboardSequenceNumber();
+
+  std::vector<INPUT> paste = BuildComboInputs({VK_CONTROL, 'V'});
+  const bool sent =
+      send(static_cast<UINT>(paste.size()), paste.data()) == paste.size();
+  {
+    std::unique_lock<std::mutex> lock(g_clipboardPaste.mutex);
+    g_clipboardPaste.cv.wait_for(
+        lock,
+        std::chrono::milliseconds(delayed ? kClipboardPasteTimeoutMs
+                                          : kClipboardSettleMs),
+        [] { return g_clipboardPaste.rendered; });
+    if (g_clipboardPaste.rendered) {
+      ours = g_clipboardPaste.sequence;
+    }
+    g_clipboardPaste.text = nullptr; // a late request gets nothing
+    g_clipboardPaste.rendered = false;
+  }
+  if (GetClipboardSequenceNumber() == ours && OpenClipboardWithRetry()) {
+    RestoreClipboard(saved);
+    CloseClipboard();
+  }
+  FreeSavedClipboard(saved);
+  return sent ? PasteResult::Sent : PasteResult::Failed;
 }
 
-void UpdatePollingRateWindow() {
-  const unsigned long long now = GetTickCount64();
-  const unsigned long long lastTick = g_lastRateWindowTick.load();
-  const unsigned long long count = g_rawInputEvents.load();
+std::thread g_textThread;
+std::mutex g_textMutex;
+std::condition_variable g_textCv;
+std::vector<std::wstring> g_textQueue; // guarded by g_textMutex
+bool g_textStop = false;               // guarded by g_textMutex
+std::atomic<unsigned long long> g_textJobs{0};
+std::atomic<unsigned long long> g_textClipboardJobs{0};
+std::atomic<unsigned long long> g_textClipboardSkipped{0};
+std::atomic<unsigned long long> g_textChars{0};
+std::atomic<unsigned long long> g_textDropped{0};
+std::atomic<unsigned long long> g_textFailures{0};
+std::atomic<unsigned long long> g_textCharsPerSec{0}; // last job
+
+bool InjectText(const std::wstring &text, SendInputFn send) {
+  const long long start = QpcNow();
+  bool ok = false;
+  PasteResult pasted = PasteResult::Unsupported;
+  if (ChooseTextStrategy(text) == TextStrategy::Clipboard) {
+    pasted = PasteTextViaClipboard(text, send);
+    if (pasted == PasteResult::Unsupported) {
+      g_textClipboardSkipped.fetch_add(1);
+    } else {
+      g_textClipboardJobs.fetch_add(1);
+      ok = pasted == PasteResult::Sent;
+    }
+  }
+  if (pasted == PasteResult::Unsupported) {
+    std::vector<size_t> groupEnds;
+    std::vector<INPUT> inputs = BuildUnicodeInputs(text, groupEnds);
+    ok = SubmitInputsPaced(inputs, groupEnds, send);
+  }
 
-  if (lastTick == 0) {
-    g_lastRateWindowTick.store(now);
-    g_lastRateWindowCount.store(count);
-    return;
+  g_textJobs.fetch_add(1);
+  g_textChars.fetch_add(text.size());
+  if (!ok) {
+    g_textFailures.fetch_add(1);
   }
+  const double ns = QpcToNs(QpcNow() - start);
+  if (ns > 0.0) {
+    g_textCharsPerSec.store(
+        static_cast<unsigned long long>(text.size() * 1e9 / ns));
+  }
+  return ok;
+}
 
-  if (now - lastTick >= 1000) {
-    const unsigned long long prevCount = g_lastRateWindowCount.load();
-    const unsigned long long delta =
-        (count >= prevCount) ? (count - prevCount) : 0;
-    g_pollRateHz.store(static_cast<unsigned int>(delta));
-    g_lastRateWindowTick.store(now);
-    g_lastRateWindowCount.store(count);
+// Called from the hook: only queues the text. A full queue drops the request
+// instead of letting the hook wait on the injector.
+bool QueueText(const std::string &text) {
+  std::wstring wide = Utf8ToWide(text);
+  if (wide.empty()) {
+    return false;
   }
+  {
+    std::lock_guard<std::mutex> lock(g_textMutex);
+    if (g_textQueue.size() >= kMaxQueuedTexts) {
+      g_textDropped.fetch_add(1);
+      return false;
+    }
+    g_textQueue.push_back(std::move(wide));
+  }
+  g_textCv.notify_one();
+  return true;
 }
 
-void UpdateMouseDeviceInfo(HANDLE hDevice) {
-  if (!hDevice) {
-    return;
+void TextThreadProc() {
+  ScopedServiceThread sched(kThreadText);
+  std::unique_lock<std::mutex> lock(g_textMutex);
+  for (;;) {
+    g_textCv.wait(lock, [] { return !g_textQueue.empty() || g_textStop; });
+    if (g_textStop) {
+      return;
+    }
+    std::wstring text = std::move(g_textQueue.front());
+    g_textQueue.erase(g_textQueue.begin());
+    lock.unlock();
+    InjectText(text, SystemSendInput);
+    lock.lock();
   }
+}
 
-  RID_DEVICE_INFO info = {};
-  info.cbSize = sizeof(info);
-  UINT size = sizeof(info);
-  if (GetRawInputDeviceInfoA(hDevice, RIDI_DEVICEINFO, &info, &size) ==
-      static_cast<UINT>(-1)) {
-    return;
+void StartTextInjector() {
+  g_textStop = false;
+  g_textThread = std::thread(TextThreadProc);
+}
+
+void StopTextInjector() {
+  {
+    std::lock_guard<std::mutex> lock(g_textMutex);
+    g_textStop = true;
   }
+  g_textCv.notify_one();
+  if (g_textThread.joinable()) {
+    g_textThread.join();
+  }
+}
 
-  if (info.dwType == RIM_TYPEMOUSE) {
-    g_mouseButtons.store(info.mouse.dwNumberOfButtons);
-    g_mouseSampleRate.store(info.mouse.dwSampleRate);
+// ---------------------------------------------------------------------------
+// Launcher: run:/open: actions are queued to a worker thread so a slow
+// CreateProcess or ShellExecute (shell extensions) never stalls the hook.
+// The queue, coalescing and reaping live in nexus_launch.h.
+// ---------------------------------------------------------------------------
+
+std::wstring FirstCommandToken(const std::wstring &commandLine) {
+  const size_t start = commandLine.find_first_not_of(L" \t");
+  if (start == std::wstring::npos) {
+    return L"";
+  }
+  if (commandLine[start] == L'"') {
+    const size_t end = commandLine.find(L'"', start + 1);
+    return commandLine.substr(start + 1, end == std::wstring::npos
+                                             ? std::wstring::npos
+                                             : end - start - 1);
   }
+  const size_t end = commandLine.find_first_of(L" \t", start);
+  return commandLine.substr(start, end == std::wstring::npos
+                                       ? std::wstring::npos
+                                       : end - start);
 }
 
-void UpdateTelemetryFromRawInput(const RAWINPUT *raw) {
-  if (!raw || raw->header.dwType != RIM_TYPEMOUSE) {
-    return;
+std::shared_ptr<const LaunchTarget> ResolveLaunchTarget(const Action &action) {
+  if (action.type != ActionType::Run && action.type != ActionType::Open) {
+    return nullptr;
+  }
+  auto target = std::make_shared<LaunchTarget>();
+  target->type = action.type;
+  target->commandLine = Utf8ToWide(action.payload);
+  if (target->commandLine.empty()) {
+    return nullptr;
   }
 
-  g_rawInputEvents.fetch_add(1);
-  UpdatePollingRateWindow();
-  UpdateMouseDeviceInfo(raw->header.hDevice);
+  if (action.type == ActionType::Run) {
+    // Resolve the image once so CreateProcessW skips its search-path walk.
+    const std::wstring exe = FirstCommandToken(target->commandLine);
+    wchar_t path[MAX_PATH] = {};
+    if (!exe.empty() &&
+        SearchPathW(nullptr, exe.c_str(), L".exe", MAX_PATH, path, nullptr) >
+            0) {
+      target->application = path;
+    }
+  }
+  return target;
 }
 
-std::string BuildStatusJson() {
-  std::ostringstream ss;
-  ss << "{";
-  ss << "\"poll_rate_hz\":" << g_pollRateHz.load() << ",";
-  ss << "\"mouse_buttons\":" << g_mouseButtons.load() << ",";
-  ss << "\"status\":\"active\",";
-  ss << "\"config_path\":\"" << JsonEscape(g_configPath) << "\"";
-  ss << "}";
-  return ss.str();
-}
+bool LaunchNow(const LaunchTarget &target, HANDLE &process) {
+  process = nullptr;
+  if (target.type == ActionType::Open) {
+    HINSTANCE res = ShellExecuteW(nullptr, L"open", target.commandLine.c_str(),
+                                  nullptr, nullptr, SW_SHOWNORMAL);
+    return reinterpret_cast<INT_PTR>(res) > 32;
+  }
 
-std::string BuildConfigJson() {
-  std::ostringstream ss;
-  ss << "{";
-  ss << "\"button4\":\"" << JsonEscape(ActionToConfigValue(g_config.button4))
-     << "\",";
-  ss << "\"button5\":\"" << JsonEscape(ActionToConfigValue(g_config.button5))
-     << "\",";
-  ss << "\"suspend_fullscreen\":"
-     << (g_config.suspendInFullscreen ? "true" : "false") << ",";
-  ss << "\"dpi\":" << g_config.dpi << ",";
-  ss << "\"launch_on_startup\":"
-     << (IsLaunchOnStartupEnabled() ? "true" : "false");
-  ss << "}";
-  return ss.str();
+  std::vector<wchar_t> mutableCmd(target.commandLine.begin(),
+                                  target.commandLine.end());
+  mutableCmd.push_back(L'\0');
+
+  STARTUPINFOW si = {};
+  si.cb = sizeof(si);
+  PROCESS_INFORMATION pi = {};
+
+  BOOL ok = CreateProcessW(
+      target.application.empty() ? nullptr : target.application.c_str(),
+      mutableCmd.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &si,
+      &pi);
+
+  if (!ok) {
+    return false;
+  }
+
+  if (pi.hThread) {
+    CloseHandle(pi.hThread);
+  }
+  process = pi.hProcess;
+  return true;
 }
 
-std::string JsonUnescape(const std::string &s) {
-  std::string out;
-  out.reserve(s.size());
-  bool esc = false;
-  for (char c : s) {
-    if (!esc) {
-      if (c == '\\') {
-        esc = true;
-      } else {
-        out.push_back(c);
+struct ShellLaunchBackend {
+  using Target = LaunchTarget;
+  using Process = HANDLE;
+
+  static std::wstring KeyOf(const LaunchTarget &t) {
+    return (t.type == ActionType::Open ? L"open:" : L"run:") + t.commandLine;
+  }
+  static bool Same(const LaunchTarget &a, const LaunchTarget &b) {
+    return a.type == b.type && a.commandLine == b.commandLine;
+  }
+  bool Launch(const LaunchTarget &t, HANDLE &child) {
+    return LaunchNow(t, child);
+  }
+  bool Exited(HANDLE child) {
+    if (WaitForSingleObject(child, 0) != WAIT_OBJECT_0) {
+      return false;
+    }
+    CloseHandle(child);
+    return true;
+  }
+  void Release(HANDLE child) { CloseHandle(child); }
+};
+
+std::thread g_launcherThread;
+nexus_launch::Launcher<ShellLaunchBackend> g_launcher;
+
+// Called from the hook: only queues the request. Targets are resolved when
+// the mapping tables are compiled (CompileAction); one that is missing is
+// not resolved here, where SearchPath could stall the hook.
+bool QueueLaunch(const Action &action) {
+  return nexus_launch::Queue(g_launcher, action.launch);
+}
+
+void LauncherThreadProc() {
+  ScopedServiceThread sched(kThreadLauncher);
+  // ShellExecute may hand off to COM-based shell extensions.
+  const HRESULT com = CoInitializeEx(
+      nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+  nexus_launch::Run(g_launcher);
+  if (SUCCEEDED(com)) {
+    CoUninitialize();
+  }
+}
+
+void StartLauncher() {
+  g_launcherThread = std::thread(LauncherThreadProc);
+}
+
+void StopLauncher() {
+  nexus_launch::Stop(g_launcher);
+  if (g_launcherThread.joinable()) {
+    g_launcherThread.join();
+  }
+}
+
+void SetLaunchOnStartup(bool enable) {
+  HKEY hKey;
+  const char *runKey = "Software\\Microsoft\\Windows\\CurrentVersion\\Run";
+  const char *appName = "NexusMouseRemapper";
+
+  if (RegOpenKeyExA(HKEY_CURRENT_USER, runKey, 0, KEY_SET_VALUE, &hKey) ==
+      ERROR_SUCCESS) {
+    if (enable) {
+      char path[MAX_PATH];
+      GetModuleFileNameA(nullptr, path, MAX_PATH);
+      
+      // Enclose path in quotes for Windows to handle spaces correctly
+      char quotedPath[MAX_PATH + 3];
+      sprintf(quotedPath, "\"%s\"", path);
+
+      RegSetValueExA(hKey, appName, 0, REG_SZ,
+                     reinterpret_cast<const BYTE *>(quotedPath),
+                     static_cast<DWORD>(strlen(quotedPath) + 1));
+    } else {
+      RegDeleteValueA(hKey, appName);
+    }
+    RegCloseKey(hKey);
+  }
+}
+
+bool IsLaunchOnStartupEnabled() {
+  HKEY hKey;
+  const char *runKey = "Software\\Microsoft\\Windows\\CurrentVersion\\Run";
+  const char *appName = "NexusMouseRemapper";
+  bool enabled = false;
+
+  if (RegOpenKeyExA(HKEY_CURRENT_USER, runKey, 0, KEY_QUERY_VALUE, &hKey) ==
+      ERROR_SUCCESS) {
+    if (RegQueryValueExA(hKey, appName, nullptr, nullptr, nullptr, nullptr) ==
+        ERROR_SUCCESS) {
+      enabled = true;
+    }
+    RegCloseKey(hKey);
+  }
+  return enabled;
+}
+
+// ---------------------------------------------------------------------------
+// Macro VM: macro: payloads compile to bytecode that runs on a dedicated
+// interpreter thread. Waits block on an event, so a release or another button
+// press preempts playback immediately instead of after the current delay.
+//
+//   A:D, A:U, A / A:P    key down / up / press
+//   50, 20-80            delay in ms / random delay in a range
+//   REPEAT:n ... END     repeat the block n times
+//   WHILEHELD ... END    loop while the trigger button is held
+//   IF:key / IFNOT:key ... END   run the block if key is (not) held
+//   LABEL:name, GOTO:name
+//   SET:var=n, ADD:var=n, JNZ:var:label
+//
+// The flat VK:STATE,DELAY format is a subset. Inside a block, write END:P
+// to press the End key.
+// ---------------------------------------------------------------------------
+
+constexpr size_t kMacroSlots = 32; // user variables plus REPEAT counters
+constexpr DWORD kMacroPressMs = 10;
+constexpr unsigned kMacroOpsPerYield = 4096; // bounds loops without delays
+
+bool ParseMacroDelay(const std::string &token, int32_t &lo, int32_t &hi) {
+  const auto dash = token.find('-');
+  lo = std::atoi(token.c_str());
+  hi = (dash == std::string::npos) ? lo
+                                   : std::atoi(token.c_str() + dash + 1);
+  return lo >= 0 && hi >= lo;
+}
+
+bool CompileMacro(const std::string &payload, std::vector<MacroOp> &ops,
+                  std::string *error = nullptr) {
+  struct Block {
+    enum Kind { Repeat, WhileHeld, If } kind;
+    size_t pc; // Repeat: body start, WhileHeld/If: the conditional jump
+    WORD slot;
+  };
+  std::vector<Block> blocks;
+  std::vector<std::string> slotNames;
+  std::unordered_map<std::string, int32_t> labels;
+  std::vector<std::pair<size_t, std::string>> fixups;
+  uint32_t heldLoop = 0;
+  ops.clear();
+
+  auto fail = [&](const std::string &what) {
+    if (error) {
+      *error = what;
+    }
+    ops.clear();
+    return false;
+  };
+  auto slotFor = [&](const std::string &name, WORD &slot) {
+    auto it = std::find(slotNames.begin(), slotNames.end(), name);
+    if (it == slotNames.end()) {
+      if (slotNames.size() >= kMacroSlots) {
+        return false;
       }
+      it = slotNames.insert(slotNames.end(), name);
+    }
+    slot = static_cast<WORD>(it - slotNames.begin());
+    return true;
+  };
+  auto emit = [&](MacroOpCode code, WORD arg = 0, int32_t a = 0,
+                  int32_t b = 0) {
+    MacroOp op;
+    op.code = code;
+    op.arg = arg;
+    op.a = a;
+    op.b = b;
+    op.loop = heldLoop;
+    ops.push_back(op);
+    return ops.size() - 1;
+  };
+
+  for (const std::string &raw : Split(payload, ',')) {
+    const std::string token = Trim(raw);
+    if (token.empty()) {
       continue;
     }
+    const std::string upper = ToUpper(token);
+    const auto colon = token.find(':');
+    const std::string head = upper.substr(0, colon);
+    const std::string arg =
+        (colon == std::string::npos) ? "" : Trim(token.substr(colon + 1));
+
+    // A bare number is a delay; 7:D is the 7 key.
+    if (colon == std::string::npos &&
+        std::isdigit(static_cast<unsigned char>(token[0]))) {
+      int32_t lo = 0;
+      int32_t hi = 0;
+      if (!ParseMacroDelay(token, lo, hi)) {
+        return fail("invalid delay '" + token + "'");
+      }
+      emit(MacroOpCode::Delay, 0, lo, hi);
+    } else if (upper == "END" && !blocks.empty()) {
+      const Block block = blocks.back();
+      blocks.pop_back();
+      if (block.kind == Block::Repeat) {
+        emit(MacroOpCode::LoopVar, block.slot,
+             static_cast<int32_t>(block.pc));
+      } else if (block.kind == Block::WhileHeld) {
+        heldLoop = ops[block.pc].loop;
+        emit(MacroOpCode::Jump, 0, static_cast<int32_t>(block.pc));
+        ops[block.pc].a = static_cast<int32_t>(ops.size());
+      } else {
+        ops[block.pc].a = static_cast<int32_t>(ops.size());
+      }
+    } else if (head == "REPEAT" && colon != std::string::npos) {
+      const int count = std::atoi(arg.c_str());
+      WORD slot = 0;
+      if (count < 1 || !slotFor("#repeat" + std::to_string(ops.size()), slot)) {
+        return fail("invalid REPEAT '" + token + "'");
+      }
+      emit(MacroOpCode::SetVar, slot, count);
+      blocks.push_back({Block::Repeat, ops.size(), slot});
+    } else if (upper == "WHILEHELD") {
+      const size_t check = emit(MacroOpCode::JumpIfReleased);
+      heldLoop = static_cast<uint32_t>(check + 1);
+      blocks.push_back({Block::WhileHeld, check, 0});
+    } else if ((head == "IF" || head == "IFNOT") && colon != std::string::npos) {
+      const WORD vk = KeyNameToVk(arg);
+      if (vk == 0) {
+        return fail("unknown key '" + arg + "'");
+      }
+      blocks.push_back({Block::If,
+                        emit(head == "IF" ? MacroOpCode::JumpIfKeyUp
+                                          : MacroOpCode::JumpIfKeyDown,
+                             vk),
+                        0});
+    } else if (head == "LABEL" && !arg.empty()) {
+      if (!labels.emplace(ToUpper(arg), static_cast<int32_t>(ops.size()))
+               .second) {
+        return fail("duplicate label '" + arg + "'");
+      }
+    } else if (head == "GOTO" && !arg.empty()) {
+      fixups.emplace_back(emit(MacroOpCode::Jump), ToUpper(arg));
+    } else if ((head == "SET" || head == "ADD") && arg.find('=') != 0 &&
+               arg.find('=') != std::string::npos) {
+      const auto eq = arg.find('=');
+      WORD slot = 0;
+      if (!slotFor(ToUpper(Trim(arg.substr(0, eq))), slot)) {
+        return fail("too many variables");
+      }
+      emit(head == "SET" ? MacroOpCode::SetVar : MacroOpCode::AddVar, slot,
+           std::atoi(arg.c_str() + eq + 1));
+    } else if (head == "JNZ" && arg.find(':') != std::string::npos) {
+      const auto sep = arg.find(':');
+      WORD slot = 0;
+      if (!slotFor(ToUpper(Trim(arg.substr(0, sep))), slot)) {
+        return fail("too many variables");
+      }
+      fixups.emplace_back(emit(MacroOpCode::JumpIfNonZero, slot),
+                          ToUpper(Trim(arg.substr(sep + 1))));
+    } else {
+      const WORD vk = KeyNameToVk(token.substr(0, colon));
+      const char state = arg.empty() ? 'P' : ToUpper(arg)[0];
+      if (vk == 0 || (state != 'D' && state != 'U' && state != 'P')) {
+        return fail("invalid step '" + token + "'");
+      }
+      ops[emit(MacroOpCode::Key, vk)].state = state;
+    }
+  }
 
-    switch (c) {
-    case '\\':
-      out.push_back('\\');
+  if (!blocks.empty()) {
+    return fail("missing END");
+  }
+  for (const auto &fixup : fixups) {
+    auto it = labels.find(fixup.second);
+    if (it == labels.end()) {
+      return fail("unknown label '" + fixup.second + "'");
+    }
+    ops[fixup.first].a = it->second;
+  }
+  if (ops.empty()) {
+    return fail("empty macro");
+  }
+  emit(MacroOpCode::Halt);
+  return true;
+}
+
+// Structural check for bytecode loaded from the config cache.
+bool ValidateMacroProgram(const std::vector<MacroOp> &ops) {
+  for (const MacroOp &op : ops) {
+    const bool jumps = (op.code >= MacroOpCode::Jump &&
+                        op.code <= MacroOpCode::JumpIfKeyDown) ||
+                       op.code == MacroOpCode::LoopVar ||
+                       op.code == MacroOpCode::JumpIfNonZero;
+    const bool usesSlot = op.code >= MacroOpCode::SetVar &&
+                          op.code <= MacroOpCode::JumpIfNonZero;
+    if (op.code > MacroOpCode::Halt || op.loop > ops.size() ||
+        (jumps && (op.a < 0 || static_cast<size_t>(op.a) > ops.size())) ||
+        (usesSlot && op.arg >= kMacroSlots) ||
+        (op.code == MacroOpCode::Delay && (op.a < 0 || op.b < op.a))) {
+      return false;
+    }
+  }
+  return ops.empty() || ops.back().code == MacroOpCode::Halt;
+}
+
+enum class MacroWaitResult { Elapsed, Released, Cancelled };
+
+// Everything the interpreter touches outside its own state, so benchmarks
+// can run it against a sink.
+struct MacroHost {
+  SendInputFn send;
+  MacroWaitResult (*wait)(DWORD ms, bool heldScope);
+  bool (*keyDown)(WORD vk);
+  bool (*triggerHeld)();
+};
+
+// Returns false if playback was cancelled. Cancellation is observed at
+// waits, which loops without delays hit every kMacroOpsPerYield ops. Keys
+// left down by D steps are released before returning.
+bool RunMacroProgram(const std::vector<MacroOp> &ops, const MacroHost &host,
+                     unsigned long long &executed) {
+  int32_t vars[kMacroSlots] = {};
+  std::vector<WORD> down;
+  uint32_t rng = static_cast<uint32_t>(QpcNow()) | 1u;
+  unsigned sinceWait = 0;
+  bool ok = true;
+  size_t pc = 0;
+
+  auto sendKey = [&](WORD vk, bool up) {
+    INPUT in = MakeKeyInput(vk, up);
+    host.send(1, &in);
+  };
+
+  while (pc < ops.size()) {
+    const MacroOp &op = ops[pc++];
+    ++executed;
+    MacroWaitResult wait = MacroWaitResult::Elapsed;
+    switch (op.code) {
+    case MacroOpCode::Key:
+      if (op.state != 'U') {
+        sendKey(op.arg, false);
+      }
+      if (op.state == 'P') {
+        wait = host.wait(kMacroPressMs, op.loop != 0);
+      }
+      if (op.state != 'D') {
+        sendKey(op.arg, true);
+        down.erase(std::remove(down.begin(), down.end(), op.arg), down.end());
+      } else if (std::find(down.begin(), down.end(), op.arg) == down.end()) {
+        down.push_back(op.arg);
+      }
       break;
-    case '"':
-      out.push_back('"');
+    case MacroOpCode::Delay: {
+      DWORD ms = static_cast<DWORD>(op.a);
+      if (op.b > op.a) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        ms += rng % static_cast<uint32_t>(op.b - op.a + 1);
+      }
+      wait = host.wait(ms, op.loop != 0);
+      sinceWait = 0;
       break;
-    case 'n':
-      out.push_back('\n');
+    }
+    case MacroOpCode::Jump:
+      pc = op.a;
       break;
-    case 'r':
-      out.push_back('\r');
+    case MacroOpCode::JumpIfReleased:
+      if (!host.triggerHeld()) {
+        pc = op.a;
+      }
       break;
-    case 't':
-      out.push_back('\t');
+    case MacroOpCode::JumpIfKeyUp:
+      if (!host.keyDown(op.arg)) {
+        pc = op.a;
+      }
       break;
-    default:
-      out.push_back(c);
+    case MacroOpCode::JumpIfKeyDown:
+      if (host.keyDown(op.arg)) {
+        pc = op.a;
+      }
+      break;
+    case MacroOpCode::SetVar:
+      vars[op.arg] = op.a;
+      break;
+    case MacroOpCode::AddVar:
+      vars[op.arg] += op.a;
+      break;
+    case MacroOpCode::LoopVar:
+      if (--vars[op.arg] > 0) {
+        pc = op.a;
+      }
+      break;
+    case MacroOpCode::JumpIfNonZero:
+      if (vars[op.arg] != 0) {
+        pc = op.a;
+      }
+      break;
+    case MacroOpCode::Halt:
+      pc = ops.size();
       break;
     }
-    esc = false;
+
+    if (wait == MacroWaitResult::Elapsed && ++sinceWait >= kMacroOpsPerYield) {
+      sinceWait = 0;
+      wait = host.wait(0, op.loop != 0);
+    }
+    if (wait == MacroWaitResult::Cancelled) {
+      ok = false;
+      break;
+    }
+    if (wait == MacroWaitResult::Released) {
+      pc = op.loop - 1; // the loop check sees the release and exits
+    }
   }
-  return out;
+
+  if (!down.empty()) {
+    std::vector<INPUT> ups;
+    for (auto it = down.rbegin(); it != down.rend(); ++it) {
+      ups.push_back(MakeKeyInput(*it, true));
+    }
+    host.send(static_cast<UINT>(ups.size()), ups.data());
+  }
+  return ok;
 }
 
-bool ExtractJsonString(const std::string &body, const std::string &key,
-                       std::string &out) {
-  const std::string needle = "\"" + key + "\"";
-  const size_t k = body.find(needle);
-  if (k == std::string::npos) {
-    return false;
+// ---------------------------------------------------------------------------
+// Macro library: recorded macros kept outside the INI as delta-encoded event
+// streams in macros.nxm, memory-mapped read-only at startup. A binding refers
+// to an entry with macro:@<id>; the macro thread decodes the entry into
+// bytecode when it starts playing, so neither the hook nor the parsed config
+// holds the event data.
+//
+//   header | entries sorted by id | event streams
+//   event = varint(ms since previous event) varint(vk << 2 | state)
+//   state 0 = down, 1 = up, 2 = press; vk 0 carries a trailing delay
+// ---------------------------------------------------------------------------
+
+constexpr uint32_t kMacroLibraryMagic = 0x4C4D584E; // "NXML"
+constexpr uint32_t kMacroLibraryVersion = 1;
+
+struct MacroLibraryHeader {
+  uint32_t magic = kMacroLibraryMagic;
+  uint32_t version = kMacroLibraryVersion;
+  uint32_t count = 0;
+  uint32_t reserved = 0;
+};
+
+struct MacroLibraryEntry {
+  uint32_t id = 0;
+  uint32_t offset = 0; // from the start of the file
+  uint32_t size = 0;
+  uint32_t events = 0;
+};
+
+void PutVarint(std::string &out, uint32_t v) {
+  while (v >= 0x80) {
+    out += static_cast<char>((v & 0x7F) | 0x80);
+    v >>= 7;
   }
-  size_t colon = body.find(':', k + needle.size());
-  if (colon == std::string::npos) {
-    return false;
+  out += static_cast<char>(v);
+}
+
+bool GetVarint(const uint8_t *&p, const uint8_t *end, uint32_t &v) {
+  v = 0;
+  for (int shift = 0; shift < 35 && p < end; shift += 7) {
+    const uint8_t byte = *p++;
+    v |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
   }
-  size_t q1 = body.find('"', colon + 1);
-  if (q1 == std::string::npos) {
-    return false;
+  return false;
+}
+
+// Returns 0 unless |payload| is a library reference such as "@12".
+uint32_t LibraryMacroId(const std::string &payload) {
+  if (payload.size() < 2 || payload.size() > 10 || payload[0] != '@' ||
+      payload.find_first_not_of("0123456789", 1) != std::string::npos) {
+    return 0;
   }
-  size_t i = q1 + 1;
-  bool esc = false;
-  for (; i < body.size(); ++i) {
-    char c = body[i];
-    if (esc) {
-      esc = false;
+  return static_cast<uint32_t>(std::strtoul(payload.c_str() + 1, nullptr, 10));
+}
+
+// Only flat programs (keys and fixed delays) fit the event format; blocks,
+// jumps and random delays stay inline in the INI.
+bool EncodeLibraryMacro(const std::vector<MacroOp> &ops, std::string &out,
+                        uint32_t &events) {
+  uint32_t delay = 0;
+  events = 0;
+  for (const MacroOp &op : ops) {
+    switch (op.code) {
+    case MacroOpCode::Delay:
+      if (op.a != op.b) {
+        return false;
+      }
+      delay += static_cast<uint32_t>(op.a);
+      break;
+    case MacroOpCode::Key:
+      PutVarint(out, delay);
+      PutVarint(out, (static_cast<uint32_t>(op.arg) << 2) |
+                         (op.state == 'D' ? 0u : op.state == 'U' ? 1u : 2u));
+      delay = 0;
+      ++events;
+      break;
+    case MacroOpCode::Halt:
+      break;
+    default:
+      return false;
+    }
+  }
+  if (delay > 0) {
+    PutVarint(out, delay);
+    PutVarint(out, 0);
+    ++events;
+  }
+  return true;
+}
+
+bool DecodeLibraryMacro(const uint8_t *p, size_t size,
+                        std::vector<MacroOp> &ops) {
+  const uint8_t *end = p + size;
+  ops.clear();
+  while (p < end) {
+    uint32_t delay = 0;
+    uint32_t key = 0;
+    if (!GetVarint(p, end, delay) || !GetVarint(p, end, key) ||
+        delay > 0x7FFFFFFF || (key & 3) == 3 || (key >> 2) > 0xFF) {
+      ops.clear();
+      return false;
+    }
+    if (delay > 0) {
+      MacroOp op;
+      op.code = MacroOpCode::Delay;
+      op.a = op.b = static_cast<int32_t>(delay);
+      ops.push_back(op);
+    }
+    if (key >> 2) {
+      MacroOp op;
+      op.code = MacroOpCode::Key;
+      op.arg = static_cast<WORD>(key >> 2);
+      op.state = "DUP"[key & 3];
+      ops.push_back(op);
+    }
+  }
+  ops.push_back(MacroOp{}); // Halt
+  return true;
+}
+
+struct MacroLibrary {
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+  const uint8_t *view = nullptr;
+  size_t size = 0;
+  const MacroLibraryEntry *entries = nullptr;
+  uint32_t count = 0;
+
+  MacroLibrary() = default;
+  MacroLibrary(const MacroLibrary &) = delete;
+  MacroLibrary &operator=(const MacroLibrary &) = delete;
+  ~MacroLibrary() {
+    if (view) {
+      UnmapViewOfFile(view);
+    }
+    if (mapping) {
+      CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+      CloseHandle(file);
+    }
+  }
+
+  const MacroLibraryEntry *Find(uint32_t id) const {
+    const MacroLibraryEntry *last = entries + count;
+    const MacroLibraryEntry *it = std::lower_bound(
+        entries, last, id,
+        [](const MacroLibraryEntry &e, uint32_t v) { return e.id < v; });
+    return (it != last && it->id == id) ? it : nullptr;
+  }
+};
+
+// Validates the header and index only; event streams are checked when they
+// are decoded for playback.
+std::unique_ptr<MacroLibrary> OpenMacroLibrary(const std::string &path) {
+  auto lib = std::make_unique<MacroLibrary>();
+  lib->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  LARGE_INTEGER size = {};
+  if (lib->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(lib->file, &size) ||
+      size.QuadPart < static_cast<LONGLONG>(sizeof(MacroLibraryHeader)) ||
+      size.QuadPart > 0x7FFFFFFF) {
+    return nullptr;
+  }
+  lib->mapping =
+      CreateFileMappingA(lib->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!lib->mapping) {
+    return nullptr;
+  }
+  lib->view = static_cast<const uint8_t *>(
+      MapViewOfFile(lib->mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!lib->view) {
+    return nullptr;
+  }
+  lib->size = static_cast<size_t>(size.QuadPart);
+
+  MacroLibraryHeader header;
+  std::memcpy(&header, lib->view, sizeof(header));
+  const size_t indexEnd = sizeof(header) +
+                          static_cast<size_t>(header.count) *
+                              sizeof(MacroLibraryEntry);
+  if (header.magic != kMacroLibraryMagic ||
+      header.version != kMacroLibraryVersion || indexEnd > lib->size) {
+    return nullptr;
+  }
+  lib->entries =
+      reinterpret_cast<const MacroLibraryEntry *>(lib->view + sizeof(header));
+  lib->count = header.count;
+  for (uint32_t i = 0; i < lib->count; ++i) {
+    const MacroLibraryEntry &e = lib->entries[i];
+    if (e.id == 0 || (i > 0 && e.id <= lib->entries[i - 1].id) ||
+        e.offset < indexEnd || e.offset > lib->size ||
+        e.size > lib->size - e.offset) {
+      return nullptr;
+    }
+  }
+  return lib;
+}
+
+std::atomic<const MacroLibrary *> g_macroLibrary{nullptr};
+std::atomic<unsigned long long> g_macroLibraryLoadUs{0};
+std::atomic<unsigned long long> g_macroLibraryMisses{0};
+
+std::string GetMacroLibraryPath() { return GetExeDir() + "\\macros.nxm"; }
+
+// A missing or invalid file leaves an empty library; @<id> bindings then
+// count as misses when triggered.
+void LoadMacroLibrary(const std::string &path) {
+  const long long start = QpcNow();
+  const MacroLibrary *next = OpenMacroLibrary(path).release();
+  g_macroLibraryLoadUs.store(
+      static_cast<unsigned long long>(QpcToNs(QpcNow() - start) / 1000.0));
+  if (const MacroLibrary *old = g_macroLibrary.exchange(next)) {
+    RetireSnapshot(std::shared_ptr<const void>(old));
+  }
+}
+
+bool DecodeLibraryMacro(uint32_t id, std::vector<MacroOp> &ops) {
+  const MacroLibrary *lib = g_macroLibrary.load();
+  const MacroLibraryEntry *entry = lib ? lib->Find(id) : nullptr;
+  return entry &&
+         DecodeLibraryMacro(lib->view + entry->offset, entry->size, ops);
+}
+
+std::thread g_macroThread;
+std::mutex g_macroMutex;
+std::condition_variable g_macroCv;
+std::shared_ptr<const std::vector<MacroOp>> g_macroPending; // g_macroMutex
+uint32_t g_macroPendingLibraryId = 0; // guarded by g_macroMutex
+int g_macroPendingButton = 0;   // guarded by g_macroMutex
+bool g_macroPendingHeld = false; // guarded by g_macroMutex
+long long g_macroPendingQpc = 0; // guarded by g_macroMutex
+bool g_macroStop = false;       // guarded by g_macroMutex
+HANDLE g_macroWake = nullptr;   // auto-reset; set on cancel and release
+std::atomic<unsigned> g_macroGeneration{0}; // bumped to cancel playback
+std::atomic<unsigned> g_macroRunningGeneration{0};
+// Macros fired by the wheel have no button to release or press again.
+constexpr int kMacroWheelButton = -1;
+
+std::atomic<bool> g_macroRunning{false};
+std::atomic<int> g_macroButton{0}; // side button that started it, if any
+std::atomic<bool> g_macroHeld{false};
+std::atomic<unsigned long long> g_macroRuns{0};
+std::atomic<unsigned long long> g_macroCancels{0};
+std::atomic<unsigned long long> g_macroOps{0};
+
+bool MacroCancelled() {
+  return g_macroGeneration.load() != g_macroRunningGeneration.load();
+}
+
+MacroWaitResult WaitMacro(DWORD ms, bool heldScope) {
+  const long long deadline = QpcNow() + ms * QpcTicksPerMs();
+  for (;;) {
+    if (MacroCancelled()) {
+      return MacroWaitResult::Cancelled;
+    }
+    if (heldScope && !g_macroHeld.load()) {
+      return MacroWaitResult::Released;
+    }
+    const long long left = deadline - QpcNow();
+    if (left <= 0) {
+      return MacroWaitResult::Elapsed;
+    }
+    WaitForSingleObject(g_macroWake,
+                        static_cast<DWORD>(QpcToNs(left) / 1e6) + 1);
+  }
+}
+
+bool MacroKeyDown(WORD vk) { return (GetAsyncKeyState(vk) & 0x8000) != 0; }
+bool MacroTriggerHeld() { return g_macroHeld.load(); }
+
+void MacroThreadProc() {
+  ScopedServiceThread sched(kThreadMacro);
+  const MacroHost host = {SystemSendInput, WaitMacro, MacroKeyDown,
+                          MacroTriggerHeld};
+  std::unique_lock<std::mutex> lock(g_macroMutex);
+  for (;;) {
+    g_macroCv.wait(lock, [] {
+      return g_macroPending || g_macroPendingLibraryId || g_macroStop;
+    });
+    if (g_macroStop) {
+      return;
+    }
+    std::shared_ptr<const std::vector<MacroOp>> program =
+        std::move(g_macroPending);
+    const uint32_t libraryId = g_macroPendingLibraryId;
+    g_macroPendingLibraryId = 0;
+    if (g_telemetryDetailed.load(std::memory_order_relaxed)) {
+      RecordHistogram(g_macroWakeHist,
+                      QpcToNs(QpcNow() - g_macroPendingQpc) / 1000.0);
+    }
+    g_macroButton.store(g_macroPendingButton);
+    g_macroHeld.store(g_macroPendingHeld);
+    g_macroRunning.store(true);
+    g_macroRunningGeneration.store(g_macroGeneration.load());
+    lock.unlock();
+
+    std::vector<MacroOp> decoded;
+    if (!program && !DecodeLibraryMacro(libraryId, decoded)) {
+      g_macroLibraryMisses.fetch_add(1);
+      g_macroRunning.store(false);
+      g_macroButton.store(0);
+      lock.lock();
       continue;
     }
-    if (c == '\\') {
-      esc = true;
+    unsigned long long executed = 0;
+    g_macroRuns.fetch_add(1);
+    RunMacroProgram(program ? *program : decoded, host, executed);
+    g_macroOps.fetch_add(executed);
+    g_macroRunning.store(false);
+    g_macroButton.store(0);
+    lock.lock();
+  }
+}
+
+// Hook thread: replaces whatever is playing with |action|'s program.
+// |button| is the side button it came from, kMacroWheelButton or 0; |held|
+// when that button is still down, which is what WHILEHELD loops on.
+bool StartMacro(const Action &action, int button, bool held) {
+  const uint32_t libraryId = action.macro ? 0 : LibraryMacroId(action.payload);
+  if (!action.macro && libraryId == 0) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(g_macroMutex);
+    g_macroPending = action.macro;
+    g_macroPendingLibraryId = libraryId;
+    g_macroPendingButton = button;
+    g_macroPendingHeld = held;
+    g_macroPendingQpc = QpcNow();
+    g_macroHeld.store(held);
+    g_macroGeneration.fetch_add(1);
+  }
+  SetEvent(g_macroWake);
+  g_macroCv.notify_one();
+  return true;
+}
+
+// Hook thread: any side-button press preempts a running macro. Returns
+// true when |button| started it, so pressing it again only stops playback.
+bool CancelMacro(int button) {
+  if (!g_macroRunning.load()) {
+    return false;
+  }
+  const int running = g_macroButton.load();
+  g_macroGeneration.fetch_add(1);
+  g_macroCancels.fetch_add(1);
+  SetEvent(g_macroWake);
+  return running == button;
+}
+
+// Under the mutex so that a release just before the macro thread picks up
+// the program is not lost.
+void MacroTriggerReleased(int button) {
+  std::lock_guard<std::mutex> lock(g_macroMutex);
+  if (g_macroPendingButton == button) {
+    g_macroPendingHeld = false;
+  }
+  if (g_macroButton.load() == button) {
+    g_macroHeld.store(false);
+    SetEvent(g_macroWake);
+  }
+}
+
+void StartMacroThread() {
+  g_macroWake = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+  g_macroStop = false;
+  g_macroThread = std::thread(MacroThreadProc);
+}
+
+void StopMacroThread() {
+  {
+    std::lock_guard<std::mutex> lock(g_macroMutex);
+    g_macroStop = true;
+    g_macroGeneration.fetch_add(1);
+  }
+  SetEvent(g_macroWake);
+  g_macroCv.notify_one();
+  if (g_macroThread.joinable()) {
+    g_macroThread.join();
+  }
+  if (g_macroWake) {
+    CloseHandle(g_macroWake);
+    g_macroWake = nullptr;
+  }
+}
+
+// |button| and |held| are passed on to macros, see StartMacro.
+bool ExecuteAction(const Action &action, int button, bool held) {
+  // If doing non-alt-tab action, release Alt if it was stuck
+  if (InjectedKeyDown(VK_MENU) &&
+      (action.type != ActionType::Keys || !IsAltTabCombo(action.keys))) {
+    ReleaseStickyAlt();
+  }
+
+  switch (action.type) {
+  case ActionType::Keys:
+    if (IsAltTabCombo(action.keys)) {
+      return HandleAltTab();
+    }
+    return action.inputs.empty() ? SendKeyCombo(action.keys)
+                                 : SendInputs(action.inputs);
+  case ActionType::Run:
+  case ActionType::Open:
+    return QueueLaunch(action);
+  case ActionType::Text:
+    return QueueText(action.payload);
+  case ActionType::Macro:
+    return StartMacro(action, button, held);
+  case ActionType::Dpi:
+    return StepDpiPreset(action.payload);
+  case ActionType::DpiShift:
+    return false; // press/release handled by the mouse hook
+  case ActionType::None:
+  default:
+    return false;
+  }
+}
+
+std::string GetConfigPath() {
+  char buffer[MAX_PATH] = {};
+  GetModuleFileNameA(nullptr, buffer, MAX_PATH);
+  std::string exePath(buffer);
+
+  const auto slash = exePath.find_last_of("\\/");
+  const std::string dir =
+      (slash == std::string::npos) ? "." : exePath.substr(0, slash);
+  return dir + "\\mouse_remap.ini";
+}
+
+std::string GetExeDir() {
+  char buffer[MAX_PATH] = {};
+  GetModuleFileNameA(nullptr, buffer, MAX_PATH);
+  std::string exePath(buffer);
+  const auto slash = exePath.find_last_of("\\/");
+  return (slash == std::string::npos) ? "." : exePath.substr(0, slash);
+}
+
+std::string GetEdgePath() {
+  char path[MAX_PATH] = {};
+  DWORD size = sizeof(path);
+  if (RegGetValueA(
+          HKEY_LOCAL_MACHINE,
+          "SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\App Paths\\msedge.exe",
+          nullptr, RRF_RT_REG_SZ, nullptr, path, &size) == ERROR_SUCCESS) {
+    return std::string(path);
+  }
+  return "msedge.exe";
+}
+
+void OpenStitchPage(const char *page) {
+  const std::string url = UiPageUrl(page);
+  const std::string edge = GetEdgePath();
+  const std::string args = "--app=\"" + url + "\" --window-size=440,900";
+
+  HINSTANCE res = ShellExecuteA(nullptr, "open", edge.c_str(), args.c_str(),
+                                nullptr, SW_SHOWNORMAL);
+  if (reinterpret_cast<INT_PTR>(res) <= 32) {
+    // Fallback to default browser
+    ShellExecuteA(nullptr, "open", url.c_str(), nullptr, nullptr,
+                  SW_SHOWNORMAL);
+  }
+}
+
+std::string JsonEscape(const std::string &s) {
+  std::string out;
+  out.reserve(s.size() + 16);
+  for (char c : s) {
+    switch (c) {
+    case '\\':
+      out += "\\\\";
+      break;
+    case '"':
+      out += "\\\"";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      out += c;
+      break;
+    }
+  }
+  return out;
+}
+
+// ---------------------------------------------------------------------------
+// Gestures: while a button with gesture bindings is held, raw motion is
+// quantized into a stroke of up to four up/down/left/right segments. Each
+// packet only updates an accumulator; a segment is appended once travel
+// along one axis reaches the distance threshold and is at least twice the
+// travel along the other, so diagonal jitter never adds segments. A
+// one-segment stroke released within the flick window is a flick.
+// ---------------------------------------------------------------------------
+
+enum GestureDir : uint16_t {
+  kGestureUp,
+  kGestureDown,
+  kGestureLeft,
+  kGestureRight
+};
+
+constexpr size_t kMaxGestureSegments = 4;
+constexpr uint16_t kGestureFlick = 1u << 11;
+constexpr uint16_t kGestureTooLong = 7u << 8; // never matches a binding
+
+// Stroke code: 2-bit directions in bits 0-7, segment count in bits 8-10.
+uint16_t GestureSegments(uint16_t stroke) { return (stroke >> 8) & 7; }
+
+uint16_t GestureDirAt(uint16_t stroke, size_t i) {
+  return (stroke >> (2 * i)) & 3;
+}
+
+uint16_t AppendGestureDir(uint16_t stroke, uint16_t dir) {
+  const uint16_t count = GestureSegments(stroke);
+  if (count >= kMaxGestureSegments) {
+    return kGestureTooLong;
+  }
+  return static_cast<uint16_t>((stroke & 0xFF) | (dir << (2 * count)) |
+                               ((count + 1) << 8));
+}
+
+// "up", "down-right", "l-u-r", "flick-left"; |upper| is upper-cased.
+bool ParseGestureStroke(const std::string &upper, uint16_t &stroke) {
+  stroke = 0;
+  bool flick = false;
+  for (const std::string &part : Split(upper, '-')) {
+    const std::string t = Trim(part);
+    uint16_t dir = 0;
+    if (t == "FLICK" && stroke == 0 && !flick) {
+      flick = true;
+      continue;
+    } else if (t == "U" || t == "UP") {
+      dir = kGestureUp;
+    } else if (t == "D" || t == "DOWN") {
+      dir = kGestureDown;
+    } else if (t == "L" || t == "LEFT") {
+      dir = kGestureLeft;
+    } else if (t == "R" || t == "RIGHT") {
+      dir = kGestureRight;
+    } else {
+      return false;
+    }
+    const uint16_t count = GestureSegments(stroke);
+    if ((count > 0 && GestureDirAt(stroke, count - 1) == dir) ||
+        count == kMaxGestureSegments) {
+      return false; // repeated directions are one segment
+    }
+    stroke = AppendGestureDir(stroke, dir);
+  }
+  if (flick) {
+    if (GestureSegments(stroke) != 1) {
+      return false;
+    }
+    stroke |= kGestureFlick;
+  }
+  return GestureSegments(stroke) > 0;
+}
+
+std::string GestureStrokeName(uint16_t stroke) {
+  static const char *names[] = {"up", "down", "left", "right"};
+  std::string out = (stroke & kGestureFlick) ? "flick" : "";
+  for (size_t i = 0; i < GestureSegments(stroke); ++i) {
+    out += out.empty() ? "" : "-";
+    out += names[GestureDirAt(stroke, i)];
+  }
+  return out;
+}
+
+struct GestureState {
+  bool active = false;
+  int button = 0;
+  int32_t distance = 0;
+  int32_t accX = 0;
+  int32_t accY = 0;
+  uint16_t stroke = 0;
+  long long startQpc = 0;
+};
+
+GestureState g_gesture; // input thread: the hook and WM_INPUT share it
+std::atomic<unsigned long long> g_gestureStrokes{0};
+std::atomic<unsigned long long> g_gestureMisses{0};
+
+void BeginGesture(GestureState &g, int button, int32_t distance,
+                  long long now) {
+  g = GestureState{};
+  g.active = true;
+  g.button = button;
+  g.distance = distance;
+  g.startQpc = now;
+}
+
+void FeedGesture(GestureState &g, LONG dx, LONG dy) {
+  g.accX += dx;
+  g.accY += dy;
+  const int32_t ax = std::abs(g.accX);
+  const int32_t ay = std::abs(g.accY);
+  if (std::max(ax, ay) < g.distance) {
+    return;
+  }
+  if (std::max(ax, ay) >= 2 * std::min(ax, ay)) {
+    const uint16_t dir = (ax >= ay)
+                             ? (g.accX < 0 ? kGestureLeft : kGestureRight)
+                             : (g.accY < 0 ? kGestureUp : kGestureDown);
+    const uint16_t count = GestureSegments(g.stroke);
+    if (count == 0 || GestureDirAt(g.stroke, count - 1) != dir) {
+      g.stroke = AppendGestureDir(g.stroke, dir);
+    }
+  }
+  g.accX = 0;
+  g.accY = 0;
+}
+
+// Returns the finished stroke, 0 if the button barely moved.
+uint16_t EndGesture(GestureState &g, long long now, long long flickTicks) {
+  g.active = false;
+  uint16_t stroke = g.stroke;
+  if (GestureSegments(stroke) == 1 && now - g.startQpc <= flickTicks) {
+    stroke |= kGestureFlick;
+  }
+  return stroke;
+}
+
+// ---------------------------------------------------------------------------
+// Motion pipeline: software DPI presets, sensitivity and acceleration
+// ---------------------------------------------------------------------------
+
+constexpr int kMotionFracBits = 16; // Q16 fixed point gains and remainders
+constexpr int32_t kMotionUnity = 1 << kMotionFracBits;
+constexpr size_t kMaxDpiPresets = 8;
+constexpr size_t kMaxDeviceScales = 8;
+constexpr size_t kAccelLutSize = 256; // indexed by speed in counts/ms
+constexpr size_t kDeviceGainCacheSize = 8;
+constexpr ULONGLONG kFullscreenCheckMs = 100;
+// Hook moves in a row without a raw packet before the pipeline gives the
+// cursor back: raw input has stopped arriving.
+constexpr unsigned kMaxMovesWithoutRaw = 8;
+constexpr ULONG_PTR kNexusInjectTag = 0x4E585553; // "NXUS" in dwExtraInfo
+constexpr ULONG_PTR kNexusProbeTag = 0x4E585052;  // "NXPR": --latency-test
+
+struct MotionProfile {
+  bool active = false; // false: physical motion passes through untouched
+  bool suspendInFullscreen = true;
+  int nativeDpi = 800;
+  size_t presetCount = 1;
+  int presetDpi[kMaxDpiPresets] = {};
+  int32_t presetGain[kMaxDpiPresets] = {}; // Q16, includes sensitivity
+  bool accelEnabled = false;
+  int32_t accelGain[kAccelLutSize] = {}; // Q16
+  double sensitivity = 1.0;
+  size_t deviceCount = 0;
+  DeviceScale devices[kMaxDeviceScales];
+  int32_t deviceGain[kMaxDeviceScales] = {}; // Q16
+};
+
+// Per-stream state; owned by the input thread.
+struct MotionState {
+  int64_t remX = 0; // sub-count remainders, Q16
+  int64_t remY = 0;
+  long long lastQpc = 0;
+  const MotionProfile *cacheProfile = nullptr;
+  HANDLE cacheDevice[kDeviceGainCacheSize] = {};
+  int32_t cacheGain[kDeviceGainCacheSize] = {};
+  size_t cacheNext = 0;
+};
+
+std::atomic<const MotionProfile *> g_motionProfile{nullptr};
+std::atomic<int> g_dpiPresetIndex{0};
+std::atomic<unsigned long long> g_motionPackets{0};
+// DPI shift (sniper) override; gain 0 means no shift is held.
+std::atomic<int32_t> g_dpiShiftGain{0};
+std::atomic<int> g_dpiShiftDpi{0};
+std::atomic<int> g_dpiShiftButton{0};
+std::atomic<unsigned> g_movesWithoutRaw{0};
+std::atomic<bool> g_lastMotionAbsolute{false};
+MotionState g_motionState;
+
+std::mutex g_retireMutex;
+std::vector<std::pair<unsigned long long, std::shared_ptr<const void>>>
+    g_retiredSnapshots;
+
+// Keeps a replaced snapshot alive long enough for any reader that loaded the
+// old pointer (hook callbacks, status requests) to finish with it.
+void RetireSnapshot(std::shared_ptr<const void> snapshot) {
+  constexpr unsigned long long kGraceMs = 5000;
+  const unsigned long long now = GetTickCount64();
+  std::lock_guard<std::mutex> lock(g_retireMutex);
+  g_retiredSnapshots.erase(
+      std::remove_if(g_retiredSnapshots.begin(), g_retiredSnapshots.end(),
+                     [&](const auto &r) { return now - r.first > kGraceMs; }),
+      g_retiredSnapshots.end());
+  if (snapshot) {
+    g_retiredSnapshots.emplace_back(now, std::move(snapshot));
+  }
+}
+
+std::vector<int> ParseIntList(const std::string &value) {
+  std::vector<int> out;
+  for (const std::string &part : Split(value, ',')) {
+    const std::string t = Trim(part);
+    if (!t.empty()) {
+      out.push_back(std::atoi(t.c_str()));
+    }
+  }
+  return out;
+}
+
+std::string IntListToString(const std::vector<int> &values) {
+  std::string out;
+  for (int v : values) {
+    if (!out.empty()) {
+      out += ",";
+    }
+    out += std::to_string(v);
+  }
+  return out;
+}
+
+AccelCurve ParseAccelCurve(const std::string &value) {
+  const std::string v = ToUpper(Trim(value));
+  if (v == "LINEAR") {
+    return AccelCurve::Linear;
+  }
+  if (v == "POWER") {
+    return AccelCurve::Power;
+  }
+  return AccelCurve::None;
+}
+
+bool ParseTelemetryMode(const std::string &value, TelemetryMode &mode) {
+  const std::string v = ToUpper(Trim(value));
+  if (v == "AUTO") {
+    mode = TelemetryMode::Auto;
+  } else if (v == "ALWAYS") {
+    mode = TelemetryMode::Always;
+  } else if (v == "MINIMAL") {
+    mode = TelemetryMode::Minimal;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *TelemetryModeToString(TelemetryMode mode) {
+  switch (mode) {
+  case TelemetryMode::Always:
+    return "always";
+  case TelemetryMode::Minimal:
+    return "minimal";
+  default:
+    return "auto";
+  }
+}
+
+std::string AccelCurveToString(AccelCurve curve) {
+  switch (curve) {
+  case AccelCurve::Linear:
+    return "linear";
+  case AccelCurve::Power:
+    return "power";
+  default:
+    return "none";
+  }
+}
+
+bool ParseHexWord(const std::string &text, WORD &out) {
+  char *end = nullptr;
+  const unsigned long value = std::strtoul(text.c_str(), &end, 16);
+  if (end == text.c_str() || value > 0xFFFF) {
+    return false;
+  }
+  out = static_cast<WORD>(value);
+  return true;
+}
+
+// Accepts "046D:C08B:1.25" (VID:PID:scale, hex ids).
+bool ParseDeviceScale(const std::string &value, DeviceScale &out) {
+  auto parts = Split(Trim(value), ':');
+  if (parts.size() != 3 || !ParseHexWord(parts[0], out.vid) ||
+      !ParseHexWord(parts[1], out.pid)) {
+    return false;
+  }
+  out.scale = std::atof(parts[2].c_str());
+  return out.scale > 0.0;
+}
+
+// Accepts "046D:C08B" (VID:PID, hex).
+bool ParseDeviceId(const std::string &value, DeviceId &out) {
+  auto parts = Split(Trim(value), ':');
+  return parts.size() == 2 && ParseHexWord(parts[0], out.vid) &&
+         ParseHexWord(parts[1], out.pid);
+}
+
+std::string DeviceIdsToString(const std::vector<DeviceId> &ids) {
+  std::string out;
+  for (const DeviceId &id : ids) {
+    char text[16] = {};
+    std::snprintf(text, sizeof(text), "%s%04X:%04X", out.empty() ? "" : ",",
+                  id.vid, id.pid);
+    out += text;
+  }
+  return out;
+}
+
+std::string DeviceScaleToString(const DeviceScale &ds) {
+  char ids[16] = {};
+  std::snprintf(ids, sizeof(ids), "%04X:%04X:", ds.vid, ds.pid);
+  std::ostringstream ss;
+  ss << ids << ds.scale;
+  return ss.str();
+}
+
+std::string DeviceScalesToString(const std::vector<DeviceScale> &scales) {
+  std::string out;
+  for (const DeviceScale &ds : scales) {
+    if (!out.empty()) {
+      out += ";";
+    }
+    out += DeviceScaleToString(ds);
+  }
+  return out;
+}
+
+// Pulls VID/PID out of a raw input device name such as
+// "\\?\HID#VID_046D&PID_C08B&MI_00#...".
+bool ParseDeviceIds(const std::string &deviceName, WORD &vid, WORD &pid) {
+  const std::string upper = ToUpper(deviceName);
+  const size_t v = upper.find("VID_");
+  const size_t p = upper.find("PID_");
+  if (v == std::string::npos || p == std::string::npos) {
+    return false;
+  }
+  vid = static_cast<WORD>(std::strtoul(upper.c_str() + v + 4, nullptr, 16));
+  pid = static_cast<WORD>(std::strtoul(upper.c_str() + p + 4, nullptr, 16));
+  return true;
+}
+
+bool QueryDeviceIds(HANDLE hDevice, WORD &vid, WORD &pid) {
+  char name[512] = {};
+  UINT size = sizeof(name);
+  if (!hDevice ||
+      GetRawInputDeviceInfoA(hDevice, RIDI_DEVICENAME, name, &size) ==
+          static_cast<UINT>(-1)) {
+    return false;
+  }
+  return ParseDeviceIds(name, vid, pid);
+}
+
+int32_t ToQ16(double v) {
+  return static_cast<int32_t>(std::lround(v * kMotionUnity));
+}
+
+double AccelMultiplier(const Config &cfg, double speed) {
+  const double excess = std::max(0.0, speed - cfg.accelOffset);
+  double gain = 1.0;
+  if (cfg.accel == AccelCurve::Linear) {
+    gain = 1.0 + cfg.accelRate * excess;
+  } else if (cfg.accel == AccelCurve::Power) {
+    gain = 1.0 + std::pow(cfg.accelRate * excess,
+                          std::max(0.0, cfg.accelExponent - 1.0));
+    if (excess == 0.0) {
+      gain = 1.0;
+    }
+  }
+  return std::min(gain, std::max(1.0, cfg.accelCap));
+}
+
+MotionProfile CompileMotionProfile(const Config &cfg) {
+  MotionProfile p;
+  p.suspendInFullscreen = cfg.suspendInFullscreen;
+  p.nativeDpi = cfg.dpi > 0 ? cfg.dpi : 800;
+  const double sens = cfg.sensitivity > 0.0 ? cfg.sensitivity : 1.0;
+  p.sensitivity = sens;
+
+  std::vector<int> presets = cfg.dpiPresets;
+  if (presets.empty()) {
+    presets.push_back(p.nativeDpi);
+  }
+  p.presetCount = std::min(presets.size(), kMaxDpiPresets);
+  for (size_t i = 0; i < p.presetCount; ++i) {
+    const int target = presets[i] > 0 ? presets[i] : p.nativeDpi;
+    p.presetDpi[i] = target;
+    p.presetGain[i] = ToQ16(sens * target / p.nativeDpi);
+    if (p.presetGain[i] != kMotionUnity) {
+      p.active = true;
+    }
+  }
+
+  p.accelEnabled = cfg.accel != AccelCurve::None && cfg.accelRate > 0.0;
+  for (size_t i = 0; i < kAccelLutSize; ++i) {
+    p.accelGain[i] = p.accelEnabled
+                         ? ToQ16(AccelMultiplier(cfg, static_cast<double>(i)))
+                         : kMotionUnity;
+  }
+
+  p.deviceCount = std::min(cfg.deviceScales.size(), kMaxDeviceScales);
+  for (size_t i = 0; i < p.deviceCount; ++i) {
+    p.devices[i] = cfg.deviceScales[i];
+    p.deviceGain[i] = ToQ16(cfg.deviceScales[i].scale);
+  }
+
+  p.active = p.active || p.accelEnabled || p.deviceCount > 0 ||
+             p.presetCount > 1;
+  return p;
+}
+
+void PublishMotionProfile(const Config &cfg) {
+  auto next = std::make_unique<MotionProfile>(CompileMotionProfile(cfg));
+  if (g_motionProfile.load() == nullptr) {
+    g_dpiPresetIndex.store(cfg.dpiPreset);
+  }
+  const MotionProfile *old = g_motionProfile.exchange(next.release());
+  if (old) {
+    RetireSnapshot(std::shared_ptr<const void>(old));
+  }
+}
+
+size_t ActivePresetIndex(const MotionProfile &p) {
+  const int idx = g_dpiPresetIndex.load(std::memory_order_relaxed);
+  return (idx >= 0 && static_cast<size_t>(idx) < p.presetCount)
+             ? static_cast<size_t>(idx)
+             : 0;
+}
+
+bool StepDpiPreset(const std::string &payload) {
+  const MotionProfile *p = g_motionProfile.load();
+  if (!p || p->presetCount == 0) {
+    return false;
+  }
+  const int count = static_cast<int>(p->presetCount);
+  const int cur = static_cast<int>(ActivePresetIndex(*p));
+  int next = cur;
+  if (payload == "next") {
+    next = (cur + 1) % count;
+  } else if (payload == "prev") {
+    next = (cur + count - 1) % count;
+  } else {
+    next = std::atoi(payload.c_str());
+    if (next < 0 || next >= count) {
+      return false;
+    }
+  }
+  g_dpiPresetIndex.store(next);
+  g_dpiChangeEvents.fetch_add(1);
+  return true;
+}
+
+bool MotionActive(const MotionProfile &p) {
+  return p.active || g_dpiShiftGain.load(std::memory_order_relaxed) != 0;
+}
+
+// Switches to a temporary DPI until the same button is released. Only
+// atomics are touched, so the very next motion packet picks it up.
+void BeginDpiShift(const std::string &payload, int button) {
+  const MotionProfile *p = g_motionProfile.load();
+  const int dpi = std::atoi(payload.c_str());
+  if (!p || dpi <= 0) {
+    return;
+  }
+  g_dpiShiftDpi.store(dpi);
+  g_dpiShiftButton.store(button);
+  g_dpiShiftGain.store(ToQ16(p->sensitivity * dpi / p->nativeDpi));
+  g_dpiChangeEvents.fetch_add(1);
+}
+
+void EndDpiShift() {
+  g_dpiShiftGain.store(0);
+  g_dpiShiftButton.store(0);
+  g_dpiShiftDpi.store(0);
+  g_dpiChangeEvents.fetch_add(1);
+}
+
+// Resolves the per-device gain once per device handle; later packets from
+// the same device hit the small cache.
+int32_t LookupDeviceGain(const MotionProfile &p, MotionState &st,
+                         HANDLE hDevice) {
+  if (p.deviceCount == 0) {
+    return kMotionUnity;
+  }
+  if (st.cacheProfile != &p) {
+    std::fill(std::begin(st.cacheDevice), std::end(st.cacheDevice), nullptr);
+    st.cacheProfile = &p;
+  }
+  for (size_t i = 0; i < kDeviceGainCacheSize; ++i) {
+    if (st.cacheDevice[i] == hDevice) {
+      return st.cacheGain[i];
+    }
+  }
+
+  int32_t gain = kMotionUnity;
+  WORD vid = 0;
+  WORD pid = 0;
+  if (QueryDeviceIds(hDevice, vid, pid)) {
+    for (size_t i = 0; i < p.deviceCount; ++i) {
+      if (p.devices[i].vid == vid && p.devices[i].pid == pid) {
+        gain = p.deviceGain[i];
+        break;
+      }
+    }
+  }
+  const size_t slot = st.cacheNext++ % kDeviceGainCacheSize;
+  st.cacheDevice[slot] = hDevice;
+  st.cacheGain[slot] = gain;
+  return gain;
+}
+
+// Scales one relative motion packet. Fractional output is carried in the
+// Q16 remainders so slow movements are never rounded away. Constant cost
+// per packet: one LUT lookup and a handful of integer operations.
+void ScaleMotion(const MotionProfile &p, MotionState &st, LONG dx, LONG dy,
+                 int32_t deviceGain, long long nowQpc, long long qpcPerMs,
+                 LONG &outX, LONG &outY) {
+  const int32_t shiftGain = g_dpiShiftGain.load(std::memory_order_relaxed);
+  const int32_t baseGain =
+      shiftGain ? shiftGain : p.presetGain[ActivePresetIndex(p)];
+  int64_t gain =
+      static_cast<int64_t>(baseGain) * deviceGain >> kMotionFracBits;
+
+  if (p.accelEnabled) {
+    const long long dt = nowQpc - st.lastQpc;
+    size_t speed = 0;
+    if (st.lastQpc != 0 && dt > 0 && dt < qpcPerMs * 100) {
+      const long long mag = std::abs(static_cast<long long>(dx)) +
+                            std::abs(static_cast<long long>(dy));
+      speed = static_cast<size_t>(
+          std::min<long long>(mag * qpcPerMs / dt, kAccelLutSize - 1));
+    }
+    gain = gain * p.accelGain[speed] >> kMotionFracBits;
+  }
+  st.lastQpc = nowQpc;
+
+  const int64_t x = st.remX + static_cast<int64_t>(dx) * gain;
+  const int64_t y = st.remY + static_cast<int64_t>(dy) * gain;
+  outX = static_cast<LONG>(x / kMotionUnity);
+  outY = static_cast<LONG>(y / kMotionUnity);
+  st.remX = x - static_cast<int64_t>(outX) * kMotionUnity;
+  st.remY = y - static_cast<int64_t>(outY) * kMotionUnity;
+}
+
+// Input thread. Motion is left alone while a fullscreen app has the focus
+// and suspend_fullscreen is set. The foreground check is a few calls into
+// win32k, so its answer is reused for kFullscreenCheckMs.
+bool MotionSuspended(const MotionProfile &p) {
+  static ULONGLONG checkedTick = 0;
+  static bool fullscreen = false;
+  if (!p.suspendInFullscreen) {
+    return false;
+  }
+  const ULONGLONG now = GetTickCount64();
+  if (checkedTick == 0 || now - checkedTick >= kFullscreenCheckMs) {
+    fullscreen = IsFullscreenForegroundWindow();
+    checkedTick = now;
+  }
+  return fullscreen;
+}
+
+// True while the hook should drop physical WM_MOUSEMOVE events because the
+// motion pipeline re-injects them from the raw input stream. This depends
+// only on the profile, not on how recently raw input arrived: the hook often
+// sees the first move after a pause before its WM_INPUT, and letting that one
+// through would deliver it twice.
+bool MotionPipelineOwnsCursor() {
+  const MotionProfile *p = g_motionProfile.load(std::memory_order_acquire);
+  if (!p || !MotionActive(*p) || g_lastMotionAbsolute.load() ||
+      !ForegroundRescalesMotion() || MotionSuspended(*p)) {
+    return false;
+  }
+  // Never freeze the cursor if raw input stops arriving.
+  return g_movesWithoutRaw.fetch_add(1, std::memory_order_relaxed) <
+         kMaxMovesWithoutRaw;
+}
+
+// The physical packet is only removed from the cursor stream; apps that read
+// raw input themselves see it as well as the injected copy. That is why the
+// pipeline only runs where motion_rescale is on for the foreground mapping.
+void ProcessRawMotion(const RAWINPUT *raw) {
+  const RAWMOUSE &m = raw->data.mouse;
+  // Injected input (including our own corrected motion) has no device.
+  if (!raw->header.hDevice || (m.lLastX == 0 && m.lLastY == 0)) {
+    return;
+  }
+  g_lastMotionAbsolute.store((m.usFlags & MOUSE_MOVE_ABSOLUTE) != 0);
+  g_movesWithoutRaw.store(0, std::memory_order_relaxed);
+  if (g_gesture.active && !(m.usFlags & MOUSE_MOVE_ABSOLUTE)) {
+    FeedGesture(g_gesture, m.lLastX, m.lLastY);
+  }
+
+  const MotionProfile *p = g_motionProfile.load(std::memory_order_acquire);
+  if (!p || !MotionActive(*p) || (m.usFlags & MOUSE_MOVE_ABSOLUTE) ||
+      !ForegroundRescalesMotion() || MotionSuspended(*p)) {
+    return;
+  }
+
+  LONG outX = 0;
+  LONG outY = 0;
+  ScaleMotion(*p, g_motionState, m.lLastX, m.lLastY,
+              LookupDeviceGain(*p, g_motionState, raw->header.hDevice),
+              QpcNow(), QpcTicksPerMs(), outX, outY);
+  g_motionPackets.fetch_add(1, std::memory_order_relaxed);
+  if (outX == 0 && outY == 0) {
+    return;
+  }
+
+  INPUT in = {};
+  in.type = INPUT_MOUSE;
+  in.mi.dx = outX;
+  in.mi.dy = outY;
+  in.mi.dwFlags = MOUSEEVENTF_MOVE | MOUSEEVENTF_MOVE_NOCOALESCE;
+  in.mi.dwExtraInfo = kNexusInjectTag;
+  g_sendInput(1, &in);
+}
+
+int EffectiveDpi() {
+  const int shiftDpi = g_dpiShiftDpi.load();
+  if (shiftDpi > 0) {
+    return shiftDpi;
+  }
+  const MotionProfile *p = g_motionProfile.load();
+  if (!p) {
+    return CurrentConfig()->dpi;
+  }
+  return p->presetDpi[ActivePresetIndex(*p)];
+}
+
+// ---------------------------------------------------------------------------
+// Per-application profiles
+// ---------------------------------------------------------------------------
+
+struct LayerTable {
+  WORD trigger = 0;
+  Action actions[kBindingCount];
+};
+
+struct MappingTable {
+  std::string name;
+  Action actions[kBindingCount];
+  bool suspendInFullscreen = true;
+  bool motionRescale = false;
+  // Layer i is active while triggers[i] is held. For each binding and mask
+  // of held triggers, layerByMask holds 1 + the first layer in file order
+  // that binds it, or 0 for the base action.
+  std::vector<LayerTable> layers;
+  WORD triggers[kMaxLayerTriggers] = {};
+  uint8_t layerByMask[kBindingCount][1u << kMaxLayerTriggers] = {};
+  std::vector<GestureBinding> gestures;
+  unsigned gestureBindings = 0; // bit per Binding with gestures
+  int32_t gestureDistance = 40;
+  int gestureFlickMs = 150;
+  unsigned wheelBindings = 0; // bit per wheel Binding bound in any layer
+  int32_t wheelNotch = 120;
+  int32_t wheelGain = kMotionUnity; // Q16 scroll multiplier
+  bool wheelSmooth = false;
+  bool wheelInvert = false;
+};
+
+struct ProfileRule {
+  std::string value; // lower-case exe name or exact window class
+  bool byClass = false;
+  bool anyWindow = false; // match_device without match_exe/match_class
+  int device = -1;        // index into CompiledProfiles::devices, -1: any
+  size_t table = 0;
+};
+
+struct CompiledProfiles {
+  MappingTable fallback; // global button4/button5
+  std::vector<MappingTable> tables;
+  std::vector<ProfileRule> rules; // in file order; first match wins
+  std::vector<DeviceId> devices;  // distinct match_device ids
+};
+
+std::atomic<const CompiledProfiles *> g_profiles{nullptr};
+std::atomic<const MappingTable *> g_activeMapping{nullptr};
+// Mapping for events correlated to CompiledProfiles::devices[i]; null past
+// the end. Written together with g_activeMapping.
+std::atomic<const MappingTable *> g_deviceMappings[kMaxMappedDevices] = {};
+// Serializes writers of g_activeMapping; the hook only loads the pointer.
+std::mutex g_profileSwitchMutex;
+std::string g_foregroundExe;   // guarded by g_profileSwitchMutex
+std::string g_foregroundClass; // guarded by g_profileSwitchMutex
+std::atomic<unsigned long long> g_profileSwitches{0};
+std::atomic<unsigned long long> g_lastProfileSwitchUs{0};
+std::atomic<unsigned long long> g_layerActions{0};
+std::atomic<unsigned long long> g_wheelEvents{0};
+std::atomic<unsigned long long> g_wheelActions{0};
+std::atomic<unsigned long long> g_smoothScrollFrames{0};
+std::atomic<unsigned long long> g_deviceCorrelations{0};
+std::atomic<unsigned long long> g_deviceInferred{0};
+std::atomic<unsigned long long> g_deviceMismatches{0}; // inferred, then refuted
+std::atomic<unsigned long long> g_deviceRingDrains{0};
+std::atomic<unsigned long long> g_deviceCorrelateNs{0}; // summed over lookups
+
+// Input thread: motion_rescale of the mapping that follows the foreground.
+bool ForegroundRescalesMotion() {
+  const MappingTable *map = g_activeMapping.load(std::memory_order_acquire);
+  return map && map->motionRescale;
+}
+struct ProcessName {
+  ULONGLONG created = 0; // FILETIME of the process start
+  std::string name;
+};
+std::unordered_map<DWORD, ProcessName> g_processNameCache; // input thread
+HWINEVENTHOOK g_foregroundHook = nullptr;
+
+Action CompileAction(const Action &action) {
+  Action compiled = action;
+  compiled.launch = ResolveLaunchTarget(action);
+  return compiled;
+}
+
+// Triggers past kMaxLayerTriggers are ignored (ValidateConfig rejects them).
+void CompileLayers(const std::vector<LayerBinding> &bindings,
+                   MappingTable &table) {
+  for (const LayerBinding &binding : bindings) {
+    auto it = std::find_if(
+        table.layers.begin(), table.layers.end(),
+        [&](const LayerTable &l) { return l.trigger == binding.trigger; });
+    if (it == table.layers.end()) {
+      if (table.layers.size() == kMaxLayerTriggers) {
+        continue;
+      }
+      table.triggers[table.layers.size()] = binding.trigger;
+      table.layers.push_back({binding.trigger, {}});
+      it = table.layers.end() - 1;
+    }
+    it->actions[binding.binding] = CompileAction(binding.action);
+  }
+  for (size_t b = 0; b < kBindingCount; ++b) {
+    for (unsigned mask = 1; mask < (1u << kMaxLayerTriggers); ++mask) {
+      for (size_t i = 0; i < table.layers.size(); ++i) {
+        if ((mask & (1u << i)) &&
+            table.layers[i].actions[b].type != ActionType::None) {
+          table.layerByMask[b][mask] = static_cast<uint8_t>(i + 1);
+          break;
+        }
+      }
+    }
+  }
+}
+
+void CompileGestures(const Config &cfg,
+                     const std::vector<GestureBinding> &gestures,
+                     MappingTable &table) {
+  table.gestureDistance = cfg.gestureDistance;
+  table.gestureFlickMs = cfg.gestureFlickMs;
+  for (const GestureBinding &gesture : gestures) {
+    table.gestures.push_back(
+        {gesture.binding, gesture.stroke, CompileAction(gesture.action)});
+    table.gestureBindings |= 1u << gesture.binding;
+  }
+}
+
+// A flick without its own binding falls back to the plain direction.
+const Action *FindGesture(const MappingTable &map, Binding binding,
+                          uint16_t stroke) {
+  for (int pass = 0; pass < 2; ++pass) {
+    for (const GestureBinding &gesture : map.gestures) {
+      if (gesture.binding == binding && gesture.stroke == stroke) {
+        return &gesture.action;
+      }
+    }
+    if (!(stroke & kGestureFlick)) {
+      break;
+    }
+    stroke &= ~kGestureFlick;
+  }
+  return nullptr;
+}
+
+void CompileWheel(const Config &cfg, const Action (&wheel)[kWheelBindings],
+                  bool invert, MappingTable &table) {
+  // Every config that reaches here passed ValidateConfig: wheelNotch > 0
+  // and wheelSpeed in (0, 100].
+  table.wheelNotch = cfg.wheelNotch;
+  table.wheelGain =
+      static_cast<int32_t>(std::lround(cfg.wheelSpeed * kMotionUnity));
+  table.wheelSmooth = cfg.wheelSmooth;
+  table.wheelInvert = invert;
+  for (size_t i = 0; i < kWheelBindings; ++i) {
+    const size_t b = kBindWheelUp + i;
+    table.actions[b] = CompileAction(wheel[i]);
+    bool bound = table.actions[b].type != ActionType::None;
+    for (const LayerTable &layer : table.layers) {
+      bound = bound || layer.actions[b].type != ActionType::None;
+    }
+    if (bound) {
+      table.wheelBindings |= 1u << b;
+    }
+  }
+}
+
+// Index of |id| in cp.devices, added on first use; -1 once kMaxMappedDevices
+// ids are taken (ValidateConfig rejects that).
+int DeviceSlot(CompiledProfiles &cp, const DeviceId &id) {
+  for (size_t i = 0; i < cp.devices.size(); ++i) {
+    if (cp.devices[i].vid == id.vid && cp.devices[i].pid == id.pid) {
+      return static_cast<int>(i);
+    }
+  }
+  if (cp.devices.size() == kMaxMappedDevices) {
+    return -1;
+  }
+  cp.devices.push_back(id);
+  return static_cast<int>(cp.devices.size() - 1);
+}
+
+CompiledProfiles CompileProfiles(const Config &cfg) {
+  CompiledProfiles cp;
+  cp.fallback.name = "Global Default";
+  cp.fallback.actions[kBindButton4] = CompileAction(cfg.button4);
+  cp.fallback.actions[kBindButton5] = CompileAction(cfg.button5);
+  cp.fallback.suspendInFullscreen = cfg.suspendInFullscreen;
+  cp.fallback.motionRescale = cfg.motionRescale;
+  CompileLayers(cfg.layers, cp.fallback);
+  CompileGestures(cfg, cfg.gestures, cp.fallback);
+  CompileWheel(cfg, cfg.wheel, cfg.wheelInvert, cp.fallback);
+
+  cp.tables.reserve(cfg.profiles.size());
+  for (const Profile &profile : cfg.profiles) {
+    MappingTable table;
+    table.name = profile.name;
+    table.actions[kBindButton4] = CompileAction(profile.button4);
+    table.actions[kBindButton5] = CompileAction(profile.button5);
+    table.suspendInFullscreen = cfg.suspendInFullscreen;
+    table.motionRescale = profile.motionRescale < 0
+                              ? cfg.motionRescale
+                              : profile.motionRescale != 0;
+    CompileLayers(profile.layers, table);
+    CompileGestures(cfg, profile.gestures, table);
+    CompileWheel(cfg, profile.wheel,
+                 profile.wheelInvert < 0 ? cfg.wheelInvert
+                                         : profile.wheelInvert != 0,
+                 table);
+    const size_t idx = cp.tables.size();
+    cp.tables.push_back(std::move(table));
+    std::vector<int> devices;
+    for (const DeviceId &id : profile.matchDevice) {
+      const int device = DeviceSlot(cp, id);
+      if (device >= 0) {
+        devices.push_back(device);
+      }
+    }
+    if (devices.empty()) {
+      devices.push_back(-1);
+    }
+    const bool anyWindow =
+        profile.matchExe.empty() && profile.matchClass.empty();
+    for (int device : devices) {
+      for (const std::string &exe : profile.matchExe) {
+        cp.rules.push_back({exe, false, false, device, idx});
+      }
+      for (const std::string &cls : profile.matchClass) {
+        cp.rules.push_back({cls, true, false, device, idx});
+      }
+      if (anyWindow && device >= 0) {
+        cp.rules.push_back({"", false, true, device, idx});
+      }
+    }
+  }
+  return cp;
+}
+
+// |device| is an index into cp.devices, or -1 for a mouse no device
+// profile names; device rules only match their own device.
+const MappingTable *MatchProfile(const CompiledProfiles &cp,
+                                 const std::string &exe,
+                                 const std::string &windowClass,
+                                 int device = -1) {
+  for (const ProfileRule &rule : cp.rules) {
+    if (rule.device >= 0 && rule.device != device) {
+      continue;
+    }
+    if (rule.anyWindow || rule.value == (rule.byClass ? windowClass : exe)) {
+      return &cp.tables[rule.table];
+    }
+  }
+  return &cp.fallback;
+}
+
+// Caller holds g_profileSwitchMutex.
+void SwitchDeviceMappings(const CompiledProfiles &cp) {
+  for (size_t i = 0; i < kMaxMappedDevices; ++i) {
+    g_deviceMappings[i].store(
+        i < cp.devices.size() ? MatchProfile(cp, g_foregroundExe,
+                                             g_foregroundClass,
+                                             static_cast<int>(i))
+                              : nullptr,
+        std::memory_order_release);
+  }
+}
+
+// Caller holds g_profileSwitchMutex.
+void SwitchMapping(const MappingTable *next, long long startQpc) {
+  if (g_activeMapping.load() == next) {
+    return;
+  }
+  g_activeMapping.store(next, std::memory_order_release);
+  ReleaseInjectedKeys();
+  g_profileSwitches.fetch_add(1);
+  g_lastProfileSwitchUs.store(
+      static_cast<unsigned long long>(QpcToNs(QpcNow() - startQpc) / 1000.0));
+}
+
+bool IsMouseButtonVk(WORD vk) {
+  return vk == VK_LBUTTON || vk == VK_RBUTTON || vk == VK_MBUTTON ||
+         vk == VK_XBUTTON1 || vk == VK_XBUTTON2;
+}
+
+// Mouse-button triggers are tracked by the mouse hook.
+bool TableHasKeyboardTrigger(const MappingTable &t) {
+  return std::any_of(t.layers.begin(), t.layers.end(),
+                     [](const LayerTable &layer) {
+                       return !IsMouseButtonVk(layer.trigger);
+                     });
+}
+
+void PublishProfiles(const Config &cfg) {
+  auto next = std::make_unique<CompiledProfiles>(CompileProfiles(cfg));
+  std::lock_guard<std::mutex> lock(g_profileSwitchMutex);
+  const CompiledProfiles *cp = next.get();
+  const CompiledProfiles *old = g_profiles.exchange(next.release());
+  g_activeMapping.store(MatchProfile(*cp, g_foregroundExe, g_foregroundClass),
+                        std::memory_order_release);
+  SwitchDeviceMappings(*cp);
+  const bool keyboard =
+      TableHasKeyboardTrigger(cp->fallback) ||
+      std::any_of(cp->tables.begin(), cp->tables.end(),
+                  TableHasKeyboardTrigger);
+  if (g_keyboardHookNeeded.exchange(keyboard) != keyboard && g_mainWindow) {
+    PostMessageA(g_mainWindow, WM_KEYBOARD_HOOK_CHANGED, 0, 0);
+  }
+  if (old) {
+    RetireSnapshot(std::shared_ptr<const void>(old));
+  }
+}
+
+// PIDs are reused, so an entry only answers for the process it was made
+// for: the creation time must match as well. Failed lookups are not cached.
+std::string CachedProcessName(DWORD pid) {
+  HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+  if (!process) {
+    return "";
+  }
+  FILETIME created = {};
+  FILETIME exited = {};
+  FILETIME kernel = {};
+  FILETIME user = {};
+  ULONGLONG stamp = 0;
+  if (GetProcessTimes(process, &created, &exited, &kernel, &user)) {
+    stamp = (static_cast<ULONGLONG>(created.dwHighDateTime) << 32) |
+            created.dwLowDateTime;
+  }
+  auto it = g_processNameCache.find(pid);
+  if (stamp && it != g_processNameCache.end() && it->second.created == stamp) {
+    CloseHandle(process);
+    return it->second.name;
+  }
+
+  std::string name;
+  char path[MAX_PATH] = {};
+  DWORD size = MAX_PATH;
+  if (QueryFullProcessImageNameA(process, 0, path, &size)) {
+    const std::string full(path, size);
+    const auto slash = full.find_last_of("\\/");
+    name = ToLower(slash == std::string::npos ? full : full.substr(slash + 1));
+  }
+  CloseHandle(process);
+
+  if (!stamp || name.empty()) {
+    if (it != g_processNameCache.end()) {
+      g_processNameCache.erase(it);
+    }
+    return name;
+  }
+  if (it == g_processNameCache.end() && g_processNameCache.size() >= 256) {
+    g_processNameCache.clear();
+  }
+  g_processNameCache[pid] = {stamp, name};
+  return name;
+}
+
+void CALLBACK ForegroundEventProc(HWINEVENTHOOK, DWORD event, HWND hwnd,
+                                  LONG, LONG, DWORD, DWORD) {
+  if (event != EVENT_SYSTEM_FOREGROUND || !hwnd) {
+    return;
+  }
+  const long long start = QpcNow();
+
+  DWORD pid = 0;
+  GetWindowThreadProcessId(hwnd, &pid);
+  std::string exe = CachedProcessName(pid);
+  char windowClass[256] = {};
+  GetClassNameA(hwnd, windowClass, sizeof(windowClass));
+
+  std::lock_guard<std::mutex> lock(g_profileSwitchMutex);
+  g_foregroundExe = std::move(exe);
+  g_foregroundClass = windowClass;
+  const CompiledProfiles *cp = g_profiles.load();
+  if (cp) {
+    SwitchMapping(MatchProfile(*cp, g_foregroundExe, g_foregroundClass),
+                  start);
+    SwitchDeviceMappings(*cp);
+  }
+}
+
+void PublishRuntimeConfig(const Config &cfg) {
+  AllocScope alloc(kThreadConfig);
+  PublishMotionProfile(cfg);
+  PublishProfiles(cfg);
+  PublishScheduling(cfg);
+  PublishTelemetryTier(cfg);
+}
+
+// Caller holds g_configWriteMutex. Makes |cfg| current and publishes it.
+const Config &CommitConfig(Config cfg) {
+  auto next = std::make_shared<const Config>(std::move(cfg));
+  {
+    std::lock_guard<std::mutex> lock(g_configMutex);
+    g_config = next;
+  }
+  g_configGeneration.fetch_add(1);
+  PublishRuntimeConfig(*next);
+  return *next; // valid while the caller holds g_configWriteMutex
+}
+
+// Replaces the whole config: startup, tray reload and INI hot reload.
+void ReplaceConfig(Config cfg) {
+  std::lock_guard<std::mutex> lock(g_configWriteMutex);
+  CommitConfig(std::move(cfg));
+}
+
+std::string ActiveProfileName() {
+  const MappingTable *map = g_activeMapping.load();
+  return map ? map->name : "";
+}
+
+void UpdatePollingRateWindow() {
+  const unsigned long long now = GetTickCount64();
+  const unsigned long long lastTick = g_lastRateWindowTick.load();
+  const unsigned long long count = g_rawInputEvents.load();
+
+  if (lastTick == 0) {
+    g_lastRateWindowTick.store(now);
+    g_lastRateWindowCount.store(count);
+    return;
+  }
+
+  if (now - lastTick >= 1000) {
+    const unsigned long long prevCount = g_lastRateWindowCount.load();
+    const unsigned long long delta =
+        (count >= prevCount) ? (count - prevCount) : 0;
+    g_pollRateHz.store(static_cast<unsigned int>(delta));
+    g_lastRateWindowTick.store(now);
+    g_lastRateWindowCount.store(count);
+  }
+}
+
+// Queries only when the packet comes from a different mouse than the last.
+void UpdateMouseDeviceInfo(HANDLE hDevice) {
+  static HANDLE last = nullptr;
+  if (!hDevice || hDevice == last) {
+    return;
+  }
+  last = hDevice;
+
+  RID_DEVICE_INFO info = {};
+  info.cbSize = sizeof(info);
+  UINT size = sizeof(info);
+  if (GetRawInputDeviceInfoA(hDevice, RIDI_DEVICEINFO, &info, &size) ==
+      static_cast<UINT>(-1)) {
+    return;
+  }
+
+  if (info.dwType == RIM_TYPEMOUSE) {
+    g_mouseButtons.store(info.mouse.dwNumberOfButtons);
+    g_mouseSampleRate.store(info.mouse.dwSampleRate);
+  }
+}
+
+void UpdateTelemetryFromRawInput(const RAWINPUT *raw) {
+  if (!raw || raw->header.dwType != RIM_TYPEMOUSE) {
+    return;
+  }
+
+  UpdatePollingRateWindow();
+  UpdateMouseDeviceInfo(raw->header.hDevice);
+}
+
+// ---------------------------------------------------------------------------
+// Input history: the input thread appends every raw mouse packet to a fixed
+// ring and folds it into 10 ms, 1 s and 1 min aggregates as it goes, so
+// GET /history can serve graphs from bounded memory. A finished bucket is
+// merged into the open bucket of the next tier. Readers copy under each
+// tier's sequence number and retry; the input thread never waits.
+// ---------------------------------------------------------------------------
+constexpr size_t kRawHistorySize = 4096; // about 0.5 s at 8 kHz
+constexpr size_t kHistoryTiers = 3;
+constexpr uint64_t kHistoryIdleUs = 1000000; // longer gaps are not intervals
+
+struct RawSample {
+  uint64_t timeUs;
+  int32_t dx;
+  int32_t dy;
+  uint32_t intervalUs; // 0 for the first packet after an idle gap
+  uint16_t buttonFlags;
+  int16_t wheel;
+};
+
+struct HistoryBucket {
+  uint64_t startMs = 0;
+  uint32_t count = 0;
+  uint32_t intervals = 0;
+  uint32_t motionMin = UINT32_MAX;
+  uint32_t motionMax = 0;
+  uint32_t intervalMinUs = UINT32_MAX;
+  uint32_t intervalMaxUs = 0;
+  uint64_t motionSum = 0;
+  uint64_t intervalSumUs = 0;
+};
+
+// Both records go out as-is in the binary /history format.
+static_assert(sizeof(RawSample) == 24, "RawSample layout is on the wire");
+static_assert(sizeof(HistoryBucket) == 48,
+              "HistoryBucket layout is on the wire");
+
+struct HistoryTier {
+  HistoryTier(const char *n, uint32_t width, size_t capacity)
+      : name(n), widthMs(width), buckets(capacity) {}
+  const char *name;
+  uint32_t widthMs;
+  std::vector<HistoryBucket> buckets; // ring of finished buckets
+  std::atomic<uint64_t> seq{0};       // odd while the input thread writes
+  uint64_t closed = 0;                // finished buckets so far
+  HistoryBucket open;
+};
+
+struct InputHistory {
+  std::atomic<uint64_t> rawHead{0}; // packets written so far
+  std::vector<RawSample> raw = std::vector<RawSample>(kRawHistorySize);
+  HistoryTier tiers[kHistoryTiers] = {
+      {"10ms", 10, 1000}, {"1s", 1000, 600}, {"1min", 60000, 1440}};
+};
+
+InputHistory g_history;
+
+uint64_t QpcToUs(long long qpc) {
+  return static_cast<uint64_t>(QpcToNs(qpc) / 1000.0);
+}
+
+void MergeBucket(HistoryBucket &into, const HistoryBucket &from) {
+  into.count += from.count;
+  into.intervals += from.intervals;
+  into.motionMin = std::min(into.motionMin, from.motionMin);
+  into.motionMax = std::max(into.motionMax, from.motionMax);
+  into.intervalMinUs = std::min(into.intervalMinUs, from.intervalMinUs);
+  into.intervalMaxUs = std::max(into.intervalMaxUs, from.intervalMaxUs);
+  into.motionSum += from.motionSum;
+  into.intervalSumUs += from.intervalSumUs;
+}
+
+// Input thread: adds |b| to tier |level|, finishing the open bucket first
+// when |b| starts in a later window.
+void FoldIntoTier(InputHistory &h, size_t level, const HistoryBucket &b) {
+  HistoryTier &t = h.tiers[level];
+  const uint64_t start = b.startMs - b.startMs % t.widthMs;
+  HistoryBucket finished;
+  t.seq.store(t.seq.load(std::memory_order_relaxed) + 1,
+              std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  if (t.open.count && t.open.startMs != start) {
+    finished = t.open;
+    t.buckets[t.closed % t.buckets.size()] = t.open;
+    ++t.closed;
+    t.open = HistoryBucket{};
+  }
+  if (!t.open.count) {
+    t.open.startMs = start;
+  }
+  MergeBucket(t.open, b);
+  t.seq.store(t.seq.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+  if (finished.count && level + 1 < kHistoryTiers) {
+    FoldIntoTier(h, level + 1, finished);
+  }
+}
+
+// Input thread, once per raw mouse packet. |intervalUs| is the gap since the
+// previous packet, ignored past kHistoryIdleUs.
+void RecordHistory(InputHistory &h, const RAWMOUSE &m, uint64_t nowUs,
+                   uint64_t intervalUs) {
+  const bool absolute = (m.usFlags & MOUSE_MOVE_ABSOLUTE) != 0;
+  const bool idle = intervalUs == 0 || intervalUs > kHistoryIdleUs;
+  RawSample sample = {};
+  sample.timeUs = nowUs;
+  sample.dx = m.lLastX;
+  sample.dy = m.lLastY;
+  sample.intervalUs = idle ? 0 : static_cast<uint32_t>(intervalUs);
+  sample.buttonFlags = m.usButtonFlags;
+  if (m.usButtonFlags & (RI_MOUSE_WHEEL | RI_MOUSE_HWHEEL)) {
+    sample.wheel = static_cast<int16_t>(m.usButtonData);
+  }
+  const uint64_t head = h.rawHead.load(std::memory_order_relaxed);
+  h.raw[head % kRawHistorySize] = sample;
+  h.rawHead.store(head + 1, std::memory_order_release);
+
+  HistoryBucket b;
+  b.startMs = nowUs / 1000;
+  b.count = 1;
+  const double dx = absolute ? 0 : m.lLastX;
+  const double dy = absolute ? 0 : m.lLastY;
+  b.motionMin = b.motionMax =
+      static_cast<uint32_t>(std::sqrt(dx * dx + dy * dy) + 0.5);
+  b.motionSum = b.motionMin;
+  if (!idle) {
+    b.intervals = 1;
+    b.intervalMinUs = b.intervalMaxUs = sample.intervalUs;
+    b.intervalSumUs = sample.intervalUs;
+  }
+  FoldIntoTier(h, 0, b);
+}
+
+// Buckets of |t| starting in [fromMs, toMs], the open one included. False if
+// the input thread kept the tier busy.
+bool ReadHistoryTier(const HistoryTier &t, uint64_t fromMs, uint64_t toMs,
+                     std::vector<HistoryBucket> &out) {
+  for (int attempt = 0; attempt < 16; ++attempt) {
+    const uint64_t before = t.seq.load(std::memory_order_acquire);
+    if (before & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    out.clear();
+    const uint64_t kept = std::min<uint64_t>(t.closed, t.buckets.size());
+    for (uint64_t i = t.closed - kept; i < t.closed; ++i) {
+      const HistoryBucket &b = t.buckets[i % t.buckets.size()];
+      if (b.startMs >= fromMs && b.startMs <= toMs) {
+        out.push_back(b);
+      }
+    }
+    if (t.open.count && t.open.startMs >= fromMs && t.open.startMs <= toMs) {
+      out.push_back(t.open);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (t.seq.load(std::memory_order_relaxed) == before) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Raw packets in [fromUs, toUs]; slots the input thread reused while they
+// were being copied are dropped.
+void ReadRawHistory(const InputHistory &h, uint64_t fromUs, uint64_t toUs,
+                    std::vector<RawSample> &out) {
+  const uint64_t head = h.rawHead.load(std::memory_order_acquire);
+  const uint64_t first = head > kRawHistorySize ? head - kRawHistorySize : 0;
+  out.assign(h.raw.begin(), h.raw.end());
+  std::rotate(out.begin(), out.begin() + head % kRawHistorySize, out.end());
+  out.erase(out.begin(), out.end() - (head - first));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t after = h.rawHead.load(std::memory_order_relaxed);
+  const uint64_t valid =
+      after + 1 > kRawHistorySize ? after + 1 - kRawHistorySize : 0;
+  const uint64_t reused =
+      std::min<uint64_t>(out.size(), valid > first ? valid - first : 0);
+  out.erase(out.begin(), out.begin() + reused);
+  out.erase(std::remove_if(out.begin(), out.end(),
+                           [&](const RawSample &s) {
+                             return s.timeUs < fromUs || s.timeUs > toUs;
+                           }),
+            out.end());
+}
+
+// Value of |key| in the query string of the request line, "" if absent.
+std::string QueryParam(const std::string &request, const std::string &key) {
+  const size_t lineEnd = request.find("\r\n");
+  const std::string line = request.substr(0, lineEnd);
+  const size_t q = line.find('?');
+  if (q == std::string::npos) {
+    return "";
+  }
+  const size_t end = line.find(' ', q);
+  const std::string query = line.substr(q + 1, end - q - 1);
+  for (size_t pos = 0; pos <= query.size();) {
+    size_t amp = query.find('&', pos);
+    amp = amp == std::string::npos ? query.size() : amp;
+    const size_t eq = query.find('=', pos);
+    if (eq < amp && query.compare(pos, eq - pos, key) == 0 &&
+        eq - pos == key.size()) {
+      return query.substr(eq + 1, amp - eq - 1);
+    }
+    pos = amp + 1;
+  }
+  return "";
+}
+
+template <typename T>
+void AppendRecords(std::string &out, const std::vector<T> &v) {
+  out.append(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+}
+
+// GET /history?res=raw|10ms|1s|1min&from=<ms>&to=<ms>&format=json|bin
+// Times are milliseconds on the service's monotonic clock (now_ms in the
+// reply). JSON is columnar; bin is a 24-byte header ("NXHS", version,
+// resolution, width_ms, count, now_ms) followed by RawSample or HistoryBucket
+// records.
+bool BuildHistoryResponse(const std::string &request, std::string &body,
+                          std::string &type) {
+  const std::string res = QueryParam(request, "res");
+  const std::string from = QueryParam(request, "from");
+  const std::string to = QueryParam(request, "to");
+  const bool binary = QueryParam(request, "format") == "bin";
+  const uint64_t nowMs = QpcToUs(QpcNow()) / 1000;
+  const uint64_t fromMs =
+      from.empty() ? 0 : std::strtoull(from.c_str(), nullptr, 10);
+  const uint64_t toMs =
+      to.empty() ? nowMs : std::strtoull(to.c_str(), nullptr, 10);
+
+  size_t tier = kHistoryTiers;
+  for (size_t i = 0; i < kHistoryTiers; ++i) {
+    if (res == g_history.tiers[i].name || (res.empty() && i == 1)) {
+      tier = i;
+    }
+  }
+  std::vector<RawSample> samples;
+  std::vector<HistoryBucket> buckets;
+  if (res == "raw") {
+    ReadRawHistory(g_history, fromMs * 1000, toMs * 1000 + 999, samples);
+  } else if (tier == kHistoryTiers) {
+    body = "{\"error\":\"res must be raw, 10ms, 1s or 1min\"}";
+    return false;
+  } else if (!ReadHistoryTier(g_history.tiers[tier], fromMs, toMs, buckets)) {
+    body = "{\"error\":\"busy\"}";
+    return false;
+  }
+  const uint32_t widthMs = res == "raw" ? 0 : g_history.tiers[tier].widthMs;
+
+  if (binary) {
+    type = "application/octet-stream";
+    const uint32_t count =
+        static_cast<uint32_t>(res == "raw" ? samples.size() : buckets.size());
+    const uint16_t version = 1;
+    const uint16_t resolution =
+        static_cast<uint16_t>(res == "raw" ? 0 : tier + 1);
+    body.assign("NXHS");
+    body.append(reinterpret_cast<const char *>(&version), sizeof(version));
+    body.append(reinterpret_cast<const char *>(&resolution),
+                sizeof(resolution));
+    body.append(reinterpret_cast<const char *>(&widthMs), sizeof(widthMs));
+    body.append(reinterpret_cast<const char *>(&count), sizeof(count));
+    body.append(reinterpret_cast<const char *>(&nowMs), sizeof(nowMs));
+    if (res == "raw") {
+      AppendRecords(body, samples);
+    } else {
+      AppendRecords(body, buckets);
+    }
+    return true;
+  }
+
+  std::ostringstream ss;
+  auto column = [&](const char *name, auto &&rows, auto &&value) {
+    ss << ",\"" << name << "\":[";
+    for (size_t i = 0; i < rows.size(); ++i) {
+      ss << (i ? "," : "") << value(rows[i]);
+    }
+    ss << "]";
+  };
+  ss << "{\"res\":\"" << (res == "raw" ? "raw" : g_history.tiers[tier].name)
+     << "\",\"width_ms\":" << widthMs << ",\"now_ms\":" << nowMs;
+  if (res == "raw") {
+    column("t_us", samples, [](const RawSample &s) { return s.timeUs; });
+    column("dx", samples, [](const RawSample &s) { return s.dx; });
+    column("dy", samples, [](const RawSample &s) { return s.dy; });
+    column("interval_us", samples,
+           [](const RawSample &s) { return s.intervalUs; });
+    column("buttons", samples,
+           [](const RawSample &s) { return s.buttonFlags; });
+    column("wheel", samples, [](const RawSample &s) { return s.wheel; });
+  } else {
+    column("t", buckets, [](const HistoryBucket &b) { return b.startMs; });
+    column("count", buckets, [](const HistoryBucket &b) { return b.count; });
+    column("rate_hz", buckets, [&](const HistoryBucket &b) {
+      return static_cast<uint64_t>(b.count) * 1000 / widthMs;
+    });
+    column("motion_min", buckets,
+           [](const HistoryBucket &b) { return b.motionMin; });
+    column("motion_max", buckets,
+           [](const HistoryBucket &b) { return b.motionMax; });
+    column("motion_mean", buckets, [](const HistoryBucket &b) {
+      return b.motionSum / b.count;
+    });
+    column("interval_min_us", buckets, [](const HistoryBucket &b) {
+      return b.intervals ? b.intervalMinUs : 0;
+    });
+    column("interval_max_us", buckets,
+           [](const HistoryBucket &b) { return b.intervalMaxUs; });
+    column("interval_mean_us", buckets, [](const HistoryBucket &b) {
+      return b.intervals ? b.intervalSumUs / b.intervals : 0;
+    });
+  }
+  ss << "}";
+  body = ss.str();
+  return true;
+}
+
+std::string BuildStatusJson() {
+  std::ostringstream ss;
+  ss << "{";
+  ss << "\"poll_rate_hz\":" << g_pollRateHz.load() << ",";
+  ss << "\"mouse_buttons\":" << g_mouseButtons.load() << ",";
+  ss << "\"status\":\"active\",";
+  ss << "\"dpi_preset\":" << g_dpiPresetIndex.load() << ",";
+  ss << "\"effective_dpi\":" << EffectiveDpi() << ",";
+  ss << "\"dpi_shift\":" << (g_dpiShiftDpi.load() > 0 ? "true" : "false")
+     << ",";
+  ss << "\"motion_packets\":" << g_motionPackets.load() << ",";
+  ss << "\"active_profile\":\"" << JsonEscape(ActiveProfileName()) << "\",";
+  ss << "\"profile_switches\":" << g_profileSwitches.load() << ",";
+  ss << "\"profile_switch_us\":" << g_lastProfileSwitchUs.load() << ",";
+  ss << "\"config_source\":\"" << (g_configFromCache.load() ? "cache" : "ini")
+     << "\",";
+  ss << "\"config_load_us\":" << g_configLoadUs.load() << ",";
+  ss << "\"startup_us\":" << g_startupUs.load() << ",";
+  ss << "\"config_reloads\":" << g_configReloads.load() << ",";
+  ss << "\"config_reload_failures\":" << g_configReloadFailures.load() << ",";
+  ss << "\"config_reloads_superseded\":" << g_configReloadsSuperseded.load()
+     << ",";
+  ss << "\"config_reload_us\":" << g_configReloadUs.load() << ",";
+  ss << "\"config_error\":\"" << JsonEscape(ConfigLastError()) << "\",";
+  ss << "\"config_save_requests\":" << g_configSaveRequests.load() << ",";
+  ss << "\"config_saves\":" << g_configSaves.load() << ",";
+  ss << "\"config_save_failures\":" << g_configSaveFailures.load() << ",";
+  ss << "\"config_save_us\":" << g_configSaveUs.load() << ",";
+  ss << "\"text_jobs\":" << g_textJobs.load() << ",";
+  ss << "\"text_clipboard_jobs\":" << g_textClipboardJobs.load() << ",";
+  ss << "\"text_clipboard_skipped\":" << g_textClipboardSkipped.load()
+     << ",";
+  ss << "\"text_chars\":" << g_textChars.load() << ",";
+  ss << "\"text_dropped\":" << g_textDropped.load() << ",";
+  ss << "\"text_failures\":" << g_textFailures.load() << ",";
+  ss << "\"text_chars_per_sec\":" << g_textCharsPerSec.load() << ",";
+  ss << "\"macro_running\":" << (g_macroRunning.load() ? "true" : "false")
+     << ",";
+  ss << "\"macro_runs\":" << g_macroRuns.load() << ",";
+  ss << "\"macro_cancels\":" << g_macroCancels.load() << ",";
+  ss << "\"macro_ops\":" << g_macroOps.load() << ",";
+  {
+    const MacroLibrary *lib = g_macroLibrary.load();
+    ss << "\"macro_library_entries\":" << (lib ? lib->count : 0) << ",";
+    ss << "\"macro_library_bytes\":" << (lib ? lib->size : 0) << ",";
+  }
+  ss << "\"macro_library_load_us\":" << g_macroLibraryLoadUs.load() << ",";
+  ss << "\"macro_library_misses\":" << g_macroLibraryMisses.load() << ",";
+  ss << "\"injected_keys_held\":" << InjectedKeysHeld() << ",";
+  ss << "\"injections_suppressed\":" << g_injectSuppressed.load() << ",";
+  ss << "\"layer_actions\":" << g_layerActions.load() << ",";
+  ss << "\"gesture_strokes\":" << g_gestureStrokes.load() << ",";
+  ss << "\"gesture_misses\":" << g_gestureMisses.load() << ",";
+  ss << "\"wheel_events\":" << g_wheelEvents.load() << ",";
+  ss << "\"wheel_actions\":" << g_wheelActions.load() << ",";
+  ss << "\"smooth_scroll_frames\":" << g_smoothScrollFrames.load() << ",";
+  const unsigned long long correlated = g_deviceCorrelations.load();
+  const unsigned long long inferred = g_deviceInferred.load();
+  ss << "\"device_correlations\":" << correlated << ",";
+  ss << "\"device_inferred\":" << inferred << ",";
+  ss << "\"device_mismatches\":" << g_deviceMismatches.load() << ",";
+  ss << "\"device_ring_drains\":" << g_deviceRingDrains.load() << ",";
+  ss << "\"device_correlate_ns\":"
+     << (correlated + inferred
+             ? g_deviceCorrelateNs.load() / (correlated + inferred)
+             : 0)
+     << ",";
+  ss << "\"launches\":" << g_launcher.launches.load() << ",";
+  ss << "\"launch_failures\":" << g_launcher.failures.load() << ",";
+  ss << "\"launch_coalesced\":" << g_launcher.coalesced.load() << ",";
+  ss << "\"launch_children\":" << g_launcher.children.load() << ",";
+  ss << "\"launch_p50_us\":"
+     << nexus_launch::LatencyPercentile(g_launcher, 50) << ",";
+  ss << "\"launch_p95_us\":"
+     << nexus_launch::LatencyPercentile(g_launcher, 95) << ",";
+  ss << "\"launch_p99_us\":"
+     << nexus_launch::LatencyPercentile(g_launcher, 99) << ",";
+  ss << "\"button_presses\":" << g_buttonPresses.load() << ",";
+  ss << "\"telemetry_segment\":"
+     << (g_telemetryMapped.load() ? "true" : "false") << ",";
+  ss << "\"telemetry_publishes\":" << g_telemetryPublishes.load() << ",";
+  ss << "\"telemetry_tier\":\""
+     << (g_telemetryDetailed.load() ? "detailed" : "minimal") << "\",";
+  ss << "\"telemetry_tier_changes\":" << g_telemetryTierChanges.load() << ",";
+  ss << "\"raw_input_registered\":"
+     << (g_rawInputRegistered.load() ? "true" : "false") << ",";
+  ss << "\"keyboard_hook\":"
+     << (g_keyboardHookInstalled.load() ? "true" : "false") << ",";
+  ss << "\"sched_applied\":" << g_schedApplied.load() << ",";
+  ss << "\"sched_failures\":" << g_schedFailures.load() << ",";
+  ss << "\"mmcss_active\":" << (g_mmcssActive.load() ? "true" : "false")
+     << ",";
+  ss << "\"config_path\":\"" << JsonEscape(g_configPath) << "\"";
+  ss << "}";
+  return ss.str();
+}
+
+const char *AllocSubsystemName(size_t i) {
+  return i == 0 ? "other" : kServiceThreadNames[i - 1];
+}
+
+long long HeapLiveBytes() {
+  long long live = 0;
+  for (const AllocCounters &c : g_allocCounters) {
+    live += c.liveBytes.load(std::memory_order_relaxed);
+  }
+  return live;
+}
+
+// GET /status/memory: heap use per subsystem (see AllocCounters) and the
+// process working set.
+std::string BuildMemoryJson() {
+  PROCESS_MEMORY_COUNTERS mem = {};
+  mem.cb = sizeof(mem);
+  GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem));
+  std::ostringstream ss;
+  ss << "{\"working_set_bytes\":" << mem.WorkingSetSize
+     << ",\"peak_working_set_bytes\":" << mem.PeakWorkingSetSize
+     << ",\"heap_tracking\":"
+     << (g_allocTracking.load() ? "true" : "false")
+     << ",\"heap_live_bytes\":" << HeapLiveBytes()
+     << ",\"heap_allocs\":" << g_heapAllocs.load() << ",\"subsystems\":[";
+  for (size_t i = 0; i < kAllocSubsystems; ++i) {
+    const AllocCounters &c = g_allocCounters[i];
+    ss << (i ? "," : "") << "{\"name\":\"" << AllocSubsystemName(i)
+       << "\",\"allocs\":" << c.allocs.load()
+       << ",\"frees\":" << c.frees.load()
+       << ",\"alloc_bytes\":" << c.allocBytes.load()
+       << ",\"live_bytes\":" << c.liveBytes.load()
+       << ",\"peak_live_bytes\":" << c.peakBytes.load() << "}";
+  }
+  ss << "]}";
+  return ss.str();
+}
+
+std::string BuildConfigJson() {
+  const std::shared_ptr<const Config> snapshot = CurrentConfig();
+  const Config &cfg = *snapshot;
+  std::ostringstream ss;
+  ss << "{";
+  ss << "\"button4\":\"" << JsonEscape(ActionToConfigValue(cfg.button4))
+     << "\",";
+  ss << "\"button5\":\"" << JsonEscape(ActionToConfigValue(cfg.button5))
+     << "\",";
+  ss << "\"suspend_fullscreen\":"
+     << (cfg.suspendInFullscreen ? "true" : "false") << ",";
+  ss << "\"motion_rescale\":" << (cfg.motionRescale ? "true" : "false")
+     << ",";
+  ss << "\"dpi\":" << cfg.dpi << ",";
+  ss << "\"dpi_presets\":\"" << IntListToString(cfg.dpiPresets) << "\",";
+  ss << "\"dpi_preset\":" << cfg.dpiPreset << ",";
+  ss << "\"sensitivity\":" << cfg.sensitivity << ",";
+  ss << "\"accel\":\"" << AccelCurveToString(cfg.accel) << "\",";
+  ss << "\"accel_rate\":" << cfg.accelRate << ",";
+  ss << "\"accel_offset\":" << cfg.accelOffset << ",";
+  ss << "\"accel_cap\":" << cfg.accelCap << ",";
+  ss << "\"accel_exponent\":" << cfg.accelExponent << ",";
+  ss << "\"wheel_notch\":" << cfg.wheelNotch << ",";
+  ss << "\"wheel_speed\":" << cfg.wheelSpeed << ",";
+  ss << "\"wheel_smooth\":" << (cfg.wheelSmooth ? "true" : "false")
+     << ",";
+  ss << "\"wheel_invert\":" << (cfg.wheelInvert ? "true" : "false")
+     << ",";
+  ss << "\"device_scales\":\""
+     << JsonEscape(DeviceScalesToString(cfg.deviceScales)) << "\",";
+  ss << "\"launch_on_startup\":"
+     << (IsLaunchOnStartupEnabled() ? "true" : "false");
+  ss << "}";
+  return ss.str();
+}
+
+std::string BuildProfilesJson() {
+  const std::shared_ptr<const Config> snapshot = CurrentConfig();
+  const Config &cfg = *snapshot;
+  std::ostringstream ss;
+  ss << "{";
+  ss << "\"active\":\"" << JsonEscape(ActiveProfileName()) << "\",";
+  ss << "\"profiles\":[";
+  for (size_t i = 0; i < cfg.profiles.size(); ++i) {
+    const Profile &profile = cfg.profiles[i];
+    ss << (i ? "," : "") << "{";
+    ss << "\"name\":\"" << JsonEscape(profile.name) << "\",";
+    ss << "\"match_exe\":\"" << JsonEscape(JoinStrings(profile.matchExe, ","))
+       << "\",";
+    ss << "\"match_class\":\""
+       << JsonEscape(JoinStrings(profile.matchClass, ",")) << "\",";
+    ss << "\"match_device\":\"" << DeviceIdsToString(profile.matchDevice)
+       << "\",";
+    ss << "\"button4\":\"" << JsonEscape(ActionToConfigValue(profile.button4))
+       << "\",";
+    ss << "\"button5\":\"" << JsonEscape(ActionToConfigValue(profile.button5))
+       << "\"";
+    ss << "}";
+  }
+  ss << "]}";
+  return ss.str();
+}
+
+std::string JsonUnescape(const std::string &s) {
+  std::string out;
+  out.reserve(s.size());
+  bool esc = false;
+  for (char c : s) {
+    if (!esc) {
+      if (c == '\\') {
+        esc = true;
+      } else {
+        out.push_back(c);
+      }
+      continue;
+    }
+
+    switch (c) {
+    case '\\':
+      out.push_back('\\');
+      break;
+    case '"':
+      out.push_back('"');
+      break;
+    case 'n':
+      out.push_back('\n');
+      break;
+    case 'r':
+      out.push_back('\r');
+      break;
+    case 't':
+      out.push_back('\t');
+      break;
+    default:
+      out.push_back(c);
+      break;
+    }
+    esc = false;
+  }
+  return out;
+}
+
+bool ExtractJsonString(const std::string &body, const std::string &key,
+                       std::string &out) {
+  const std::string needle = "\"" + key + "\"";
+  const size_t k = body.find(needle);
+  if (k == std::string::npos) {
+    return false;
+  }
+  size_t colon = body.find(':', k + needle.size());
+  if (colon == std::string::npos) {
+    return false;
+  }
+  size_t q1 = body.find('"', colon + 1);
+  if (q1 == std::string::npos) {
+    return false;
+  }
+  size_t i = q1 + 1;
+  bool esc = false;
+  for (; i < body.size(); ++i) {
+    char c = body[i];
+    if (esc) {
+      esc = false;
+      continue;
+    }
+    if (c == '\\') {
+      esc = true;
+      continue;
+    }
+    if (c == '"') {
+      break;
+    }
+  }
+  if (i >= body.size()) {
+    return false;
+  }
+  out = JsonUnescape(body.substr(q1 + 1, i - q1 - 1));
+  return true;
+}
+
+bool ExtractJsonBool(const std::string &body, const std::string &key,
+                     bool &out) {
+  const std::string needle = "\"" + key + "\"";
+  const size_t k = body.find(needle);
+  if (k == std::string::npos) {
+    return false;
+  }
+  size_t colon = body.find(':', k + needle.size());
+  if (colon == std::string::npos) {
+    return false;
+  }
+  size_t v = body.find_first_not_of(" \t\r\n", colon + 1);
+  if (v == std::string::npos) {
+    return false;
+  }
+  if (body.compare(v, 4, "true") == 0) {
+    out = true;
+    return true;
+  }
+  if (body.compare(v, 5, "false") == 0) {
+    out = false;
+    return true;
+  }
+  return false;
+}
+
+bool ExtractJsonInt(const std::string &body, const std::string &key, int &out) {
+  const std::string needle = "\"" + key + "\"";
+  const size_t k = body.find(needle);
+  if (k == std::string::npos) {
+    return false;
+  }
+  size_t colon = body.find(':', k + needle.size());
+  if (colon == std::string::npos) {
+    return false;
+  }
+  size_t v = body.find_first_not_of(" \t\r\n", colon + 1);
+  if (v == std::string::npos) {
+    return false;
+  }
+  out = std::atoi(body.c_str() + v);
+  return true;
+}
+
+bool ExtractJsonDouble(const std::string &body, const std::string &key,
+                       double &out) {
+  const std::string needle = "\"" + key + "\"";
+  const size_t k = body.find(needle);
+  if (k == std::string::npos) {
+    return false;
+  }
+  size_t colon = body.find(':', k + needle.size());
+  if (colon == std::string::npos) {
+    return false;
+  }
+  size_t v = body.find_first_not_of(" \t\r\n", colon + 1);
+  if (v == std::string::npos) {
+    return false;
+  }
+  out = std::atof(body.c_str() + v);
+  return true;
+}
+
+bool ApplyConfigJson(const std::string &body, std::string &error) {
+  AllocScope alloc(kThreadConfig);
+  std::lock_guard<std::mutex> lock(g_configWriteMutex);
+  const std::shared_ptr<const Config> current = CurrentConfig();
+  std::string b4;
+  std::string b5;
+  bool fullscreen = current->suspendInFullscreen;
+
+  if (!ExtractJsonString(body, "button4", b4) ||
+      !ExtractJsonString(body, "button5", b5)) {
+    error = "missing button mapping";
+    return false;
+  }
+  (void)ExtractJsonBool(body, "suspend_fullscreen", fullscreen);
+
+  int dpi = current->dpi;
+  (void)ExtractJsonInt(body, "dpi", dpi);
+
+  Action a4;
+  Action a5;
+  if (!ParseAction(b4, a4) || !ParseAction(b5, a5)) {
+    error = "invalid action syntax";
+    return false;
+  }
+
+  Config next = *current;
+  next.button4 = a4;
+  next.button5 = a5;
+  next.suspendInFullscreen = fullscreen;
+  next.dpi = dpi;
+
+  std::string text;
+  if (ExtractJsonString(body, "dpi_presets", text)) {
+    next.dpiPresets = ParseIntList(text);
+  }
+  (void)ExtractJsonBool(body, "motion_rescale", next.motionRescale);
+  (void)ExtractJsonInt(body, "dpi_preset", next.dpiPreset);
+  (void)ExtractJsonDouble(body, "sensitivity", next.sensitivity);
+  if (ExtractJsonString(body, "accel", text)) {
+    next.accel = ParseAccelCurve(text);
+  }
+  (void)ExtractJsonDouble(body, "accel_rate", next.accelRate);
+  (void)ExtractJsonDouble(body, "accel_offset", next.accelOffset);
+  (void)ExtractJsonDouble(body, "accel_cap", next.accelCap);
+  (void)ExtractJsonDouble(body, "accel_exponent", next.accelExponent);
+  (void)ExtractJsonInt(body, "wheel_notch", next.wheelNotch);
+  (void)ExtractJsonDouble(body, "wheel_speed", next.wheelSpeed);
+  (void)ExtractJsonBool(body, "wheel_smooth", next.wheelSmooth);
+  (void)ExtractJsonBool(body, "wheel_invert", next.wheelInvert);
+  if (ExtractJsonString(body, "device_scales", text)) {
+    next.deviceScales.clear();
+    for (const std::string &part : Split(text, ';')) {
+      DeviceScale ds;
+      if (ParseDeviceScale(part, ds)) {
+        next.deviceScales.push_back(ds);
+      }
+    }
+  }
+
+  if (!ValidateConfig(next, error)) {
+    return false;
+  }
+
+  bool startup = false;
+  if (ExtractJsonBool(body, "launch_on_startup", startup)) {
+    SetLaunchOnStartup(startup);
+  }
+
+  RequestConfigSave(CommitConfig(std::move(next)));
+  return true;
+}
+
+// PATCH /config/binding, same-origin only (TrustedOrigin)
+// {"button":"button4|...|wheel_right","action":"keys:CTRL+C"
+//  [,"profile":"<name>"]
+//  [,"layer":"<trigger key>"]}
+bool ApplyBindingPatch(const std::string &body, std::string &error) {
+  AllocScope alloc(kThreadConfig);
+  std::lock_guard<std::mutex> lock(g_configWriteMutex);
+  std::string button;
+  std::string value;
+  if (!ExtractJsonString(body, "button", button) ||
+      !ExtractJsonString(body, "action", value)) {
+    error = "missing button or action";
+    return false;
+  }
+  Binding binding = kBindButton4;
+  if (!ParseBindingName(ToUpper(button), binding)) {
+    error = "unknown button";
+    return false;
+  }
+  LayerBinding layer;
+  std::string layerName;
+  if (ExtractJsonString(body, "layer", layerName) && !layerName.empty()) {
+    layer.trigger = KeyNameToVk(layerName);
+    if (layer.trigger == 0) {
+      error = "unknown layer trigger";
+      return false;
+    }
+    layer.binding = binding;
+  }
+
+  Action action;
+  if (!ParseAction(value, action)) {
+    error = "invalid action syntax";
+    return false;
+  }
+
+  Config next = *CurrentConfig();
+  Action *slot = &BindingAction(next, binding);
+  std::vector<LayerBinding> *layers = &next.layers;
+  std::string profileName;
+  if (ExtractJsonString(body, "profile", profileName) &&
+      !profileName.empty()) {
+    auto it = std::find_if(
+        next.profiles.begin(), next.profiles.end(),
+        [&](const Profile &profile) { return profile.name == profileName; });
+    if (it == next.profiles.end()) {
+      error = "unknown profile";
+      return false;
+    }
+    slot = &BindingAction(*it, binding);
+    layers = &it->layers;
+  }
+  if (layer.trigger == 0) {
+    *slot = std::move(action);
+  } else {
+    layer.action = std::move(action);
+    SetLayerBinding(*layers, std::move(layer));
+  }
+  if (!ValidateConfig(next, error)) {
+    return false;
+  }
+
+  RequestConfigSave(CommitConfig(std::move(next)));
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// Web UI: the pages are served by the status server under /ui/<build id>/ so
+// they share an origin with the API. tools/embed_ui.py compiles ui/ into
+// ui_assets.inc, precompressed; those responses never change under one build
+// id and are cached for good. Without it, ui/ next to the exe is served and
+// revalidated on every load.
+// ---------------------------------------------------------------------------
+
+struct UiAsset {
+  const char *name;
+  const char *type;
+  const char *etag; // quoted per encoding when sent
+  const unsigned char *identity;
+  size_t identitySize;
+  const unsigned char *gzip; // null when it would not be smaller
+  size_t gzipSize;
+  const unsigned char *brotli;
+  size_t brotliSize;
+};
+
+#if __has_include("ui_assets.inc")
+#include "ui_assets.inc"
+constexpr bool kUiEmbedded = true;
+
+// Whether an Accept-Encoding value lists |coding| without q=0.
+bool AcceptsEncoding(const std::string &accept, const char *coding) {
+  for (const std::string &part : Split(accept, ',')) {
+    const std::string token = Trim(part);
+    const size_t semi = token.find(';');
+    if (ToLower(Trim(token.substr(0, semi))) != coding) {
+      continue;
+    }
+    const size_t q = token.find("q=", semi);
+    return semi == std::string::npos || q == std::string::npos ||
+           std::atof(token.c_str() + q + 2) > 0.0;
+  }
+  return false;
+}
+#else
+constexpr char kUiBuildId[] = "dev";
+constexpr bool kUiEmbedded = false;
+
+const char *UiContentType(const std::string &name) {
+  const size_t dot = name.rfind('.');
+  const std::string ext = dot == std::string::npos ? "" : name.substr(dot);
+  if (ext == ".html") {
+    return "text/html; charset=utf-8";
+  }
+  if (ext == ".css") {
+    return "text/css; charset=utf-8";
+  }
+  if (ext == ".js") {
+    return "text/javascript; charset=utf-8";
+  }
+  return "application/octet-stream";
+}
+#endif
+
+std::string UiPageUrl(const char *page) {
+  return "http://127.0.0.1:" + std::to_string(kStatusPort) + "/ui/" +
+         kUiBuildId + "/" + page;
+}
+
+// Trimmed value of header |name| (case-insensitive), "" if absent.
+std::string RequestHeader(const std::string &request, const char *name) {
+  const size_t headerEnd = request.find("\r\n\r\n");
+  const std::string lower = ToLower(request.substr(0, headerEnd));
+  const std::string needle = "\r\n" + ToLower(name) + ":";
+  const size_t k = lower.find(needle);
+  if (k == std::string::npos) {
+    return "";
+  }
+  const size_t v = request.find_first_not_of(" \t", k + needle.size());
+  const size_t end = request.find("\r\n", k + needle.size());
+  return v >= end ? "" : request.substr(v, end - v);
+}
+
+// GET /ui/<build id>/<file>. Any other /ui/ path, including one from an older
+// build, redirects to the current build's copy of its last component.
+void BuildUiResponse(const std::string &request, std::string &code,
+                     std::string &type, std::string &body,
+                     std::string &headers) {
+  const size_t start = request.find(' ') + 1;
+  const std::string path =
+      request.substr(start, request.find_first_of(" ?#\r", start) - start);
+  const std::string prefix = std::string("/ui/") + kUiBuildId + "/";
+  if (path.rfind(prefix, 0) != 0) {
+    const size_t slash = path.find_last_of('/');
+    const std::string page = slash + 1 < path.size() && slash >= 3
+                                 ? path.substr(slash + 1)
+                                 : "remapper.html";
+    code = "302 Found";
+    headers = "Location: " + prefix + page + "\r\nCache-Control: no-cache\r\n";
+    return;
+  }
+  const std::string name = path.substr(prefix.size());
+
+  const unsigned char *data = nullptr;
+  size_t size = 0;
+  const char *encoding = nullptr;
+  std::string etag;
+#if __has_include("ui_assets.inc")
+  const std::string accept = RequestHeader(request, "Accept-Encoding");
+  for (const UiAsset &asset : kUiAssets) {
+    if (name != asset.name) {
+      continue;
+    }
+    type = asset.type;
+    etag = asset.etag;
+    data = asset.identity;
+    size = asset.identitySize;
+    if (asset.brotli && AcceptsEncoding(accept, "br")) {
+      data = asset.brotli;
+      size = asset.brotliSize;
+      encoding = "br";
+    } else if (asset.gzip && AcceptsEncoding(accept, "gzip")) {
+      data = asset.gzip;
+      size = asset.gzipSize;
+      encoding = "gzip";
+    }
+  }
+#else
+  std::string file;
+  if (name.find_first_of("/\\:") == std::string::npos &&
+      name.find("..") == std::string::npos &&
+      ReadFileBytes(GetExeDir() + "\\ui\\" + name, file)) {
+    type = UiContentType(name);
+    char hex[17] = {};
+    std::snprintf(hex, sizeof(hex), "%016llx",
+                  static_cast<unsigned long long>(
+                      Fnv1a64(file.data(), file.size())));
+    etag = hex;
+    data = reinterpret_cast<const unsigned char *>(file.data());
+    size = file.size();
+  }
+#endif
+  if (!data) {
+    code = "404 Not Found";
+    body = "{\"error\":\"not_found\"}";
+    return;
+  }
+
+  etag = "\"" + etag + (encoding ? std::string("-") + encoding : "") + "\"";
+  headers = "ETag: " + etag + "\r\nVary: Accept-Encoding\r\n";
+  headers += kUiEmbedded
+                 ? "Cache-Control: public, max-age=31536000, immutable\r\n"
+                 : "Cache-Control: no-cache\r\n";
+  if (encoding) {
+    headers += std::string("Content-Encoding: ") + encoding + "\r\n";
+  }
+  const std::string match = RequestHeader(request, "If-None-Match");
+  if (match == "*" || match.find(etag) != std::string::npos) {
+    code = "304 Not Modified";
+    return;
+  }
+  body.assign(reinterpret_cast<const char *>(data), size);
+}
+
+// Whether a request that writes, or opens a dialog, comes from the pages
+// themselves. The API sends no CORS headers, so other sites cannot read its
+// replies, but a browser still delivers their form posts and no-cors fetches.
+// Those carry a foreign Origin, or Sec-Fetch-Site when there is none; tools
+// such as curl send neither.
+bool TrustedOrigin(const std::string &request) {
+  const std::string origin = RequestHeader(request, "Origin");
+  if (!origin.empty()) {
+    return origin == "http://127.0.0.1:" + std::to_string(kStatusPort);
+  }
+  const std::string site = ToLower(RequestHeader(request, "Sec-Fetch-Site"));
+  return site.empty() || site == "same-origin" || site == "none";
+}
+
+void HandleStatusClient(SOCKET client) {
+  std::string r;
+  r.reserve(4096);
+  char chunk[2048] = {};
+  int contentLength = -1;
+  size_t headerEnd = std::string::npos;
+
+  while (true) {
+    const int got = recv(client, chunk, sizeof(chunk), 0);
+    if (got <= 0) {
+      break;
+    }
+    r.append(chunk, chunk + got);
+
+    if (headerEnd == std::string::npos) {
+      headerEnd = r.find("\r\n\r\n");
+      if (headerEnd != std::string::npos) {
+        const std::string h = r.substr(0, headerEnd);
+        const std::string key = "Content-Length:";
+        size_t p = h.find(key);
+        if (p != std::string::npos) {
+          p += key.size();
+          while (p < h.size() && (h[p] == ' ' || h[p] == '\t')) {
+            ++p;
+          }
+          contentLength = std::atoi(h.c_str() + p);
+        } else {
+          contentLength = 0;
+        }
+      }
+    }
+
+    if (headerEnd != std::string::npos && contentLength >= 0) {
+      const size_t haveBody = r.size() - (headerEnd + 4);
+      if (haveBody >= static_cast<size_t>(contentLength)) {
+        break;
+      }
+    }
+  }
+
+  if (r.empty()) {
+    return;
+  }
+  std::string body;
+  std::string code = "200 OK";
+  std::string type = "application/json";
+  std::string headers;
+  const bool ui = r.rfind("GET /ui", 0) == 0;
+  const bool privileged = r.rfind("POST ", 0) == 0 ||
+                          r.rfind("PATCH ", 0) == 0 ||
+                          r.rfind("GET /browse", 0) == 0;
+
+  if (ui) {
+    BuildUiResponse(r, code, type, body, headers);
+  } else if (privileged && !TrustedOrigin(r)) {
+    code = "403 Forbidden";
+    body = "{\"error\":\"forbidden_origin\"}";
+  } else if (r.rfind("GET /status/memory", 0) == 0) {
+    body = BuildMemoryJson();
+  } else if (r.rfind("GET /status", 0) == 0) {
+    RenewTelemetryLease();
+    body = BuildStatusJson();
+  } else if (r.rfind("GET /profiles", 0) == 0) {
+    body = BuildProfilesJson();
+  } else if (r.rfind("GET /history", 0) == 0) {
+    RenewTelemetryLease();
+    if (!BuildHistoryResponse(r, body, type)) {
+      code = "400 Bad Request";
+    }
+  } else if (r.rfind("GET /config", 0) == 0) {
+    body = BuildConfigJson();
+  } else if (r.rfind("POST /config", 0) == 0) {
+    const size_t sep = r.find("\r\n\r\n");
+    std::string reqBody = (sep == std::string::npos) ? "" : r.substr(sep + 4);
+    std::string err;
+    if (ApplyConfigJson(reqBody, err)) {
+      body = "{\"ok\":true}";
+    } else {
+      code = "400 Bad Request";
+      body = "{\"ok\":false,\"error\":\"" + JsonEscape(err) + "\"}";
+    }
+  } else if (r.rfind("PATCH /config/binding", 0) == 0) {
+    const size_t sep = r.find("\r\n\r\n");
+    std::string reqBody = (sep == std::string::npos) ? "" : r.substr(sep + 4);
+    std::string err;
+    if (ApplyBindingPatch(reqBody, err)) {
+      body = "{\"ok\":true}";
+    } else {
+      code = "400 Bad Request";
+      body = "{\"ok\":false,\"error\":\"" + JsonEscape(err) + "\"}";
+    }
+  } else if (r.rfind("GET /browse", 0) == 0) {
+    char path[MAX_PATH] = {};
+    OPENFILENAMEA ofn = {};
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = nullptr;
+    ofn.lpstrFile = path;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrFilter = "Applications (*.exe)\0*.exe\0All Files (*.*)\0*.*\0";
+    ofn.nFilterIndex = 1;
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST | OFN_NOCHANGEDIR;
+
+    if (GetOpenFileNameA(&ofn)) {
+      body = "{\"ok\":true, \"path\":\"" + JsonEscape(path) + "\"}";
+    } else {
+      body = "{\"ok\":false}";
+    }
+  } else {
+    code = "404 Not Found";
+    type = "application/json";
+    body = "{\"error\":\"not_found\"}";
+  }
+
+  std::ostringstream resp;
+  resp << "HTTP/1.1 " << code << "\r\n";
+  resp << "Content-Type: " << type << "\r\n";
+  resp << headers;
+  resp << "Connection: close\r\n";
+  resp << "Content-Length: " << body.size() << "\r\n\r\n";
+  resp << body;
+  const std::string out = resp.str();
+  send(client, out.c_str(), static_cast<int>(out.size()), 0);
+}
+
+void StatusServerThreadProc() {
+  ScopedServiceThread sched(kThreadServer);
+  WSADATA wsa = {};
+  if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+    return;
+  }
+
+  SOCKET listenSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (listenSock == INVALID_SOCKET) {
+    WSACleanup();
+    return;
+  }
+  g_statusListenSocket.store(listenSock);
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(kStatusPort);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+  int yes = 1;
+  setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR,
+             reinterpret_cast<const char *>(&yes), sizeof(yes));
+  if (bind(listenSock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ==
+          SOCKET_ERROR ||
+      listen(listenSock, 4) == SOCKET_ERROR) {
+    closesocket(listenSock);
+    g_statusListenSocket.store(INVALID_SOCKET);
+    WSACleanup();
+    return;
+  }
+
+  while (!g_statusServerStop.load()) {
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(listenSock, &set);
+    timeval tv = {0, 250000};
+    const int sel = select(0, &set, nullptr, nullptr, &tv);
+    if (sel <= 0) {
+      continue;
+    }
+
+    SOCKET client = accept(listenSock, nullptr, nullptr);
+    if (client == INVALID_SOCKET) {
+      continue;
+    }
+    HandleStatusClient(client);
+    closesocket(client);
+  }
+
+  closesocket(listenSock);
+  g_statusListenSocket.store(INVALID_SOCKET);
+  WSACleanup();
+}
+
+void StartStatusServer() {
+  g_statusServerStop.store(false);
+  g_statusServerThread = std::thread(StatusServerThreadProc);
+}
+
+void StopStatusServer() {
+  g_statusServerStop.store(true);
+  const SOCKET s = g_statusListenSocket.load();
+  if (s != INVALID_SOCKET) {
+    closesocket(s);
+  }
+  if (g_statusServerThread.joinable()) {
+    g_statusServerThread.join();
+  }
+}
+
+std::string ActionTypeToString(ActionType type) {
+  switch (type) {
+  case ActionType::Keys:
+    return "keys";
+  case ActionType::Run:
+    return "run";
+  case ActionType::Open:
+    return "open";
+  case ActionType::Text:
+    return "text";
+  case ActionType::Macro:
+    return "macro";
+  case ActionType::Dpi:
+    return "dpi";
+  case ActionType::DpiShift:
+    return "dpishift";
+  default:
+    return "none";
+  }
+}
+
+std::string KeysToString(const std::vector<WORD> &keys) {
+  std::string out;
+  out.reserve(keys.size() * 8);
+  for (WORD vk : keys) {
+    if (!out.empty()) {
+      out += '+';
+    }
+    const char *name = (vk < 256) ? kVkNames.names[vk] : nullptr;
+    if (name) {
+      out += name;
+    } else {
+      out += std::to_string(vk);
+    }
+  }
+  return out;
+}
+
+std::string ActionToConfigValue(const Action &action) {
+  if (action.type == ActionType::None) {
+    return "none:";
+  }
+
+  if (action.type == ActionType::Keys) {
+    return "keys:" + KeysToString(action.keys);
+  }
+
+  return ActionTypeToString(action.type) + ":" + action.payload;
+}
+
+bool ParseAction(const std::string &rawValue, Action &action) {
+  action = {};
+  std::string value = Trim(rawValue);
+  if (value.empty()) {
+    return false;
+  }
+
+  const auto colon = value.find(':');
+  if (colon == std::string::npos) {
+    return false;
+  }
+
+  std::string type = ToUpper(Trim(value.substr(0, colon)));
+  std::string payload = Trim(value.substr(colon + 1));
+
+  if (type == "NONE") {
+    action.type = ActionType::None;
+    return true;
+  }
+
+  if (type == "KEYS") {
+    std::vector<WORD> keys;
+    if (!ParseKeys(payload, keys)) {
+      return false;
+    }
+    action.type = ActionType::Keys;
+    action.inputs = BuildComboInputs(keys);
+    action.keys = std::move(keys);
+    return true;
+  }
+
+  if (type == "RUN") {
+    action.type = ActionType::Run;
+    action.payload = payload;
+    return !action.payload.empty();
+  }
+
+  if (type == "OPEN") {
+    action.type = ActionType::Open;
+    action.payload = payload;
+    return !action.payload.empty();
+  }
+
+  if (type == "TEXT") {
+    action.type = ActionType::Text;
+    action.payload = payload;
+    return !action.payload.empty();
+  }
+
+  if (type == "MACRO") {
+    action.type = ActionType::Macro;
+    action.payload = payload;
+    if (LibraryMacroId(payload) != 0) {
+      return true; // macro:@<id>, resolved from the library at playback
+    }
+    std::vector<MacroOp> ops;
+    if (!CompileMacro(action.payload, ops)) {
+      return false;
+    }
+    action.macro = std::make_shared<const std::vector<MacroOp>>(std::move(ops));
+    return true;
+  }
+
+  if (type == "DPI") {
+    // dpi:next, dpi:prev or dpi:<preset index>
+    action.type = ActionType::Dpi;
+    action.payload = ToLower(payload);
+    return action.payload == "next" || action.payload == "prev" ||
+           (!action.payload.empty() &&
+            action.payload.find_first_not_of("0123456789") ==
+                std::string::npos);
+  }
+
+  if (type == "DPISHIFT") {
+    // dpishift:<dpi> runs at <dpi> while the button is held
+    action.type = ActionType::DpiShift;
+    action.payload = payload;
+    return std::atoi(payload.c_str()) > 0;
+  }
+
+  return false;
+}
+
+void WriteDefaultConfigIfMissing(const std::string &path) {
+  std::ifstream probe(path);
+  if (probe.good()) {
+    return;
+  }
+
+  std::ofstream out(path);
+  out << "# Mouse side button remap config\n";
+  out << "# button4 / button5 syntax: <type>:<value>\n";
+  out << "# types: none, keys, run, open, text, macro, dpi, dpishift\n";
+  out << "# dpi:next / dpi:prev / dpi:<index> cycles through dpi_presets\n";
+  out << "# dpishift:<dpi> switches to <dpi> while the button is held\n";
+  out << "# DPI presets, sensitivity and accel need motion_rescale=true\n";
+  out << "# wheel_up / wheel_down / wheel_left / wheel_right take the same\n";
+  out << "# actions and fire once per wheel_notch (120 = one wheel click)\n";
+  out << "# wheel_speed, wheel_smooth and wheel_invert shape unbound scroll\n";
+  out << "# suspend_fullscreen=true disables remap when a fullscreen window is "
+         "active\n\n";
+  out << "button4=keys:CTRL+C\n";
+  out << "button5=keys:ALT+TAB\n";
+  out << "suspend_fullscreen=true\n\n";
+  out << "# Per-application profiles override button4/button5 while a\n";
+  out << "# matching window is in the foreground, e.g.\n";
+  out << "# [profile:Games]\n";
+  out << "# match_exe=game.exe,other.exe\n";
+  out << "# match_class=UnrealWindow\n";
+  out << "# match_device=046D:C08B (only clicks from this mouse)\n";
+  out << "# button4=dpishift:400\n";
+  out << "#\n";
+  out << "# Chord layers apply while a key or mouse button is held, e.g.\n";
+  out << "# layer.shift.button4=keys:CTRL+Z\n";
+  out << "# layer.xbutton2.button5=dpi:next\n";
+}
+
+constexpr const char *kBindingNames[kBindingCount] = {
+    "button4",    "button5",    "wheel_up",
+    "wheel_down", "wheel_left", "wheel_right"};
+
+const char *BindingName(Binding binding) { return kBindingNames[binding]; }
+
+bool ParseBindingName(const std::string &upper, Binding &binding) {
+  for (size_t i = 0; i < kBindingCount; ++i) {
+    if (upper == ToUpper(kBindingNames[i])) {
+      binding = static_cast<Binding>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ParseBoolValue(const std::string &value) {
+  const std::string b = ToUpper(value);
+  return b == "1" || b == "TRUE" || b == "YES" || b == "ON";
+}
+
+// |key| is the upper-cased "LAYER.<trigger>.<binding>".
+bool ParseLayerBinding(const std::string &key, const std::string &value,
+                       LayerBinding &layer) {
+  const auto dot = key.rfind('.');
+  if (dot <= 6) {
+    return false;
+  }
+  layer.trigger = KeyNameToVk(key.substr(6, dot - 6));
+  return layer.trigger != 0 &&
+         ParseBindingName(key.substr(dot + 1), layer.binding) &&
+         ParseAction(value, layer.action);
+}
+
+// Adds or replaces the binding for (trigger, binding); a none: action
+// removes it.
+void SetLayerBinding(std::vector<LayerBinding> &layers, LayerBinding layer) {
+  auto it = std::find_if(layers.begin(), layers.end(),
+                         [&](const LayerBinding &l) {
+                           return l.trigger == layer.trigger &&
+                                  l.binding == layer.binding;
+                         });
+  if (layer.action.type == ActionType::None) {
+    if (it != layers.end()) {
+      layers.erase(it);
+    }
+  } else if (it != layers.end()) {
+    *it = std::move(layer);
+  } else {
+    layers.push_back(std::move(layer));
+  }
+}
+
+// |key| is the upper-cased "GESTURE.<binding>.<stroke>".
+bool ParseGestureBinding(const std::string &key, const std::string &value,
+                         GestureBinding &gesture) {
+  const auto dot = key.find('.', 8);
+  return dot != std::string::npos &&
+         ParseBindingName(key.substr(8, dot - 8), gesture.binding) &&
+         gesture.binding < kBindWheelUp &&
+         ParseGestureStroke(key.substr(dot + 1), gesture.stroke) &&
+         ParseAction(value, gesture.action);
+}
+
+// Adds or replaces the binding for (binding, stroke); a none: action
+// removes it.
+void SetGestureBinding(std::vector<GestureBinding> &gestures,
+                       GestureBinding gesture) {
+  auto it = std::find_if(gestures.begin(), gestures.end(),
+                         [&](const GestureBinding &g) {
+                           return g.binding == gesture.binding &&
+                                  g.stroke == gesture.stroke;
+                         });
+  if (gesture.action.type == ActionType::None) {
+    if (it != gestures.end()) {
+      gestures.erase(it);
+    }
+  } else if (it != gestures.end()) {
+    *it = std::move(gesture);
+  } else {
+    gestures.push_back(std::move(gesture));
+  }
+}
+
+size_t CountLayerTriggers(const std::vector<LayerBinding> &layers) {
+  std::vector<WORD> seen;
+  for (const LayerBinding &layer : layers) {
+    if (std::find(seen.begin(), seen.end(), layer.trigger) == seen.end()) {
+      seen.push_back(layer.trigger);
+    }
+  }
+  return seen.size();
+}
+
+// Lines that cannot be parsed are skipped; when |error| is given the first
+// one is reported there as "line N: ...".
+Config ParseConfigText(const std::string &text, std::string *error = nullptr) {
+  Config cfg;
+
+  std::istringstream in(text);
+  std::string line;
+  Profile *profile = nullptr;
+  bool skipSection = false;
+  int lineNo = 0;
+  auto fail = [&](const std::string &what) {
+    if (error && error->empty()) {
+      *error = "line " + std::to_string(lineNo) + ": " + what;
+    }
+  };
+  while (std::getline(in, line)) {
+    ++lineNo;
+    std::string t = Trim(line);
+    if (t.empty() || t[0] == '#') {
+      continue;
+    }
+
+    if (t.front() == '[' && t.back() == ']') {
+      const std::string section = Trim(t.substr(1, t.size() - 2));
+      profile = nullptr;
+      skipSection = true;
+      if (ToUpper(section).rfind("PROFILE:", 0) == 0) {
+        Profile p;
+        p.name = Trim(section.substr(8));
+        if (!p.name.empty()) {
+          cfg.profiles.push_back(p);
+          profile = &cfg.profiles.back();
+          skipSection = false;
+        }
+      }
+      continue;
+    }
+
+    const auto eq = t.find('=');
+    if (eq == std::string::npos) {
+      fail("expected key=value");
+      continue;
+    }
+    if (skipSection) {
+      continue;
+    }
+
+    std::string key = ToUpper(Trim(t.substr(0, eq)));
+    std::string value = Trim(t.substr(eq + 1));
+
+    if (profile) {
+      Action action;
+      Binding binding = kBindButton4;
+      if (key == "MATCH_EXE") {
+        for (const std::string &exe : Split(value, ',')) {
+          if (!Trim(exe).empty()) {
+            profile->matchExe.push_back(ToLower(Trim(exe)));
+          }
+        }
+      } else if (key == "MATCH_CLASS") {
+        for (const std::string &cls : Split(value, ',')) {
+          if (!Trim(cls).empty()) {
+            profile->matchClass.push_back(Trim(cls));
+          }
+        }
+      } else if (key == "MATCH_DEVICE") {
+        for (const std::string &part : Split(value, ',')) {
+          DeviceId id;
+          if (ParseDeviceId(part, id)) {
+            profile->matchDevice.push_back(id);
+          } else if (!Trim(part).empty()) {
+            fail("invalid match_device '" + Trim(part) + "'");
+          }
+        }
+      } else if (ParseBindingName(key, binding)) {
+        if (!ParseAction(value, action)) {
+          fail("invalid action '" + value + "'");
+        } else {
+          BindingAction(*profile, binding) = std::move(action);
+        }
+      } else if (key == "WHEEL_INVERT") {
+        profile->wheelInvert = ParseBoolValue(value) ? 1 : 0;
+      } else if (key == "MOTION_RESCALE") {
+        profile->motionRescale = ParseBoolValue(value) ? 1 : 0;
+      } else if (key.rfind("LAYER.", 0) == 0) {
+        LayerBinding layer;
+        if (ParseLayerBinding(key, value, layer)) {
+          SetLayerBinding(profile->layers, std::move(layer));
+        } else {
+          fail("invalid layer binding '" + t + "'");
+        }
+      } else if (key.rfind("GESTURE.", 0) == 0) {
+        GestureBinding gesture;
+        if (ParseGestureBinding(key, value, gesture)) {
+          SetGestureBinding(profile->gestures, std::move(gesture));
+        } else {
+          fail("invalid gesture binding '" + t + "'");
+        }
+      }
+      continue;
+    }
+
+    Binding binding = kBindButton4;
+    if (ParseBindingName(key, binding)) {
+      Action action;
+      if (!ParseAction(value, action)) {
+        fail("invalid action '" + value + "'");
+      } else {
+        BindingAction(cfg, binding) = std::move(action);
+      }
+    } else if (key.rfind("LAYER.", 0) == 0) {
+      LayerBinding layer;
+      if (ParseLayerBinding(key, value, layer)) {
+        SetLayerBinding(cfg.layers, std::move(layer));
+      } else {
+        fail("invalid layer binding '" + t + "'");
+      }
+    } else if (key.rfind("GESTURE.", 0) == 0) {
+      GestureBinding gesture;
+      if (ParseGestureBinding(key, value, gesture)) {
+        SetGestureBinding(cfg.gestures, std::move(gesture));
+      } else {
+        fail("invalid gesture binding '" + t + "'");
+      }
+    } else if (key == "GESTURE_DISTANCE") {
+      cfg.gestureDistance = std::atoi(value.c_str());
+    } else if (key == "GESTURE_FLICK_MS") {
+      cfg.gestureFlickMs = std::atoi(value.c_str());
+    } else if (key == "WHEEL_NOTCH") {
+      cfg.wheelNotch = std::atoi(value.c_str());
+    } else if (key == "WHEEL_SPEED") {
+      cfg.wheelSpeed = std::atof(value.c_str());
+    } else if (key == "WHEEL_SMOOTH") {
+      cfg.wheelSmooth = ParseBoolValue(value);
+    } else if (key == "WHEEL_INVERT") {
+      cfg.wheelInvert = ParseBoolValue(value);
+    } else if (key == "SUSPEND_FULLSCREEN") {
+      cfg.suspendInFullscreen = ParseBoolValue(value);
+    } else if (key == "MOTION_RESCALE") {
+      cfg.motionRescale = ParseBoolValue(value);
+    } else if (key == "PRIORITY_CLASS") {
+      if (!nexus_sched::ParsePriority(value, cfg.priorityClass)) {
+        fail("invalid priority_class '" + value + "'");
+      }
+    } else if (key.rfind("THREAD.", 0) == 0) {
+      ServiceThread thread = kThreadInput;
+      if (!ParseServiceThreadName(key.substr(7), thread) ||
+          !nexus_sched::ParseThreadPolicy(value, cfg.threads[thread])) {
+        fail("invalid thread policy '" + t + "'");
+      }
+    } else if (key == "MMCSS") {
+      cfg.mmcssTask = value;
+    } else if (key == "TELEMETRY") {
+      if (!ParseTelemetryMode(value, cfg.telemetry)) {
+        fail("invalid telemetry '" + value + "'");
+      }
+    } else if (key == "DPI") {
+      cfg.dpi = std::atoi(value.c_str());
+    } else if (key == "DPI_PRESETS") {
+      cfg.dpiPresets = ParseIntList(value);
+    } else if (key == "DPI_PRESET") {
+      cfg.dpiPreset = std::atoi(value.c_str());
+    } else if (key == "SENSITIVITY") {
+      cfg.sensitivity = std::atof(value.c_str());
+    } else if (key == "ACCEL") {
+      cfg.accel = ParseAccelCurve(value);
+    } else if (key == "ACCEL_RATE") {
+      cfg.accelRate = std::atof(value.c_str());
+    } else if (key == "ACCEL_OFFSET") {
+      cfg.accelOffset = std::atof(value.c_str());
+    } else if (key == "ACCEL_CAP") {
+      cfg.accelCap = std::atof(value.c_str());
+    } else if (key == "ACCEL_EXPONENT") {
+      cfg.accelExponent = std::atof(value.c_str());
+    } else if (key == "DEVICE_SCALE") {
+      DeviceScale ds;
+      if (ParseDeviceScale(value, ds)) {
+        cfg.deviceScales.push_back(ds);
+      } else {
+        fail("invalid device_scale '" + value + "'");
+      }
+    }
+  }
+
+  return cfg;
+}
+
+size_t CountMatchedDevices(const Config &cfg) {
+  std::vector<DeviceId> seen;
+  for (const Profile &profile : cfg.profiles) {
+    for (const DeviceId &id : profile.matchDevice) {
+      if (std::none_of(seen.begin(), seen.end(), [&](const DeviceId &s) {
+            return s.vid == id.vid && s.pid == id.pid;
+          })) {
+        seen.push_back(id);
+      }
+    }
+  }
+  return seen.size();
+}
+
+bool ValidateConfig(const Config &cfg, std::string &error) {
+  if (cfg.dpi <= 0) {
+    error = "dpi must be positive";
+  } else if (std::any_of(cfg.dpiPresets.begin(), cfg.dpiPresets.end(),
+                         [](int dpi) { return dpi <= 0; })) {
+    error = "dpi_presets must be positive";
+  } else if (!(cfg.sensitivity > 0.0)) {
+    error = "sensitivity must be positive";
+  } else if (!(cfg.accelCap >= 1.0) || cfg.accelRate < 0.0 ||
+             cfg.accelOffset < 0.0) {
+    error = "accel_cap must be >= 1 and accel_rate/accel_offset >= 0";
+  } else if (CountLayerTriggers(cfg.layers) > kMaxLayerTriggers ||
+             std::any_of(cfg.profiles.begin(), cfg.profiles.end(),
+                         [](const Profile &profile) {
+                           return CountLayerTriggers(profile.layers) >
+                                  kMaxLayerTriggers;
+                         })) {
+    error = "at most 8 layer triggers per section";
+  } else if (cfg.gestureDistance <= 0 || cfg.gestureFlickMs < 0) {
+    error = "gesture_distance must be positive and gesture_flick_ms >= 0";
+  } else if (cfg.wheelNotch <= 0 ||
+             !(cfg.wheelSpeed > 0.0 && cfg.wheelSpeed <= 100.0)) {
+    error = "wheel_notch must be positive and wheel_speed in (0, 100]";
+  } else if (CountMatchedDevices(cfg) > kMaxMappedDevices) {
+    error = "at most 8 match_device ids";
+  } else {
+    return true;
+  }
+  return false;
+}
+
+bool ReadFileBytes(const std::string &path, std::string &out) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  out = ss.str();
+  return true;
+}
+
+Config LoadConfig(const std::string &path) {
+  std::string text;
+  if (!ReadFileBytes(path, text)) {
+    return Config{};
+  }
+  return ParseConfigText(text);
+}
+
+void WriteLayerBindings(std::ostream &out,
+                        const std::vector<LayerBinding> &layers) {
+  for (const LayerBinding &layer : layers) {
+    out << "layer." << ToLower(KeysToString({layer.trigger})) << "."
+        << BindingName(layer.binding) << "="
+        << ActionToConfigValue(layer.action) << "\n";
+  }
+}
+
+void WriteGestureBindings(std::ostream &out,
+                          const std::vector<GestureBinding> &gestures) {
+  for (const GestureBinding &gesture : gestures) {
+    out << "gesture." << BindingName(gesture.binding) << "."
+        << GestureStrokeName(gesture.stroke) << "="
+        << ActionToConfigValue(gesture.action) << "\n";
+  }
+}
+
+void WriteWheelBindings(std::ostream &out,
+                        const Action (&wheel)[kWheelBindings]) {
+  for (size_t i = 0; i < kWheelBindings; ++i) {
+    if (wheel[i].type != ActionType::None) {
+      out << BindingName(static_cast<Binding>(kBindWheelUp + i)) << "="
+          << ActionToConfigValue(wheel[i]) << "\n";
+    }
+  }
+}
+
+std::string ConfigToText(const Config &cfg) {
+  std::ostringstream out;
+  out << "# Mouse side button remap config\n";
+  out << "button4=" << ActionToConfigValue(cfg.button4) << "\n";
+  out << "button5=" << ActionToConfigValue(cfg.button5) << "\n";
+  WriteWheelBindings(out, cfg.wheel);
+  WriteLayerBindings(out, cfg.layers);
+  WriteGestureBindings(out, cfg.gestures);
+  out << "suspend_fullscreen=" << (cfg.suspendInFullscreen ? "true" : "false")
+      << "\n";
+  out << "motion_rescale=" << (cfg.motionRescale ? "true" : "false") << "\n";
+  out << "dpi=" << cfg.dpi << "\n";
+  if (!cfg.dpiPresets.empty()) {
+    out << "dpi_presets=" << IntListToString(cfg.dpiPresets) << "\n";
+  }
+  out << "dpi_preset=" << cfg.dpiPreset << "\n";
+  out << "sensitivity=" << cfg.sensitivity << "\n";
+  out << "accel=" << AccelCurveToString(cfg.accel) << "\n";
+  out << "accel_rate=" << cfg.accelRate << "\n";
+  out << "accel_offset=" << cfg.accelOffset << "\n";
+  out << "accel_cap=" << cfg.accelCap << "\n";
+  out << "accel_exponent=" << cfg.accelExponent << "\n";
+  out << "gesture_distance=" << cfg.gestureDistance << "\n";
+  out << "gesture_flick_ms=" << cfg.gestureFlickMs << "\n";
+  out << "wheel_notch=" << cfg.wheelNotch << "\n";
+  out << "wheel_speed=" << cfg.wheelSpeed << "\n";
+  out << "wheel_smooth=" << (cfg.wheelSmooth ? "true" : "false") << "\n";
+  out << "wheel_invert=" << (cfg.wheelInvert ? "true" : "false") << "\n";
+  for (const DeviceScale &ds : cfg.deviceScales) {
+    out << "device_scale=" << DeviceScaleToString(ds) << "\n";
+  }
+  if (cfg.priorityClass != nexus_sched::Priority::kDefault) {
+    out << "priority_class=" << nexus_sched::PriorityName(cfg.priorityClass)
+        << "\n";
+  }
+  for (size_t i = 0; i < kServiceThreadCount; ++i) {
+    if (cfg.threads[i].priority != nexus_sched::Priority::kDefault) {
+      out << "thread." << kServiceThreadNames[i] << "="
+          << nexus_sched::ThreadPolicyToString(cfg.threads[i]) << "\n";
+    }
+  }
+  if (!cfg.mmcssTask.empty()) {
+    out << "mmcss=" << cfg.mmcssTask << "\n";
+  }
+  if (cfg.telemetry != TelemetryMode::Auto) {
+    out << "telemetry=" << TelemetryModeToString(cfg.telemetry) << "\n";
+  }
+  for (const Profile &profile : cfg.profiles) {
+    out << "\n[profile:" << profile.name << "]\n";
+    if (!profile.matchExe.empty()) {
+      out << "match_exe=" << JoinStrings(profile.matchExe, ",") << "\n";
+    }
+    if (!profile.matchClass.empty()) {
+      out << "match_class=" << JoinStrings(profile.matchClass, ",") << "\n";
+    }
+    if (!profile.matchDevice.empty()) {
+      out << "match_device=" << DeviceIdsToString(profile.matchDevice) << "\n";
+    }
+    out << "button4=" << ActionToConfigValue(profile.button4) << "\n";
+    out << "button5=" << ActionToConfigValue(profile.button5) << "\n";
+    WriteWheelBindings(out, profile.wheel);
+    if (profile.wheelInvert >= 0) {
+      out << "wheel_invert=" << (profile.wheelInvert ? "true" : "false")
+          << "\n";
+    }
+    if (profile.motionRescale >= 0) {
+      out << "motion_rescale=" << (profile.motionRescale ? "true" : "false")
+          << "\n";
+    }
+    WriteLayerBindings(out, profile.layers);
+    WriteGestureBindings(out, profile.gestures);
+  }
+  return out.str();
+}
+
+// Writes |bytes| to a sibling temp file, flushes it to disk and renames it
+// over |path|, so readers and crashes only ever see the old or new file.
+bool WriteFileAtomic(const std::string &path, const std::string &bytes) {
+  const std::string tmpPath = path + ".tmp";
+  HANDLE file = CreateFileA(tmpPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  DWORD written = 0;
+  const bool ok = WriteFile(file, bytes.data(), static_cast<DWORD>(bytes.size()),
+                            &written, nullptr) &&
+                  written == bytes.size() && FlushFileBuffers(file);
+  CloseHandle(file);
+  if (!ok) {
+    DeleteFileA(tmpPath.c_str());
+    return false;
+  }
+  return MoveFileExA(tmpPath.c_str(), path.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) !=
+         FALSE;
+}
+
+bool SaveConfig(const std::string &path, const Config &cfg) {
+  const std::string text = ConfigToText(cfg);
+  // Our own write must not bounce back through the hot-reload watcher.
+  const uint64_t previousHash =
+      g_loadedIniHash.exchange(Fnv1a64(text.data(), text.size()));
+  if (!WriteFileAtomic(path, text)) {
+    g_loadedIniHash.store(previousHash);
+    return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// Compiled config cache: a validated binary snapshot of the parsed INI with
+// key INPUT arrays and macro steps already materialized. Memory-mapped at
+// startup and rebuilt only when the INI content hash changes.
+// ---------------------------------------------------------------------------
+
+constexpr uint32_t kConfigCacheMagic = 0x4643584E; // "NXCF"
+constexpr uint32_t kConfigCacheVersion = 9;
+constexpr uint32_t kConfigCacheMaxItems = 1u << 20;
+
+struct ConfigCacheHeader {
+  uint32_t magic = kConfigCacheMagic;
+  uint32_t version = kConfigCacheVersion;
+  uint32_t inputSize = sizeof(INPUT); // rejects caches from other builds
+  uint32_t payloadSize = 0;
+  uint64_t iniHash = 0;
+  uint64_t payloadHash = 0;
+};
+
+uint64_t Fnv1a64(const void *data, size_t size) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  uint64_t h = 1469598103934665603ull;
+  for (size_t i = 0; i < size; ++i) {
+    h = (h ^ p[i]) * 1099511628211ull;
+  }
+  return h;
+}
+
+struct CacheWriter {
+  std::string bytes;
+
+  template <typename T> void Pod(const T &v) {
+    bytes.append(reinterpret_cast<const char *>(&v), sizeof(T));
+  }
+  template <typename T> void PodVector(const std::vector<T> &v) {
+    Pod(static_cast<uint32_t>(v.size()));
+    bytes.append(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+  }
+  void Str(const std::string &s) {
+    Pod(static_cast<uint32_t>(s.size()));
+    bytes += s;
+  }
+};
+
+struct CacheReader {
+  const char *p;
+  const char *end;
+
+  template <typename T> bool Pod(T &v) {
+    if (static_cast<size_t>(end - p) < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+  }
+  bool Count(uint32_t &n, size_t itemSize) {
+    return Pod(n) && n <= kConfigCacheMaxItems &&
+           static_cast<size_t>(end - p) / itemSize >= n;
+  }
+  template <typename T> bool PodVector(std::vector<T> &v) {
+    uint32_t n = 0;
+    if (!Count(n, sizeof(T))) {
+      return false;
+    }
+    v.resize(n);
+    std::memcpy(v.data(), p, n * sizeof(T));
+    p += n * sizeof(T);
+    return true;
+  }
+  bool Str(std::string &s) {
+    uint32_t n = 0;
+    if (!Count(n, 1)) {
+      return false;
+    }
+    s.assign(p, n);
+    p += n;
+    return true;
+  }
+};
+
+void WriteCachedAction(CacheWriter &w, const Action &action) {
+  w.Pod(static_cast<uint8_t>(action.type));
+  w.PodVector(action.keys);
+  w.Str(action.payload);
+  w.PodVector(action.inputs);
+  w.PodVector(action.macro ? *action.macro : std::vector<MacroOp>());
+}
+
+bool ReadCachedAction(CacheReader &r, Action &action) {
+  uint8_t type = 0;
+  if (!r.Pod(type) || type > static_cast<uint8_t>(ActionType::DpiShift)) {
+    return false;
+  }
+  action.type = static_cast<ActionType>(type);
+  std::vector<MacroOp> macro;
+  if (!r.PodVector(action.keys) || !r.Str(action.payload) ||
+      !r.PodVector(action.inputs) || !r.PodVector(macro) ||
+      action.inputs.size() != action.keys.size() * 2 ||
+      !ValidateMacroProgram(macro)) {
+    return false;
+  }
+  if (!macro.empty()) {
+    action.macro =
+        std::make_shared<const std::vector<MacroOp>>(std::move(macro));
+  }
+  return true;
+}
+
+void WriteCachedLayers(CacheWriter &w, const std::vector<LayerBinding> &layers) {
+  w.Pod(static_cast<uint32_t>(layers.size()));
+  for (const LayerBinding &layer : layers) {
+    w.Pod(layer.trigger);
+    w.Pod(static_cast<uint8_t>(layer.binding));
+    WriteCachedAction(w, layer.action);
+  }
+}
+
+void WriteCachedGestures(CacheWriter &w,
+                         const std::vector<GestureBinding> &gestures) {
+  w.Pod(static_cast<uint32_t>(gestures.size()));
+  for (const GestureBinding &gesture : gestures) {
+    w.Pod(static_cast<uint8_t>(gesture.binding));
+    w.Pod(gesture.stroke);
+    WriteCachedAction(w, gesture.action);
+  }
+}
+
+std::string SerializeConfig(const Config &cfg) {
+  CacheWriter w;
+  WriteCachedAction(w, cfg.button4);
+  WriteCachedAction(w, cfg.button5);
+  w.Pod(static_cast<uint8_t>(cfg.suspendInFullscreen));
+  w.Pod(static_cast<uint8_t>(cfg.motionRescale));
+  w.Pod(cfg.dpi);
+  w.PodVector(cfg.dpiPresets);
+  w.Pod(cfg.dpiPreset);
+  w.Pod(cfg.sensitivity);
+  w.Pod(static_cast<uint8_t>(cfg.accel));
+  w.Pod(cfg.accelRate);
+  w.Pod(cfg.accelOffset);
+  w.Pod(cfg.accelCap);
+  w.Pod(cfg.accelExponent);
+  w.PodVector(cfg.deviceScales);
+  WriteCachedLayers(w, cfg.layers);
+  w.Pod(cfg.gestureDistance);
+  w.Pod(cfg.gestureFlickMs);
+  WriteCachedGestures(w, cfg.gestures);
+  for (const Action &action : cfg.wheel) {
+    WriteCachedAction(w, action);
+  }
+  w.Pod(cfg.wheelNotch);
+  w.Pod(cfg.wheelSpeed);
+  w.Pod(static_cast<uint8_t>(cfg.wheelSmooth));
+  w.Pod(static_cast<uint8_t>(cfg.wheelInvert));
+  w.Pod(cfg.priorityClass);
+  for (const nexus_sched::ThreadPolicy &policy : cfg.threads) {
+    w.Pod(policy.priority);
+    w.Pod(policy.affinity);
+  }
+  w.Str(cfg.mmcssTask);
+  w.Pod(cfg.telemetry);
+  w.Pod(static_cast<uint32_t>(cfg.profiles.size()));
+  for (const Profile &profile : cfg.profiles) {
+    w.Str(profile.name);
+    w.Pod(static_cast<uint32_t>(profile.matchExe.size()));
+    for (const std::string &exe : profile.matchExe) {
+      w.Str(exe);
+    }
+    w.Pod(static_cast<uint32_t>(profile.matchClass.size()));
+    for (const std::string &cls : profile.matchClass) {
+      w.Str(cls);
+    }
+    w.PodVector(profile.matchDevice);
+    WriteCachedAction(w, profile.button4);
+    WriteCachedAction(w, profile.button5);
+    for (const Action &action : profile.wheel) {
+      WriteCachedAction(w, action);
+    }
+    w.Pod(static_cast<int8_t>(profile.wheelInvert));
+    w.Pod(static_cast<int8_t>(profile.motionRescale));
+    WriteCachedLayers(w, profile.layers);
+    WriteCachedGestures(w, profile.gestures);
+  }
+  return w.bytes;
+}
+
+bool ReadCachedStrings(CacheReader &r, std::vector<std::string> &out) {
+  uint32_t n = 0;
+  if (!r.Count(n, sizeof(uint32_t))) {
+    return false;
+  }
+  out.resize(n);
+  for (std::string &s : out) {
+    if (!r.Str(s)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ReadCachedLayers(CacheReader &r, std::vector<LayerBinding> &layers) {
+  uint32_t n = 0;
+  if (!r.Count(n, sizeof(WORD) + 1)) {
+    return false;
+  }
+  layers.resize(n);
+  for (LayerBinding &layer : layers) {
+    uint8_t binding = 0;
+    if (!r.Pod(layer.trigger) || !r.Pod(binding) || binding >= kBindingCount ||
+        !ReadCachedAction(r, layer.action)) {
+      return false;
+    }
+    layer.binding = static_cast<Binding>(binding);
+  }
+  return true;
+}
+
+bool ReadCachedGestures(CacheReader &r, std::vector<GestureBinding> &gestures) {
+  uint32_t n = 0;
+  if (!r.Count(n, 1 + sizeof(uint16_t))) {
+    return false;
+  }
+  gestures.resize(n);
+  for (GestureBinding &gesture : gestures) {
+    uint8_t binding = 0;
+    if (!r.Pod(binding) || binding >= kBindWheelUp ||
+        !r.Pod(gesture.stroke) || !ReadCachedAction(r, gesture.action)) {
+      return false;
+    }
+    gesture.binding = static_cast<Binding>(binding);
+  }
+  return true;
+}
+
+bool ReadCachedWheel(CacheReader &r, Action (&wheel)[kWheelBindings]) {
+  for (Action &action : wheel) {
+    if (!ReadCachedAction(r, action)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ReadCachedThreadPolicies(
+    CacheReader &r, nexus_sched::ThreadPolicy (&threads)[kServiceThreadCount]) {
+  for (nexus_sched::ThreadPolicy &policy : threads) {
+    if (!r.Pod(policy.priority) || !r.Pod(policy.affinity) ||
+        static_cast<size_t>(policy.priority) >= nexus_sched::kPriorityCount) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DeserializeConfig(const char *data, size_t size, Config &cfg) {
+  CacheReader r{data, data + size};
+  uint8_t fullscreen = 0;
+  uint8_t motionRescale = 0;
+  uint8_t accel = 0;
+  uint8_t wheelSmooth = 0;
+  uint8_t wheelInvert = 0;
+  uint32_t profileCount = 0;
+  if (!ReadCachedAction(r, cfg.button4) || !ReadCachedAction(r, cfg.button5) ||
+      !r.Pod(fullscreen) || !r.Pod(motionRescale) || !r.Pod(cfg.dpi) ||
+      !r.PodVector(cfg.dpiPresets) || !r.Pod(cfg.dpiPreset) ||
+      !r.Pod(cfg.sensitivity) || !r.Pod(accel) ||
+      !r.Pod(cfg.accelRate) || !r.Pod(cfg.accelOffset) ||
+      !r.Pod(cfg.accelCap) || !r.Pod(cfg.accelExponent) ||
+      !r.PodVector(cfg.deviceScales) || !ReadCachedLayers(r, cfg.layers) ||
+      !r.Pod(cfg.gestureDistance) || !r.Pod(cfg.gestureFlickMs) ||
+      !ReadCachedGestures(r, cfg.gestures) || !ReadCachedWheel(r, cfg.wheel) ||
+      !r.Pod(cfg.wheelNotch) || !r.Pod(cfg.wheelSpeed) || !r.Pod(wheelSmooth) ||
+      !r.Pod(wheelInvert) || !r.Pod(cfg.priorityClass) ||
+      !ReadCachedThreadPolicies(r, cfg.threads) || !r.Str(cfg.mmcssTask) ||
+      !r.Pod(cfg.telemetry) || !r.Count(profileCount, 1) ||
+      accel > static_cast<uint8_t>(AccelCurve::Power) ||
+      static_cast<size_t>(cfg.priorityClass) >= nexus_sched::kPriorityCount ||
+      cfg.telemetry > TelemetryMode::Minimal) {
+    return false;
+  }
+  cfg.suspendInFullscreen = fullscreen != 0;
+  cfg.motionRescale = motionRescale != 0;
+  cfg.accel = static_cast<AccelCurve>(accel);
+  cfg.wheelSmooth = wheelSmooth != 0;
+  cfg.wheelInvert = wheelInvert != 0;
+
+  cfg.profiles.resize(profileCount);
+  for (Profile &profile : cfg.profiles) {
+    int8_t invert = -1;
+    int8_t rescale = -1;
+    if (!r.Str(profile.name) || !ReadCachedStrings(r, profile.matchExe) ||
+        !ReadCachedStrings(r, profile.matchClass) ||
+        !r.PodVector(profile.matchDevice) ||
+        !ReadCachedAction(r, profile.button4) ||
+        !ReadCachedAction(r, profile.button5) ||
+        !ReadCachedWheel(r, profile.wheel) || !r.Pod(invert) ||
+        !r.Pod(rescale) || !ReadCachedLayers(r, profile.layers) ||
+        !ReadCachedGestures(r, profile.gestures)) {
+      return false;
+    }
+    profile.wheelInvert = invert < 0 ? -1 : invert != 0;
+    profile.motionRescale = rescale < 0 ? -1 : rescale != 0;
+  }
+  return r.p == r.end;
+}
+
+std::string GetConfigCachePath(const std::string &iniPath) {
+  return iniPath + ".cache";
+}
+
+bool LoadConfigCache(const std::string &cachePath, uint64_t iniHash,
+                     Config &cfg) {
+  HANDLE file = CreateFileA(cachePath.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  bool ok = false;
+  LARGE_INTEGER size = {};
+  if (GetFileSizeEx(file, &size) &&
+      size.QuadPart >= static_cast<LONGLONG>(sizeof(ConfigCacheHeader))) {
+    HANDLE mapping =
+        CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping) {
+      const char *view = static_cast<const char *>(
+          MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+      if (view) {
+        ConfigCacheHeader header;
+        std::memcpy(&header, view, sizeof(header));
+        const char *payload = view + sizeof(header);
+        ok = header.magic == kConfigCacheMagic &&
+             header.version == kConfigCacheVersion &&
+             header.inputSize == sizeof(INPUT) && header.iniHash == iniHash &&
+             header.payloadSize ==
+                 static_cast<uint64_t>(size.QuadPart) - sizeof(header) &&
+             Fnv1a64(payload, header.payloadSize) == header.payloadHash &&
+             DeserializeConfig(payload, header.payloadSize, cfg);
+        UnmapViewOfFile(view);
+      }
+      CloseHandle(mapping);
+    }
+  }
+  CloseHandle(file);
+  return ok;
+}
+
+bool WriteConfigCache(const std::string &cachePath, uint64_t iniHash,
+                      const Config &cfg) {
+  const std::string payload = SerializeConfig(cfg);
+  ConfigCacheHeader header;
+  header.payloadSize = static_cast<uint32_t>(payload.size());
+  header.iniHash = iniHash;
+  header.payloadHash = Fnv1a64(payload.data(), payload.size());
+
+  std::string bytes(reinterpret_cast<const char *>(&header), sizeof(header));
+  bytes += payload;
+  return WriteFileAtomic(cachePath, bytes);
+}
+
+// Returns defaults and sets |error| when the INI fails ValidateConfig.
+Config LoadConfigCached(const std::string &path,
+                        std::string *error = nullptr) {
+  const long long start = QpcNow();
+  Config cfg;
+  bool fromCache = false;
+
+  std::string text;
+  if (ReadFileBytes(path, text)) {
+    const uint64_t iniHash = Fnv1a64(text.data(), text.size());
+    const std::string cachePath = GetConfigCachePath(path);
+    fromCache = LoadConfigCache(cachePath, iniHash, cfg);
+    if (!fromCache) {
+      cfg = ParseConfigText(text);
+    }
+    std::string invalid;
+    if (!ValidateConfig(cfg, invalid)) {
+      if (error) {
+        *error = invalid;
+      }
+      cfg = Config{};
+      fromCache = false;
+    } else {
+      if (!fromCache) {
+        WriteConfigCache(cachePath, iniHash, cfg);
+      }
+      g_loadedIniHash.store(iniHash);
+    }
+  }
+
+  g_configFromCache.store(fromCache);
+  g_configLoadUs.store(
+      static_cast<unsigned long long>(QpcToNs(QpcNow() - start) / 1000.0));
+  return cfg;
+}
+
+// ---------------------------------------------------------------------------
+// Config hot-reload: watch the config directory, debounce bursts of writes,
+// parse and validate on the watcher thread and hand the finished Config to
+// the UI thread, which publishes it with the usual snapshot swap.
+// ---------------------------------------------------------------------------
+
+constexpr DWORD kConfigReloadDebounceMs = 150;
+
+struct PendingConfig {
+  Config cfg;
+  uint64_t iniHash = 0;
+  long long startQpc = 0;
+  unsigned long long generation = 0; // g_configGeneration before the read
+};
+
+std::thread g_configWatcherThread;
+HANDLE g_configWatcherStop = nullptr;
+
+void SetConfigError(const std::string &error) {
+  std::lock_guard<std::mutex> lock(g_configErrorMutex);
+  g_configLastError = error;
+}
+
+std::string ConfigLastError() {
+  std::lock_guard<std::mutex> lock(g_configErrorMutex);
+  return g_configLastError;
+}
+
+void ReloadConfigFromWatcher(long long startQpc) {
+  const unsigned long long generation = g_configGeneration.load();
+  std::string text;
+  if (!ReadFileBytes(g_configPath, text)) {
+    return; // mid-rename; the next notification retries
+  }
+  const uint64_t iniHash = Fnv1a64(text.data(), text.size());
+  if (iniHash == g_loadedIniHash.load()) {
+    return;
+  }
+
+  std::string error;
+  auto pending = std::make_unique<PendingConfig>();
+  pending->cfg = ParseConfigText(text, &error);
+  pending->startQpc = startQpc;
+  pending->generation = generation;
+  if (error.empty()) {
+    ValidateConfig(pending->cfg, error);
+  }
+  if (!error.empty()) {
+    g_configReloadFailures.fetch_add(1);
+    SetConfigError(error);
+    return;
+  }
+
+  // The cache is keyed on the INI hash, so it is valid whether or not the
+  // UI thread gets to apply this config. g_loadedIniHash is only advanced
+  // once it does (ApplyPendingConfig); until then the next change retries.
+  WriteConfigCache(GetConfigCachePath(g_configPath), iniHash, pending->cfg);
+  pending->iniHash = iniHash;
+  if (!PostMessageA(g_mainWindow, WM_CONFIG_RELOADED, 0,
+                    reinterpret_cast<LPARAM>(pending.get()))) {
+    g_configReloadFailures.fetch_add(1);
+    SetConfigError("config reload could not be handed to the UI thread");
+    return;
+  }
+  pending.release(); // owned by the UI thread now
+  SetConfigError("");
+}
+
+// Startup and tray reload. An INI that fails validation is reported like a
+// failed hot reload and leaves the running config alone.
+bool LoadConfigFromDisk() {
+  std::string error;
+  Config cfg = LoadConfigCached(g_configPath, &error);
+  if (!error.empty()) {
+    g_configReloadFailures.fetch_add(1);
+    SetConfigError(error);
+    return false;
+  }
+  SetConfigError("");
+  ReplaceConfig(std::move(cfg));
+  return true;
+}
+
+// UI thread: takes ownership of a PendingConfig posted by the watcher. A
+// config committed since the watcher read the file (an edit from the UI) is
+// newer than the file and is about to be saved over it, so it wins.
+void ApplyPendingConfig(LPARAM lParam) {
+  std::unique_ptr<PendingConfig> pending(
+      reinterpret_cast<PendingConfig *>(lParam));
+  {
+    std::lock_guard<std::mutex> lock(g_configWriteMutex);
+    if (g_configGeneration.load() != pending->generation) {
+      g_configReloadsSuperseded.fetch_add(1);
+      return;
+    }
+    CommitConfig(std::move(pending->cfg));
+    g_loadedIniHash.store(pending->iniHash);
+  }
+  g_configReloads.fetch_add(1);
+  g_configReloadUs.store(static_cast<unsigned long long>(
+      QpcToNs(QpcNow() - pending->startQpc) / 1000.0));
+}
+
+bool NotificationMatches(const char *buffer, DWORD bytes,
+                         const std::wstring &fileName) {
+  if (bytes == 0) {
+    return true; // buffer overflowed; assume the config changed
+  }
+  DWORD offset = 0;
+  for (;;) {
+    const auto *info =
+        reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(buffer + offset);
+    const std::wstring name(info->FileName,
+                            info->FileNameLength / sizeof(WCHAR));
+    if (CompareStringOrdinal(name.c_str(), static_cast<int>(name.size()),
+                             fileName.c_str(),
+                             static_cast<int>(fileName.size()),
+                             TRUE) == CSTR_EQUAL) {
+      return true;
+    }
+    if (info->NextEntryOffset == 0) {
+      return false;
+    }
+    offset += info->NextEntryOffset;
+  }
+}
+
+void ConfigWatcherThreadProc() {
+  ScopedServiceThread sched(kThreadConfig);
+  const auto slash = g_configPath.find_last_of("\\/");
+  const std::string dir =
+      (slash == std::string::npos) ? "." : g_configPath.substr(0, slash);
+  const std::wstring fileName = Utf8ToWide(
+      slash == std::string::npos ? g_configPath : g_configPath.substr(slash + 1));
+
+  HANDLE dirHandle = CreateFileA(
+      dir.c_str(), FILE_LIST_DIRECTORY,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+      OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+      nullptr);
+  if (dirHandle == INVALID_HANDLE_VALUE) {
+    return;
+  }
+
+  OVERLAPPED ov = {};
+  ov.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+  alignas(DWORD) char buffer[4096];
+  const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME |
+                       FILE_NOTIFY_CHANGE_LAST_WRITE |
+                       FILE_NOTIFY_CHANGE_SIZE;
+  const HANDLE waits[2] = {g_configWatcherStop, ov.hEvent};
+  long long pendingSince = 0; // QPC of the first change in the current burst
+
+  while (ov.hEvent) {
+    ResetEvent(ov.hEvent);
+    if (!ReadDirectoryChangesW(dirHandle, buffer, sizeof(buffer), FALSE,
+                               filter, nullptr, &ov, nullptr)) {
+      break;
+    }
+
+    // Wait for a change; while a burst is pending, reload once the
+    // directory has been quiet for the debounce interval.
+    const DWORD wait = WaitForMultipleObjects(
+        2, waits, FALSE, pendingSince ? kConfigReloadDebounceMs : INFINITE);
+    if (wait == WAIT_OBJECT_0) {
+      break;
+    }
+    if (wait == WAIT_TIMEOUT) {
+      CancelIoEx(dirHandle, &ov);
+      DWORD ignored = 0;
+      GetOverlappedResult(dirHandle, &ov, &ignored, TRUE);
+      ReloadConfigFromWatcher(pendingSince);
+      pendingSince = 0;
       continue;
     }
-    if (c == '"') {
-      break;
+
+    DWORD bytes = 0;
+    if (GetOverlappedResult(dirHandle, &ov, &bytes, FALSE) &&
+        NotificationMatches(buffer, bytes, fileName) && !pendingSince) {
+      pendingSince = QpcNow();
     }
   }
-  if (i >= body.size()) {
-    return false;
+
+  CancelIoEx(dirHandle, &ov);
+  if (ov.hEvent) {
+    DWORD ignored = 0;
+    GetOverlappedResult(dirHandle, &ov, &ignored, TRUE);
+    CloseHandle(ov.hEvent);
   }
-  out = JsonUnescape(body.substr(q1 + 1, i - q1 - 1));
-  return true;
+  CloseHandle(dirHandle);
 }
 
-bool ExtractJsonBool(const std::string &body, const std::string &key,
-                     bool &out) {
-  const std::string needle = "\"" + key + "\"";
-  const size_t k = body.find(needle);
-  if (k == std::string::npos) {
-    return false;
+void StartConfigWatcher() {
+  g_configWatcherStop = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+  if (g_configWatcherStop) {
+    g_configWatcherThread = std::thread(ConfigWatcherThreadProc);
   }
-  size_t colon = body.find(':', k + needle.size());
-  if (colon == std::string::npos) {
-    return false;
+}
+
+void StopConfigWatcher() {
+  if (g_configWatcherStop) {
+    SetEvent(g_configWatcherStop);
   }
-  size_t v = body.find_first_not_of(" \t\r\n", colon + 1);
-  if (v == std::string::npos) {
-    return false;
+  if (g_configWatcherThread.joinable()) {
+    g_configWatcherThread.join();
   }
-  if (body.compare(v, 4, "true") == 0) {
-    out = true;
-    return true;
+  if (g_configWatcherStop) {
+    CloseHandle(g_configWatcherStop);
+    g_configWatcherStop = nullptr;
   }
-  if (body.compare(v, 5, "false") == 0) {
-    out = false;
-    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Async config persistence: edits hand the latest Config to a writer thread,
+// which saves it once edits have been quiet for the coalescing window, so a
+// burst of UI changes costs one disk write.
+// ---------------------------------------------------------------------------
+
+constexpr DWORD kConfigSaveCoalesceMs = 250;
+
+std::thread g_configSaveThread;
+std::mutex g_configSaveMutex;
+std::condition_variable g_configSaveCv;
+std::unique_ptr<Config> g_pendingSave;  // guarded by g_configSaveMutex
+unsigned long long g_configSaveSeq = 0; // guarded by g_configSaveMutex
+bool g_configSaveStop = false;          // guarded by g_configSaveMutex
+
+void RequestConfigSave(const Config &cfg) {
+  auto next = std::make_unique<Config>(cfg);
+  {
+    std::lock_guard<std::mutex> lock(g_configSaveMutex);
+    g_pendingSave = std::move(next);
+    ++g_configSaveSeq;
   }
-  return false;
+  g_configSaveRequests.fetch_add(1);
+  g_configSaveCv.notify_one();
 }
 
-bool ExtractJsonInt(const std::string &body, const std::string &key, int &out) {
-  const std::string needle = "\"" + key + "\"";
-  const size_t k = body.find(needle);
-  if (k == std::string::npos) {
-    return false;
+void ConfigSaveThreadProc() {
+  ScopedServiceThread sched(kThreadConfig);
+  std::unique_lock<std::mutex> lock(g_configSaveMutex);
+  for (;;) {
+    g_configSaveCv.wait(lock,
+                        [] { return g_pendingSave || g_configSaveStop; });
+    unsigned long long seen = g_configSaveSeq;
+    while (!g_configSaveStop) {
+      g_configSaveCv.wait_for(
+          lock, std::chrono::milliseconds(kConfigSaveCoalesceMs));
+      if (g_configSaveSeq == seen) {
+        break;
+      }
+      seen = g_configSaveSeq;
+    }
+
+    std::unique_ptr<Config> cfg = std::move(g_pendingSave);
+    const bool stop = g_configSaveStop;
+    lock.unlock();
+    if (cfg) {
+      const long long start = QpcNow();
+      if (SaveConfig(g_configPath, *cfg)) {
+        g_configSaves.fetch_add(1);
+      } else {
+        g_configSaveFailures.fetch_add(1);
+      }
+      g_configSaveUs.store(static_cast<unsigned long long>(
+          QpcToNs(QpcNow() - start) / 1000.0));
+    }
+    if (stop) {
+      return;
+    }
+    lock.lock();
   }
-  size_t colon = body.find(':', k + needle.size());
-  if (colon == std::string::npos) {
-    return false;
+}
+
+void StartConfigPersistence() {
+  g_configSaveStop = false;
+  g_configSaveThread = std::thread(ConfigSaveThreadProc);
+}
+
+// Flushes any pending edit before returning.
+void StopConfigPersistence() {
+  {
+    std::lock_guard<std::mutex> lock(g_configSaveMutex);
+    g_configSaveStop = true;
   }
-  size_t v = body.find_first_not_of(" \t\r\n", colon + 1);
-  if (v == std::string::npos) {
-    return false;
+  g_configSaveCv.notify_one();
+  if (g_configSaveThread.joinable()) {
+    g_configSaveThread.join();
   }
-  out = std::atoi(body.c_str() + v);
-  return true;
 }
 
-bool ApplyConfigJson(const std::string &body, std::string &error) {
-  std::string b4;
-  std::string b5;
-  bool fullscreen = g_config.suspendInFullscreen;
+// ---------------------------------------------------------------------------
+// Shared-memory telemetry: a publisher thread copies the status counters and
+// histograms into the nexus_telemetry segment every kTelemetryPublishMs, so
+// monitors read them without HTTP or JSON. The hook paths only touch their
+// own atomics; the seqlock write happens here.
+// ---------------------------------------------------------------------------
+constexpr int kTelemetryPublishMs = 10;
+
+std::thread g_telemetryThread;
+std::mutex g_telemetryMutex;
+std::condition_variable g_telemetryCv;
+bool g_telemetryStop = false; // guarded by g_telemetryMutex
+nexus_telemetry::Mapping g_telemetryMapping;
+
+void RecordHistogram(std::atomic<uint64_t> *hist, double value) {
+  const uint64_t v = value > 0 ? static_cast<uint64_t>(value) : 0;
+  hist[nexus_telemetry::BucketFor(v)].fetch_add(1, std::memory_order_relaxed);
+}
 
-  if (!ExtractJsonString(body, "button4", b4) ||
-      !ExtractJsonString(body, "button5", b5)) {
-    error = "missing button mapping";
-    return false;
+void PublishTelemetry(nexus_telemetry::Segment &s) {
+  using namespace nexus_telemetry;
+  const uint64_t values[kCounterCount] = {
+      g_rawInputEvents.load(),
+      g_pollRateHz.load(),
+      g_mouseButtons.load(),
+      g_mouseSampleRate.load(),
+      g_buttonPresses.load(),
+      g_motionPackets.load(),
+      g_dpiChangeEvents.load(),
+      static_cast<uint64_t>(g_dpiPresetIndex.load()),
+      static_cast<uint64_t>(EffectiveDpi()),
+      g_profileSwitches.load(),
+      g_layerActions.load(),
+      g_gestureStrokes.load(),
+      g_gestureMisses.load(),
+      g_wheelEvents.load(),
+      g_wheelActions.load(),
+      g_deviceCorrelations.load(),
+      g_deviceInferred.load(),
+      g_deviceMismatches.load(),
+      g_injectSuppressed.load(),
+      g_macroRuns.load(),
+      g_textJobs.load(),
+      g_launcher.launches.load(),
+      g_configReloads.load()};
+  BeginWrite(s);
+  for (size_t c = 0; c < kCounterCount; ++c) {
+    s.counters[c].store(values[c], std::memory_order_relaxed);
   }
-  (void)ExtractJsonBool(body, "suspend_fullscreen", fullscreen);
-
-  int dpi = g_config.dpi;
-  (void)ExtractJsonInt(body, "dpi", dpi);
+  for (size_t b = 0; b < kHistogramBuckets; ++b) {
+    s.histograms[kHookLatencyNs][b].store(g_hookLatencyHist[b].load(),
+                                          std::memory_order_relaxed);
+    s.histograms[kRawIntervalUs][b].store(g_rawIntervalHist[b].load(),
+                                          std::memory_order_relaxed);
+    s.histograms[kMacroWakeUs][b].store(g_macroWakeHist[b].load(),
+                                        std::memory_order_relaxed);
+  }
+  EndWrite(s, GetTickCount64());
+  g_telemetryPublishes.fetch_add(1, std::memory_order_relaxed);
+}
 
-  Action a4;
-  Action a5;
-  if (!ParseAction(b4, a4) || !ParseAction(b5, a5)) {
-    error = "invalid action syntax";
+// Adaptive tiers: minimal counters are always kept. The detailed tier
+// (histograms, input history, poll-rate window, device info) runs only while
+// telemetry=always, or in the default auto mode while a client has polled
+// /status or /history within kTelemetryLeaseMs. Outside the detailed tier,
+// raw input is unregistered unless motion scaling, dpishift, gestures or
+// device profiles need it, and the publisher wakes once a second instead of
+// every kTelemetryPublishMs.
+constexpr int kTelemetryIdlePublishMs = 1000;
+constexpr unsigned long long kTelemetryLeaseMs = 5000;
+
+std::atomic<unsigned long long> g_telemetryLeaseUntil{0}; // GetTickCount64
+std::atomic<TelemetryMode> g_telemetryMode{TelemetryMode::Auto};
+std::atomic<bool> g_rawInputNeeded{true}; // a feature reads WM_INPUT
+
+bool WantDetailedTelemetry() {
+  switch (g_telemetryMode.load()) {
+  case TelemetryMode::Always:
+    return true;
+  case TelemetryMode::Minimal:
     return false;
+  default:
+    return GetTickCount64() < g_telemetryLeaseUntil.load();
   }
+}
 
-  Config next = g_config;
-  next.button4 = a4;
-  next.button5 = a5;
-  next.suspendInFullscreen = fullscreen;
-  next.dpi = dpi;
+// Any thread. Raw input follows on the input thread via WM_RAW_INPUT_CHANGED.
+void UpdateTelemetryTier() {
+  const bool detailed = WantDetailedTelemetry();
+  bool current = !detailed;
+  if (!g_telemetryDetailed.compare_exchange_strong(current, detailed)) {
+    return;
+  }
+  if (detailed) {
+    g_lastRateWindowTick.store(0); // restart the window, do not span the gap
+  }
+  g_telemetryTierChanges.fetch_add(1);
+  g_telemetryCv.notify_one();
+  if (g_mainWindow) {
+    PostMessageA(g_mainWindow, WM_RAW_INPUT_CHANGED, 0, 0);
+  }
+}
 
-  bool startup = false;
-  if (ExtractJsonBool(body, "launch_on_startup", startup)) {
-    SetLaunchOnStartup(startup);
+void RenewTelemetryLease() {
+  g_telemetryLeaseUntil.store(GetTickCount64() + kTelemetryLeaseMs);
+  UpdateTelemetryTier();
+}
+
+bool TableNeedsRawInput(const MappingTable &t) {
+  const auto shift = [](const Action &a) {
+    return a.type == ActionType::DpiShift;
+  };
+  return t.gestureBindings ||
+         std::any_of(std::begin(t.actions), std::end(t.actions), shift) ||
+         std::any_of(t.layers.begin(), t.layers.end(),
+                     [&](const LayerTable &layer) {
+                       return std::any_of(std::begin(layer.actions),
+                                          std::end(layer.actions), shift);
+                     });
+}
+
+// After the motion profile and profiles are published.
+void PublishTelemetryTier(const Config &cfg) {
+  const MotionProfile *motion = g_motionProfile.load();
+  const CompiledProfiles *cp = g_profiles.load();
+  const bool needed =
+      (motion && motion->active) ||
+      (cp && (!cp->devices.empty() || TableNeedsRawInput(cp->fallback) ||
+              std::any_of(cp->tables.begin(), cp->tables.end(),
+                          TableNeedsRawInput)));
+  g_telemetryMode = cfg.telemetry;
+  if (g_rawInputNeeded.exchange(needed) != needed && g_mainWindow) {
+    PostMessageA(g_mainWindow, WM_RAW_INPUT_CHANGED, 0, 0);
   }
+  UpdateTelemetryTier();
+}
 
-  if (!SaveConfig(g_configPath, next)) {
-    error = "failed to save config";
+// Input thread: registers WM_INPUT while a feature or the detailed tier
+// uses it, and removes it otherwise so motion only wakes the hook.
+bool UpdateRawInputRegistration(HWND hwnd) {
+  const bool want = g_rawInputNeeded.load() || g_telemetryDetailed.load();
+  if (want == g_rawInputRegistered.load()) {
+    return true;
+  }
+  RAWINPUTDEVICE rid = {};
+  rid.usUsagePage = 0x01;
+  rid.usUsage = 0x02;
+  rid.dwFlags = want ? RIDEV_INPUTSINK : RIDEV_REMOVE;
+  rid.hwndTarget = want ? hwnd : nullptr;
+  if (!RegisterRawInputDevices(&rid, 1, sizeof(rid))) {
     return false;
   }
-
-  g_config = next;
+  g_rawInputRegistered = want;
   return true;
 }
 
-void HandleStatusClient(SOCKET client) {
-  std::string r;
-  r.reserve(4096);
-  char chunk[2048] = {};
-  int contentLength = -1;
-  size_t headerEnd = std::string::npos;
-
-  while (true) {
-    const int got = recv(client, chunk, sizeof(chunk), 0);
-    if (got <= 0) {
-      break;
+void TelemetryThreadProc() {
+  ScopedServiceThread sched(kThreadTelemetry);
+  std::unique_lock<std::mutex> lock(g_telemetryMutex);
+  while (!g_telemetryStop) {
+    lock.unlock();
+    UpdateTelemetryTier();
+    if (g_telemetryMapped) {
+      PublishTelemetry(*g_telemetryMapping.segment);
     }
-    r.append(chunk, chunk + got);
+    lock.lock();
+    const bool detailed = g_telemetryDetailed.load();
+    g_telemetryCv.wait_for(
+        lock,
+        std::chrono::milliseconds(detailed ? kTelemetryPublishMs
+                                           : kTelemetryIdlePublishMs),
+        [&] { return g_telemetryStop || g_telemetryDetailed != detailed; });
+  }
+}
 
-    if (headerEnd == std::string::npos) {
-      headerEnd = r.find("\r\n\r\n");
-      if (headerEnd != std::string::npos) {
-        const std::string h = r.substr(0, headerEnd);
-        const std::string key = "Content-Length:";
-        size_t p = h.find(key);
-        if (p != std::string::npos) {
-          p += key.size();
-          while (p < h.size() && (h[p] == ' ' || h[p] == '\t')) {
-            ++p;
-          }
-          contentLength = std::atoi(h.c_str() + p);
-        } else {
-          contentLength = 0;
-        }
-      }
-    }
+// Without a segment (name taken by another user, for instance) the service
+// runs as before and /status reports telemetry_segment=false; the thread
+// still drives the adaptive tiers. The first lease covers the UI opened at
+// startup.
+void StartTelemetry() {
+  if (nexus_telemetry::CreateSegment(g_telemetryMapping, kTelemetryPublishMs,
+                                     GetCurrentProcessId())) {
+    g_telemetryMapped = true;
+  } else {
+    nexus_telemetry::CloseSegment(g_telemetryMapping);
+  }
+  g_telemetryLeaseUntil = GetTickCount64() + kTelemetryLeaseMs;
+  g_telemetryStop = false;
+  g_telemetryThread = std::thread(TelemetryThreadProc);
+}
 
-    if (headerEnd != std::string::npos && contentLength >= 0) {
-      const size_t haveBody = r.size() - (headerEnd + 4);
-      if (haveBody >= static_cast<size_t>(contentLength)) {
-        break;
-      }
-    }
+void StopTelemetry() {
+  {
+    std::lock_guard<std::mutex> lock(g_telemetryMutex);
+    g_telemetryStop = true;
   }
+  g_telemetryCv.notify_one();
+  if (g_telemetryThread.joinable()) {
+    g_telemetryThread.join();
+  }
+  if (g_telemetryMapped.exchange(false)) {
+    PublishTelemetry(*g_telemetryMapping.segment);
+    nexus_telemetry::CloseSegment(g_telemetryMapping);
+  }
+}
 
-  if (r.empty()) {
-    return;
+bool IsFullscreenForegroundWindow() {
+  HWND fg = GetForegroundWindow();
+  if (!fg || fg == g_mainWindow || fg == g_settingsWindow) {
+    return false;
   }
-  std::string body;
-  std::string code = "200 OK";
-  std::string type = "application/json";
 
-  if (r.rfind("GET /status", 0) == 0) {
-    body = BuildStatusJson();
-  } else if (r.rfind("GET /config", 0) == 0) {
-    body = BuildConfigJson();
-  } else if (r.rfind("POST /config", 0) == 0) {
-    const size_t sep = r.find("\r\n\r\n");
-    std::string reqBody = (sep == std::string::npos) ? "" : r.substr(sep + 4);
-    std::string err;
-    if (ApplyConfigJson(reqBody, err)) {
-      body = "{\"ok\":true}";
-    } else {
-      code = "400 Bad Request";
-      body = "{\"ok\":false,\"error\":\"" + JsonEscape(err) + "\"}";
-    }
-  } else if (r.rfind("GET /browse", 0) == 0) {
-    char path[MAX_PATH] = {};
-    OPENFILENAMEA ofn = {};
-    ofn.lStructSize = sizeof(ofn);
-    ofn.hwndOwner = nullptr;
-    ofn.lpstrFile = path;
-    ofn.nMaxFile = MAX_PATH;
-    ofn.lpstrFilter = "Applications (*.exe)\0*.exe\0All Files (*.*)\0*.*\0";
-    ofn.nFilterIndex = 1;
-    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST | OFN_NOCHANGEDIR;
+  RECT wr = {};
+  if (!GetWindowRect(fg, &wr)) {
+    return false;
+  }
 
-    if (GetOpenFileNameA(&ofn)) {
-      body = "{\"ok\":true, \"path\":\"" + JsonEscape(path) + "\"}";
-    } else {
-      body = "{\"ok\":false}";
-    }
-  } else if (r.rfind("OPTIONS ", 0) == 0) {
-    body = "";
-    type = "text/plain";
-  } else {
-    code = "404 Not Found";
-    type = "application/json";
-    body = "{\"error\":\"not_found\"}";
+  HMONITOR monitor = MonitorFromWindow(fg, MONITOR_DEFAULTTONEAREST);
+  MONITORINFO mi = {};
+  mi.cbSize = sizeof(mi);
+  if (!GetMonitorInfoA(monitor, &mi)) {
+    return false;
   }
 
-  std::ostringstream resp;
-  resp << "HTTP/1.1 " << code << "\r\n";
-  resp << "Content-Type: " << type << "\r\n";
-  resp << "Access-Control-Allow-Origin: *\r\n";
-  resp << "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n";
-  resp << "Access-Control-Allow-Headers: *\r\n";
-  resp << "Connection: close\r\n";
-  resp << "Content-Length: " << body.size() << "\r\n\r\n";
-  resp << body;
-  const std::string out = resp.str();
-  send(client, out.c_str(), static_cast<int>(out.size()), 0);
+  const int tol = 2;
+  return abs(wr.left - mi.rcMonitor.left) <= tol &&
+         abs(wr.top - mi.rcMonitor.top) <= tol &&
+         abs(wr.right - mi.rcMonitor.right) <= tol &&
+         abs(wr.bottom - mi.rcMonitor.bottom) <= tol;
 }
 
-void StatusServerThreadProc() {
-  WSADATA wsa = {};
-  if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
-    return;
+// ---------------------------------------------------------------------------
+// Device correlation: the hook only sees the merged input stream, WM_INPUT
+// knows the device. Side-button and wheel transitions from either side wait
+// in a short timestamped ring until the other side claims them, whichever
+// arrives first. A hook event that finds its raw packet already recorded
+// knows its mouse; one that runs first (first pulling in queued raw input
+// with GetRawInputBuffer, which unlike PeekMessage never re-enters hook
+// callbacks) is attributed to the most recently active mouse, and the raw
+// packet arriving later confirms or contradicts that guess.
+// ---------------------------------------------------------------------------
+
+constexpr uint32_t kDeviceRingSize = 32; // power of two
+constexpr DWORD kDeviceMatchMs = 50;
+constexpr DWORD kDeviceRecentMs = 2000; // "most recently active" horizon
+constexpr size_t kDeviceIndexCacheSize = 8;
+constexpr USHORT kCorrelatedRawFlags =
+    RI_MOUSE_BUTTON_4_DOWN | RI_MOUSE_BUTTON_4_UP | RI_MOUSE_BUTTON_5_DOWN |
+    RI_MOUSE_BUTTON_5_UP | RI_MOUSE_WHEEL | RI_MOUSE_HWHEEL;
+
+struct TransitionRecord {
+  HANDLE device = nullptr;
+  DWORD time = 0;   // GetMessageTime clock, as MSLLHOOKSTRUCT::time
+  USHORT flags = 0; // RI_MOUSE_* transitions not yet claimed
+};
+
+struct TransitionRing {
+  TransitionRecord records[kDeviceRingSize];
+  uint32_t head = 0; // total records written
+  uint32_t tail = 0; // records before this one are fully claimed
+
+  void Push(HANDLE device, DWORD time, USHORT flags) {
+    records[head++ % kDeviceRingSize] = {device, time, flags};
   }
 
-  SOCKET listenSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-  if (listenSock == INVALID_SOCKET) {
-    WSACleanup();
-    return;
+  // Claims |flag| on the oldest record within kDeviceMatchMs of |time|.
+  bool Claim(USHORT flag, DWORD time, HANDLE &device) {
+    tail = std::max(tail, head - std::min<uint32_t>(head, kDeviceRingSize));
+    for (uint32_t i = tail; i != head; ++i) {
+      TransitionRecord &r = records[i % kDeviceRingSize];
+      // Either order; unsigned differences handle tick wraparound.
+      if ((r.flags & flag) &&
+          (time - r.time <= kDeviceMatchMs || r.time - time <= kDeviceMatchMs)) {
+        r.flags &= ~flag;
+        device = r.device;
+        while (tail != head && !records[tail % kDeviceRingSize].flags) {
+          ++tail;
+        }
+        return true;
+      }
+    }
+    return false;
   }
-  g_statusListenSocket.store(listenSock);
+};
 
-  sockaddr_in addr = {};
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(48621);
-  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+struct DeviceCorrelator {
+  TransitionRing raw;  // raw packets the hook has not seen yet
+  TransitionRing hook; // hook guesses the raw stream has not confirmed yet
+  HANDLE lastDevice = nullptr; // device of the latest raw packet of any kind
+  DWORD lastTime = 0;
+  const CompiledProfiles *cacheProfiles = nullptr;
+  HANDLE cacheDevice[kDeviceIndexCacheSize] = {};
+  int cacheIndex[kDeviceIndexCacheSize] = {};
+  size_t cacheNext = 0;
+};
 
-  int yes = 1;
-  setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR,
-             reinterpret_cast<const char *>(&yes), sizeof(yes));
-  if (bind(listenSock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ==
-          SOCKET_ERROR ||
-      listen(listenSock, 4) == SOCKET_ERROR) {
-    closesocket(listenSock);
-    g_statusListenSocket.store(INVALID_SOCKET);
-    WSACleanup();
-    return;
+DeviceCorrelator g_devices; // input thread: WM_INPUT and the hook
+
+// Raw side of a packet: settles hook guesses for its transitions and leaves
+// the rest for the hook to claim.
+void RecordRawTransitions(DeviceCorrelator &c, HANDLE device, USHORT flags,
+                          DWORD time) {
+  c.lastDevice = device;
+  c.lastTime = time;
+  flags &= kCorrelatedRawFlags;
+  for (USHORT rest = flags; rest; rest &= rest - 1) {
+    const USHORT flag = rest & -rest;
+    HANDLE guessed = nullptr;
+    if (c.hook.Claim(flag, time, guessed)) {
+      flags &= ~flag;
+      if (guessed != device) {
+        g_deviceMismatches.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+  if (flags) {
+    c.raw.Push(device, time, flags);
   }
+}
 
-  while (!g_statusServerStop.load()) {
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(listenSock, &set);
-    timeval tv = {0, 250000};
-    const int sel = select(0, &set, nullptr, nullptr, &tv);
-    if (sel <= 0) {
-      continue;
+// Index of the device's VID/PID in cp.devices, -1 if no profile names it.
+// Resolved once per handle; the name query is a kernel call.
+int DeviceIndex(DeviceCorrelator &c, const CompiledProfiles &cp,
+                HANDLE device) {
+  if (c.cacheProfiles != &cp) {
+    std::fill(std::begin(c.cacheDevice), std::end(c.cacheDevice), nullptr);
+    c.cacheProfiles = &cp;
+  }
+  for (size_t i = 0; i < kDeviceIndexCacheSize; ++i) {
+    if (c.cacheDevice[i] == device) {
+      return c.cacheIndex[i];
     }
-
-    SOCKET client = accept(listenSock, nullptr, nullptr);
-    if (client == INVALID_SOCKET) {
-      continue;
+  }
+  int index = -1;
+  WORD vid = 0;
+  WORD pid = 0;
+  if (QueryDeviceIds(device, vid, pid)) {
+    for (size_t i = 0; i < cp.devices.size(); ++i) {
+      if (cp.devices[i].vid == vid && cp.devices[i].pid == pid) {
+        index = static_cast<int>(i);
+        break;
+      }
     }
-    HandleStatusClient(client);
-    closesocket(client);
   }
+  const size_t slot = c.cacheNext++ % kDeviceIndexCacheSize;
+  c.cacheDevice[slot] = device;
+  c.cacheIndex[slot] = index;
+  return index;
+}
 
-  closesocket(listenSock);
-  g_statusListenSocket.store(INVALID_SOCKET);
-  WSACleanup();
+// Every raw mouse packet, from WM_INPUT or a drain.
+void HandleRawMouse(const RAWINPUT *raw, DWORD time) {
+  static long long lastQpc = 0;
+  g_rawInputEvents.fetch_add(1, std::memory_order_relaxed);
+  if (g_telemetryDetailed.load(std::memory_order_relaxed)) {
+    const long long now = QpcNow();
+    const uint64_t intervalUs = lastQpc ? QpcToUs(now - lastQpc) : 0;
+    if (lastQpc) {
+      RecordHistogram(g_rawIntervalHist, static_cast<double>(intervalUs));
+    }
+    lastQpc = now;
+    UpdateTelemetryFromRawInput(raw);
+    RecordHistory(g_history, raw->data.mouse, QpcToUs(now), intervalUs);
+  } else {
+    lastQpc = 0; // no interval across a minimal stretch
+  }
+  RecordRawTransitions(g_devices, raw->header.hDevice,
+                       raw->data.mouse.usButtonFlags, time);
+  ProcessRawMotion(raw);
 }
 
-void StartStatusServer() {
-  g_statusServerStop.store(false);
-  g_statusServerThread = std::thread(StatusServerThreadProc);
+// Hook thread: processes raw input that is queued but not yet dispatched.
+void DrainRawInput() {
+  alignas(8) BYTE buffer[16 * sizeof(RAWINPUT)];
+  for (;;) {
+    UINT size = sizeof(buffer);
+    const UINT count = GetRawInputBuffer(reinterpret_cast<PRAWINPUT>(buffer),
+                                         &size, sizeof(RAWINPUTHEADER));
+    if (count == 0 || count == static_cast<UINT>(-1)) {
+      return;
+    }
+    const DWORD now = GetTickCount();
+    PRAWINPUT raw = reinterpret_cast<PRAWINPUT>(buffer);
+    for (UINT i = 0; i < count; ++i, raw = NEXTRAWINPUTBLOCK(raw)) {
+      if (raw->header.dwType == RIM_TYPEMOUSE) {
+        HandleRawMouse(raw, now);
+      }
+    }
+  }
 }
 
-void StopStatusServer() {
-  g_statusServerStop.store(true);
-  const SOCKET s = g_statusListenSocket.load();
-  if (s != INVALID_SOCKET) {
-    closesocket(s);
+// Hook side of a transition: the device that produced it, or a guess.
+HANDLE CorrelateHookEvent(DeviceCorrelator &c, USHORT flag, DWORD time) {
+  HANDLE device = nullptr;
+  if (c.raw.Claim(flag, time, device)) {
+    g_deviceCorrelations.fetch_add(1, std::memory_order_relaxed);
+    return device;
   }
-  if (g_statusServerThread.joinable()) {
-    g_statusServerThread.join();
+  g_deviceRingDrains.fetch_add(1, std::memory_order_relaxed);
+  DrainRawInput();
+  if (c.raw.Claim(flag, time, device)) {
+    g_deviceCorrelations.fetch_add(1, std::memory_order_relaxed);
+    return device;
   }
+  if (c.lastDevice && time - c.lastTime <= kDeviceRecentMs) {
+    device = c.lastDevice;
+  }
+  c.hook.Push(device, time, flag);
+  g_deviceInferred.fetch_add(1, std::memory_order_relaxed);
+  return device;
 }
 
-std::string ActionTypeToString(ActionType type) {
-  switch (type) {
-  case ActionType::Keys:
-    return "keys";
-  case ActionType::Run:
-    return "run";
-  case ActionType::Open:
-    return "open";
-  case ActionType::Text:
-    return "text";
-  case ActionType::Macro:
-    return "macro";
+// RI_MOUSE_* transition behind a hook message, 0 if it is not correlated.
+USHORT RawFlagForHookEvent(WPARAM msg, const MSLLHOOKSTRUCT &m) {
+  const bool x1 = HIWORD(m.mouseData) == XBUTTON1;
+  switch (msg) {
+  case WM_XBUTTONDOWN:
+    return x1 ? RI_MOUSE_BUTTON_4_DOWN : RI_MOUSE_BUTTON_5_DOWN;
+  case WM_XBUTTONUP:
+    return x1 ? RI_MOUSE_BUTTON_4_UP : RI_MOUSE_BUTTON_5_UP;
+  case WM_MOUSEWHEEL:
+    return RI_MOUSE_WHEEL;
+  case WM_MOUSEHWHEEL:
+    return RI_MOUSE_HWHEEL;
   default:
-    return "none";
+    return 0;
   }
 }
 
-std::string KeysToString(const std::vector<WORD> &keys) {
-  std::unordered_map<WORD, std::string> reverse = {
-      {VK_CONTROL, "CTRL"},
-      {VK_SHIFT, "SHIFT"},
-      {VK_MENU, "ALT"},
-      {VK_LWIN, "WIN"},
-      {VK_TAB, "TAB"},
-      {VK_RETURN, "ENTER"},
-      {VK_ESCAPE, "ESC"},
-      {VK_SPACE, "SPACE"},
-      {VK_BACK, "BACKSPACE"},
-      {VK_DELETE, "DELETE"},
-      {VK_INSERT, "INSERT"},
-      {VK_HOME, "HOME"},
-      {VK_END, "END"},
-      {VK_PRIOR, "PGUP"},
-      {VK_NEXT, "PGDN"},
-      {VK_UP, "UP"},
-      {VK_DOWN, "DOWN"},
-      {VK_LEFT, "LEFT"},
-      {VK_RIGHT, "RIGHT"},
-      {VK_VOLUME_UP, "VOLUMEUP"},
-      {VK_VOLUME_DOWN, "VOLUMEDOWN"},
-      {VK_VOLUME_MUTE, "VOLUMEMUTE"},
-      {VK_MEDIA_PLAY_PAUSE, "PLAYPAUSE"},
-      {VK_MEDIA_NEXT_TRACK, "NEXTTRACK"},
-      {VK_MEDIA_PREV_TRACK, "PREVTRACK"}};
-
-  std::string out;
-  for (size_t i = 0; i < keys.size(); ++i) {
-    WORD vk = keys[i];
-    std::string part;
-    auto it = reverse.find(vk);
-    if (it != reverse.end()) {
-      part = it->second;
-    } else if ((vk >= 'A' && vk <= 'Z') || (vk >= '0' && vk <= '9')) {
-      part.push_back(static_cast<char>(vk));
-    } else if (vk >= VK_F1 && vk <= VK_F24) {
-      part = "F" + std::to_string(vk - VK_F1 + 1);
-    } else {
-      part = std::to_string(vk);
-    }
-
-    if (!out.empty()) {
-      out += "+";
+// Hook thread: the table for the mouse that produced the event. Without
+// device profiles this is the foreground mapping and costs nothing extra.
+const MappingTable *MappingForEvent(WPARAM msg, const MSLLHOOKSTRUCT &m) {
+  const MappingTable *active = g_activeMapping.load(std::memory_order_acquire);
+  const CompiledProfiles *cp = g_profiles.load(std::memory_order_acquire);
+  const USHORT flag = RawFlagForHookEvent(msg, m);
+  if (!cp || cp->devices.empty() || !flag) {
+    return active;
+  }
+  const long long start = QpcNow();
+  const MappingTable *table = active;
+  HANDLE device = CorrelateHookEvent(g_devices, flag, m.time);
+  if (device) {
+    const int index = DeviceIndex(g_devices, *cp, device);
+    if (index >= 0) {
+      const MappingTable *deviceTable =
+          g_deviceMappings[index].load(std::memory_order_acquire);
+      table = deviceTable ? deviceTable : active;
     }
-    out += part;
   }
+  g_deviceCorrelateNs.fetch_add(
+      static_cast<unsigned long long>(QpcToNs(QpcNow() - start)),
+      std::memory_order_relaxed);
+  return table;
+}
 
-  return out;
+// ---------------------------------------------------------------------------
+// Chord layers: the keyboard and mouse hooks keep a bitmap of the keys and
+// buttons physically held (injected input is ignored). A side-button event
+// masks the held layer triggers of the active table and resolves its action
+// with one lookup in MappingTable::layerByMask.
+// ---------------------------------------------------------------------------
+
+HHOOK g_keyboardHook = nullptr;
+std::atomic<uint64_t> g_inputState[4] = {};
+// Input thread: triggers under which a layered binding fired since they
+// were pressed; a side-button trigger only taps its own action otherwise.
+unsigned g_chordUsed = 0;
+
+bool InputHeld(WORD vk) {
+  return vk < 256 &&
+         ((g_inputState[vk >> 6].load(std::memory_order_relaxed) >>
+           (vk & 63)) & 1) != 0;
 }
 
-std::string ActionToConfigValue(const Action &action) {
-  if (action.type == ActionType::None) {
-    return "none:";
+// VK_SHIFT/VK_CONTROL/VK_MENU for their left/right variants, 0 otherwise.
+WORD GenericModifier(WORD vk) {
+  switch (vk) {
+  case VK_LSHIFT:
+  case VK_RSHIFT:
+    return VK_SHIFT;
+  case VK_LCONTROL:
+  case VK_RCONTROL:
+    return VK_CONTROL;
+  case VK_LMENU:
+  case VK_RMENU:
+    return VK_MENU;
+  default:
+    return 0;
   }
+}
 
-  if (action.type == ActionType::Keys) {
-    return "keys:" + KeysToString(action.keys);
+void SetInputBit(WORD vk, bool down) {
+  const uint64_t bit = 1ull << (vk & 63);
+  if (down) {
+    g_inputState[vk >> 6].fetch_or(bit, std::memory_order_relaxed);
+  } else {
+    g_inputState[vk >> 6].fetch_and(~bit, std::memory_order_relaxed);
   }
-
-  return ActionTypeToString(action.type) + ":" + action.payload;
 }
 
-bool ParseAction(const std::string &rawValue, Action &action) {
-  action = {};
-  std::string value = Trim(rawValue);
-  if (value.empty()) {
-    return false;
+void UpdateInputState(WORD vk, bool down) {
+  if (vk > 0xFF) {
+    return;
   }
-
-  const auto colon = value.find(':');
-  if (colon == std::string::npos) {
-    return false;
+  SetInputBit(vk, down);
+  if (const WORD generic = GenericModifier(vk)) {
+    SetInputBit(generic, down || InputHeld(vk ^ 1)); // the other side
   }
+}
 
-  std::string type = ToUpper(Trim(value.substr(0, colon)));
-  std::string payload = Trim(value.substr(colon + 1));
+void TrackMouseButton(WPARAM msg, const MSLLHOOKSTRUCT &m) {
+  if (m.flags & LLMHF_INJECTED) {
+    return;
+  }
+  if (msg == WM_LBUTTONDOWN || msg == WM_RBUTTONDOWN ||
+      msg == WM_MBUTTONDOWN || msg == WM_XBUTTONDOWN) {
+    g_buttonPresses.fetch_add(1, std::memory_order_relaxed);
+  }
+  switch (msg) {
+  case WM_LBUTTONDOWN:
+  case WM_LBUTTONUP:
+    UpdateInputState(VK_LBUTTON, msg == WM_LBUTTONDOWN);
+    break;
+  case WM_RBUTTONDOWN:
+  case WM_RBUTTONUP:
+    UpdateInputState(VK_RBUTTON, msg == WM_RBUTTONDOWN);
+    break;
+  case WM_MBUTTONDOWN:
+  case WM_MBUTTONUP:
+    UpdateInputState(VK_MBUTTON, msg == WM_MBUTTONDOWN);
+    break;
+  case WM_XBUTTONDOWN:
+  case WM_XBUTTONUP:
+    UpdateInputState(HIWORD(m.mouseData) == XBUTTON1 ? VK_XBUTTON1
+                                                     : VK_XBUTTON2,
+                     msg == WM_XBUTTONDOWN);
+    break;
+  default:
+    break;
+  }
+}
 
-  if (type == "NONE") {
-    action.type = ActionType::None;
-    return true;
+unsigned HeldTriggerMask(const MappingTable &map) {
+  unsigned mask = 0;
+  for (size_t i = 0; i < map.layers.size(); ++i) {
+    if (InputHeld(map.triggers[i])) {
+      mask |= 1u << i;
+    }
   }
+  return mask;
+}
 
-  if (type == "KEYS") {
-    std::vector<WORD> keys;
-    if (!ParseKeys(payload, keys)) {
-      return false;
+int TriggerIndex(const MappingTable &map, WORD vk) {
+  for (size_t i = 0; i < map.layers.size(); ++i) {
+    if (map.triggers[i] == vk) {
+      return static_cast<int>(i);
     }
-    action.type = ActionType::Keys;
-    action.keys = std::move(keys);
-    return true;
   }
+  return -1;
+}
 
-  if (type == "RUN") {
-    action.type = ActionType::Run;
-    action.payload = payload;
-    return !action.payload.empty();
+// |layer| receives 1 + the layer that supplied the action, 0 for the base.
+const Action &ResolveBinding(const MappingTable &map, Binding binding,
+                             unsigned held, size_t &layer) {
+  layer = map.layerByMask[binding][held];
+  return layer ? map.layers[layer - 1].actions[binding]
+               : map.actions[binding];
+}
+
+// Left/right VKs covered by a modifier trigger; 0 for other triggers.
+size_t ModifierSides(WORD trigger, WORD sides[2]) {
+  switch (trigger) {
+  case VK_SHIFT:
+  case VK_CONTROL:
+  case VK_MENU: {
+    const WORD left = trigger == VK_SHIFT     ? VK_LSHIFT
+                      : trigger == VK_CONTROL ? VK_LCONTROL
+                                              : VK_LMENU;
+    sides[0] = left;
+    sides[1] = static_cast<WORD>(left + 1);
+    return 2;
+  }
+  case VK_LSHIFT:
+  case VK_RSHIFT:
+  case VK_LCONTROL:
+  case VK_RCONTROL:
+  case VK_LMENU:
+  case VK_RMENU:
+  case VK_LWIN:
+  case VK_RWIN:
+    sides[0] = trigger;
+    return 1;
+  default:
+    return 0;
   }
+}
 
-  if (type == "OPEN") {
-    action.type = ActionType::Open;
-    action.payload = payload;
-    return !action.payload.empty();
+// A keys: action from a modifier layer runs with that modifier lifted, so
+// layer.shift.button4=keys:CTRL+Z sends Ctrl+Z rather than Ctrl+Shift+Z.
+bool ExecuteLayerAction(const Action &action, WORD trigger, int button,
+                        bool held) {
+  const WORD generic =
+      GenericModifier(trigger) ? GenericModifier(trigger) : trigger;
+  WORD sides[2] = {};
+  const size_t count =
+      (action.type == ActionType::Keys && !IsAltTabCombo(action.keys) &&
+       std::find(action.keys.begin(), action.keys.end(), generic) ==
+           action.keys.end())
+          ? ModifierSides(trigger, sides)
+          : 0;
+  INPUT lift[2] = {};
+  INPUT restore[2] = {};
+  UINT lifted = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (InputHeld(sides[i])) {
+      lift[lifted] = MakeKeyInput(sides[i], true);
+      restore[lifted] = MakeKeyInput(sides[i], false);
+      ++lifted;
+    }
   }
+  if (lifted == 0) {
+    return ExecuteAction(action, button, held);
+  }
+  // Physical keys, so these bypass the injected-key table.
+  g_sendInput(lifted, lift);
+  const bool ok = ExecuteAction(action, button, held);
+  g_sendInput(lifted, restore);
+  return ok;
+}
 
-  if (type == "TEXT") {
-    action.type = ActionType::Text;
-    action.payload = payload;
-    return !action.payload.empty();
+// Release of a side button that is also a layer trigger. With no base
+// action the swallowed click is replayed, tagged so the hook skips it.
+void TapTriggerButton(const Action &action, int button) {
+  switch (action.type) {
+  case ActionType::None: {
+    const WORD vk = button == 1 ? VK_XBUTTON1 : VK_XBUTTON2;
+    INPUT click[2] = {MakeKeyInput(vk, false), MakeKeyInput(vk, true)};
+    click[0].mi.dwExtraInfo = click[1].mi.dwExtraInfo = kNexusInjectTag;
+    g_sendInput(2, click);
+    break;
+  }
+  case ActionType::DpiShift:
+    break; // needs a hold; not available on a trigger button
+  default:
+    ExecuteAction(action, button, false);
+    break;
   }
+}
 
-  if (type == "MACRO") {
-    action.type = ActionType::Macro;
-    action.payload = payload;
-    return !action.payload.empty();
+// Release of a button that was tracking a gesture: a stroke runs its
+// gesture action, no movement runs the button's own action.
+void FinishGesture(const MappingTable &map, Binding binding, int button) {
+  const uint16_t stroke =
+      EndGesture(g_gesture, QpcNow(), map.gestureFlickMs * QpcTicksPerMs());
+  if (stroke == 0) {
+    TapTriggerButton(map.actions[binding], button);
+  } else if (const Action *action = FindGesture(map, binding, stroke)) {
+    g_gestureStrokes.fetch_add(1, std::memory_order_relaxed);
+    ExecuteAction(*action, button, false);
+  } else {
+    g_gestureMisses.fetch_add(1, std::memory_order_relaxed);
   }
+}
 
-  return false;
+// ---------------------------------------------------------------------------
+// Wheel: a bound direction accumulates wheel delta and fires its action once
+// per wheel_notch, so high-resolution wheels that report fractions of a
+// notch fire at the same rate as classic ones. Unbound scroll is re-injected
+// with speed and inversion applied, or handed to the smooth-scroll thread.
+// All per-event state is fixed-size and owned by the input thread.
+// ---------------------------------------------------------------------------
+
+constexpr int kSmoothScrollFrameMs = 10;
+constexpr int32_t kSmoothScrollDivisor = 4; // share of the rest per frame
+constexpr int32_t kSmoothScrollMinStep = 6;
+
+struct WheelState {
+  int32_t travel[kWheelBindings] = {}; // toward the next action, per direction
+  int64_t remQ16[2] = {}; // scaled scroll remainder, vertical/horizontal
+};
+
+WheelState g_wheel; // input thread
+
+std::thread g_scrollThread;
+std::mutex g_scrollMutex;
+std::condition_variable g_scrollCv;
+int32_t g_scrollPending[2] = {}; // guarded by g_scrollMutex
+bool g_scrollStop = false;       // guarded by g_scrollMutex
+
+// Adds |delta| (> 0) of travel toward direction |dir| and returns the number
+// of notches it completed. Turning the wheel back clears the opposite
+// direction, so a wobble never fires on stale travel.
+int AccumulateWheel(WheelState &s, size_t dir, int32_t delta, int32_t notch) {
+  s.travel[dir ^ 1] = 0;
+  const int32_t total = s.travel[dir] + delta;
+  s.travel[dir] = total % notch;
+  return total / notch;
 }
 
-void WriteDefaultConfigIfMissing(const std::string &path) {
-  std::ifstream probe(path);
-  if (probe.good()) {
-    return;
-  }
+// Scales pass-through scroll on |axis|; the fraction carries over.
+int32_t ScaleWheel(WheelState &s, size_t axis, int32_t delta, int32_t gain) {
+  const int64_t scaled = static_cast<int64_t>(delta) * gain + s.remQ16[axis];
+  const int64_t out = scaled / kMotionUnity;
+  s.remQ16[axis] = scaled - out * kMotionUnity;
+  return static_cast<int32_t>(out);
+}
 
-  std::ofstream out(path);
-  out << "# Mouse side button remap config\n";
-  out << "# button4 / button5 syntax: <type>:<value>\n";
-  out << "# types: none, keys, run, open, text\n";
-  out << "# suspend_fullscreen=true disables remap when a fullscreen window is "
-         "active\n\n";
-  out << "button4=keys:CTRL+C\n";
-  out << "button5=keys:ALT+TAB\n";
-  out << "suspend_fullscreen=true\n";
+INPUT WheelInput(size_t axis, int32_t delta) {
+  INPUT in = {};
+  in.type = INPUT_MOUSE;
+  in.mi.mouseData = static_cast<DWORD>(delta);
+  in.mi.dwFlags = axis ? MOUSEEVENTF_HWHEEL : MOUSEEVENTF_WHEEL;
+  in.mi.dwExtraInfo = kNexusInjectTag;
+  return in;
 }
 
-Config LoadConfig(const std::string &path) {
-  Config cfg;
+// Eases out: each frame sends a quarter of what is left, never less than a
+// few units so the tail does not crawl.
+int32_t SmoothScrollStep(int32_t pending) {
+  const int32_t rest = std::abs(pending);
+  const int32_t step =
+      std::max(rest / kSmoothScrollDivisor, std::min(rest, kSmoothScrollMinStep));
+  return pending < 0 ? -step : step;
+}
 
-  std::ifstream in(path);
-  if (!in.is_open()) {
-    return cfg;
+// Hook thread: only adds to the distance left to scroll.
+void QueueSmoothScroll(size_t axis, int32_t delta) {
+  if (delta == 0) {
+    return;
   }
+  {
+    std::lock_guard<std::mutex> lock(g_scrollMutex);
+    g_scrollPending[axis] += delta;
+  }
+  g_scrollCv.notify_one();
+}
 
-  std::string line;
-  while (std::getline(in, line)) {
-    std::string t = Trim(line);
-    if (t.empty() || t[0] == '#') {
-      continue;
-    }
-
-    const auto eq = t.find('=');
-    if (eq == std::string::npos) {
-      continue;
+void ScrollThreadProc() {
+  ScopedServiceThread sched(kThreadScroll);
+  std::unique_lock<std::mutex> lock(g_scrollMutex);
+  for (;;) {
+    g_scrollCv.wait(lock, [] {
+      return g_scrollStop || g_scrollPending[0] != 0 || g_scrollPending[1] != 0;
+    });
+    if (g_scrollStop) {
+      return;
     }
-
-    std::string key = ToUpper(Trim(t.substr(0, eq)));
-    std::string value = Trim(t.substr(eq + 1));
-
-    if (key == "BUTTON4") {
-      Action action;
-      if (ParseAction(value, action)) {
-        cfg.button4 = action;
-      }
-    } else if (key == "BUTTON5") {
-      Action action;
-      if (ParseAction(value, action)) {
-        cfg.button5 = action;
+    INPUT frame[2] = {};
+    UINT count = 0;
+    for (size_t axis = 0; axis < 2; ++axis) {
+      const int32_t step = SmoothScrollStep(g_scrollPending[axis]);
+      if (step != 0) {
+        g_scrollPending[axis] -= step;
+        frame[count++] = WheelInput(axis, step);
       }
-    } else if (key == "SUSPEND_FULLSCREEN") {
-      std::string b = ToUpper(value);
-      cfg.suspendInFullscreen =
-          (b == "1" || b == "TRUE" || b == "YES" || b == "ON");
-    } else if (key == "DPI") {
-      cfg.dpi = std::atoi(value.c_str());
     }
+    lock.unlock();
+    g_sendInput(count, frame);
+    g_smoothScrollFrames.fetch_add(1, std::memory_order_relaxed);
+    lock.lock();
+    g_scrollCv.wait_for(lock, std::chrono::milliseconds(kSmoothScrollFrameMs),
+                        [] { return g_scrollStop; });
   }
+}
 
-  return cfg;
+void StartSmoothScroll() {
+  g_scrollStop = false;
+  g_scrollThread = std::thread(ScrollThreadProc);
 }
 
-bool SaveConfig(const std::string &path, const Config &cfg) {
-  std::ofstream out(path, std::ios::trunc);
-  if (!out.is_open()) {
-    return false;
+void StopSmoothScroll() {
+  {
+    std::lock_guard<std::mutex> lock(g_scrollMutex);
+    g_scrollStop = true;
   }
+  g_scrollCv.notify_one();
+  if (g_scrollThread.joinable()) {
+    g_scrollThread.join();
+  }
+}
 
-  out << "# Mouse side button remap config\n";
-  out << "button4=" << ActionToConfigValue(cfg.button4) << "\n";
-  out << "button5=" << ActionToConfigValue(cfg.button5) << "\n";
-  out << "suspend_fullscreen=" << (cfg.suspendInFullscreen ? "true" : "false")
-      << "\n";
-  out << "dpi=" << cfg.dpi << "\n";
-  return true;
+bool WheelRemapped(const MappingTable &map) {
+  return map.wheelBindings != 0 || map.wheelInvert || map.wheelSmooth ||
+         map.wheelGain != kMotionUnity;
 }
 
-bool IsFullscreenForegroundWindow() {
-  HWND fg = GetForegroundWindow();
-  if (!fg || fg == g_mainWindow || fg == g_settingsWindow) {
+// Hook thread. |axis| is 0 for WM_MOUSEWHEEL, 1 for WM_MOUSEHWHEEL. Returns
+// true if the event was consumed.
+bool HandleWheel(const MappingTable &map, size_t axis, int32_t delta) {
+  if (delta == 0) {
     return false;
   }
-
-  RECT wr = {};
-  if (!GetWindowRect(fg, &wr)) {
+  if (map.wheelInvert) {
+    delta = -delta;
+  }
+  // Positive delta is up on the vertical wheel and right on the tilt wheel.
+  const size_t dir = axis * 2 + (axis ? delta > 0 : delta < 0);
+  const Binding binding = static_cast<Binding>(kBindWheelUp + dir);
+  if (map.wheelBindings & (1u << binding)) {
+    size_t layer = 0;
+    const unsigned held = HeldTriggerMask(map);
+    const Action &action = ResolveBinding(map, binding, held, layer);
+    if (action.type != ActionType::None) {
+      int notches =
+          AccumulateWheel(g_wheel, dir, std::abs(delta), map.wheelNotch);
+      if (layer && notches > 0) {
+        g_chordUsed |= held;
+      }
+      for (; notches > 0; --notches) {
+        g_wheelActions.fetch_add(1, std::memory_order_relaxed);
+        if (layer) {
+          g_layerActions.fetch_add(1, std::memory_order_relaxed);
+          ExecuteLayerAction(action, map.layers[layer - 1].trigger,
+                             kMacroWheelButton, false);
+        } else {
+          ExecuteAction(action, kMacroWheelButton, false);
+        }
+      }
+      return true;
+    }
+  }
+  if (!map.wheelInvert && !map.wheelSmooth && map.wheelGain == kMotionUnity) {
     return false;
   }
+  const int32_t out = ScaleWheel(g_wheel, axis, delta, map.wheelGain);
+  if (map.wheelSmooth) {
+    QueueSmoothScroll(axis, out);
+  } else if (out != 0) {
+    INPUT in = WheelInput(axis, out);
+    g_sendInput(1, &in);
+  }
+  return true;
+}
 
-  HMONITOR monitor = MonitorFromWindow(fg, MONITOR_DEFAULTTONEAREST);
-  MONITORINFO mi = {};
-  mi.cbSize = sizeof(mi);
-  if (!GetMonitorInfoA(monitor, &mi)) {
-    return false;
+LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam,
+                                      LPARAM lParam) {
+  if (nCode == HC_ACTION) {
+    const auto *kb = reinterpret_cast<const KBDLLHOOKSTRUCT *>(lParam);
+    if (!(kb->flags & LLKHF_INJECTED)) {
+      UpdateInputState(static_cast<WORD>(kb->vkCode),
+                       wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN);
+    }
   }
+  return CallNextHookEx(g_keyboardHook, nCode, wParam, lParam);
+}
 
-  const int tol = 2;
-  return abs(wr.left - mi.rcMonitor.left) <= tol &&
-         abs(wr.top - mi.rcMonitor.top) <= tol &&
-         abs(wr.right - mi.rcMonitor.right) <= tol &&
-         abs(wr.bottom - mi.rcMonitor.bottom) <= tol;
+// Input thread: installs the keyboard hook while g_keyboardHookNeeded and
+// removes it otherwise. Keys pressed while it was off are picked up from
+// GetAsyncKeyState so a trigger already held works at once.
+void UpdateKeyboardHook() {
+  const bool want = g_keyboardHookNeeded.load();
+  if (want == (g_keyboardHook != nullptr)) {
+    return;
+  }
+  if (!want) {
+    UnhookWindowsHookEx(g_keyboardHook);
+    g_keyboardHook = nullptr;
+    g_keyboardHookInstalled.store(false);
+    return;
+  }
+  g_keyboardHook = SetWindowsHookExA(WH_KEYBOARD_LL, LowLevelKeyboardProc,
+                                     GetModuleHandleA(nullptr), 0);
+  if (!g_keyboardHook) {
+    return;
+  }
+  for (WORD vk = 1; vk < 256; ++vk) {
+    if (!IsMouseButtonVk(vk)) {
+      SetInputBit(vk, (GetAsyncKeyState(vk) & 0x8000) != 0);
+    }
+  }
+  g_keyboardHookInstalled.store(true);
 }
 
-LRESULT CALLBACK LowLevelMouseProc(int nCode, WPARAM wParam, LPARAM lParam) {
+LRESULT HandleMouseHook(int nCode, WPARAM wParam, LPARAM lParam) {
+  if (nCode == HC_ACTION && wParam == WM_MOUSEMOVE) {
+    const MSLLHOOKSTRUCT *move = reinterpret_cast<MSLLHOOKSTRUCT *>(lParam);
+    if (move->dwExtraInfo != kNexusInjectTag && MotionPipelineOwnsCursor()) {
+      return 1; // Re-injected with DPI scaling from WM_INPUT.
+    }
+  } else if (nCode == HC_ACTION) {
+    TrackMouseButton(wParam, *reinterpret_cast<MSLLHOOKSTRUCT *>(lParam));
+  }
   if (nCode == HC_ACTION && !g_macroRecording) {
-    if (wParam == WM_XBUTTONDOWN || wParam == WM_XBUTTONUP) {
+    if (wParam == WM_MOUSEWHEEL || wParam == WM_MOUSEHWHEEL) {
+      const auto *wheel = reinterpret_cast<const MSLLHOOKSTRUCT *>(lParam);
+      if (wheel->dwExtraInfo != kNexusInjectTag) {
+        g_wheelEvents.fetch_add(1, std::memory_order_relaxed);
+        const MappingTable *map = MappingForEvent(wParam, *wheel);
+        if (map && WheelRemapped(*map) &&
+            !(map->suspendInFullscreen && IsFullscreenForegroundWindow()) &&
+            HandleWheel(*map, wParam == WM_MOUSEHWHEEL,
+                        GET_WHEEL_DELTA_WPARAM(wheel->mouseData))) {
+          return 1;
+        }
+      }
+    } else if (wParam == WM_XBUTTONDOWN || wParam == WM_XBUTTONUP) {
       MSLLHOOKSTRUCT *pMouseStruct = (MSLLHOOKSTRUCT *)lParam;
       int button = HIWORD(pMouseStruct->mouseData);
-      
-      if (g_config.suspendInFullscreen && IsFullscreenForegroundWindow()) {
+      if (pMouseStruct->dwExtraInfo == kNexusInjectTag ||
+          pMouseStruct->dwExtraInfo == kNexusProbeTag) {
         return CallNextHookEx(g_mouseHook, nCode, wParam, lParam);
       }
-      
-      static DWORD lastBtn4Tick = 0;
-      static DWORD lastBtn5Tick = 0;
+      const MappingTable *map = MappingForEvent(wParam, *pMouseStruct);
+
+      // Always end a held DPI shift, even if remapping got suspended
+      // in between.
+      if (wParam == WM_XBUTTONUP && g_dpiShiftButton.load() == button) {
+        EndDpiShift();
+        return 1;
+      }
+      if (wParam == WM_XBUTTONUP) {
+        MacroTriggerReleased(button);
+      } else if (CancelMacro(button)) {
+        return 1; // pressing a macro's button again stops it
+      }
+
+      if (!map || (button != 1 && button != 2)) {
+        return CallNextHookEx(g_mouseHook, nCode, wParam, lParam);
+      }
+
+      if (map->suspendInFullscreen && IsFullscreenForegroundWindow()) {
+        return CallNextHookEx(g_mouseHook, nCode, wParam, lParam);
+      }
+
+      // XBUTTON2 is typically Upper/Forward -> Button 4,
+      // XBUTTON1 is typically Lower/Back -> Button 5.
+      const Binding binding = (button == 2) ? kBindButton4 : kBindButton5;
+      const bool down = wParam == WM_XBUTTONDOWN;
+
+      // A side button that is itself a layer trigger taps its base action
+      // on release, unless a layered binding fired while it was held.
+      const int selfTrigger =
+          TriggerIndex(*map, button == 1 ? VK_XBUTTON1 : VK_XBUTTON2);
+      if (selfTrigger >= 0) {
+        const unsigned bit = 1u << selfTrigger;
+        if (down) {
+          g_chordUsed &= ~bit;
+        } else if (!(g_chordUsed & bit)) {
+          TapTriggerButton(map->actions[binding], button);
+        }
+        return 1;
+      }
+
+      if (!down && g_gesture.active && g_gesture.button == button) {
+        FinishGesture(*map, binding, button);
+        return 1;
+      }
+
+      size_t layer = 0;
+      const unsigned held = HeldTriggerMask(*map);
+      const Action &action = ResolveBinding(*map, binding, held, layer);
+      if (layer && down) {
+        g_chordUsed |= held;
+        g_layerActions.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (!layer && down && (map->gestureBindings & (1u << binding))) {
+        BeginGesture(g_gesture, button, map->gestureDistance, QpcNow());
+        return 1;
+      }
+
+      static DWORD lastTick[kBindingCount] = {};
       const DWORD now = GetTickCount();
       const DWORD debounceMs = 120;
 
-      if (button == 2) { // XBUTTON2 (typically Upper/Forward -> Button 4)
-         if (g_config.button4.type != ActionType::None) {
-            if (wParam == WM_XBUTTONDOWN) {
-               if (now - lastBtn4Tick > debounceMs) {
-                 lastBtn4Tick = now;
-                 ExecuteAction(g_config.button4);
-               }
-            }
-            return 1; // Block!
-         }
-      } else if (button == 1) { // XBUTTON1 (typically Lower/Back -> Button 5)
-         if (g_config.button5.type != ActionType::None) {
-            if (wParam == WM_XBUTTONDOWN) {
-               if (now - lastBtn5Tick > debounceMs) {
-                 lastBtn5Tick = now;
-                 ExecuteAction(g_config.button5);
-               }
+      if (action.type == ActionType::DpiShift) {
+        if (wParam == WM_XBUTTONDOWN) {
+          BeginDpiShift(action.payload, button);
+        }
+        return 1;
+      }
+      if (action.type == ActionType::Macro) {
+        if (wParam == WM_XBUTTONDOWN && now - lastTick[binding] > debounceMs) {
+          lastTick[binding] = now;
+          StartMacro(action, button, true);
+        }
+        return 1;
+      }
+      if (action.type != ActionType::None) {
+        if (wParam == WM_XBUTTONDOWN) {
+          if (now - lastTick[binding] > debounceMs) {
+            lastTick[binding] = now;
+            if (layer) {
+              ExecuteLayerAction(action, map->layers[layer - 1].trigger,
+                                 button, true);
+            } else {
+              ExecuteAction(action, button, true);
             }
-            return 1; // Block!
-         }
+          }
+        }
+        return 1; // Block!
       }
     }
   }
   return CallNextHookEx(g_mouseHook, nCode, wParam, lParam);
 }
 
+// Times every non-motion event for the hook_latency_ns histogram while
+// telemetry is detailed; motion is left out so the 8 kHz stream does not pay
+// for two QPC reads.
+LRESULT CALLBACK LowLevelMouseProc(int nCode, WPARAM wParam, LPARAM lParam) {
+  if (nCode != HC_ACTION || wParam == WM_MOUSEMOVE ||
+      !g_telemetryDetailed.load(std::memory_order_relaxed)) {
+    return HandleMouseHook(nCode, wParam, lParam);
+  }
+  const long long start = QpcNow();
+  const LRESULT result = HandleMouseHook(nCode, wParam, lParam);
+  RecordHistogram(g_hookLatencyHist, QpcToNs(QpcNow() - start));
+  return result;
+}
+
 ActionType IndexToActionType(int idx) {
   switch (idx) {
   case 1:
@@ -1365,12 +7550,7 @@ void RemoveTrayIcon() { Shell_NotifyIconA(NIM_DELETE, &g_tray); }
 LRESULT CALLBACK MainProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
   switch (msg) {
   case WM_CREATE: {
-    RAWINPUTDEVICE rid = {};
-    rid.usUsagePage = 0x01;
-    rid.usUsage = 0x02;
-    rid.dwFlags = RIDEV_INPUTSINK;
-    rid.hwndTarget = hwnd;
-    if (!RegisterRawInputDevices(&rid, 1, sizeof(rid))) {
+    if (!UpdateRawInputRegistration(hwnd)) {
       MessageBoxA(hwnd, "Failed to register raw input.", "Mouse Remapper",
                   MB_ICONERROR | MB_OK);
       PostQuitMessage(1);
@@ -1389,15 +7569,22 @@ LRESULT CALLBACK MainProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
       return 0;
     }
 
-    std::vector<BYTE> buffer(size);
+    // Mouse packets fit in a RAWINPUT; avoid a heap allocation per packet.
+    RAWINPUT stackRaw = {};
+    std::vector<BYTE> heapBuffer;
+    void *buffer = &stackRaw;
+    if (size > sizeof(stackRaw)) {
+      heapBuffer.resize(size);
+      buffer = heapBuffer.data();
+    }
     if (GetRawInputData(reinterpret_cast<HRAWINPUT>(lParam), RID_INPUT,
-                        buffer.data(), &size, sizeof(RAWINPUTHEADER)) != size) {
+                        buffer, &size, sizeof(RAWINPUTHEADER)) != size) {
       return 0;
     }
 
-    const RAWINPUT *raw = reinterpret_cast<const RAWINPUT *>(buffer.data());
+    const RAWINPUT *raw = static_cast<const RAWINPUT *>(buffer);
     if (raw->header.dwType == RIM_TYPEMOUSE) {
-      UpdateTelemetryFromRawInput(raw);
+      HandleRawMouse(raw, static_cast<DWORD>(GetMessageTime()));
     }
     return 0;
   }
@@ -1423,7 +7610,8 @@ LRESULT CALLBACK MainProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
       OpenStitchPage("settings.html");
       return 0;
     case ID_TRAY_RELOAD:
-      g_config = LoadConfig(g_configPath);
+      LoadMacroLibrary(GetMacroLibraryPath());
+      LoadConfigFromDisk();
       return 0;
     case ID_TRAY_EXIT:
       DestroyWindow(hwnd);
@@ -1431,6 +7619,31 @@ LRESULT CALLBACK MainProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
     default:
       return DefWindowProcA(hwnd, msg, wParam, lParam);
     }
+  case WM_CONFIG_RELOADED:
+    ApplyPendingConfig(lParam);
+    return 0;
+  case WM_SCHEDULING_CHANGED:
+    ApplyInputMmcss();
+    return 0;
+  case WM_RAW_INPUT_CHANGED:
+    UpdateRawInputRegistration(hwnd);
+    return 0;
+  case WM_KEYBOARD_HOOK_CHANGED:
+    UpdateKeyboardHook();
+    return 0;
+  case WM_RENDERFORMAT:
+    if (wParam == CF_UNICODETEXT) {
+      RenderPastedText();
+    }
+    return 0;
+  case WM_RENDERALLFORMATS:
+    if (OpenClipboard(hwnd)) {
+      if (GetClipboardOwner() == hwnd) {
+        RenderPastedText();
+      }
+      CloseClipboard();
+    }
+    return 0;
   case WM_TIMER:
     if (wParam == TIMER_ID_ALT_RELEASE) {
       ReleaseStickyAlt();
@@ -1441,10 +7654,23 @@ LRESULT CALLBACK MainProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
       DestroyWindow(g_settingsWindow);
       g_settingsWindow = nullptr;
     }
+    StopTelemetry();
     StopStatusServer();
+    StopLauncher();
+    StopTextInjector();
+    StopSmoothScroll();
+    StopMacroThread();
+    StopConfigPersistence();
+    StopConfigWatcher();
+    ReleaseInjectedKeys();
     if (g_mouseHook) {
       UnhookWindowsHookEx(g_mouseHook);
     }
+    g_keyboardHookNeeded.store(false);
+    UpdateKeyboardHook();
+    if (g_foregroundHook) {
+      UnhookWinEvent(g_foregroundHook);
+    }
     RemoveTrayIcon();
     PostQuitMessage(0);
     return 0;
@@ -1453,15 +7679,1434 @@ LRESULT CALLBACK MainProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
   }
 }
 
+// ---------------------------------------------------------------------------
+// Microbenchmarks (run with --bench [output.json])
+// ---------------------------------------------------------------------------
+
+struct BenchResult {
+  std::string name;
+  unsigned long long iterations = 0;
+  double nsPerOp = 0.0;
+  double allocsPerOp = 0.0;
+  double bytesPerOp = 0.0;
+  double itemsPerOp = 0.0; // reported as items_per_sec when set
+  double accuracy = -1.0;  // reported when >= 0
+};
+
+volatile unsigned long long g_benchSink = 0;
+
+// Runs fn in batches until at least minMs of wall time has been measured, so
+// fast and slow benchmarks both get stable numbers.
+template <typename Fn>
+BenchResult RunBench(const std::string &name, Fn &&fn, double minMs = 200.0) {
+  for (int i = 0; i < 3; ++i) {
+    fn();
+  }
+
+  unsigned long long batch = 1;
+  unsigned long long iterations = 0;
+  long long ticks = 0;
+  unsigned long long allocs = 0;
+  unsigned long long bytes = 0;
+  while (QpcToNs(ticks) < minMs * 1e6) {
+    const unsigned long long allocs0 = g_heapAllocs.load();
+    const unsigned long long bytes0 = g_heapAllocBytes.load();
+    const long long t0 = QpcNow();
+    for (unsigned long long i = 0; i < batch; ++i) {
+      fn();
+    }
+    ticks += QpcNow() - t0;
+    allocs += g_heapAllocs.load() - allocs0;
+    bytes += g_heapAllocBytes.load() - bytes0;
+    iterations += batch;
+    if (batch < (1ull << 24)) {
+      batch *= 2;
+    }
+  }
+
+  BenchResult r;
+  r.name = name;
+  r.iterations = iterations;
+  r.nsPerOp = QpcToNs(ticks) / static_cast<double>(iterations);
+  r.allocsPerOp = static_cast<double>(allocs) / static_cast<double>(iterations);
+  r.bytesPerOp = static_cast<double>(bytes) / static_cast<double>(iterations);
+  return r;
+}
+
+std::string BuildBenchMacro(size_t steps) {
+  static const char *keys[] = {"A", "CTRL", "SHIFT", "F5", "SPACE", "7"};
+  std::string out;
+  out.reserve(steps * 8);
+  for (size_t i = 0; i < steps; ++i) {
+    if (!out.empty()) {
+      out += ",";
+    }
+    if (i % 3 == 2) {
+      out += std::to_string(5 + i % 40);
+    } else {
+      out += keys[i % 6];
+      out += (i % 3 == 0) ? ":D" : ":U";
+    }
+  }
+  return out;
+}
+
+std::string BuildBenchJsonBody(size_t targetBytes) {
+  std::string body = "{";
+  for (size_t i = 0; body.size() < targetBytes; ++i) {
+    body += "\"filler" + std::to_string(i) + "\":\"" +
+            std::string(48, static_cast<char>('a' + i % 26)) + "\\\"x\",";
+  }
+  body += "\"button4\":\"keys:CTRL+SHIFT+ESC\",\"dpi\":1600}";
+  return body;
+}
+
+bool WriteBenchConfig(const std::string &path, size_t bindings) {
+  std::ofstream out(path, std::ios::trunc);
+  if (!out.is_open()) {
+    return false;
+  }
+  static const char *values[] = {"keys:CTRL+ALT+DELETE", "run:notepad.exe",
+                                 "open:https://example.com", "text:hello",
+                                 "macro:A:D,20,A:U"};
+  out << "# benchmark config\n";
+  for (size_t i = 0; i < bindings; ++i) {
+    out << ((i % 2) ? "button4=" : "button5=") << values[i % 5] << "\n";
+    if (i % 10 == 0) {
+      out << "# comment " << i << "\n";
+    }
+  }
+  out << "suspend_fullscreen=true\n";
+  out << "dpi=1600\n";
+  return true;
+}
+
+std::string BenchResultsToJson(const std::vector<BenchResult> &results) {
+  std::ostringstream ss;
+  ss.setf(std::ios::fixed);
+  ss.precision(2);
+  ss << "{\"schema\":1,\"benchmarks\":[\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult &r = results[i];
+    ss << "{\"name\":\"" << JsonEscape(r.name) << "\",\"iterations\":"
+       << r.iterations << ",\"ns_per_op\":" << r.nsPerOp
+       << ",\"allocs_per_op\":" << r.allocsPerOp
+       << ",\"bytes_per_op\":" << r.bytesPerOp;
+    if (r.itemsPerOp > 0.0) {
+      ss << ",\"items_per_sec\":" << r.itemsPerOp * 1e9 / r.nsPerOp;
+    }
+    if (r.accuracy >= 0.0) {
+      ss << ",\"accuracy\":" << r.accuracy;
+    }
+    ss << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  ss << "]}\n";
+  return ss.str();
+}
+
+int RunBenchmarks(const std::string &outputPath, bool clipboard) {
+  EnableAllocTracking();
+  std::vector<BenchResult> results;
+
+  const std::vector<std::string> commonNames = {"ctrl", " Shift ", "F12", "a",
+                                                "volumeup", "PgDn", "7"};
+  size_t nameIdx = 0;
+  results.push_back(RunBench("KeyNameToVk/common", [&] {
+    g_benchSink += KeyNameToVk(commonNames[nameIdx++ % commonNames.size()]);
+  }));
+  const std::string unknownName(256, 'Q');
+  results.push_back(RunBench("KeyNameToVk/unknown_256b", [&] {
+    g_benchSink += KeyNameToVk(unknownName);
+  }));
+
+  std::vector<WORD> keys;
+  results.push_back(RunBench("ParseKeys/combo4", [&] {
+    g_benchSink += ParseKeys("CTRL+SHIFT+ALT+F4", keys);
+  }));
+  std::string longCombo;
+  for (int i = 0; i < 64; ++i) {
+    longCombo += (i ? "+" : "") + std::string(i % 2 ? "SHIFT" : "F11");
+  }
+  results.push_back(RunBench("ParseKeys/combo64", [&] {
+    g_benchSink += ParseKeys(longCombo, keys);
+  }));
+
+  Action action;
+  results.push_back(RunBench("ParseAction/keys", [&] {
+    g_benchSink += ParseAction("keys:CTRL+C", action);
+  }));
+  results.push_back(RunBench("ParseAction/run", [&] {
+    g_benchSink += ParseAction("run: C:\\Tools\\app.exe --flag", action);
+  }));
+  // Down/up bookkeeping only; the filtered batch is not sent.
+  const std::vector<INPUT> comboInputs =
+      BuildComboInputs({VK_CONTROL, VK_SHIFT, VK_MENU, 'S'});
+  std::vector<INPUT> filtered;
+  results.push_back(RunBench("InjectedKeys/filter_combo4", [&] {
+    filtered = comboInputs;
+    g_benchSink += FilterInjectedInputs(filtered.data(),
+                                        static_cast<UINT>(filtered.size()));
+  }));
+  // Release with bit 63 of a word held (F16 = 0x7F, OEM_2 = 0xBF).
+  const SendInputFn prevSend = g_sendInput;
+  g_sendInput = [](UINT count, INPUT *) -> UINT { return count; };
+  results.push_back(RunBench("InjectedKeys/release_bit63", [&] {
+    for (WORD vk : {WORD{VK_F16}, WORD{VK_OEM_2}, WORD{'A'}}) {
+      SetInjectedKey(vk, true);
+    }
+    g_benchSink += ReleaseInjectedKeys();
+  }));
+  g_sendInput = prevSend;
+  // Keyboard hook per-event cost over a replay of typing with modifiers,
+  // and layer resolution for a side-button press with 8 layers defined.
+  std::vector<KBDLLHOOKSTRUCT> keyReplay;
+  const WORD typedKeys[] = {VK_LSHIFT, 'H', 'E', VK_RCONTROL, 'L', 'O', VK_SPACE};
+  for (WORD vk : typedKeys) {
+    KBDLLHOOKSTRUCT kb = {};
+    kb.vkCode = vk;
+    keyReplay.push_back(kb);
+  }
+  size_t keyIdx = 0;
+  results.push_back(RunBench("Hook/keyboard_replay", [&] {
+    const size_t i = keyIdx++;
+    KBDLLHOOKSTRUCT &kb = keyReplay[(i / 2) % keyReplay.size()];
+    g_benchSink += LowLevelKeyboardProc(HC_ACTION, i % 2 ? WM_KEYUP : WM_KEYDOWN,
+                                        reinterpret_cast<LPARAM>(&kb));
+  }));
+  Config layerCfg;
+  const WORD layerTriggers[] = {VK_SHIFT, VK_CONTROL, VK_MENU, VK_LWIN,
+                                VK_CAPITAL, VK_XBUTTON1, VK_MBUTTON, VK_TAB};
+  for (WORD trigger : layerTriggers) {
+    LayerBinding layer;
+    layer.trigger = trigger;
+    ParseAction("keys:CTRL+Z", layer.action);
+    layerCfg.layers.push_back(layer);
+  }
+  const CompiledProfiles layerProfiles = CompileProfiles(layerCfg);
+  UpdateInputState(VK_MENU, true);
+  results.push_back(RunBench("Layers/resolve_8_layers", [&] {
+    size_t layer = 0;
+    const Action &resolved =
+        ResolveBinding(layerProfiles.fallback, kBindButton4,
+                       HeldTriggerMask(layerProfiles.fallback), layer);
+    g_benchSink += layer + static_cast<size_t>(resolved.type);
+  }));
+  UpdateInputState(VK_MENU, false);
+
+  const std::string macro10k = "macro:" + BuildBenchMacro(10000);
+  results.push_back(RunBench("ParseAction/macro_10k", [&] {
+    g_benchSink += ParseAction(macro10k, action);
+  }));
+
+  std::vector<MacroOp> ops;
+  const std::string macroSmall = BuildBenchMacro(12);
+  results.push_back(RunBench("CompileMacro/12_steps", [&] {
+    g_benchSink += CompileMacro(macroSmall, ops);
+  }));
+  const std::string macroLarge = macro10k.substr(6);
+  results.push_back(RunBench("CompileMacro/10k_steps", [&] {
+    g_benchSink += CompileMacro(macroLarge, ops);
+  }));
+  std::string encoded;
+  uint32_t encodedEvents = 0;
+  if (CompileMacro(macroLarge, ops) &&
+      EncodeLibraryMacro(ops, encoded, encodedEvents)) {
+    const auto *bytes = reinterpret_cast<const uint8_t *>(encoded.data());
+    results.push_back(RunBench("MacroLibrary/decode_10k", [&] {
+      g_benchSink += DecodeLibraryMacro(bytes, encoded.size(), ops);
+    }));
+  }
+
+  // Interpreter dispatch vs. a straight-line walk over the same compiled
+  // ops, both against a counting sink with zero-length waits. The bench
+  // macro has no jumps, so the walk only needs keys and delays.
+  const MacroHost benchHost = {
+      [](UINT count, INPUT *) -> UINT {
+        g_benchSink += count;
+        return count;
+      },
+      [](DWORD, bool) { return MacroWaitResult::Elapsed; },
+      [](WORD) { return false; }, [] { return false; }};
+  CompileMacro(macroLarge, ops);
+  results.push_back(RunBench("Macro/straight_line_10k", [&] {
+    for (const MacroOp &op : ops) {
+      if (op.code == MacroOpCode::Delay) {
+        benchHost.wait(static_cast<DWORD>(op.a), false);
+        continue;
+      }
+      if (op.code != MacroOpCode::Key) {
+        break;
+      }
+      INPUT in = MakeKeyInput(op.arg, op.state == 'U');
+      benchHost.send(1, &in);
+      if (op.state == 'P') {
+        benchHost.wait(kMacroPressMs, false);
+        in = MakeKeyInput(op.arg, true);
+        benchHost.send(1, &in);
+      }
+    }
+  }));
+  results.push_back(RunBench("Macro/vm_dispatch_10k", [&] {
+    unsigned long long executed = 0;
+    RunMacroProgram(ops, benchHost, executed);
+    g_benchSink += executed;
+  }));
+  CompileMacro("REPEAT:100,REPEAT:100,A,END,END", ops);
+  results.push_back(RunBench("Macro/vm_repeat_10k", [&] {
+    unsigned long long executed = 0;
+    RunMacroProgram(ops, benchHost, executed);
+    g_benchSink += executed;
+  }));
+
+  const std::string configPath = GetExeDir() + "\\bench_config.ini";
+  if (WriteBenchConfig(configPath, 8)) {
+    results.push_back(RunBench("LoadConfig/8_bindings", [&] {
+      g_benchSink += LoadConfig(configPath).dpi;
+    }));
+  }
+  if (WriteBenchConfig(configPath, 500)) {
+    results.push_back(RunBench("LoadConfig/500_bindings", [&] {
+      g_benchSink += LoadConfig(configPath).dpi;
+    }));
+    results.push_back(RunBench("LoadConfigCached/500_bindings_warm", [&] {
+      g_benchSink += LoadConfigCached(configPath).dpi;
+    }));
+  }
+  std::remove(configPath.c_str());
+  std::remove(GetConfigCachePath(configPath).c_str());
+
+  std::string extracted;
+  const std::string smallBody =
+      "{\"button4\":\"keys:CTRL+C\",\"button5\":\"keys:ALT+TAB\"}";
+  results.push_back(RunBench("ExtractJsonString/small", [&] {
+    g_benchSink += ExtractJsonString(smallBody, "button5", extracted);
+  }));
+  const std::string bigBody = BuildBenchJsonBody(64 * 1024);
+  results.push_back(RunBench("ExtractJsonString/64kb_key_last", [&] {
+    g_benchSink += ExtractJsonString(bigBody, "button4", extracted);
+  }));
+  results.push_back(RunBench("ExtractJsonString/64kb_missing", [&] {
+    g_benchSink += ExtractJsonString(bigBody, "button5", extracted);
+  }));
+
+  results.push_back(RunBench("BuildStatusJson", [&] {
+    g_benchSink += BuildStatusJson().size();
+  }));
+
+  const std::vector<WORD> combo = {VK_CONTROL, VK_SHIFT, VK_ESCAPE, 'K'};
+  results.push_back(RunBench("KeysToString/combo4", [&] {
+    g_benchSink += KeysToString(combo).size();
+  }));
+
+  // One second of 8 kHz motion replayed packet by packet; the per-packet
+  // budget at 8 kHz is 125000 ns.
+  struct ReplayPacket {
+    LONG dx;
+    LONG dy;
+    long long qpc;
+  };
+  std::vector<ReplayPacket> replay(8000);
+  const long long qpcPerMs = QpcTicksPerMs();
+  for (size_t i = 0; i < replay.size(); ++i) {
+    replay[i].dx = static_cast<LONG>(std::lround(3.0 * std::sin(i * 0.01)));
+    replay[i].dy = static_cast<LONG>(std::lround(2.0 * std::cos(i * 0.013)));
+    replay[i].qpc = 1 + static_cast<long long>(i) * qpcPerMs / 8;
+  }
+  Config motionCfg;
+  motionCfg.dpi = 1600;
+  motionCfg.dpiPresets = {400, 800, 1600, 3200};
+  motionCfg.dpiPreset = 1;
+  const MotionProfile presetsOnly = CompileMotionProfile(motionCfg);
+  motionCfg.accel = AccelCurve::Power;
+  motionCfg.accelRate = 0.05;
+  motionCfg.accelOffset = 2.0;
+  motionCfg.accelCap = 3.0;
+  const MotionProfile withAccel = CompileMotionProfile(motionCfg);
+  g_dpiPresetIndex.store(1);
+  MotionState motionState;
+  size_t replayIdx = 0;
+  LONG mx = 0;
+  LONG my = 0;
+  results.push_back(RunBench("Motion/8khz_replay_presets", [&] {
+    const ReplayPacket &pk = replay[replayIdx++ % replay.size()];
+    ScaleMotion(presetsOnly, motionState, pk.dx, pk.dy, kMotionUnity, pk.qpc,
+                qpcPerMs, mx, my);
+    g_benchSink += mx + my;
+  }));
+  results.push_back(RunBench("Motion/8khz_replay_accel_device", [&] {
+    const ReplayPacket &pk = replay[replayIdx++ % replay.size()];
+    ScaleMotion(withAccel, motionState, pk.dx, pk.dy, ToQ16(1.25), pk.qpc,
+                qpcPerMs, mx, my);
+    g_benchSink += mx + my;
+  }));
+
+  // Gesture strokes replayed as 8 kHz packets of 1-3 counts with
+  // perpendicular wobble and noise; accuracy is the share of strokes
+  // recognized as drawn, ns_per_op is per packet.
+  struct GesturePacket {
+    LONG dx;
+    LONG dy;
+    uint16_t expected; // set on the last packet of a stroke
+  };
+  const char *strokeNames[] = {
+      "up",        "down",         "left",       "right",
+      "up-right",  "up-left",      "down-right", "down-left",
+      "right-up",  "right-down",   "left-up",    "left-down",
+      "up-right-down", "left-down-right", "right-up-left",
+      "right-down-left-up"};
+  std::vector<GesturePacket> gestureReplay;
+  uint32_t noise = 12345;
+  for (int round = 0; round < 8; ++round) {
+    for (const char *name : strokeNames) {
+      uint16_t stroke = 0;
+      ParseGestureStroke(ToUpper(name), stroke);
+      for (size_t seg = 0; seg < GestureSegments(stroke); ++seg) {
+        const uint16_t dir = GestureDirAt(stroke, seg);
+        const int length = 120 + (round * 37 + static_cast<int>(seg) * 53) % 180;
+        for (int travelled = 0, i = 0; travelled < length; ++i) {
+          noise = noise * 1664525u + 1013904223u;
+          const LONG step = 1 + static_cast<LONG>((noise >> 16) % 3);
+          const LONG wobble =
+              static_cast<LONG>(std::lround(0.8 * std::sin(i * 0.05))) +
+              static_cast<LONG>((noise >> 8) % 3) - 1;
+          const LONG sign = (dir == kGestureUp || dir == kGestureLeft) ? -1 : 1;
+          const bool horizontal = dir == kGestureLeft || dir == kGestureRight;
+          gestureReplay.push_back({horizontal ? sign * step : wobble,
+                                   horizontal ? wobble : sign * step, 0});
+          travelled += step;
+        }
+      }
+      gestureReplay.back().expected = stroke;
+    }
+  }
+  GestureState gestureState;
+  size_t recognized = 0;
+  size_t strokes = 0;
+  BeginGesture(gestureState, 1, 40, 0);
+  for (const GesturePacket &pk : gestureReplay) {
+    FeedGesture(gestureState, pk.dx, pk.dy);
+    if (pk.expected) {
+      recognized += EndGesture(gestureState, 1, 0) == pk.expected;
+      ++strokes;
+      BeginGesture(gestureState, 1, 40, 0);
+    }
+  }
+  size_t gestureIdx = 0;
+  BenchResult gestureResult = RunBench("Gesture/8khz_replay", [&] {
+    const GesturePacket &pk = gestureReplay[gestureIdx++ % gestureReplay.size()];
+    FeedGesture(gestureState, pk.dx, pk.dy);
+    if (pk.expected) {
+      g_benchSink += EndGesture(gestureState, 1, 0);
+      BeginGesture(gestureState, 1, 40, 0);
+    }
+  });
+  gestureResult.accuracy = static_cast<double>(recognized) / strokes;
+  results.push_back(gestureResult);
+
+  // A free-spinning high-resolution wheel: sub-notch deltas with a short
+  // reversal every 500 events, through a bound direction's notch counter and
+  // the scaled pass-through path.
+  std::vector<int32_t> wheelDeltas;
+  for (int i = 0; i < 8000; ++i) {
+    wheelDeltas.push_back((i % 500 < 480 ? 1 : -1) * (8 + (i * 7) % 25));
+  }
+  WheelState wheelState;
+  size_t wheelIdx = 0;
+  results.push_back(RunBench("Wheel/free_spin_8khz", [&] {
+    const int32_t delta = wheelDeltas[wheelIdx++ % wheelDeltas.size()];
+    g_benchSink += AccumulateWheel(wheelState, delta < 0, std::abs(delta), 120);
+    g_benchSink += ScaleWheel(wheelState, 0, delta, kMotionUnity * 3 / 2);
+  }));
+
+  // Two mice clicking alternately: each raw packet is recorded and then
+  // claimed by its hook event, so ns_per_op covers both sides.
+  DeviceCorrelator correlator;
+  const HANDLE mice[2] = {reinterpret_cast<HANDLE>(1),
+                          reinterpret_cast<HANDLE>(2)};
+  DWORD correlateTime = 0;
+  results.push_back(RunBench("Devices/correlate_2_mice", [&] {
+    const HANDLE mouse = mice[correlateTime & 1];
+    RecordRawTransitions(correlator, mouse, RI_MOUSE_BUTTON_4_DOWN,
+                         correlateTime);
+    g_benchSink += CorrelateHookEvent(correlator, RI_MOUSE_BUTTON_4_DOWN,
+                                      correlateTime) == mouse;
+    ++correlateTime;
+  }));
+
+  // 8 kHz motion into a private history: ring write plus the 10 ms tier,
+  // with the 1 s and 1 min folds amortized in.
+  auto history = std::make_unique<InputHistory>();
+  RAWMOUSE historyPacket = {};
+  uint64_t historyUs = 0;
+  results.push_back(RunBench("History/ingest_8khz", [&] {
+    historyPacket.lLastX = static_cast<LONG>(historyUs & 7) - 3;
+    historyPacket.lLastY = 2;
+    historyUs += 125;
+    RecordHistory(*history, historyPacket, historyUs, 125);
+  }));
+
+  // The per-packet cost of each telemetry tier, one mouse.
+  RAWINPUT tierPacket = {};
+  tierPacket.header.dwType = RIM_TYPEMOUSE;
+  tierPacket.header.hDevice = reinterpret_cast<HANDLE>(0x1000);
+  tierPacket.data.mouse.lLastX = 1;
+  const bool wasDetailed = g_telemetryDetailed.exchange(true);
+  results.push_back(RunBench("RawInput/packet_detailed", [&] {
+    HandleRawMouse(&tierPacket, 0);
+  }));
+  g_telemetryDetailed = false;
+  results.push_back(RunBench("RawInput/packet_minimal", [&] {
+    HandleRawMouse(&tierPacket, 0);
+  }));
+  g_telemetryDetailed = wasDetailed;
+
+  // Text strategies deliver into a counting sink instead of SendInput. The
+  // clipboard is shared with every other app, so its run is opt-in
+  // (--bench ... --clipboard); it saves and restores whatever is on it.
+  const SendInputFn countingSink = [](UINT count, INPUT *) -> UINT {
+    g_benchSink += count;
+    return count;
+  };
+  std::wstring benchText;
+  while (benchText.size() < 2000) {
+    benchText += L"Hello, world! \xD83D\xDE00 ";
+  }
+  BenchResult typed = RunBench("TextInject/unicode_2k", [&] {
+    std::vector<size_t> groupEnds;
+    std::vector<INPUT> inputs = BuildUnicodeInputs(benchText, groupEnds);
+    g_benchSink += SubmitInputsPaced(inputs, groupEnds, countingSink);
+  });
+  typed.itemsPerOp = static_cast<double>(benchText.size());
+  results.push_back(typed);
+  if (clipboard) {
+    if (!g_mainWindow) {
+      g_mainWindow = CreateWindowExA(0, "STATIC", "", 0, 0, 0, 0, 0,
+                                     HWND_MESSAGE, nullptr, nullptr, nullptr);
+    }
+    BenchResult pasted = RunBench("TextInject/clipboard_2k", [&] {
+      g_benchSink += PasteTextViaClipboard(benchText, countingSink) ==
+                     PasteResult::Sent;
+    });
+    pasted.itemsPerOp = static_cast<double>(benchText.size());
+    results.push_back(pasted);
+  }
+
+  const std::string json = BenchResultsToJson(results);
+  std::ofstream out(outputPath, std::ios::trunc);
+  if (!out.is_open()) {
+    return 1;
+  }
+  out << json;
+  return out.good() ? 0 : 1;
+}
+
+// ---------------------------------------------------------------------------
+// Macro library converter (run with --convert-macros [config.ini] [macros.nxm])
+// Moves flat inline macro: bindings into the library, rewrites them as
+// macro:@<id> and prints a size and load-time comparison. Entries already in
+// the library are kept. Exit the app first; it keeps the library mapped.
+// ---------------------------------------------------------------------------
+
+struct LibraryMacroBlob {
+  uint32_t id = 0;
+  uint32_t events = 0;
+  std::string bytes;
+};
+
+// |macros| must be sorted by id.
+std::string BuildMacroLibrary(const std::vector<LibraryMacroBlob> &macros) {
+  MacroLibraryHeader header;
+  header.count = static_cast<uint32_t>(macros.size());
+  std::string out(reinterpret_cast<const char *>(&header), sizeof(header));
+  uint32_t offset = static_cast<uint32_t>(
+      sizeof(header) + macros.size() * sizeof(MacroLibraryEntry));
+  for (const LibraryMacroBlob &m : macros) {
+    MacroLibraryEntry entry;
+    entry.id = m.id;
+    entry.offset = offset;
+    entry.size = static_cast<uint32_t>(m.bytes.size());
+    entry.events = m.events;
+    out.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    offset += entry.size;
+  }
+  for (const LibraryMacroBlob &m : macros) {
+    out += m.bytes;
+  }
+  return out;
+}
+
+template <typename Fn> double AverageUs(Fn &&fn) {
+  constexpr int kReps = 100;
+  const long long start = QpcNow();
+  for (int i = 0; i < kReps; ++i) {
+    fn();
+  }
+  return QpcToNs(QpcNow() - start) / 1000.0 / kReps;
+}
+
+int RunMacroConvert(const std::string &iniPath,
+                    const std::string &libraryPath) {
+  if (AttachConsole(ATTACH_PARENT_PROCESS)) {
+    std::freopen("CONOUT$", "w", stdout);
+    std::freopen("CONOUT$", "w", stderr);
+  }
+
+  std::string text;
+  std::string error;
+  if (!ReadFileBytes(iniPath, text)) {
+    std::fprintf(stderr, "cannot read %s\n", iniPath.c_str());
+    return 1;
+  }
+  Config cfg = ParseConfigText(text, &error);
+  if (!error.empty()) {
+    std::fprintf(stderr, "%s: %s\n", iniPath.c_str(), error.c_str());
+    return 1;
+  }
+
+  std::vector<LibraryMacroBlob> macros;
+  uint32_t nextId = 1;
+  if (auto existing = OpenMacroLibrary(libraryPath)) {
+    for (uint32_t i = 0; i < existing->count; ++i) {
+      const MacroLibraryEntry &e = existing->entries[i];
+      macros.push_back(
+          {e.id, e.events,
+           std::string(reinterpret_cast<const char *>(existing->view) +
+                           e.offset,
+                       e.size)});
+      nextId = e.id + 1;
+    }
+  }
+  const size_t kept = macros.size();
+
+  std::vector<Action *> bindings;
+  for (size_t b = 0; b < kBindingCount; ++b) {
+    bindings.push_back(&BindingAction(cfg, static_cast<Binding>(b)));
+    for (Profile &profile : cfg.profiles) {
+      bindings.push_back(&BindingAction(profile, static_cast<Binding>(b)));
+    }
+  }
+  std::vector<std::string> texts;
+  size_t textBytes = 0;
+  size_t libraryBytes = 0;
+  size_t skipped = 0;
+  for (Action *action : bindings) {
+    if (action->type != ActionType::Macro || !action->macro) {
+      continue;
+    }
+    LibraryMacroBlob blob;
+    if (!EncodeLibraryMacro(*action->macro, blob.bytes, blob.events)) {
+      ++skipped; // uses VM constructs; stays inline
+      continue;
+    }
+    blob.id = nextId++;
+    textBytes += action->payload.size();
+    libraryBytes += blob.bytes.size() + sizeof(MacroLibraryEntry);
+    texts.push_back(action->payload);
+    action->payload = "@" + std::to_string(blob.id);
+    action->macro.reset();
+    macros.push_back(std::move(blob));
+  }
+  if (texts.empty()) {
+    std::printf("no convertible inline macros in %s (%zu skipped)\n",
+                iniPath.c_str(), skipped);
+    return 0;
+  }
+
+  // Library first, so the INI never references an id that is not on disk.
+  if (!WriteFileAtomic(libraryPath, BuildMacroLibrary(macros))) {
+    std::fprintf(stderr, "cannot write %s\n", libraryPath.c_str());
+    return 1;
+  }
+  if (!SaveConfig(iniPath, cfg)) {
+    std::fprintf(stderr, "cannot write %s\n", iniPath.c_str());
+    return 1;
+  }
+
+  std::vector<MacroOp> ops;
+  const double compileUs = AverageUs([&] {
+    for (const std::string &t : texts) {
+      g_benchSink += CompileMacro(t, ops);
+    }
+  });
+  const double openUs = AverageUs([&] {
+    g_benchSink += OpenMacroLibrary(libraryPath) != nullptr;
+  });
+  const double decodeUs = AverageUs([&] {
+    auto lib = OpenMacroLibrary(libraryPath);
+    for (size_t i = kept; lib && i < macros.size(); ++i) {
+      const MacroLibraryEntry *e = lib->Find(macros[i].id);
+      g_benchSink +=
+          e && DecodeLibraryMacro(lib->view + e->offset, e->size, ops);
+    }
+  });
+
+  std::printf("converted %zu macros (%zu skipped, %zu already in library)\n",
+              texts.size(), skipped, kept);
+  std::printf("  text:    %zu bytes, compile %.1f us\n", textBytes,
+              compileUs);
+  std::printf("  library: %zu bytes, open %.1f us, open+decode %.1f us\n",
+              libraryBytes, openUs, decodeUs);
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Latency self-test (run with --latency-test [probes] [output.json])
+// Injects tagged XBUTTON1 clicks and timestamps every stage from the moment
+// the probe is submitted. The stages are SendInput returning, our low-level
+// hook, the hooks installed before it (a running Nexus service among them)
+// and the raw input packet arriving back. The probe hook swallows every
+// probe, so no application sees the clicks. A running service passes probes
+// through untouched. The raw stage is only reported when Windows still
+// delivers a packet for a swallowed event.
+// ---------------------------------------------------------------------------
+constexpr int kProbeTimeoutMs = 100;
+constexpr size_t kProbeRawWarmup = 8; // probes to wait for raw before giving up
+
+std::atomic<bool> g_probeArmed{false};
+std::atomic<long long> g_probeHookQpc{0};
+std::atomic<long long> g_probeChainTicks{0};
+std::atomic<long long> g_probeRawQpc{0};
+
+LRESULT CALLBACK LatencyProbeHook(int nCode, WPARAM wParam, LPARAM lParam) {
+  const auto *m = reinterpret_cast<const MSLLHOOKSTRUCT *>(lParam);
+  if (nCode != HC_ACTION || m->dwExtraInfo != kNexusProbeTag) {
+    return CallNextHookEx(g_mouseHook, nCode, wParam, lParam);
+  }
+  const long long entry = QpcNow();
+  CallNextHookEx(g_mouseHook, nCode, wParam, lParam);
+  if (wParam == WM_XBUTTONDOWN && g_probeArmed.load()) {
+    g_probeChainTicks.store(QpcNow() - entry);
+    g_probeHookQpc.store(entry);
+  }
+  return 1;
+}
+
+LRESULT CALLBACK LatencyProbeProc(HWND hwnd, UINT msg, WPARAM wParam,
+                                  LPARAM lParam) {
+  if (msg == WM_INPUT) {
+    RAWINPUT raw = {};
+    UINT size = sizeof(raw);
+    if (GetRawInputData(reinterpret_cast<HRAWINPUT>(lParam), RID_INPUT, &raw,
+                        &size, sizeof(RAWINPUTHEADER)) !=
+            static_cast<UINT>(-1) &&
+        raw.header.dwType == RIM_TYPEMOUSE && !raw.header.hDevice &&
+        (raw.data.mouse.usButtonFlags & RI_MOUSE_BUTTON_4_DOWN) &&
+        g_probeArmed.load()) {
+      long long unset = 0;
+      g_probeRawQpc.compare_exchange_strong(unset, QpcNow());
+    }
+  }
+  return DefWindowProcA(hwnd, msg, wParam, lParam);
+}
+
+// Driver thread: the hook and WM_INPUT run on the thread pumping messages.
+nexus_latency::Report RunLatencyProbes(size_t probes) {
+  nexus_latency::Report report;
+  report.backend = "win32";
+  report.probes = probes;
+  report.stages = {{"send", {}}, {"hook", {}}, {"chain", {}}, {"raw", {}}};
+  INPUT down = {};
+  down.type = INPUT_MOUSE;
+  down.mi.dwFlags = MOUSEEVENTF_XDOWN;
+  down.mi.mouseData = XBUTTON1;
+  down.mi.dwExtraInfo = kNexusProbeTag;
+  INPUT up = down;
+  up.mi.dwFlags = MOUSEEVENTF_XUP;
+
+  uint32_t rng = static_cast<uint32_t>(QpcNow()) | 1u;
+  size_t rawSeen = 0;
+  for (size_t i = 0; i < probes; ++i) {
+    g_probeHookQpc = 0;
+    g_probeChainTicks = 0;
+    g_probeRawQpc = 0;
+    g_probeArmed = true;
+    const long long start = QpcNow();
+    SendInput(1, &down, sizeof(INPUT));
+    const long long sent = QpcNow();
+    const long long deadline = start + kProbeTimeoutMs * QpcTicksPerMs();
+    const bool wantRaw = rawSeen > 0 || i < kProbeRawWarmup;
+    while (QpcNow() < deadline &&
+           (!g_probeHookQpc.load() || (wantRaw && !g_probeRawQpc.load()))) {
+      std::this_thread::yield();
+    }
+    g_probeArmed = false;
+
+    report.stages[0].us.push_back(QpcToNs(sent - start) / 1000.0);
+    if (const long long hook = g_probeHookQpc.load()) {
+      report.stages[1].us.push_back(QpcToNs(hook - start) / 1000.0);
+      report.stages[2].us.push_back(QpcToNs(g_probeChainTicks.load()) /
+                                    1000.0);
+    } else {
+      ++report.timeouts;
+    }
+    if (const long long raw = g_probeRawQpc.load()) {
+      report.stages[3].us.push_back(QpcToNs(raw - start) / 1000.0);
+      ++rawSeen;
+    }
+    SendInput(1, &up, sizeof(INPUT));
+    // 1-3 ms apart so probes do not phase-lock with the message loop.
+    rng = rng * 1664525u + 1013904223u;
+    Sleep(1 + (rng >> 16) % 3);
+  }
+  return report;
+}
+
+int RunLatencyTest(size_t probes, const std::string &outputPath) {
+  if (AttachConsole(ATTACH_PARENT_PROCESS)) {
+    std::freopen("CONOUT$", "w", stdout);
+    std::freopen("CONOUT$", "w", stderr);
+  }
+
+  WNDCLASSA wc = {};
+  wc.lpfnWndProc = LatencyProbeProc;
+  wc.hInstance = GetModuleHandleA(nullptr);
+  wc.lpszClassName = "NexusLatencyProbe";
+  HWND hwnd = RegisterClassA(&wc)
+                  ? CreateWindowExA(0, wc.lpszClassName, "", 0, 0, 0, 0, 0,
+                                    HWND_MESSAGE, nullptr, wc.hInstance,
+                                    nullptr)
+                  : nullptr;
+  RAWINPUTDEVICE rid = {};
+  rid.usUsagePage = 0x01;
+  rid.usUsage = 0x02;
+  rid.dwFlags = RIDEV_INPUTSINK;
+  rid.hwndTarget = hwnd;
+  if (!hwnd || !RegisterRawInputDevices(&rid, 1, sizeof(rid))) {
+    std::fprintf(stderr, "cannot register for raw input\n");
+    return 1;
+  }
+  g_mouseHook = SetWindowsHookExA(WH_MOUSE_LL, LatencyProbeHook,
+                                  GetModuleHandleA(nullptr), 0);
+  if (!g_mouseHook) {
+    std::fprintf(stderr, "cannot install the mouse hook\n");
+    DestroyWindow(hwnd);
+    return 1;
+  }
+
+  nexus_latency::Report report;
+  const DWORD pumpThread = GetCurrentThreadId();
+  std::thread driver([&] {
+    report = RunLatencyProbes(probes);
+    PostThreadMessageA(pumpThread, WM_QUIT, 0, 0);
+  });
+  MSG msg = {};
+  while (GetMessageA(&msg, nullptr, 0, 0) > 0) {
+    DispatchMessageA(&msg);
+  }
+  driver.join();
+  UnhookWindowsHookEx(g_mouseHook);
+  g_mouseHook = nullptr;
+  DestroyWindow(hwnd);
+
+  std::fputs(nexus_latency::ReportToText(report).c_str(), stdout);
+  std::ofstream out(outputPath, std::ios::trunc);
+  out << nexus_latency::ReportToJson(report);
+  if (!out) {
+    std::fprintf(stderr, "cannot write %s\n", outputPath.c_str());
+    return 1;
+  }
+  return report.timeouts == report.probes ? 1 : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Stress test (run with --stress [key=value ...])
+// Drives synthetic mouse streams through the remap core the way Windows
+// would: every raw packet goes to HandleRawMouse and its hook message to
+// LowLevelMouseProc, on one input thread. Meanwhile other threads poll the
+// /status, /history, /config and /profiles builders, push configs through
+// ApplyConfigJson and, as the INI watcher would, through ApplyPendingConfig.
+// Injections go to a counting sink. A packet the input thread cannot start
+// within kStressMaxLagMs of its slot is dropped, as Windows would coalesce
+// it.
+//
+// --memcheck runs the same session, longer and slower, without timing
+// samples, and checks memory instead: heap growth between the start and the
+// end of the steady state (after the warmup), the peak working set, and
+// that the input thread allocates nothing once warm.
+// ---------------------------------------------------------------------------
+constexpr int kStressMaxLagMs = 10;
+constexpr int kMemcheckSampleMs = 50;
+
+struct StressOptions {
+  double seconds = 10;
+  double rate = 8000; // raw packets per second, all devices together
+  int devices = 2;
+  int burstMs = 0;     // > 0: bursts of burstMs at rate, then burstMs idle
+  double clicks = 0.02; // chance per packet of a side-button transition
+  double wheel = 0.01;  // chance per packet of a wheel notch
+  int motion = 4;       // max counts per axis per packet
+  int pollers = 2;      // threads polling the status and history builders
+  int pollMs = 5;
+  int reloadMs = 20;    // ApplyConfigJson period, 0 disables
+  int hotReloadMs = 30; // ApplyPendingConfig (INI hot reload) period
+  int contention = 0; // busy threads competing for the CPUs
+  nexus_sched::ThreadPolicy priority; // for the input thread
+  std::string output;
+  bool memcheck = false;
+  double warmupS = 10;  // memcheck: outlasts RetireSnapshot's grace period
+  double growthKb = 64; // memcheck: steady-state heap growth budget
+  double peakMb = 8;    // memcheck: peak working set budget
+};
+
+constexpr const char *kStressConfig =
+    "button4=keys:F24\n"
+    "button5=dpi:next\n"
+    "wheel_down=keys:F23\n"
+    "motion_rescale=true\n"
+    "dpi=1600\n"
+    "dpi_presets=800,1600\n"
+    "telemetry=always\n"
+    "[profile:stress-device]\n"
+    "match_device=4E58:0002\n"
+    "button4=keys:F22\n";
+
+std::atomic<unsigned long long> g_stressInjected{0};
+
+UINT StressSendInput(UINT count, INPUT *) {
+  g_stressInjected.fetch_add(count, std::memory_order_relaxed);
+  return count;
+}
+
+bool ParseStressOption(const std::string &arg, StressOptions &o) {
+  const size_t eq = arg.find('=');
+  if (eq == std::string::npos) {
+    return false;
+  }
+  const std::string key = arg.substr(0, eq);
+  const std::string value = arg.substr(eq + 1);
+  const double number = std::atof(value.c_str());
+  if (key == "seconds" && number > 0) {
+    o.seconds = number;
+  } else if (key == "rate" && number > 0) {
+    o.rate = number;
+  } else if (key == "devices" && number >= 1) {
+    o.devices = static_cast<int>(number);
+  } else if (key == "burst" && number >= 0) {
+    o.burstMs = static_cast<int>(number);
+  } else if (key == "clicks" && number >= 0 && number <= 1) {
+    o.clicks = number;
+  } else if (key == "wheel" && number >= 0 && number <= 1) {
+    o.wheel = number;
+  } else if (key == "motion" && number >= 0) {
+    o.motion = static_cast<int>(number);
+  } else if (key == "pollers" && number >= 0) {
+    o.pollers = static_cast<int>(number);
+  } else if (key == "poll_ms" && number >= 0) {
+    o.pollMs = static_cast<int>(number);
+  } else if (key == "reload_ms" && number >= 0) {
+    o.reloadMs = static_cast<int>(number);
+  } else if (key == "hot_reload_ms" && number >= 0) {
+    o.hotReloadMs = static_cast<int>(number);
+  } else if (key == "contention" && number >= 0) {
+    o.contention = static_cast<int>(number);
+  } else if (key == "priority") {
+    return nexus_sched::ParseThreadPolicy(value, o.priority);
+  } else if (key == "out" && !value.empty()) {
+    o.output = value;
+  } else if (o.memcheck && key == "warmup" && number >= 0) {
+    o.warmupS = number;
+  } else if (o.memcheck && key == "growth_kb" && number >= 0) {
+    o.growthKb = number;
+  } else if (o.memcheck && key == "peak_mb" && number > 0) {
+    o.peakMb = number;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+double StressRandom(uint32_t &rng) {
+  rng = rng * 1664525u + 1013904223u;
+  return (rng >> 8) / 16777216.0;
+}
+
+// Memcheck runs pass a null |stage|: growing sample vectors would count
+// against the heap budget.
+template <typename Fn> void TimeStage(nexus_latency::Stage *stage, Fn &&fn) {
+  if (!stage) {
+    fn();
+    return;
+  }
+  const long long start = QpcNow();
+  fn();
+  stage->us.push_back(QpcToNs(QpcNow() - start) / 1000.0);
+}
+
+struct StressInput {
+  std::vector<HANDLE> devices;
+  std::vector<unsigned> held; // per device: bit 0 XBUTTON1, bit 1 XBUTTON2
+  uint32_t rng = 1;
+  bool timed = true;
+  nexus_latency::Stage lag{"lag", {}}; // packet start behind its slot
+  nexus_latency::Stage raw{"raw", {}};
+  nexus_latency::Stage move{"move", {}};
+  nexus_latency::Stage hook{"hook", {}};
+};
+
+// One raw packet from |device| and the hook messages Windows derives from
+// it; hook and raw order is randomized like the real race between them.
+void StressPacket(StressInput &in, size_t device, const StressOptions &o) {
+  RAWINPUT raw = {};
+  raw.header.dwType = RIM_TYPEMOUSE;
+  raw.header.dwSize = sizeof(RAWINPUT);
+  raw.header.hDevice = in.devices[device];
+  RAWMOUSE &m = raw.data.mouse;
+  m.lLastX = static_cast<LONG>(StressRandom(in.rng) * (2 * o.motion + 1)) -
+             o.motion;
+  m.lLastY = static_cast<LONG>(StressRandom(in.rng) * (2 * o.motion + 1)) -
+             o.motion;
+
+  MSLLHOOKSTRUCT hook = {};
+  WPARAM msg = 0;
+  const double pick = StressRandom(in.rng);
+  if (pick < o.clicks) {
+    const unsigned bit = StressRandom(in.rng) < 0.5 ? 1u : 2u;
+    const bool down = !(in.held[device] & bit);
+    in.held[device] ^= bit;
+    m.usButtonFlags = bit == 1 ? (down ? RI_MOUSE_BUTTON_4_DOWN
+                                       : RI_MOUSE_BUTTON_4_UP)
+                               : (down ? RI_MOUSE_BUTTON_5_DOWN
+                                       : RI_MOUSE_BUTTON_5_UP);
+    msg = down ? WM_XBUTTONDOWN : WM_XBUTTONUP;
+    hook.mouseData = static_cast<DWORD>(bit == 1 ? XBUTTON1 : XBUTTON2) << 16;
+  } else if (pick < o.clicks + o.wheel) {
+    const SHORT delta = StressRandom(in.rng) < 0.5 ? WHEEL_DELTA : -WHEEL_DELTA;
+    m.usButtonFlags = RI_MOUSE_WHEEL;
+    m.usButtonData = static_cast<USHORT>(delta);
+    msg = WM_MOUSEWHEEL;
+    hook.mouseData = static_cast<DWORD>(static_cast<USHORT>(delta)) << 16;
+  }
+  hook.time = GetTickCount();
+
+  const bool hookFirst = msg && StressRandom(in.rng) < 0.5;
+  auto runHook = [&] {
+    TimeStage(in.timed ? &in.hook : nullptr, [&] {
+      LowLevelMouseProc(HC_ACTION, msg, reinterpret_cast<LPARAM>(&hook));
+    });
+  };
+  if (hookFirst) {
+    runHook();
+  }
+  TimeStage(in.timed ? &in.raw : nullptr,
+            [&] { HandleRawMouse(&raw, hook.time); });
+  if (m.lLastX || m.lLastY) {
+    MSLLHOOKSTRUCT move = {};
+    move.time = hook.time;
+    TimeStage(in.timed ? &in.move : nullptr, [&] {
+      LowLevelMouseProc(HC_ACTION, WM_MOUSEMOVE,
+                        reinterpret_cast<LPARAM>(&move));
+    });
+  }
+  if (msg && !hookFirst) {
+    runHook();
+  }
+}
+
+int RunStressTest(const StressOptions &o) {
+  EnableAllocTracking();
+  if (AttachConsole(ATTACH_PARENT_PROCESS)) {
+    std::freopen("CONOUT$", "w", stdout);
+    std::freopen("CONOUT$", "w", stderr);
+  }
+
+  // Saves from ApplyConfigJson land in a scratch INI, not the user's.
+  g_configPath = GetExeDir() + "\\stress_config.ini";
+  g_sendInput = StressSendInput;
+  ReplaceConfig(ParseConfigText(kStressConfig));
+  StartConfigPersistence();
+  StartSmoothScroll();
+  StartMacroThread();
+  const unsigned long long allocsBefore = g_heapAllocs.load();
+  const unsigned long long bytesBefore = g_heapAllocBytes.load();
+
+  StressInput input;
+  for (int d = 0; d < o.devices; ++d) {
+    input.devices.push_back(reinterpret_cast<HANDLE>(
+        static_cast<uintptr_t>(0x1000 + d)));
+  }
+  input.held.assign(input.devices.size(), 0);
+  input.rng = static_cast<uint32_t>(QpcNow()) | 1u;
+  input.timed = !o.memcheck;
+  const bool timed = input.timed;
+  const size_t expected =
+      timed ? static_cast<size_t>(o.rate * o.seconds) + 1 : 0;
+  input.lag.us.reserve(expected);
+  input.raw.us.reserve(expected);
+  input.move.us.reserve(expected);
+  input.hook.us.reserve(
+      static_cast<size_t>(expected * (o.clicks + o.wheel) * 1.5) + 16);
+
+  std::atomic<bool> stop{false};
+  std::vector<nexus_latency::Stage> pollStages;
+  std::vector<std::thread> workers;
+  pollStages.reserve(4 * o.pollers + 2);
+  for (int p = 0; p < o.pollers; ++p) {
+    pollStages.push_back({"status", {}});
+    pollStages.push_back({"history", {}});
+    pollStages.push_back({"config", {}});
+    pollStages.push_back({"profiles", {}});
+    nexus_latency::Stage *stages = &pollStages[pollStages.size() - 4];
+    workers.emplace_back([&o, &stop, stages, timed] {
+      AllocScope alloc(kThreadServer);
+      std::string body;
+      std::string type;
+      const std::string request = "GET /history?res=10ms HTTP/1.1\r\n\r\n";
+      while (!stop.load()) {
+        TimeStage(timed ? &stages[0] : nullptr,
+                  [&] { body = BuildStatusJson(); });
+        TimeStage(timed ? &stages[1] : nullptr,
+                  [&] { BuildHistoryResponse(request, body, type); });
+        TimeStage(timed ? &stages[2] : nullptr,
+                  [&] { body = BuildConfigJson(); });
+        TimeStage(timed ? &stages[3] : nullptr,
+                  [&] { body = BuildProfilesJson(); });
+        Sleep(o.pollMs);
+      }
+    });
+  }
+  pollStages.push_back({"config_apply", {}});
+  if (o.reloadMs > 0) {
+    nexus_latency::Stage *stage = timed ? &pollStages.back() : nullptr;
+    workers.emplace_back([&o, &stop, stage] {
+      const char *bodies[2] = {
+          "{\"button4\":\"keys:F24\",\"button5\":\"dpi:next\","
+          "\"wheel_speed\":1.5}",
+          "{\"button4\":\"keys:F21\",\"button5\":\"dpi:next\","
+          "\"wheel_speed\":1.0}"};
+      std::string error;
+      for (size_t n = 0; !stop.load(); ++n) {
+        TimeStage(stage, [&] { ApplyConfigJson(bodies[n & 1], error); });
+        Sleep(o.reloadMs);
+      }
+    });
+  }
+  // Hot reload: this thread parses like the watcher and then applies like
+  // the UI thread, racing the ApplyConfigJson writer above.
+  pollStages.push_back({"config_reload", {}});
+  if (o.hotReloadMs > 0) {
+    nexus_latency::Stage *stage = timed ? &pollStages.back() : nullptr;
+    workers.emplace_back([&o, &stop, stage] {
+      const std::string texts[2] = {
+          std::string("wheel_speed=2.0\n") + kStressConfig,
+          std::string("wheel_notch=240\n") + kStressConfig};
+      AllocScope alloc(kThreadConfig);
+      for (size_t n = 0; !stop.load(); ++n) {
+        TimeStage(stage, [&] {
+          auto pending = std::make_unique<PendingConfig>();
+          pending->generation = g_configGeneration.load();
+          pending->cfg = ParseConfigText(texts[n & 1]);
+          pending->startQpc = QpcNow();
+          ApplyPendingConfig(reinterpret_cast<LPARAM>(pending.release()));
+        });
+        Sleep(o.hotReloadMs);
+      }
+    });
+  }
+
+  for (int c = 0; c < o.contention; ++c) {
+    workers.emplace_back([&stop] {
+      while (!stop.load(std::memory_order_relaxed)) {
+      }
+    });
+  }
+  const bool prioritized = nexus_sched::ApplyCurrentThreadPolicy(o.priority);
+  if (!prioritized) {
+    std::fprintf(stderr, "could not apply priority=%s to the input thread\n",
+                 nexus_sched::ThreadPolicyToString(o.priority).c_str());
+  }
+
+  const long long perMs = QpcTicksPerMs();
+  const double ticksPerPacket = perMs * 1000.0 / o.rate;
+  const long long period = 2LL * o.burstMs * perMs;
+  const long long start = QpcNow();
+  const long long end = start + static_cast<long long>(o.seconds * 1000 * perMs);
+  uint64_t slot = 0;
+  size_t events = 0;
+  size_t dropped = 0;
+  // Memcheck: live heap every kMemcheckSampleMs once warm, and the input
+  // thread's allocations from then on. This thread is the input thread.
+  std::vector<long long> heapSamples;
+  heapSamples.reserve(
+      o.memcheck ? static_cast<size_t>(o.seconds * 1000 / kMemcheckSampleMs) + 2
+                 : 0);
+  long long nextSample =
+      start + static_cast<long long>(o.warmupS * 1000 * perMs);
+  unsigned long long inputAllocsWarm = 0;
+  size_t eventsWarm = 0;
+  const AllocCounters &inputHeap = g_allocCounters[kThreadInput + 1];
+  AllocScope inputAlloc(kThreadInput);
+  for (;; ++slot) {
+    const long long due = start + static_cast<long long>(slot * ticksPerPacket);
+    if (due >= end) {
+      break;
+    }
+    if (period > 0 && (due - start) % period >= period / 2) {
+      continue; // idle half of a burst period
+    }
+    long long now = QpcNow();
+    while (now < due) {
+      if (due - now > perMs) {
+        Sleep(0);
+      }
+      now = QpcNow();
+    }
+    if (o.memcheck && now >= nextSample) {
+      if (heapSamples.empty()) {
+        inputAllocsWarm = inputHeap.allocs.load();
+        eventsWarm = events;
+      }
+      heapSamples.push_back(HeapLiveBytes());
+      nextSample += kMemcheckSampleMs * perMs;
+    }
+    if (now - due > kStressMaxLagMs * perMs) {
+      ++dropped;
+      continue;
+    }
+    if (timed) {
+      input.lag.us.push_back(QpcToNs(now - due) / 1000.0);
+    }
+    StressPacket(input, slot % input.devices.size(), o);
+    ++events;
+  }
+  const double elapsedS = QpcToNs(QpcNow() - start) / 1e9;
+  const unsigned long long inputAllocs =
+      heapSamples.empty() ? 0 : inputHeap.allocs.load() - inputAllocsWarm;
+  // Least-squares trend of the live heap over the steady state, times its
+  // length: retired snapshots and in-flight requests come and go, a leak
+  // keeps climbing.
+  double growth = 0;
+  if (heapSamples.size() >= 4) {
+    const double n = static_cast<double>(heapSamples.size());
+    double sumX = 0;
+    double sumY = 0;
+    double sumXY = 0;
+    double sumXX = 0;
+    for (size_t i = 0; i < heapSamples.size(); ++i) {
+      const double y = static_cast<double>(heapSamples[i]);
+      sumX += i;
+      sumY += y;
+      sumXY += i * y;
+      sumXX += static_cast<double>(i) * i;
+    }
+    const double slope = (n * sumXY - sumX * sumY) / (n * sumXX - sumX * sumX);
+    growth = slope * (n - 1);
+  }
+
+  stop = true;
+  for (std::thread &w : workers) {
+    w.join();
+  }
+  // Release anything still held so no macro or DPI shift outlives the run.
+  StressOptions releaseOnly = o;
+  releaseOnly.clicks = 1;
+  releaseOnly.wheel = 0;
+  for (size_t d = 0; d < input.devices.size(); ++d) {
+    while (input.held[d]) {
+      StressPacket(input, d, releaseOnly);
+    }
+  }
+  StopMacroThread();
+  StopSmoothScroll();
+  StopConfigPersistence();
+  ReleaseInjectedKeys();
+  DeleteFileA(g_configPath.c_str());
+
+  PROCESS_MEMORY_COUNTERS mem = {};
+  mem.cb = sizeof(mem);
+  GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem));
+  const bool heapOver = growth > o.growthKb * 1024;
+  const bool peakOver = mem.PeakWorkingSetSize > o.peakMb * 1024 * 1024;
+  const bool overBudget =
+      o.memcheck && (heapOver || peakOver || inputAllocs > 0);
+
+  std::vector<nexus_latency::Stage> stages = {input.lag, input.raw,
+                                              input.move, input.hook};
+  for (const nexus_latency::Stage &s : pollStages) {
+    auto it = std::find_if(stages.begin(), stages.end(),
+                           [&](const nexus_latency::Stage &t) {
+                             return std::strcmp(t.name, s.name) == 0;
+                           });
+    if (it == stages.end()) {
+      stages.push_back(s);
+    } else {
+      it->us.insert(it->us.end(), s.us.begin(), s.us.end());
+    }
+  }
+
+  std::ostringstream ss;
+  ss.precision(1);
+  ss << std::fixed;
+  ss << "{\"seconds\":" << elapsedS << ",\"rate\":" << o.rate
+     << ",\"devices\":" << o.devices << ",\"burst_ms\":" << o.burstMs
+     << ",\"contention\":" << o.contention << ",\"priority\":\""
+     << nexus_sched::ThreadPolicyToString(o.priority) << "\""
+     << ",\"priority_applied\":" << (prioritized ? "true" : "false")
+     << ",\"events\":" << events << ",\"dropped\":" << dropped
+     << ",\"events_per_sec\":" << events / elapsedS
+     << ",\"injected\":" << g_stressInjected.load()
+     << ",\"heap_allocs\":" << g_heapAllocs.load() - allocsBefore
+     << ",\"heap_alloc_bytes\":" << g_heapAllocBytes.load() - bytesBefore
+     << ",\"peak_working_set_bytes\":" << mem.PeakWorkingSetSize
+     << ",\"device_mismatches\":" << g_deviceMismatches.load()
+     << ",\"text_dropped\":" << g_textDropped.load();
+  if (o.memcheck) {
+    const size_t warmEvents = events - eventsWarm;
+    ss << ",\"memcheck\":{\"warmup_s\":" << o.warmupS
+       << ",\"heap_samples\":" << heapSamples.size()
+       << ",\"heap_growth_bytes\":" << growth
+       << ",\"heap_growth_budget_bytes\":" << o.growthKb * 1024
+       << ",\"peak_working_set_budget_bytes\":" << o.peakMb * 1024 * 1024
+       << ",\"input_allocs\":" << inputAllocs
+       << ",\"input_allocs_per_packet\":"
+       << (warmEvents ? static_cast<double>(inputAllocs) / warmEvents : 0)
+       << ",\"over_budget\":" << (overBudget ? "true" : "false")
+       << ",\"memory\":" << BuildMemoryJson() << "}";
+  }
+  ss << ",\"stages\":[";
+  for (size_t i = 0; i < stages.size(); ++i) {
+    ss << (i ? "," : "");
+    nexus_latency::WriteStageJson(ss, stages[i]);
+  }
+  ss << "]}\n";
+
+  std::ostringstream text;
+  text.precision(1);
+  text << std::fixed;
+  text << "stress: " << events << " packets (" << events / elapsedS
+       << "/s), " << dropped << " dropped, peak working set "
+       << mem.PeakWorkingSetSize / 1024 << " KB\n";
+  for (size_t i = 0; timed && i < stages.size(); ++i) {
+    nexus_latency::WriteStageText(text, stages[i]);
+  }
+  if (o.memcheck) {
+    text << "memcheck: heap growth " << growth / 1024.0 << " KB (budget "
+         << o.growthKb << ")" << (heapOver ? " OVER" : "")
+         << ", peak working set " << mem.PeakWorkingSetSize / 1024
+         << " KB (budget " << o.peakMb * 1024 << ")"
+         << (peakOver ? " OVER" : "") << ", " << inputAllocs
+         << " input thread allocations after warmup\n";
+  }
+  std::fputs(text.str().c_str(), stdout);
+
+  const std::string output =
+      !o.output.empty() ? o.output
+      : o.memcheck      ? GetExeDir() + "\\memcheck_results.json"
+                        : GetExeDir() + "\\stress_results.json";
+  std::ofstream out(output, std::ios::trunc);
+  out << ss.str();
+  if (!out) {
+    std::fprintf(stderr, "cannot write %s\n", output.c_str());
+    return 1;
+  }
+  return (o.memcheck ? overBudget : dropped > 0) ? 1 : 0;
+}
+
+std::vector<std::string> SplitCommandLine(const std::string &cmdLine) {
+  std::vector<std::string> args;
+  std::string cur;
+  bool quoted = false;
+  bool have = false;
+  for (char c : cmdLine) {
+    if (c == '"') {
+      quoted = !quoted;
+      have = true;
+    } else if ((c == ' ' || c == '\t') && !quoted) {
+      if (have) {
+        args.push_back(cur);
+        cur.clear();
+        have = false;
+      }
+    } else {
+      cur += c;
+      have = true;
+    }
+  }
+  if (have) {
+    args.push_back(cur);
+  }
+  return args;
+}
+
 } // namespace
 
-int WINAPI WinMain(HINSTANCE instance, HINSTANCE, LPSTR, int) {
+int WINAPI WinMain(HINSTANCE instance, HINSTANCE, LPSTR cmdLine, int) {
+  const std::vector<std::string> args = SplitCommandLine(cmdLine ? cmdLine : "");
+  if (!args.empty() && args[0] == "--bench") {
+    std::string output = GetExeDir() + "\\bench_results.json";
+    bool clipboard = false;
+    for (size_t i = 1; i < args.size(); ++i) {
+      if (args[i] == "--clipboard") {
+        clipboard = true;
+      } else {
+        output = args[i];
+      }
+    }
+    return RunBenchmarks(output, clipboard);
+  }
+  if (!args.empty() && args[0] == "--latency-test") {
+    const long probes = args.size() > 1 ? std::atol(args[1].c_str()) : 0;
+    return RunLatencyTest(probes > 0 ? static_cast<size_t>(probes) : 1000,
+                          args.size() > 2
+                              ? args[2]
+                              : GetExeDir() + "\\latency_results.json");
+  }
+  if (!args.empty() && args[0] == "--stress") {
+    StressOptions options;
+    for (size_t i = 1; i < args.size(); ++i) {
+      if (!ParseStressOption(args[i], options)) {
+        MessageBoxA(nullptr,
+                    "usage: --stress [seconds=10] [rate=8000] [devices=2] "
+                    "[burst=<ms>] [clicks=0.02] [wheel=0.01] [motion=4] "
+                    "[pollers=2] [poll_ms=5] [reload_ms=20] "
+                    "[hot_reload_ms=30] [contention=0] "
+                    "[priority=<policy>] [out=<file>]",
+                    "Mouse Remapper", MB_ICONERROR | MB_OK);
+        return 2;
+      }
+    }
+    return RunStressTest(options);
+  }
+  if (!args.empty() && args[0] == "--memcheck") {
+    StressOptions options;
+    options.memcheck = true;
+    options.seconds = 60;
+    options.rate = 1000;
+    for (size_t i = 1; i < args.size(); ++i) {
+      if (!ParseStressOption(args[i], options)) {
+        MessageBoxA(nullptr,
+                    "usage: --memcheck [seconds=60] [rate=1000] [warmup=10] "
+                    "[growth_kb=64] [peak_mb=8] [any --stress option]",
+                    "Mouse Remapper", MB_ICONERROR | MB_OK);
+        return 2;
+      }
+    }
+    return RunStressTest(options);
+  }
+  if (!args.empty() && args[0] == "--convert-macros") {
+    return RunMacroConvert(args.size() > 1 ? args[1] : GetConfigPath(),
+                           args.size() > 2 ? args[2] : GetMacroLibraryPath());
+  }
+
+  const long long startQpc = QpcNow();
   g_configPath = GetConfigPath();
   WriteDefaultConfigIfMissing(g_configPath);
-  g_config = LoadConfig(g_configPath);
+  LoadMacroLibrary(GetMacroLibraryPath());
+  if (!LoadConfigFromDisk()) {
+    ReplaceConfig(Config{}); // defaults; /status reports the INI error
+  }
+  StartConfigPersistence();
+  StartLauncher();
+  StartTextInjector();
+  StartSmoothScroll();
+  StartMacroThread();
   StartStatusServer();
+  StartTelemetry();
 
   g_mouseHook = SetWindowsHookExA(WH_MOUSE_LL, LowLevelMouseProc, GetModuleHandleA(nullptr), 0);
+  g_foregroundHook = SetWinEventHook(
+      EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, nullptr,
+      ForegroundEventProc, 0, 0,
+      WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
 
   WNDCLASSA wc = {};
   wc.lpfnWndProc = MainProc;
@@ -1483,6 +9128,12 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE, LPSTR, int) {
     return 1;
   }
 
+  ScopedServiceThread inputSched(kThreadInput);
+  UpdateRawInputRegistration(g_mainWindow); // a tier change may predate it
+  UpdateKeyboardHook();
+  StartConfigWatcher();
+  g_startupUs.store(
+      static_cast<unsigned long long>(QpcToNs(QpcNow() - startQpc) / 1000.0));
   OpenStitchPage("remapper.html");
 
   MSG msg = {};
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Embeds ui/ into the service binary.
+
+Writes ui_assets.inc next to readig_buttom.cpp with every file of ui/ in its
+original form plus gzip and, when the brotli module or CLI is available,
+brotli encodings. The status server then serves the pages from memory under
+/ui/<build id>/ with immutable cache headers. Run it before compiling
+whenever ui/ changes:
+
+    python tools/embed_ui.py [ui_dir] [output.inc]
+
+Without ui_assets.inc the service serves ui/ from disk instead.
+"""
+
+import gzip
+import hashlib
+import os
+import shutil
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+CONTENT_TYPES = {
+    ".html": "text/html; charset=utf-8",
+    ".css": "text/css; charset=utf-8",
+    ".js": "text/javascript; charset=utf-8",
+    ".json": "application/json",
+    ".svg": "image/svg+xml",
+    ".png": "image/png",
+    ".ico": "image/x-icon",
+}
+
+
+def brotli_compress(data):
+    try:
+        import brotli
+        return brotli.compress(data, quality=11)
+    except ImportError:
+        pass
+    if shutil.which("brotli"):
+        return subprocess.run(["brotli", "-c", "-q", "11"], input=data,
+                              stdout=subprocess.PIPE, check=True).stdout
+    return None
+
+
+def c_array(name, data):
+    lines = ["constexpr unsigned char %s[] = {" % name]
+    for i in range(0, len(data), 16):
+        lines.append("    " + ",".join(str(b) for b in data[i:i + 16]) + ",")
+    lines.append("};")
+    return "\n".join(lines)
+
+
+def main():
+    ui_dir = sys.argv[1] if len(sys.argv) > 1 else os.path.join(ROOT, "ui")
+    output = (sys.argv[2] if len(sys.argv) > 2 else
+              os.path.join(ROOT, "ui_assets.inc"))
+
+    names = sorted(n for n in os.listdir(ui_dir)
+                   if os.path.splitext(n)[1] in CONTENT_TYPES)
+    build = hashlib.sha256()
+    arrays = []
+    entries = []
+    have_brotli = True
+    for index, name in enumerate(names):
+        with open(os.path.join(ui_dir, name), "rb") as f:
+            data = f.read()
+        build.update(name.encode() + b"\0" + data)
+        etag = hashlib.sha256(data).hexdigest()[:16]
+        gz = gzip.compress(data, compresslevel=9, mtime=0)
+        br = brotli_compress(data)
+        have_brotli = have_brotli and br is not None
+
+        fields = []
+        for suffix, blob in (("", data), ("Gzip", gz), ("Brotli", br)):
+            # Encodings that do not save anything are left out.
+            if blob is None or (suffix and len(blob) >= len(data)):
+                fields.append("nullptr, 0")
+                continue
+            array = "kUiAsset%d%s" % (index, suffix)
+            arrays.append(c_array(array, blob))
+            fields.append("%s, sizeof(%s)" % (array, array))
+        entries.append('    {"%s", "%s", "%s",\n     %s},' % (
+            name, CONTENT_TYPES[os.path.splitext(name)[1]],
+            etag, ",\n     ".join(fields)))
+
+    with open(output, "w", newline="\n") as out:
+        out.write("// Generated by tools/embed_ui.py from ui/. Do not edit.\n")
+        out.write('constexpr char kUiBuildId[] = "%s";\n\n' %
+                  build.hexdigest()[:12])
+        out.write("\n\n".join(arrays))
+        out.write("\n\nconstexpr UiAsset kUiAssets[] = {\n")
+        out.write("\n".join(entries))
+        out.write("\n};\n")
+
+    print("%s: %d assets, build %s%s" % (
+        output, len(names), build.hexdigest()[:12],
+        "" if have_brotli else " (brotli unavailable, gzip only)"))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,255 @@
+// Linux counterpart of nexus_ultra_final.exe --latency-test: submits
+// synthetic side-button clicks and times them until they are read back,
+// writing the same JSON report.
+//
+//   latency_loopback [--uinput | --fake] [--priority <policy>] [probes]
+//                    [output.json]
+//
+// --uinput creates a virtual mouse through /dev/uinput and reads its evdev
+// node (grabbed, so the desktop never sees the clicks); stages are the
+// write() returning, the kernel event timestamp and the read(). --fake
+// sends the probes through a pipe to a reader thread; it needs no
+// permissions and exercises the same pipeline in CI. --priority applies a
+// nexus_sched.h policy (e.g. time_critical@1 for SCHED_FIFO on CPU 1) to the
+// probing thread.
+//
+// Build: g++ -std=c++17 -O2 -pthread tools/latency_loopback.cpp -o latency_loopback
+#include "../nexus_latency.h"
+#include "../nexus_sched.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr int kProbeTimeoutMs = 100;
+
+double NowUs() {
+  timespec ts = {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void Pause(uint32_t &rng) {
+  // 1-3 ms apart so probes do not phase-lock with anything periodic.
+  rng = rng * 1664525u + 1013904223u;
+  usleep((1 + (rng >> 16) % 3) * 1000);
+}
+
+bool WriteEvent(int fd, uint16_t type, uint16_t code, int32_t value) {
+  input_event ev = {};
+  ev.type = type;
+  ev.code = code;
+  ev.value = value;
+  return write(fd, &ev, sizeof(ev)) == sizeof(ev);
+}
+
+// /dev/input/eventN of the uinput device called |sysname|.
+std::string EventNode(const char *sysname) {
+  const std::string dir = std::string("/sys/devices/virtual/input/") + sysname;
+  std::string node;
+  if (DIR *d = opendir(dir.c_str())) {
+    while (const dirent *e = readdir(d)) {
+      if (std::strncmp(e->d_name, "event", 5) == 0) {
+        node = std::string("/dev/input/") + e->d_name;
+      }
+    }
+    closedir(d);
+  }
+  return node;
+}
+
+bool RunUinput(size_t probes, nexus_latency::Report &report) {
+  const int ui = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+  if (ui < 0) {
+    std::perror("/dev/uinput");
+    return false;
+  }
+  ioctl(ui, UI_SET_EVBIT, EV_KEY);
+  ioctl(ui, UI_SET_KEYBIT, BTN_LEFT);
+  ioctl(ui, UI_SET_KEYBIT, BTN_SIDE);
+  ioctl(ui, UI_SET_EVBIT, EV_REL);
+  ioctl(ui, UI_SET_RELBIT, REL_X);
+  ioctl(ui, UI_SET_RELBIT, REL_Y);
+  uinput_setup setup = {};
+  setup.id.bustype = BUS_VIRTUAL;
+  setup.id.vendor = 0x4E58; // "NX"
+  setup.id.product = 0x0001;
+  std::strcpy(setup.name, "Nexus latency probe");
+  char sysname[64] = {};
+  if (ioctl(ui, UI_DEV_SETUP, &setup) < 0 || ioctl(ui, UI_DEV_CREATE) < 0 ||
+      ioctl(ui, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+    std::perror("uinput setup");
+    close(ui);
+    return false;
+  }
+
+  // udev creates the node asynchronously.
+  int ev = -1;
+  for (int tries = 0; tries < 50 && ev < 0; ++tries) {
+    const std::string node = EventNode(sysname);
+    ev = node.empty() ? -1 : open(node.c_str(), O_RDONLY | O_NONBLOCK);
+    if (ev < 0) {
+      usleep(20000);
+    }
+  }
+  int clock = CLOCK_MONOTONIC;
+  if (ev < 0 || ioctl(ev, EVIOCGRAB, 1) < 0 ||
+      ioctl(ev, EVIOCSCLOCKID, &clock) < 0) {
+    std::perror("evdev");
+    if (ev >= 0) {
+      close(ev);
+    }
+    ioctl(ui, UI_DEV_DESTROY);
+    close(ui);
+    return false;
+  }
+
+  report.backend = "uinput";
+  report.stages = {{"send", {}}, {"kernel", {}}, {"read", {}}};
+  uint32_t rng = static_cast<uint32_t>(NowUs()) | 1u;
+  for (size_t i = 0; i < probes; ++i) {
+    const double start = NowUs();
+    WriteEvent(ui, EV_KEY, BTN_SIDE, 1);
+    WriteEvent(ui, EV_SYN, SYN_REPORT, 0);
+    const double sent = NowUs();
+    report.stages[0].us.push_back(sent - start);
+    bool seen = false;
+    while (!seen && NowUs() - start < kProbeTimeoutMs * 1000.0) {
+      pollfd p = {ev, POLLIN, 0};
+      if (poll(&p, 1, kProbeTimeoutMs) <= 0) {
+        break;
+      }
+      input_event e = {};
+      while (read(ev, &e, sizeof(e)) == sizeof(e)) {
+        if (e.type == EV_KEY && e.code == BTN_SIDE && e.value == 1) {
+          const double readAt = NowUs();
+          const double kernel = e.time.tv_sec * 1e6 + e.time.tv_usec;
+          report.stages[1].us.push_back(kernel - start);
+          report.stages[2].us.push_back(readAt - start);
+          seen = true;
+        }
+      }
+    }
+    report.timeouts += !seen;
+    WriteEvent(ui, EV_KEY, BTN_SIDE, 0);
+    WriteEvent(ui, EV_SYN, SYN_REPORT, 0);
+    Pause(rng);
+  }
+  report.probes = probes;
+
+  ioctl(ev, EVIOCGRAB, 0);
+  close(ev);
+  ioctl(ui, UI_DEV_DESTROY);
+  close(ui);
+  return true;
+}
+
+bool RunFake(size_t probes, nexus_latency::Report &report) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    std::perror("pipe");
+    return false;
+  }
+  std::atomic<double> readUs{0};
+  std::thread reader([&] {
+    input_event e = {};
+    while (read(fds[0], &e, sizeof(e)) == sizeof(e)) {
+      if (e.type == EV_KEY && e.value == 1) {
+        readUs.store(NowUs());
+      }
+    }
+  });
+
+  report.backend = "fake";
+  report.stages = {{"send", {}}, {"read", {}}};
+  uint32_t rng = static_cast<uint32_t>(NowUs()) | 1u;
+  for (size_t i = 0; i < probes; ++i) {
+    readUs.store(0);
+    const double start = NowUs();
+    WriteEvent(fds[1], EV_KEY, BTN_SIDE, 1);
+    const double sent = NowUs();
+    report.stages[0].us.push_back(sent - start);
+    double seen = 0;
+    while (!(seen = readUs.load()) &&
+           NowUs() - start < kProbeTimeoutMs * 1000.0) {
+      std::this_thread::yield();
+    }
+    if (seen) {
+      report.stages[1].us.push_back(seen - start);
+    } else {
+      ++report.timeouts;
+    }
+    WriteEvent(fds[1], EV_KEY, BTN_SIDE, 0);
+    Pause(rng);
+  }
+  report.probes = probes;
+
+  close(fds[1]);
+  reader.join();
+  close(fds[0]);
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bool fake = false;
+  size_t probes = 1000;
+  std::string outputPath = "latency_results.json";
+  nexus_sched::ThreadPolicy policy;
+  int positional = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--fake") == 0) {
+      fake = true;
+    } else if (std::strcmp(argv[i], "--priority") == 0 && i + 1 < argc &&
+               nexus_sched::ParseThreadPolicy(argv[i + 1], policy)) {
+      ++i;
+    } else if (std::strcmp(argv[i], "--uinput") == 0) {
+      fake = false;
+    } else if (positional == 0 && std::atol(argv[i]) > 0) {
+      probes = static_cast<size_t>(std::atol(argv[i]));
+      ++positional;
+    } else if (argv[i][0] != '-') {
+      outputPath = argv[i];
+      positional = 2;
+    } else {
+      std::fprintf(stderr,
+                   "usage: %s [--uinput | --fake] [--priority <policy>] "
+                   "[probes] [output.json]\n",
+                   argv[0]);
+      return 2;
+    }
+  }
+
+  if (!nexus_sched::ApplyCurrentThreadPolicy(policy)) {
+    std::fprintf(stderr, "could not apply --priority %s\n",
+                 nexus_sched::ThreadPolicyToString(policy).c_str());
+  }
+  nexus_latency::Report report;
+  if (!(fake ? RunFake(probes, report) : RunUinput(probes, report))) {
+    return 1;
+  }
+  std::fputs(nexus_latency::ReportToText(report).c_str(), stdout);
+  std::ofstream out(outputPath, std::ios::trunc);
+  out << nexus_latency::ReportToJson(report);
+  if (!out) {
+    std::fprintf(stderr, "cannot write %s\n", outputPath.c_str());
+    return 1;
+  }
+  return report.timeouts == report.probes ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+// Linux driver for nexus_launch.h: sends run: requests through the same
+// launcher queue, coalescing and reaping as the service, with posix_spawn
+// standing in for CreateProcess.
+//
+//   launch_driver [--clicks <n>] [--gap-ms <ms>] [command line]
+//
+// Without a command line it runs its checks and exits 1 if one fails: a
+// burst of clicks on one target launches it once, a second target launches
+// alongside it, a program missing from PATH is refused before it is queued,
+// a child is reaped once it exits and requests after a restart still run.
+// With a command line it clicks that <n> times, <gap-ms> apart, and prints
+// the counters.
+//
+// Build: g++ -std=c++17 -O2 -pthread tools/launch_driver.cpp -o launch_driver
+#include "../nexus_launch.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace {
+
+using Backend = nexus_launch::PosixSpawnBackend;
+using Launcher = nexus_launch::Launcher<Backend>;
+
+void Print(const Launcher &l) {
+  std::printf("launches=%llu failures=%llu coalesced=%llu children=%u "
+              "p50_us=%llu p99_us=%llu\n",
+              l.launches.load(), l.failures.load(), l.coalesced.load(),
+              l.children.load(), nexus_launch::LatencyPercentile(l, 50),
+              nexus_launch::LatencyPercentile(l, 99));
+}
+
+// Polls |done| for up to |ms|, as the worker runs on its own schedule.
+template <typename Fn> bool WaitFor(Fn &&done, int ms) {
+  const auto end =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > end) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return true;
+}
+
+int failures = 0;
+
+void Check(bool ok, const char *what) {
+  std::printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+  failures += ok ? 0 : 1;
+}
+
+int RunChecks() {
+  Launcher l;
+  std::thread worker([&] { nexus_launch::Run(l); });
+
+  const auto once = Backend::MakeTarget("true");
+  const auto sleeper = Backend::MakeTarget("sleep 0.3");
+  Check(once && sleeper, "targets resolve on PATH");
+  if (!once || !sleeper) {
+    nexus_launch::Stop(l);
+    worker.join();
+    return 1;
+  }
+
+  for (int i = 0; i < 5; ++i) {
+    nexus_launch::Queue(l, once);
+  }
+  Check(WaitFor([&] { return l.launches + l.coalesced == 5; }, 1000) &&
+            l.launches == 1,
+        "five clicks on one target launch it once");
+
+  nexus_launch::Queue(l, sleeper);
+  Check(WaitFor([&] { return l.launches == 2; }, 1000),
+        "a second target launches alongside the first");
+  Check(WaitFor([&] { return l.children >= 1; }, 200),
+        "the running child is tracked");
+  Check(WaitFor([&] { return l.children == 0; }, 2000),
+        "the child is reaped after it exits");
+
+  Check(!Backend::MakeTarget("nexus-no-such-program --flag") &&
+            !nexus_launch::Queue(l, nullptr),
+        "a program missing from PATH is refused before queueing");
+  Check(l.failures == 0, "no launch failed");
+
+  nexus_launch::Stop(l);
+  worker.join();
+  std::thread restarted([&] { nexus_launch::Run(l); });
+  std::this_thread::sleep_for(nexus_launch::kCoalesceWindow);
+  nexus_launch::Queue(l, once);
+  Check(WaitFor([&] { return l.launches == 3; }, 1000),
+        "requests run after a restart");
+  nexus_launch::Stop(l);
+  restarted.join();
+
+  Print(l);
+  return failures ? 1 : 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  int clicks = 5;
+  int gapMs = 0;
+  std::string command;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--clicks") == 0 && i + 1 < argc &&
+        std::atoi(argv[i + 1]) > 0) {
+      clicks = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--gap-ms") == 0 && i + 1 < argc &&
+               std::atoi(argv[i + 1]) >= 0) {
+      gapMs = std::atoi(argv[++i]);
+    } else if (argv[i][0] != '-') {
+      command += (command.empty() ? "" : " ") + std::string(argv[i]);
+    } else {
+      std::fprintf(stderr,
+                   "usage: %s [--clicks <n>] [--gap-ms <ms>] [command line]\n",
+                   argv[0]);
+      return 2;
+    }
+  }
+  if (command.empty()) {
+    return RunChecks();
+  }
+
+  const auto target = Backend::MakeTarget(command);
+  if (!target) {
+    std::fprintf(stderr, "not found on PATH: %s\n", command.c_str());
+    return 1;
+  }
+  Launcher l;
+  std::thread worker([&] { nexus_launch::Run(l); });
+  for (int i = 0; i < clicks; ++i) {
+    nexus_launch::Queue(l, target);
+    std::this_thread::sleep_for(std::chrono::milliseconds(gapMs));
+  }
+  WaitFor([&] {
+    return l.launches + l.failures + l.coalesced ==
+           static_cast<unsigned long long>(clicks);
+  }, 5000);
+  nexus_launch::Stop(l);
+  worker.join();
+  Print(l);
+  return l.failures ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+// Reads the service's shared-memory telemetry segment and prints it.
+//
+//   telemetry_reader [--json] [--watch <ms>]
+//
+// Build: g++ -std=c++17 -O2 tools/telemetry_reader.cpp -o telemetry_reader
+//        cl /std:c++17 /O2 /EHsc tools\telemetry_reader.cpp
+#include "../nexus_telemetry.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+using namespace nexus_telemetry;
+
+// Upper bound of the bucket holding the |pct|th percentile, 0 when empty.
+uint64_t Percentile(const uint64_t *buckets, double pct) {
+  uint64_t total = 0;
+  for (size_t b = 0; b < kHistogramBuckets; ++b) {
+    total += buckets[b];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  const double target = total * pct / 100.0;
+  uint64_t seen = 0;
+  for (size_t b = 0; b < kHistogramBuckets; ++b) {
+    seen += buckets[b];
+    if (seen >= target) {
+      return b == 0 ? 0 : 1ull << b;
+    }
+  }
+  return 1ull << (kHistogramBuckets - 1);
+}
+
+void PrintText(const Segment &s, const Snapshot &snap, double readNs) {
+  std::printf("writer pid %u, seq %llu, publish every %u ms, read %.0f ns\n",
+              s.writerPid, static_cast<unsigned long long>(snap.seq),
+              s.publishMs, readNs);
+  for (size_t c = 0; c < kCounterCount; ++c) {
+    std::printf("  %-24s %llu\n", kCounterNames[c],
+                static_cast<unsigned long long>(snap.counters[c]));
+  }
+  for (size_t h = 0; h < kHistogramCount; ++h) {
+    const uint64_t *buckets = snap.histograms[h];
+    std::printf("  %-24s p50<=%llu p99<=%llu max<=%llu\n", kHistogramNames[h],
+                static_cast<unsigned long long>(Percentile(buckets, 50)),
+                static_cast<unsigned long long>(Percentile(buckets, 99)),
+                static_cast<unsigned long long>(Percentile(buckets, 100)));
+  }
+}
+
+void PrintJson(const Segment &s, const Snapshot &snap, double readNs) {
+  std::printf("{\"writer_pid\":%u,\"seq\":%llu,\"updated_ms\":%llu,"
+              "\"read_ns\":%.0f",
+              s.writerPid, static_cast<unsigned long long>(snap.seq),
+              static_cast<unsigned long long>(snap.updatedMs), readNs);
+  for (size_t c = 0; c < kCounterCount; ++c) {
+    std::printf(",\"%s\":%llu", kCounterNames[c],
+                static_cast<unsigned long long>(snap.counters[c]));
+  }
+  for (size_t h = 0; h < kHistogramCount; ++h) {
+    std::printf(",\"%s\":[", kHistogramNames[h]);
+    for (size_t b = 0; b < kHistogramBuckets; ++b) {
+      std::printf("%s%llu", b ? "," : "",
+                  static_cast<unsigned long long>(snap.histograms[h][b]));
+    }
+    std::printf("]");
+  }
+  std::printf("}\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bool json = false;
+  int watchMs = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (std::strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+      watchMs = std::atoi(argv[++i]);
+    } else {
+      std::fprintf(stderr, "usage: %s [--json] [--watch <ms>]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  Mapping m;
+  if (!OpenSegment(m)) {
+    std::fprintf(stderr, "telemetry segment %s not found; is the service "
+                         "running?\n",
+                 kSegmentName);
+    return 1;
+  }
+  const Segment &s = *m.segment;
+  int status = 0;
+  for (;;) {
+    Snapshot snap;
+    const auto start = std::chrono::steady_clock::now();
+    const bool ok = ReadSnapshot(s, snap);
+    const double readNs = std::chrono::duration<double, std::nano>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    if (!ok) {
+      std::fprintf(stderr, "segment version %u/size %u does not match this "
+                           "reader (%u/%zu), or the writer is stuck\n",
+                   s.version, s.size, kVersion, sizeof(Segment));
+      status = 1;
+      break;
+    }
+    if (json) {
+      PrintJson(s, snap, readNs);
+    } else {
+      PrintText(s, snap, readNs);
+    }
+    std::fflush(stdout);
+    if (watchMs <= 0) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(watchMs));
+  }
+  CloseSegment(m);
+  return status;
+}